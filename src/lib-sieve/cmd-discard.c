@@ -32,7 +32,8 @@ const struct sieve_command_def cmd_discard = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
-	.generate = cmd_discard_generate
+	.generate = cmd_discard_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -1,13 +1,19 @@
 /* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
  */
 
+#include "lib.h"
+
 #include "sieve-common.h"
 #include "sieve-commands.h"
 #include "sieve-validator.h"
 #include "sieve-generator.h"
+#include "sieve-optimizer.h"
 #include "sieve-code.h"
 #include "sieve-binary.h"
 
+/* Minimum number of consecutive header tests compiled into a header switch */
+#define CMD_IF_SWITCH_MIN_CASES 4
+
 /*
  * Commands
  */
@@ -39,7 +45,8 @@ const struct sieve_command_def cmd_if = {
 	.block_required = TRUE,
 	.validate = cmd_if_validate,
 	.validate_const = cmd_if_validate_const,
-	.generate = cmd_if_generate
+	.generate = cmd_if_generate,
+	.data_declared = TRUE
 };
 
 /* ElsIf command
@@ -57,7 +64,8 @@ const struct sieve_command_def cmd_elsif = {
 	.block_required = TRUE,
 	.validate = cmd_elsif_validate,
 	.validate_const = cmd_if_validate_const,
-	.generate = cmd_if_generate
+	.generate = cmd_if_generate,
+	.data_declared = TRUE
 };
 
 /* Else command
@@ -75,7 +83,8 @@ const struct sieve_command_def cmd_else = {
 	.block_required = TRUE,
 	.validate = cmd_elsif_validate,
 	.validate_const = cmd_if_validate_const,
-	.generate = cmd_else_generate
+	.generate = cmd_else_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -90,6 +99,14 @@ struct cmd_if_context_data {
 
 	bool jump_generated;
 	sieve_size_t exit_jump;
+
+	/* Test is part of a header switch, which jumps to switch_jump when it
+	 * matches and to switch_default_jump (last case only) when no case
+	 * matches */
+	bool switch_case;
+	bool switch_last;
+	sieve_size_t switch_jump;
+	sieve_size_t switch_default_jump;
 };
 
 static void cmd_if_initialize_context_data
@@ -188,7 +205,8 @@ static bool cmd_if_validate_const
 
 /* The if command does not generate specific IF-ELSIF-ELSE opcodes, but only uses
  * JMP instructions. This is why the implementation of the if command does not
- * include an opcode implementation.
+ * include an opcode implementation. The only exception is the HEADER_SWITCH
+ * operation, which is implemented by the header test.
  */
 
 static void cmd_if_resolve_exit_jumps
@@ -206,6 +224,73 @@ static void cmd_if_resolve_exit_jumps
 	}
 }
 
+static struct sieve_command *cmd_if_get_test
+(struct sieve_command *cmd)
+{
+	struct sieve_ast_node *test = sieve_ast_test_first(cmd->ast_node);
+
+	return ( test != NULL ? test->command : NULL );
+}
+
+/* A chain of if/elsif commands that each test the same header using :is with
+ * literal keys, e.g. when sorting messages by List-Id, is compiled into a
+ * single header switch. That reads the header once and jumps to the block of
+ * the first matching test directly, rather than matching the header again for
+ * each elsif.
+ */
+static bool cmd_if_generate_switch
+(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd)
+{
+	struct cmd_if_context_data *cmd_data =
+		(struct cmd_if_context_data *) cmd->data;
+	struct cmd_if_context_data *case_data;
+	struct sieve_command *first_test, *next, **tests;
+	sieve_size_t *case_jumps, default_jump;
+	unsigned int count, i;
+
+	/* Count consecutive compatible tests in this if-elsif-else structure */
+	first_test = cmd_if_get_test(cmd);
+	count = 0;
+	next = cmd;
+	case_data = cmd_data;
+	while ( next != NULL && case_data != NULL && next->data == case_data &&
+		case_data->const_condition < 0 &&
+		sieve_optimize_headers_compatible(first_test, cmd_if_get_test(next)) ) {
+		count++;
+		next = sieve_command_next(next);
+		case_data = case_data->next;
+	}
+
+	if ( count < CMD_IF_SWITCH_MIN_CASES )
+		return TRUE;
+
+	tests = t_new(struct sieve_command *, count);
+	case_jumps = t_new(sieve_size_t, count);
+
+	next = cmd;
+	for ( i = 0; i < count; i++ ) {
+		tests[i] = cmd_if_get_test(next);
+		next = sieve_command_next(next);
+	}
+
+	if ( !tst_header_generate_switch
+		(cgenv, tests, count, case_jumps, &default_jump) )
+		return FALSE;
+
+	/* The commands generate their blocks at the resolved case offsets */
+	case_data = cmd_data;
+	for ( i = 0; i < count; i++ ) {
+		case_data->switch_case = TRUE;
+		case_data->switch_jump = case_jumps[i];
+		if ( i == count - 1 ) {
+			case_data->switch_last = TRUE;
+			case_data->switch_default_jump = default_jump;
+		}
+		case_data = case_data->next;
+	}
+	return TRUE;
+}
+
 static bool cmd_if_generate
 (const struct sieve_codegen_env *cgenv, struct sieve_command *cmd)
 {
@@ -217,12 +302,21 @@ static bool cmd_if_generate
 
 	/* Generate test condition */
 	if ( cmd_data->const_condition < 0 ) {
-		/* Prepare jumplist */
-		sieve_jumplist_init_temp(&jmplist, sblock);
-
-		test = sieve_ast_test_first(cmd->ast_node);
-		if ( !sieve_generate_test(cgenv, test, &jmplist, FALSE) )
+		if ( !cmd_data->switch_case &&
+			!cmd_if_generate_switch(cgenv, cmd) )
 			return FALSE;
+
+		if ( cmd_data->switch_case ) {
+			/* Header switch jumps here when the test matches */
+			sieve_binary_resolve_offset(sblock, cmd_data->switch_jump);
+		} else {
+			/* Prepare jumplist */
+			sieve_jumplist_init_temp(&jmplist, sblock);
+
+			test = sieve_ast_test_first(cmd->ast_node);
+			if ( !sieve_generate_test(cgenv, test, &jmplist, FALSE) )
+				return FALSE;
+		}
 	}
 
 	/* Case true { */
@@ -251,7 +345,12 @@ static bool cmd_if_generate
 
 	if ( cmd_data->const_condition < 0 ) {
 		/* Case false ... (subsequent elsif/else commands might generate more) */
-		sieve_jumplist_resolve(&jmplist);
+		if ( !cmd_data->switch_case ) {
+			sieve_jumplist_resolve(&jmplist);
+		} else if ( cmd_data->switch_last ) {
+			/* No case of the header switch matched */
+			sieve_binary_resolve_offset(sblock, cmd_data->switch_default_jump);
+		}
 	}
 
 	return TRUE;
@@ -31,7 +31,8 @@ const struct sieve_command_def cmd_keep = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
-	.generate = cmd_keep_generate
+	.generate = cmd_keep_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -51,7 +51,9 @@ const struct sieve_command_def cmd_redirect = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = cmd_redirect_validate,
-	.generate = cmd_redirect_generate
+	.generate = cmd_redirect_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE
 };
 
 /*
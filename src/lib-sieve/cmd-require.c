@@ -26,7 +26,8 @@ const struct sieve_command_def cmd_require = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
-	.validate = cmd_require_validate
+	.validate = cmd_require_validate,
+	.data_declared = TRUE
 };
 
 /*
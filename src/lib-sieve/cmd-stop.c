@@ -28,7 +28,8 @@ const struct sieve_command_def cmd_stop = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = cmd_stop_validate,
-	.generate = cmd_stop_generate
+	.generate = cmd_stop_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -24,6 +24,9 @@ static int cmp_i_ascii_casemap_compare
 static bool cmp_i_ascii_casemap_char_match
 	(const struct sieve_comparator *cmp, const char **val1, const char *val1_end,
 		const char **val2, const char *val2_end);
+static void cmp_i_ascii_casemap_normalize
+	(const struct sieve_comparator *cmp,
+		const char *val, size_t val_size, char *dest);
 
 /*
  * Comparator object
@@ -39,7 +42,8 @@ const struct sieve_comparator_def i_ascii_casemap_comparator = {
 		SIEVE_COMPARATOR_FLAG_PREFIX_MATCH,
 	.compare = cmp_i_ascii_casemap_compare,
 	.char_match = cmp_i_ascii_casemap_char_match,
-	.char_skip = sieve_comparator_octet_skip
+	.char_skip = sieve_comparator_octet_skip,
+	.normalize = cmp_i_ascii_casemap_normalize
 };
 
 /*
@@ -79,8 +83,8 @@ static bool cmp_i_ascii_casemap_char_match
 	const char *val_begin = *val;
 	const char *key_begin = *key;
 
-	while ( i_tolower(**val) == i_tolower(**key) &&
-		*val < val_end && *key < key_end ) {
+	while ( *val < val_end && *key < key_end &&
+		i_tolower(**val) == i_tolower(**key) ) {
 		(*val)++;
 		(*key)++;
 	}
@@ -96,4 +100,12 @@ static bool cmp_i_ascii_casemap_char_match
 	return TRUE;
 }
 
+static void cmp_i_ascii_casemap_normalize
+	(const struct sieve_comparator *cmp ATTR_UNUSED,
+		const char *val, size_t val_size, char *dest)
+{
+	size_t i;
 
+	for ( i = 0; i < val_size; i++ )
+		dest[i] = i_tolower(val[i]);
+}
@@ -173,7 +173,8 @@ static const struct sieve_command_def envelope_test = {
 	.block_required = FALSE,
 	.registered = tst_envelope_registered,
 	.validate = tst_envelope_validate,
-	.generate = tst_envelope_generate
+	.generate = tst_envelope_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -647,6 +648,8 @@ tst_envelope_generate(const struct sieve_codegen_env *cgenv,
 	(void)sieve_operation_emit(cgenv->sblock, cmd->ext,
 				   &envelope_operation);
 
+	sieve_generate_require_envelope_parts(cgenv, cmd->first_positional);
+
 	/* Generate arguments */
 	if (!sieve_generate_arguments(cgenv, cmd, NULL))
 		return FALSE;
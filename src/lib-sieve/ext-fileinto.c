@@ -83,6 +83,7 @@ static const struct sieve_command_def fileinto_command = {
 	.block_required = FALSE,
 	.validate = cmd_fileinto_validate,
 	.generate = cmd_fileinto_generate,
+	.data_declared = TRUE,
 };
 
 /*
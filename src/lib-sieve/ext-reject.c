@@ -231,7 +231,9 @@ static const struct sieve_command_def reject_command = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = cmd_reject_validate,
-	.generate = cmd_reject_generate
+	.generate = cmd_reject_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE
 };
 
 /* EReject command
@@ -249,6 +251,8 @@ static const struct sieve_command_def ereject_command = {
 	.block_required = FALSE,
 	.validate = cmd_reject_validate,
 	.generate = cmd_reject_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE,
 };
 
 /*
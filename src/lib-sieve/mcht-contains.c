@@ -5,21 +5,40 @@
  */
 
 #include "lib.h"
+#include "str.h"
+#include "array.h"
+#include "substr-search.h"
 
 #include "sieve-match-types.h"
 #include "sieve-comparators.h"
+#include "sieve-stringlist.h"
 #include "sieve-match.h"
 
 #include <string.h>
 #include <stdio.h>
 
+/* Minimum number of keys for which a multi-key search automaton is built */
+#define MCHT_CONTAINS_MULTI_KEY_MIN 3
+
 /*
  * Forward declarations
  */
 
+static void mcht_contains_match_init(struct sieve_match_context *mctx);
+static int mcht_contains_match_keys
+	(struct sieve_match_context *mctx, const char *val, size_t val_size,
+		struct sieve_stringlist *key_list);
 static int mcht_contains_match_key
 	(struct sieve_match_context *mctx, const char *val, size_t val_size,
 		const char *key, size_t key_size);
+static int mcht_contains_match_stream_init
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+		void **context_r);
+static int mcht_contains_match_stream_more
+	(struct sieve_match_context *mctx, void *context,
+		const unsigned char *data, size_t size);
+static int mcht_contains_match_stream_finish
+	(struct sieve_match_context *mctx, void *context);
 
 /*
  * Match-type object
@@ -29,16 +48,213 @@ const struct sieve_match_type_def contains_match_type = {
 	SIEVE_OBJECT("contains",
 		&match_type_operand, SIEVE_MATCH_TYPE_CONTAINS),
 	.validate_context = sieve_match_substring_validate_context,
-	.match_key = mcht_contains_match_key
+	.match_init = mcht_contains_match_init,
+	.match_keys = mcht_contains_match_keys,
+	.match_key = mcht_contains_match_key,
+	.match_stream_init = mcht_contains_match_stream_init,
+	.match_stream_more = mcht_contains_match_stream_more,
+	.match_stream_finish = mcht_contains_match_stream_finish
 };
 
 /*
  * Match-type implementation
  */
 
-/* FIXME: Naive substring match implementation. Should switch to more
- * efficient algorithm if large values need to be searched (e.g. message body).
- */
+/* Multi-key matching */
+
+struct mcht_contains_context {
+	struct sieve_stringlist *key_list;
+	struct substr_search_multi *multi;
+};
+
+static void mcht_contains_match_init(struct sieve_match_context *mctx)
+{
+	mctx->data = p_new(mctx->pool, struct mcht_contains_context, 1);
+}
+
+static int mcht_contains_multi_create
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	pool_t pool, bool icase, struct substr_search_multi **multi_r)
+{
+	ARRAY(string_t *) keys;
+	string_t *key_item = NULL;
+	string_t *const *key_items;
+	unsigned int count;
+	int ret;
+
+	*multi_r = NULL;
+
+	T_BEGIN {
+		t_array_init(&keys, 64);
+		while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 )
+			array_append(&keys, &key_item, 1);
+
+		if ( ret == 0 ) {
+			key_items = array_get(&keys, &count);
+			*multi_r = substr_search_multi_create
+				(pool, (const string_t *const *)key_items, count, icase);
+		}
+	} T_END;
+
+	if ( ret < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		return -1;
+	}
+	return 0;
+}
+
+static bool mcht_contains_multi_supported
+(const struct sieve_comparator *cmp, bool *icase_r)
+{
+	if ( sieve_comparator_is(cmp, i_octet_comparator) )
+		*icase_r = FALSE;
+	else if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) )
+		*icase_r = TRUE;
+	else
+		return FALSE;
+	return TRUE;
+}
+
+/* Cached for key lists that are too large for an automaton */
+static char mcht_contains_multi_too_large;
+
+static int mcht_contains_multi_lookup
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	bool icase, struct substr_search_multi **multi_r)
+{
+	void **cached;
+	pool_t pool;
+
+	*multi_r = NULL;
+
+	/* Literal key lists are compiled only once for the loaded binary */
+	if ( sieve_match_key_list_cache_lookup(mctx, key_list, &cached, &pool) ) {
+		if ( *cached == NULL ) {
+			if ( mcht_contains_multi_create
+				(mctx, key_list, pool, icase, multi_r) < 0 )
+				return -1;
+			*cached = ( *multi_r != NULL ?
+				(void *) *multi_r : &mcht_contains_multi_too_large );
+		}
+		if ( *cached != &mcht_contains_multi_too_large )
+			*multi_r = (struct substr_search_multi *) *cached;
+		return 0;
+	}
+
+	return mcht_contains_multi_create
+		(mctx, key_list, mctx->pool, icase, multi_r);
+}
+
+static int mcht_contains_multi_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	struct substr_search_multi **multi_r)
+{
+	struct mcht_contains_context *cctx =
+		(struct mcht_contains_context *) mctx->data;
+	bool icase;
+
+	*multi_r = NULL;
+
+	/* Same key list as for the previous value */
+	if ( cctx->key_list == key_list ) {
+		*multi_r = cctx->multi;
+		return 0;
+	}
+	cctx->key_list = key_list;
+	cctx->multi = NULL;
+
+	if ( !mcht_contains_multi_supported(mctx->comparator, &icase) )
+		return 0;
+
+	if ( sieve_stringlist_get_length(key_list) < MCHT_CONTAINS_MULTI_KEY_MIN )
+		return 0;
+
+	if ( mcht_contains_multi_lookup(mctx, key_list, icase, &cctx->multi) < 0 )
+		return -1;
+
+	*multi_r = cctx->multi;
+	return 0;
+}
+
+static int mcht_contains_match_keys
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	struct sieve_stringlist *key_list)
+{
+	struct substr_search_multi *multi;
+
+	/* Tracing reports the result for each individual key */
+	if ( mctx->trace )
+		return sieve_match_keys_default(mctx, val, val_size, key_list);
+
+	if ( mcht_contains_multi_get(mctx, key_list, &multi) < 0 )
+		return -1;
+
+	if ( multi == NULL ) {
+		sieve_stringlist_reset(key_list);
+		return sieve_match_keys_default(mctx, val, val_size, key_list);
+	}
+
+	return ( substr_search_multi_find(multi, val, val_size, NULL) ? 1 : 0 );
+}
+
+/* Streaming */
+
+struct mcht_contains_stream {
+	struct substr_search_multi *multi;
+	unsigned int state;
+};
+
+static int mcht_contains_match_stream_init
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	void **context_r)
+{
+	struct mcht_contains_stream *stream;
+	struct substr_search_multi *multi;
+	bool icase;
+
+	/* The automaton carries its state across chunks, so it is used for any
+	 * number of keys here.
+	 */
+	if ( !mcht_contains_multi_supported(mctx->comparator, &icase) )
+		return 0;
+
+	if ( mcht_contains_multi_lookup(mctx, key_list, icase, &multi) < 0 )
+		return -1;
+	if ( multi == NULL ) {
+		/* Too large; match the keys individually */
+		return 0;
+	}
+
+	stream = p_new(mctx->pool, struct mcht_contains_stream, 1);
+	stream->multi = multi;
+	*context_r = stream;
+	return 1;
+}
+
+static int mcht_contains_match_stream_more
+(struct sieve_match_context *mctx ATTR_UNUSED, void *context,
+	const unsigned char *data, size_t size)
+{
+	struct mcht_contains_stream *stream =
+		(struct mcht_contains_stream *) context;
+
+	return ( substr_search_multi_find_more
+		(stream->multi, &stream->state, data, size, NULL) ? 1 : 0 );
+}
+
+static int mcht_contains_match_stream_finish
+(struct sieve_match_context *mctx ATTR_UNUSED, void *context)
+{
+	struct mcht_contains_stream *stream =
+		(struct mcht_contains_stream *) context;
+
+	/* An empty key also matches an empty value */
+	return ( substr_search_multi_find_more
+		(stream->multi, &stream->state, "", 0, NULL) ? 1 : 0 );
+}
+
+/* Single-key matching */
+
 static int mcht_contains_match_key
 (struct sieve_match_context *mctx, const char *val, size_t val_size,
 	const char *key, size_t key_size)
@@ -55,6 +271,17 @@ static int mcht_contains_match_key
 	if ( cmp->def == NULL || cmp->def->char_match == NULL )
 		return 0;
 
+	/* Core comparators use the substring search engine */
+	if ( sieve_comparator_is(cmp, i_octet_comparator) ) {
+		return ( substr_search_find
+			(val, val_size, key, key_size, FALSE, NULL) ? 1 : 0 );
+	}
+	if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) ) {
+		return ( substr_search_find
+			(val, val_size, key, key_size, TRUE, NULL) ? 1 : 0 );
+	}
+
+	/* Naive substring match for other comparators */
 	while ( (vp < vend) && (kp < kend) ) {
 		if ( !cmp->def->char_match(cmp, &vp, vend, &kp, kend) )
 			vp++;
@@ -62,5 +289,3 @@ static int mcht_contains_match_key
 
 	return ( kp == kend ? 1 : 0 );
 }
-
-
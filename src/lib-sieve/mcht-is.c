@@ -5,18 +5,28 @@
  */
 
 #include "lib.h"
+#include "str.h"
 
 #include "sieve-match-types.h"
 #include "sieve-comparators.h"
+#include "sieve-stringlist.h"
 #include "sieve-match.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+/* Minimum number of keys for which a sorted key set is built */
+#define MCHT_IS_KEY_SET_MIN 8
+
 /*
  * Forward declarations
  */
 
+static void mcht_is_match_init(struct sieve_match_context *mctx);
+static int mcht_is_match_keys
+	(struct sieve_match_context *mctx, const char *val, size_t val_size,
+		struct sieve_stringlist *key_list);
 static int mcht_is_match_key
 	(struct sieve_match_context *mctx, const char *val, size_t val_size,
 		const char *key, size_t key_size);
@@ -28,6 +38,8 @@ static int mcht_is_match_key
 const struct sieve_match_type_def is_match_type = {
 	SIEVE_OBJECT("is",
 		&match_type_operand, SIEVE_MATCH_TYPE_IS),
+	.match_init = mcht_is_match_init,
+	.match_keys = mcht_is_match_keys,
 	.match_key = mcht_is_match_key
 };
 
@@ -35,6 +47,161 @@ const struct sieve_match_type_def is_match_type = {
  * Match-type implementation
  */
 
+/* Key set */
+
+/* Large literal key lists are turned into a sorted array of normalized keys
+ * once for the loaded binary, so that each value is matched using a binary
+ * search rather than by comparing it to every key.
+ */
+
+struct mcht_is_key {
+	const char *data;
+	size_t size;
+};
+
+struct mcht_is_key_set {
+	const struct mcht_is_key *keys;
+	unsigned int count;
+};
+
+struct mcht_is_context {
+	struct sieve_stringlist *key_list;
+	const struct mcht_is_key_set *key_set;
+};
+
+static int mcht_is_key_cmp(const void *p1, const void *p2)
+{
+	const struct mcht_is_key *key1 = p1, *key2 = p2;
+
+	if ( key1->size != key2->size )
+		return ( key1->size < key2->size ? -1 : 1 );
+	return memcmp(key1->data, key2->data, key1->size);
+}
+
+static void mcht_is_match_init(struct sieve_match_context *mctx)
+{
+	mctx->data = p_new(mctx->pool, struct mcht_is_context, 1);
+}
+
+static int mcht_is_key_set_create
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	pool_t pool, unsigned int count, struct mcht_is_key_set **set_r)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct mcht_is_key_set *set;
+	struct mcht_is_key *keys;
+	string_t *key_item = NULL;
+	int ret = 0;
+
+	*set_r = NULL;
+
+	set = p_new(pool, struct mcht_is_key_set, 1);
+	keys = p_new(pool, struct mcht_is_key, count);
+
+	sieve_stringlist_reset(key_list);
+	while ( set->count < count &&
+		(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+		struct mcht_is_key *key = &keys[set->count++];
+
+		key->size = str_len(key_item);
+		key->data = p_sieve_comparator_normalize
+			(pool, cmp, str_c(key_item), key->size);
+		if ( key->data == str_c(key_item) )
+			key->data = p_strndup(pool, key->data, key->size);
+	}
+
+	if ( ret < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		return -1;
+	}
+
+	qsort(keys, set->count, sizeof(*keys), mcht_is_key_cmp);
+	set->keys = keys;
+	*set_r = set;
+	return 0;
+}
+
+static int mcht_is_key_set_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	const struct mcht_is_key_set **set_r)
+{
+	struct mcht_is_context *ictx = (struct mcht_is_context *) mctx->data;
+	struct mcht_is_key_set *set;
+	void **cached;
+	pool_t pool;
+	int count;
+
+	*set_r = NULL;
+
+	/* Same key list as for the previous value */
+	if ( ictx->key_list == key_list ) {
+		*set_r = ictx->key_set;
+		return 0;
+	}
+	ictx->key_list = key_list;
+	ictx->key_set = NULL;
+
+	/* Keys must be comparable octet-wise in canonical form */
+	if ( !sieve_comparator_can_normalize(mctx->comparator) )
+		return 0;
+
+	if ( (count=sieve_stringlist_get_length(key_list)) < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		return -1;
+	}
+	if ( count < MCHT_IS_KEY_SET_MIN )
+		return 0;
+
+	/* Only literal key lists; these are sorted once for the loaded binary */
+	if ( !sieve_match_key_list_cache_lookup(mctx, key_list, &cached, &pool) )
+		return 0;
+
+	if ( *cached == NULL ) {
+		if ( mcht_is_key_set_create
+			(mctx, key_list, pool, (unsigned int)count, &set) < 0 )
+			return -1;
+		*cached = set;
+	}
+	ictx->key_set = (const struct mcht_is_key_set *) *cached;
+
+	*set_r = ictx->key_set;
+	return 0;
+}
+
+static int mcht_is_match_keys
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	struct sieve_stringlist *key_list)
+{
+	const struct mcht_is_key_set *set;
+	struct mcht_is_key lookup_key;
+	bool found;
+
+	/* Tracing reports the result for each individual key */
+	if ( mctx->trace )
+		return sieve_match_keys_default(mctx, val, val_size, key_list);
+
+	if ( mcht_is_key_set_get(mctx, key_list, &set) < 0 )
+		return -1;
+
+	if ( set == NULL ) {
+		sieve_stringlist_reset(key_list);
+		return sieve_match_keys_default(mctx, val, val_size, key_list);
+	}
+
+	T_BEGIN {
+		lookup_key.data = t_sieve_comparator_normalize
+			(mctx->comparator, val, val_size);
+		lookup_key.size = val_size;
+
+		found = ( bsearch(&lookup_key, set->keys, set->count,
+			sizeof(*set->keys), mcht_is_key_cmp) != NULL );
+	} T_END;
+
+	return ( found ? 1 : 0 );
+}
+
+/* Single-key matching */
+
 static int mcht_is_match_key
 (struct sieve_match_context *mctx ATTR_UNUSED,
 	const char *val, size_t val_size,
@@ -6,9 +6,13 @@
 
 #include "lib.h"
 #include "str.h"
+#include "buffer.h"
+#include "array.h"
+#include "substr-search.h"
 
 #include "sieve-match-types.h"
 #include "sieve-comparators.h"
+#include "sieve-stringlist.h"
 #include "sieve-match.h"
 
 #include <string.h>
@@ -18,9 +22,21 @@
  * Forward declarations
  */
 
+static void mcht_matches_match_init(struct sieve_match_context *mctx);
+static int mcht_matches_match_keys
+	(struct sieve_match_context *mctx, const char *val, size_t val_size,
+		struct sieve_stringlist *key_list);
 static int mcht_matches_match_key
 	(struct sieve_match_context *mctx, const char *val, size_t val_size,
 		const char *key, size_t key_size);
+static int mcht_matches_match_stream_init
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+		void **context_r);
+static int mcht_matches_match_stream_more
+	(struct sieve_match_context *mctx, void *context,
+		const unsigned char *data, size_t size);
+static int mcht_matches_match_stream_finish
+	(struct sieve_match_context *mctx, void *context);
 
 /*
  * Match-type object
@@ -30,411 +46,689 @@ const struct sieve_match_type_def matches_match_type = {
 	SIEVE_OBJECT("matches",
 		&match_type_operand, SIEVE_MATCH_TYPE_MATCHES),
 	.validate_context = sieve_match_substring_validate_context,
-	.match_key = mcht_matches_match_key
+	.match_init = mcht_matches_match_init,
+	.match_keys = mcht_matches_match_keys,
+	.match_key = mcht_matches_match_key,
+	.match_stream_init = mcht_matches_match_stream_init,
+	.match_stream_more = mcht_matches_match_stream_more,
+	.match_stream_finish = mcht_matches_match_stream_finish
 };
 
 /*
- * Match-type implementation
+ * Wildcard program
  */
 
-/* Quick 'n dirty debug */
-//#define MATCH_DEBUG
-#ifdef MATCH_DEBUG
-#define debug_printf(...) printf ("match debug: " __VA_ARGS__)
-#else
-#define debug_printf(...)
-#endif
-
-/* FIXME: Naive implementation, substitute this with dovecot src/lib/str-find.c
+/* A key is compiled into a list of sections separated by '*' wildcards:
+ *
+ *   <pattern> = <section>*<section>*<section>...
+ *   <section> = <part><part><part>...
+ *   <part>    = <literal text> / <run of '?' wildcards>
+ *
+ * Escape sequences \? and \* are resolved during compilation. The first
+ * section is anchored at the beginning of the value and the last section is
+ * anchored at its end. Each section in between is matched at its leftmost
+ * occurrence after the previous one, which is always a valid choice. This
+ * means that no backtracking is needed and it also yields the shortest
+ * possible match values for the '*' wildcards.
  */
-static inline bool _string_find(const struct sieve_comparator *cmp,
-	const char **valp, const char *vend, const char **keyp, const char *kend)
+
+struct mcht_matches_part {
+	/* Literal text; NULL for a run of '?' wildcards */
+	const char *text;
+	size_t size;
+};
+
+struct mcht_matches_section {
+	const struct mcht_matches_part *parts;
+	unsigned int parts_count;
+
+	/* Number of value octets matched by this section */
+	size_t size;
+
+	/* Longest literal part; used to find candidate positions */
+	const struct mcht_matches_part *anchor;
+	size_t anchor_offset;
+};
+
+struct mcht_matches_program {
+	const struct mcht_matches_section *sections;
+	unsigned int sections_count;
+};
+
+static struct mcht_matches_program *mcht_matches_program_compile
+(pool_t pool, const struct sieve_comparator *cmp,
+	const char *key, size_t key_size)
 {
-	while ( (*valp < vend) && (*keyp < kend) ) {
-		if ( !cmp->def->char_match(cmp, valp, vend, keyp, kend) )
-			(*valp)++;
+	struct mcht_matches_program *prog;
+	struct mcht_matches_section *sections, *section;
+	struct mcht_matches_part *parts, *part;
+	const char *kp, *kend = key + key_size;
+	char *text, *text_begin;
+	unsigned int i;
+
+	prog = p_new(pool, struct mcht_matches_program, 1);
+
+	/* Determine upper bounds for the number of sections and parts */
+	prog->sections_count = 1;
+	for ( kp = key; kp < kend; kp++ ) {
+		if ( *kp == '*' )
+			prog->sections_count++;
 	}
 
-	return (*keyp == kend);
-}
+	sections = p_new(pool, struct mcht_matches_section, prog->sections_count);
+	parts = p_new(pool, struct mcht_matches_part, key_size);
+	text = text_begin = p_malloc(pool, key_size + 1);
+
+	section = sections;
+	section->parts = parts;
+	part = NULL;
+	for ( kp = key; kp < kend; kp++ ) {
+		char c = *kp;
+
+		switch ( c ) {
+		case '*':
+			/* Start next section */
+			section++;
+			section->parts = parts;
+			part = NULL;
+			continue;
+		case '?':
+			/* Extend current run of '?' wildcards */
+			if ( part == NULL || part->text != NULL ) {
+				part = parts++;
+				section->parts_count++;
+			}
+			part->size++;
+			section->size++;
+			continue;
+		case '\\':
+			if ( kp + 1 < kend )
+				c = *(++kp);
+			break;
+		default:
+			break;
+		}
 
-static char _scan_key_section
-	(string_t *section, const char **wcardp, const char *key_end)
-{
-	/* Find next wildcard and resolve escape sequences */
-	str_truncate(section, 0);
-	while ( *wcardp < key_end && **wcardp != '*' && **wcardp != '?') {
-		if ( **wcardp == '\\' ) {
-			(*wcardp)++;
+		/* Extend current literal part */
+		if ( part == NULL || part->text == NULL ) {
+			part = parts++;
+			part->text = text;
+			section->parts_count++;
 		}
-		str_append_c(section, **wcardp);
-		(*wcardp)++;
+		*(text++) = c;
+		part->size++;
+		section->size++;
 	}
 
-	/* Record wildcard character or \0 */
-	if ( *wcardp < key_end ) {
-		return **wcardp;
+	/* Literal text is matched in canonical form if possible */
+	if ( cmp->def != NULL && cmp->def->normalize != NULL ) {
+		cmp->def->normalize
+			(cmp, text_begin, text - text_begin, text_begin);
 	}
 
-	i_assert( *wcardp == key_end );
-	return '\0';
+	/* Select the longest literal part of each section as its anchor */
+	for ( i = 0; i < prog->sections_count; i++ ) {
+		unsigned int j;
+		size_t offset = 0;
+
+		section = &sections[i];
+		for ( j = 0; j < section->parts_count; j++ ) {
+			const struct mcht_matches_part *spart = &section->parts[j];
+
+			if ( spart->text != NULL && ( section->anchor == NULL ||
+				spart->size > section->anchor->size ) ) {
+				section->anchor = spart;
+				section->anchor_offset = offset;
+			}
+			offset += spart->size;
+		}
+	}
+
+	prog->sections = sections;
+	return prog;
 }
 
-static int mcht_matches_match_key
-(struct sieve_match_context *mctx, const char *val, size_t val_size,
-	const char *key, size_t key_size)
+/* Comparison */
+
+/* For comparators that can normalize, both the literal text and the value
+ * are matched in canonical form, so that plain octet comparison applies.
+ */
+
+static inline bool mcht_matches_compare
+(const struct sieve_comparator *cmp, const char *val, const char *key,
+	size_t size)
 {
-	const struct sieve_comparator *cmp = mctx->comparator;
-	struct sieve_match_values *mvalues;
-	string_t *mvalue = NULL, *mchars = NULL;
-	string_t *section, *subsection;
-	const char *vend, *kend, *vp, *kp, *wp, *pvp;
-	bool backtrack = FALSE; /* TRUE: match of '?'-connected sections failed */
-	char wcard = '\0';      /* Current wildcard */
-	char next_wcard = '\0'; /* Next  widlcard */
-	unsigned int key_offset = 0;
+	if ( sieve_comparator_can_normalize(cmp) )
+		return ( memcmp(val, key, size) == 0 );
 
-	if ( cmp->def == NULL || cmp->def->char_match == NULL )
-		return 0;
+	return cmp->def->char_match(cmp, &val, val + size, &key, key + size);
+}
 
-	/* Key sections */
-	section = t_str_new(32);    /* Section (after beginning or *) */
-	subsection = t_str_new(32); /* Sub-section (after ?) */
+static bool mcht_matches_find
+(const struct sieve_comparator *cmp, const char *val, size_t val_size,
+	const char *key, size_t key_size, size_t *offset_r)
+{
+	const char *vp, *vlast;
 
-	/* Mark end of value and key */
-	vend = (const char *) val + val_size;
-	kend = (const char *) key + key_size;
+	if ( sieve_comparator_can_normalize(cmp) ) {
+		return substr_search_find
+			(val, val_size, key, key_size, FALSE, offset_r);
+	}
 
-	/* Initialize pointers */
-	vp = val;                   /* Value pointer */
-	kp = key;                   /* Key pointer */
-	wp = key;                   /* Wildcard (key) pointer */
+	if ( key_size > val_size )
+		return FALSE;
 
-	/* Start match values list if requested */
-	if ( (mvalues = sieve_match_values_start(mctx->runenv)) != NULL ) {
-		/* Skip ${0} for now; added when match succeeds */
-		sieve_match_values_add(mvalues, NULL);
+	vlast = val + (val_size - key_size);
+	for ( vp = val; vp <= vlast; vp++ ) {
+		if ( mcht_matches_compare(cmp, vp, key, key_size) ) {
+			*offset_r = vp - val;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Section matching */
+
+static bool mcht_matches_section_match
+(const struct sieve_comparator *cmp,
+	const struct mcht_matches_section *section, const char *vp)
+{
+	unsigned int i;
+
+	for ( i = 0; i < section->parts_count; i++ ) {
+		const struct mcht_matches_part *part = &section->parts[i];
 
-		mvalue = t_str_new(32);     /* Match value (*) */
-		mchars = t_str_new(32);     /* Match characters (.?..?.??) */
+		if ( part->text != NULL &&
+			!mcht_matches_compare(cmp, vp, part->text, part->size) )
+			return FALSE;
+		vp += part->size;
 	}
+	return TRUE;
+}
 
-	/* Match the pattern:
-	 *   <pattern> = <section>*<section>*<section>...
-	 *   <section> = <sub-section>?<sub-section>?<sub-section>...
-	 *
-	 * Escape sequences \? and \* need special attention.
-	 */
+static const char *mcht_matches_section_find
+(const struct sieve_comparator *cmp,
+	const struct mcht_matches_section *section, const char *vp,
+	const char *vlimit)
+{
+	const struct mcht_matches_part *anchor = section->anchor;
+	const char *vlast;
+
+	if ( (size_t)(vlimit - vp) < section->size )
+		return NULL;
+
+	/* Sections without literal text match right away */
+	if ( anchor == NULL )
+		return vp;
+
+	/* Find candidate positions using the anchor text */
+	vlast = vlimit - section->size;
+	while ( vp <= vlast ) {
+		const char *ap = vp + section->anchor_offset;
+		size_t asize, offset;
+
+		asize = (vlast - vp) + anchor->size;
+		if ( !mcht_matches_find
+			(cmp, ap, asize, anchor->text, anchor->size, &offset) )
+			return NULL;
+
+		vp = ap + offset - section->anchor_offset;
+		if ( mcht_matches_section_match(cmp, section, vp) )
+			return vp;
+		vp++;
+	}
+	return NULL;
+}
 
-	debug_printf("=== Start ===\n");
-	debug_printf("  key:   %s\n", t_strdup_until(key, kend));
-	debug_printf("  value: %s\n", t_strdup_until(val, vend));
+/* Match values */
 
-	/* Loop until either key or value ends */
-	while (kp < kend && vp < vend ) {
-		const char *needle, *nend;
+static void mcht_matches_values_add_chars
+(struct sieve_match_values *mvalues,
+	const struct mcht_matches_section *section, const char *vp)
+{
+	unsigned int i;
 
-		if ( !backtrack ) {
-			/* Search the next '*' wildcard in the key string */
+	for ( i = 0; i < section->parts_count; i++ ) {
+		const struct mcht_matches_part *part = &section->parts[i];
 
-			wcard = next_wcard;
+		if ( part->text == NULL ) {
+			size_t j;
 
-			/* Find the needle to look for in the string */
-			key_offset = 0;
-			for (;;) {
-				next_wcard = _scan_key_section(section, &wp, kend);
+			for ( j = 0; j < part->size; j++ )
+				sieve_match_values_add_char(mvalues, vp[j]);
+		}
+		vp += part->size;
+	}
+}
 
-				if ( wcard == '\0' || str_len(section) > 0 )
-					break;
+static void mcht_matches_values_add_str
+(struct sieve_match_values *mvalues, const char *begin, const char *end)
+{
+	sieve_match_values_add_data(mvalues, begin, end - begin);
+}
 
-				if ( next_wcard == '*' ) {
-					break;
-				}
+/* Program execution */
 
-				if ( wp < kend )
-					wp++;
-				else
-					break;
-				key_offset++;
-			}
+static int mcht_matches_program_match
+(struct sieve_match_context *mctx, const struct mcht_matches_program *prog,
+	const char *val, const char *nval, size_t val_size)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	const struct mcht_matches_section *first, *last;
+	struct sieve_match_values *mvalues;
+	const char *vp, *vlast = NULL;
+	unsigned int i;
 
-			debug_printf("found wildcard '%c' at pos [%d]\n",
-				next_wcard, (int) (wp-key));
+	/* The value is matched in canonical form (nval), but match values are
+	 * taken from the original value at the same offsets.
+	 */
 
-			if ( mvalues != NULL )
-				str_truncate(mvalue, 0);
-		} else {
-			/* Backtracked; '*' wildcard is retained */
-			debug_printf("backtracked");
-			backtrack = FALSE;
-		}
+	if ( cmp->def == NULL || cmp->def->char_match == NULL )
+		return 0;
 
-		/* Determine what we are looking for */
-		needle = str_c(section);
-		nend = PTR_OFFSET(needle, str_len(section));
-
-		debug_printf("  section needle:  '%s'\n", t_strdup_until(needle, nend));
-		debug_printf("  section key:     '%s'\n", t_strdup_until(kp, kend));
-		debug_printf("  section remnant: '%s'\n", t_strdup_until(wp, kend));
-		debug_printf("  value remnant:   '%s'\n", t_strdup_until(vp, vend));
-		debug_printf("  key offset:      %d\n", key_offset);
-
-		pvp = vp;
-		if ( next_wcard == '\0' ) {
-			if ( wcard == '\0' ) {
-				/* No current wildcard; match needs to happen right at the beginning */
-				debug_printf("next_wcard = NULL && wcard = NUL; needle should be equal to value.\n");
-
-				if ( (vend - vp) != (nend - needle) ||
-					!cmp->def->char_match(cmp, &vp, vend, &needle, nend) ) {
-					debug_printf("  key not equal to value\n");
-					break;
-				}
+	first = &prog->sections[0];
+	last = &prog->sections[prog->sections_count-1];
+
+	/* Without '*' wildcards, the key must match the whole value */
+	if ( prog->sections_count == 1 ) {
+		if ( val_size != first->size ||
+			!mcht_matches_section_match(cmp, first, nval) )
+			return 0;
+	} else {
+		/* Check the anchored sections first */
+		if ( val_size < first->size + last->size ||
+			!mcht_matches_section_match(cmp, first, nval) )
+			return 0;
+
+		vlast = nval + (val_size - last->size);
+		if ( !mcht_matches_section_match(cmp, last, vlast) )
+			return 0;
+
+		/* Find the sections in between */
+		vp = nval + first->size;
+		for ( i = 1; i < prog->sections_count-1; i++ ) {
+			if ( (vp=mcht_matches_section_find
+				(cmp, &prog->sections[i], vp, vlast)) == NULL )
+				return 0;
+			vp += prog->sections[i].size;
+		}
+	}
 
-			} else {
-				const char *qp, *qend;
-				size_t slen;
+	/* Matched; now record match values if requested */
+	if ( (mvalues = sieve_match_values_start(mctx->runenv)) == NULL )
+		return 1;
 
-				/* No more wildcards; find the needle substring at the end of string */
-				debug_printf("next_wcard = NUL; must find needle at end\n");
+	/* Set ${0} */
+	sieve_match_values_add_data(mvalues, val, val_size);
 
-				/* Check if the value is still large enough */
-				slen = str_len(section);
-				if ( (vp + slen) > vend ) {
-					debug_printf("  wont match: value is too short\n");
-					break;
-				}
+	mcht_matches_values_add_chars(mvalues, first, val);
+	if ( prog->sections_count > 1 ) {
+		const char *nvp = nval + first->size;
 
-				/* Move value pointer to where the needle should be */
-				vp = vend - slen;
+		vp = val + first->size;
+		for ( i = 1; i < prog->sections_count-1; i++ ) {
+			const struct mcht_matches_section *section = &prog->sections[i];
+			const char *nsp, *sp;
 
-				/* Record match values */
-				qend = vp;
-				qp = vp - key_offset;
+			nsp = mcht_matches_section_find(cmp, section, nvp, vlast);
+			i_assert( nsp != NULL );
+			sp = val + (nsp - nval);
 
-				if ( mvalues != NULL )
-					str_append_data(mvalue, pvp, qp-pvp);
+			mcht_matches_values_add_str(mvalues, vp, sp);
+			mcht_matches_values_add_chars(mvalues, section, sp);
+			nvp = nsp + section->size;
+			vp = sp + section->size;
+		}
+		vlast = val + (vlast - nval);
+		mcht_matches_values_add_str(mvalues, vp, vlast);
+		mcht_matches_values_add_chars(mvalues, last, vlast);
+	}
 
-				/* Compare needle to end of value string */
-				if ( !cmp->def->char_match(cmp, &vp, vend, &needle, nend) ) {
-					debug_printf("  match at end failed\n");
-					break;
-				}
+	/* Activate new match values */
+	sieve_match_values_commit(mctx->runenv, &mvalues);
+	return 1;
+}
 
-				/* Add match values */
-				if ( mvalues != NULL ) {
-					/* Append '*' match value */
-					sieve_match_values_add(mvalues, mvalue);
+/*
+ * Match-type implementation
+ */
 
-					/* Append any initial '?' match values */
-					for ( ; qp < qend; qp++ )
-						sieve_match_values_add_char(mvalues, *qp);
-				}
-			}
+struct mcht_matches_context {
+	struct sieve_stringlist *key_list;
 
-			/* Finish match */
-			kp = kend;
-			vp = vend;
+	/* Programs compiled for a literal key list */
+	const struct mcht_matches_key_list *programs;
+};
 
-			debug_printf("  matched end of value\n");
-			break;
-		} else {
-			/* Next wildcard found; match needle before next wildcard */
-
-			const char *prv = NULL; /* Stored value pointer for backtrack */
-			const char *prk = NULL; /* Stored key pointer for backtrack */
-			const char *prw = NULL; /* Stored wildcard pointer for backtrack */
-			const char *chars;
-
-			/* Reset '?' match values */
-			if ( mvalues != NULL )
-				str_truncate(mchars, 0);
-
-			if ( wcard == '\0' ) {
-				/* No current wildcard; match needs to happen right at the beginning */
-				debug_printf("wcard = NUL; needle should be found at the beginning.\n");
-				debug_printf("  begin needle: '%s'\n", t_strdup_until(needle, nend));
-				debug_printf("  begin value:  '%s'\n", t_strdup_until(vp, vend));
-
-				if ( !cmp->def->char_match(cmp, &vp, vend, &needle, nend) ) {
-					debug_printf("  failed to find needle at beginning\n");
-					break;
-				}
+struct mcht_matches_key_list {
+	const struct mcht_matches_program *const *programs;
+	unsigned int count;
+};
 
-			} else {
-				/* Current wildcard present; match needle between current and next wildcard */
-				debug_printf("wcard != NUL; must find needle at an offset (>= %d).\n",
-					key_offset);
+static void mcht_matches_match_init(struct sieve_match_context *mctx)
+{
+	mctx->data = p_new(mctx->pool, struct mcht_matches_context, 1);
+}
 
-				/* Match may happen at any offset (>= key offset): find substring */
-				vp += key_offset;
-				if ( (vp >= vend) || !_string_find(cmp, &vp, vend, &needle, nend) ) {
-					debug_printf("  failed to find needle at an offset\n");
-					break;
-				}
+static int mcht_matches_key_list_compile
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	pool_t pool, struct mcht_matches_key_list **mkl_r)
+{
+	struct mcht_matches_key_list *mkl;
+	ARRAY(const struct mcht_matches_program *) programs;
+	const struct mcht_matches_program *prog;
+	string_t *key_item = NULL;
+	int ret;
 
-				prv = vp - str_len(section);
-				prk = kp;
-				prw = wp;
+	*mkl_r = NULL;
 
-				/* Append match values */
-				if ( mvalues != NULL ) {
-					const char *qend = vp - str_len(section);
-					const char *qp = qend - key_offset;
+	p_array_init(&programs, pool, 16);
 
-					/* Append '*' match value */
-					str_append_data(mvalue, pvp, qp-pvp);
+	sieve_stringlist_reset(key_list);
+	while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+		prog = mcht_matches_program_compile
+			(pool, mctx->comparator, str_c(key_item), str_len(key_item));
+		array_append(&programs, &prog, 1);
+	}
 
-					/* Append any initial '?' match values (those that caused the key
-					 * offset.
-					 */
-					for ( ; qp < qend; qp++ )
-						str_append_c(mchars, *qp);
-				}
-			}
+	if ( ret < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		return -1;
+	}
 
-			/* Update wildcard and key pointers for next wildcard scan */
-			if ( wp < kend ) wp++;
-			kp = wp;
+	mkl = p_new(pool, struct mcht_matches_key_list, 1);
+	mkl->programs = array_get(&programs, &mkl->count);
+	*mkl_r = mkl;
+	return 0;
+}
 
-			/* Scan successive '?' wildcards */
-			while ( next_wcard == '?' ) {
-				debug_printf("next_wcard = '?'; need to match arbitrary character\n");
+static int mcht_matches_key_list_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	const struct mcht_matches_key_list **mkl_r)
+{
+	struct mcht_matches_context *mmctx =
+		(struct mcht_matches_context *) mctx->data;
+	struct mcht_matches_key_list *mkl;
+	void **cached;
+	pool_t pool;
+	int ret = 0;
+
+	/* Same key list as for the previous value */
+	if ( mmctx->key_list == key_list ) {
+		*mkl_r = mmctx->programs;
+		return 0;
+	}
+	mmctx->key_list = key_list;
+	mmctx->programs = NULL;
+
+	/* Literal key lists are compiled only once for the loaded binary */
+	if ( sieve_match_key_list_cache_lookup(mctx, key_list, &cached, &pool) ) {
+		if ( *cached == NULL ) {
+			T_BEGIN {
+				ret = mcht_matches_key_list_compile
+					(mctx, key_list, pool, &mkl);
+			} T_END;
+			if ( ret < 0 )
+				return -1;
+			*cached = mkl;
+		}
+		mmctx->programs = (const struct mcht_matches_key_list *) *cached;
+	}
 
-				/* Add match value */
-				if ( mvalues != NULL )
-					str_append_c(mchars, *vp);
+	*mkl_r = mmctx->programs;
+	return 0;
+}
 
-				vp++;
+static int mcht_matches_match_keys
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	struct sieve_stringlist *key_list)
+{
+	const struct mcht_matches_key_list *mkl;
+	unsigned int i;
+	int match;
 
-				/* Scan for next '?' wildcard */
-				next_wcard = _scan_key_section(subsection, &wp, kend);
-				debug_printf("found next wildcard '%c' at pos [%d] (fixed match)\n",
-					next_wcard, (int) (wp-key));
+	/* Tracing reports the result for each individual key */
+	if ( mctx->trace )
+		return sieve_match_keys_default(mctx, val, val_size, key_list);
 
-				/* Determine what we are looking for */
-				needle = str_c(subsection);
-				nend = needle + str_len(subsection);
+	if ( mcht_matches_key_list_get(mctx, key_list, &mkl) < 0 )
+		return -1;
 
-				debug_printf("  sub key:       '%s'\n", t_strdup_until(needle, nend));
-				debug_printf("  value remnant: '%s'\n", vp <= vend ? t_strdup_until(vp, vend) : "");
+	/* Key lists that are not literal are compiled for each use */
+	if ( mkl == NULL ) {
+		sieve_stringlist_reset(key_list);
+		return sieve_match_keys_default(mctx, val, val_size, key_list);
+	}
 
-				/* Try matching the needle at fixed position */
-				if ( (needle == nend && next_wcard == '\0' && vp < vend ) ||
-					!cmp->def->char_match(cmp, &vp, vend, &needle, nend) ) {
+	match = 0;
+	T_BEGIN {
+		const char *nval = val;
 
-					/* Match failed: now we have a problem. We need to backtrack to the previous
-					 * '*' wildcard occurrence and start scanning for the next possible match.
-					 */
+		/* Normalize the value only once for all keys */
+		if ( sieve_comparator_can_normalize(mctx->comparator) ) {
+			nval = t_sieve_comparator_normalize
+				(mctx->comparator, val, val_size);
+		}
 
-					debug_printf("  failed fixed match\n");
+		for ( i = 0; match == 0 && i < mkl->count; i++ ) {
+			match = mcht_matches_program_match
+				(mctx, mkl->programs[i], val, nval, val_size);
+		}
+	} T_END;
+	return match;
+}
 
-					/* Start backtrack */
-					if ( prv != NULL && prv + 1 < vend ) {
-						/* Restore pointers */
-						vp = prv;
-						kp = prk;
-						wp = prw;
+static int mcht_matches_match_key
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	const char *key, size_t key_size)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	const struct mcht_matches_program *prog;
+	const char *nval = val;
 
-						/* Skip forward one value character to scan the next possible match */
-						if ( mvalues != NULL )
-							str_append_c(mvalue, *vp);
-						vp++;
+	if ( sieve_comparator_can_normalize(cmp) )
+		nval = t_sieve_comparator_normalize(cmp, val, val_size);
 
-						/* Set wildcard state appropriately */
-						wcard = '*';
-						next_wcard = '?';
+	prog = mcht_matches_program_compile
+		(pool_datastack_create(), cmp, key, key_size);
+	return mcht_matches_program_match(mctx, prog, val, nval, val_size);
+}
 
-						/* Backtrack */
-						backtrack = TRUE;
+/* Streaming */
 
-						debug_printf("  BACKTRACK\n");
-					}
+/* Since each section is matched at its leftmost occurrence, a program can be
+ * executed on a value that arrives in chunks: only a window that may still
+ * hold (the start of) the current section is retained. The last section is
+ * verified on the trailing octets of the value once it ends. Match values
+ * would need the whole value, so streaming is only used when these are
+ * disabled.
+ */
 
-					/* Break '?' wildcard scanning loop */
-					break;
-				}
+struct mcht_matches_stream_key {
+	const struct mcht_matches_program *prog;
 
-				/* Update wildcard and key pointers for next wildcard scan */
-				if ( wp < kend ) wp++;
-				kp = wp;
-			}
+	/* Section that is currently being matched */
+	unsigned int section;
+	/* Value octets from where the current section may start */
+	buffer_t *window;
 
-			if ( !backtrack ) {
-				unsigned int i;
+	bool failed:1;
+};
 
-				if ( next_wcard == '?' ) {
-					debug_printf("failed to match '?'\n");
-					break;
-				}
+struct mcht_matches_stream {
+	struct mcht_matches_stream_key *keys;
+	unsigned int keys_count;
+};
 
-				if ( mvalues != NULL ) {
-					if ( prv != NULL )
-						sieve_match_values_add(mvalues, mvalue);
+static bool mcht_matches_stream_key_more
+(const struct sieve_comparator *cmp, struct mcht_matches_stream_key *skey,
+	const char *data, size_t size)
+{
+	const struct mcht_matches_program *prog = skey->prog;
+	const struct mcht_matches_section *section;
+	const char *wdata, *vp;
+	size_t wsize;
+
+	buffer_append(skey->window, data, size);
+
+	for (;;) {
+		wdata = (const char *) skey->window->data;
+		wsize = skey->window->used;
+		section = &prog->sections[skey->section];
+
+		if ( skey->section == 0 ) {
+			/* First section is anchored at the beginning */
+			if ( wsize < section->size )
+				return FALSE;
+			if ( !mcht_matches_section_match(cmp, section, wdata) ) {
+				skey->failed = TRUE;
+				return FALSE;
+			}
 
-					chars = (const char *) str_data(mchars);
+			/* Without '*' wildcards, nothing may follow */
+			if ( prog->sections_count == 1 ) {
+				if ( wsize > section->size )
+					skey->failed = TRUE;
+				return FALSE;
+			}
 
-					for ( i = 0; i < str_len(mchars); i++ ) {
-						sieve_match_values_add_char(mvalues, chars[i]);
-					}
-				}
+			buffer_delete(skey->window, 0, section->size);
+			skey->section++;
+			continue;
+		}
 
-				if ( next_wcard != '*' ) {
-					debug_printf("failed to match at end of string\n");
-					break;
+		if ( skey->section < prog->sections_count-1 ) {
+			/* Sections in between: find leftmost occurrence */
+			vp = mcht_matches_section_find(cmp, section, wdata, wdata + wsize);
+			if ( vp == NULL ) {
+				/* Retain what may still be the start of an occurrence */
+				if ( wsize >= section->size ) {
+					buffer_delete(skey->window, 0,
+						wsize - (section->size - 1));
 				}
+				return FALSE;
 			}
+
+			buffer_delete(skey->window, 0, (vp - wdata) + section->size);
+			skey->section++;
+			continue;
 		}
 
-		/* Check whether string ends in a wildcard
-		 * (avoid scanning the rest of the string)
+		/* Last section is anchored at the end; without literal text it
+		 * matches whatever follows.
 		 */
-		if ( kp == kend && next_wcard == '*' ) {
-			/* Add the rest of the string as match value */
-			if ( mvalues != NULL ) {
-				str_truncate(mvalue, 0);
-				str_append_data(mvalue, vp, vend-vp);
-				sieve_match_values_add(mvalues, mvalue);
-			}
-
-			/* Finish match */
-			kp = kend;
-			vp = vend;
+		if ( section->size == 0 )
+			return TRUE;
+		if ( wsize > section->size )
+			buffer_delete(skey->window, 0, wsize - section->size);
+		return FALSE;
+	}
+}
 
-			debug_printf("key ends with '*'\n");
-			break;
-		}
+static int mcht_matches_match_stream_init
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	void **context_r)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct mcht_matches_stream *stream;
+	const struct mcht_matches_key_list *mkl;
+	struct mcht_matches_key_list *mkl_new;
+	unsigned int i;
+	int ret = 0;
+
+	if ( sieve_match_values_are_enabled(mctx->runenv) ||
+		!sieve_comparator_can_normalize(cmp) )
+		return 0;
 
-		debug_printf("== Loop ==\n");
+	if ( mcht_matches_key_list_get(mctx, key_list, &mkl) < 0 )
+		return -1;
+
+	/* Key lists that are not literal are compiled for this match only */
+	if ( mkl == NULL ) {
+		T_BEGIN {
+			ret = mcht_matches_key_list_compile
+				(mctx, key_list, mctx->pool, &mkl_new);
+		} T_END;
+		if ( ret < 0 )
+			return -1;
+		mkl = mkl_new;
 	}
 
-	/* Eat away a trailing series of *s */
-	if ( vp == vend ) {
-		while ( kp < kend && *kp == '*' ) kp++;
+	stream = p_new(mctx->pool, struct mcht_matches_stream, 1);
+	stream->keys = p_new(mctx->pool,
+		struct mcht_matches_stream_key, I_MAX(mkl->count, 1));
+	stream->keys_count = mkl->count;
+	for ( i = 0; i < mkl->count; i++ ) {
+		stream->keys[i].prog = mkl->programs[i];
+		stream->keys[i].window = buffer_create_dynamic(mctx->pool, 128);
 	}
 
-	/* By definition, the match is only successful if both value and key pattern
-	 * are exhausted.
-	 */
+	*context_r = stream;
+	return 1;
+}
 
-	debug_printf("=== Finish ===\n");
-	debug_printf("  result: %s\n", (kp == kend && vp == vend) ? "true" : "false");
+static int mcht_matches_match_stream_more
+(struct sieve_match_context *mctx, void *context,
+	const unsigned char *data, size_t size)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct mcht_matches_stream *stream =
+		(struct mcht_matches_stream *) context;
+	unsigned int i;
+	int match = 0;
 
-	if (kp == kend && vp == vend) {
-		/* Activate new match values after successful match */
-		if ( mvalues != NULL ) {
-			/* Set ${0} */
-			string_t *matched = str_new_const(pool_datastack_create(), val, val_size);
-			sieve_match_values_set(mvalues, 0, matched);
+	T_BEGIN {
+		const char *ndata;
 
-			/* Commit new match values */
-			sieve_match_values_commit(mctx->runenv, &mvalues);
+		ndata = t_sieve_comparator_normalize
+			(cmp, (const char *) data, size);
+
+		for ( i = 0; match == 0 && i < stream->keys_count; i++ ) {
+			struct mcht_matches_stream_key *skey = &stream->keys[i];
+
+			if ( !skey->failed &&
+				mcht_matches_stream_key_more(cmp, skey, ndata, size) )
+				match = 1;
 		}
-		return 1;
-	}
+	} T_END;
+	return match;
+}
+
+static int mcht_matches_match_stream_finish
+(struct sieve_match_context *mctx, void *context)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct mcht_matches_stream *stream =
+		(struct mcht_matches_stream *) context;
+	unsigned int i;
+
+	for ( i = 0; i < stream->keys_count; i++ ) {
+		struct mcht_matches_stream_key *skey = &stream->keys[i];
+		const struct mcht_matches_program *prog = skey->prog;
+		const struct mcht_matches_section *section;
 
-	/* No match; drop collected match values */
-	sieve_match_values_abort(&mvalues);
+		/* Sections without literal text may not have been visited yet
+		 * (e.g. for an empty value).
+		 */
+		if ( skey->failed )
+			continue;
+		if ( mcht_matches_stream_key_more(cmp, skey, "", 0) )
+			return 1;
+		if ( skey->failed )
+			continue;
+
+		section = &prog->sections[skey->section];
+		if ( skey->section == 0 ) {
+			if ( prog->sections_count == 1 &&
+				skey->window->used == section->size )
+				return 1;
+		} else if ( skey->section == prog->sections_count-1 &&
+			skey->window->used == section->size &&
+			mcht_matches_section_match
+				(cmp, section, skey->window->data) ) {
+			return 1;
+		}
+	}
 	return 0;
 }
-
@@ -1,6 +1,9 @@
 /* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
  */
 
+#include "lib.h"
+#include "istream.h"
+
 #include "sieve-extensions.h"
 #include "sieve-commands.h"
 #include "sieve-stringlist.h"
@@ -13,6 +16,7 @@
 #include "sieve-generator.h"
 #include "sieve-binary.h"
 #include "sieve-interpreter.h"
+#include "sieve-message.h"
 #include "sieve-dump.h"
 #include "sieve-match.h"
 
@@ -43,7 +47,8 @@ const struct sieve_command_def body_test = {
 	.block_required = FALSE,
 	.registered = tst_body_registered,
 	.validate = tst_body_validate,
-	.generate = tst_body_generate
+	.generate = tst_body_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -217,6 +222,8 @@ static bool tst_body_generate
 {
 	(void)sieve_operation_emit(cgenv->sblock, cmd->ext, &body_operation);
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_BODY);
+
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, cmd, NULL);
 }
@@ -293,6 +300,40 @@ static bool ext_body_operation_dump
  * Interpretation
  */
 
+static int ext_body_match_raw
+(const struct sieve_runtime_env *renv,
+	const struct sieve_match_type *mcht, const struct sieve_comparator *cmp,
+	struct sieve_stringlist *key_list, int *exec_status)
+{
+	struct sieve_match_context *mctx;
+	struct istream *input;
+	int ret;
+
+	*exec_status = SIEVE_EXEC_OK;
+
+	/* The raw body is matched as a stream, which avoids reading large
+	 * messages into memory.
+	 */
+	if ( (ret=sieve_message_body_get_raw_stream(renv, &input)) <= 0 ) {
+		*exec_status = ret;
+		return -1;
+	}
+
+	if ( (mctx=sieve_match_begin(renv, mcht, cmp)) == NULL ) {
+		if ( input != NULL )
+			i_stream_unref(&input);
+		return 0;
+	}
+
+	/* A message without a body matches nothing */
+	if ( input != NULL ) {
+		(void)sieve_match_value_stream(mctx, input, key_list);
+		i_stream_unref(&input);
+	}
+
+	return sieve_match_end(&mctx, exec_status);
+}
+
 static int ext_body_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
@@ -363,7 +404,8 @@ static int ext_body_operation_execute
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "body test");
 
 	/* Extract requested parts */
-	if ( (ret=ext_body_get_part_list(renv,
+	if ( transform != TST_BODY_TRANSFORM_RAW &&
+		(ret=ext_body_get_part_list(renv,
 		(enum tst_body_transform) transform, content_types,&value_list)) <= 0 )
 		return ret;
 
@@ -371,7 +413,10 @@ static int ext_body_operation_execute
 	mvalues_active = sieve_match_values_set_enabled(renv, FALSE);
 
 	/* Perform match */
-	match = sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret);
+	if ( transform == TST_BODY_TRANSFORM_RAW )
+		match = ext_body_match_raw(renv, &mcht, &cmp, key_list, &ret);
+	else
+		match = sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret);
 
 	/* Restore match values processing */
 	(void)sieve_match_values_set_enabled(renv, mvalues_active);
@@ -51,7 +51,8 @@ const struct sieve_command_def date_test = {
 	.block_required = FALSE,
 	.registered = tst_date_registered,
 	.validate = tst_date_validate,
-	.generate = tst_date_generate
+	.generate = tst_date_generate,
+	.data_declared = TRUE
 };
 
 /* Currentdate test
@@ -75,7 +76,8 @@ const struct sieve_command_def currentdate_test = {
 	.block_required = FALSE,
 	.registered = tst_currentdate_registered,
 	.validate = tst_date_validate,
-	.generate = tst_date_generate
+	.generate = tst_date_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -305,9 +307,10 @@ static bool tst_date_validate
 static bool tst_date_generate
 (const struct sieve_codegen_env *cgenv, struct sieve_command *tst)
 {
-	if ( sieve_command_is(tst, date_test) )
+	if ( sieve_command_is(tst, date_test) ) {
 		sieve_operation_emit(cgenv->sblock, tst->ext, &date_operation);
-	else if ( sieve_command_is(tst, currentdate_test) )
+		sieve_generate_require_headers(cgenv, tst->first_positional);
+	} else if ( sieve_command_is(tst, currentdate_test) )
 		sieve_operation_emit(cgenv->sblock, tst->ext, &currentdate_operation);
 	else
 		i_unreached();
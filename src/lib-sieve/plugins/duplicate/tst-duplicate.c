@@ -40,7 +40,8 @@ const struct sieve_command_def tst_duplicate = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.registered = tst_duplicate_registered,
-	.generate = tst_duplicate_generate
+	.generate = tst_duplicate_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -248,8 +249,21 @@ static bool
 tst_duplicate_generate(const struct sieve_codegen_env *cgenv,
 		       struct sieve_command *cmd)
 {
+	struct sieve_ast_argument *arg;
+
 	sieve_operation_emit(cgenv->sblock, cmd->ext, &tst_duplicate_operation);
 
+	/* The Message-ID header is used unless another unique ID is given */
+	if (!(bool)cmd->data)
+		sieve_binary_require_header(cgenv->sbin, "message-id");
+	arg = sieve_ast_argument_first(cmd->ast_node);
+	while (arg != NULL) {
+		if (arg->argument != NULL &&
+		    arg->argument->id_code == OPT_HEADER)
+			sieve_generate_require_headers(cgenv, arg);
+		arg = sieve_ast_argument_next(arg);
+	}
+
 	if (!sieve_generate_arguments(cgenv, cmd, NULL))
 		return FALSE;
 	return TRUE;
@@ -45,7 +45,8 @@ const struct sieve_command_def addheader_command = {
 	.block_required = FALSE,
 	.registered = cmd_addheader_registered,
 	.validate = cmd_addheader_validate,
-	.generate = cmd_addheader_generate
+	.generate = cmd_addheader_generate,
+	.data_declared = TRUE
 };
 
 /*
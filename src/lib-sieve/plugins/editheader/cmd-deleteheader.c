@@ -49,7 +49,8 @@ const struct sieve_command_def deleteheader_command = {
 	.block_required = FALSE,
 	.registered = cmd_deleteheader_registered,
 	.validate = cmd_deleteheader_validate,
-	.generate = cmd_deleteheader_generate
+	.generate = cmd_deleteheader_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -297,6 +298,8 @@ static bool cmd_deleteheader_generate
 {
 	sieve_operation_emit(cgenv->sblock, cmd->ext, &deleteheader_operation);
 
+	sieve_generate_require_headers(cgenv, cmd->first_positional);
+
  	/* Generate arguments */
 	if ( !sieve_generate_arguments(cgenv, cmd, NULL) )
 		return FALSE;
@@ -62,6 +62,8 @@ const struct sieve_command_def notify_command = {
 	.pre_validate = cmd_notify_pre_validate,
 	.validate = cmd_notify_validate,
 	.generate = cmd_notify_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAG_ANY_HEADER,
+	.data_declared = TRUE,
 };
 
 /*
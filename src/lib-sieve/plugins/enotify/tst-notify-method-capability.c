@@ -42,7 +42,8 @@ const struct sieve_command_def notify_method_capability_test = {
 	.block_required = FALSE,
 	.registered = tst_notifymc_registered,
 	.validate = tst_notifymc_validate,
-	.generate = tst_notifymc_generate
+	.generate = tst_notifymc_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -35,7 +35,8 @@ const struct sieve_command_def valid_notify_method_test = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = tst_vnotifym_validate,
-	.generate = tst_vnotifym_generate
+	.generate = tst_vnotifym_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -43,7 +43,8 @@ const struct sieve_command_def tst_environment = {
 	.block_required = FALSE,
 	.registered = tst_environment_registered,
 	.validate = tst_environment_validate,
-	.generate = tst_environment_generate
+	.generate = tst_environment_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -36,7 +36,8 @@ const struct sieve_command_def error_command = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = cmd_error_validate,
-	.generate = cmd_error_generate
+	.generate = cmd_error_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -41,7 +41,8 @@ const struct sieve_command_def ihave_test = {
 	.block_required = FALSE,
 	.validate = tst_ihave_validate,
 	.validate_const = tst_ihave_validate_const,
-	.generate = tst_ihave_generate
+	.generate = tst_ihave_generate,
+	.data_declared = TRUE
 };
 
 /*
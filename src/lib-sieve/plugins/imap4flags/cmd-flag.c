@@ -36,7 +36,8 @@ const struct sieve_command_def cmd_setflag = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = ext_imap4flags_command_validate,
-	.generate = cmd_flag_generate
+	.generate = cmd_flag_generate,
+	.data_declared = TRUE
 };
 
 /* Addflag command
@@ -53,7 +54,8 @@ const struct sieve_command_def cmd_addflag = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = ext_imap4flags_command_validate,
-	.generate = cmd_flag_generate
+	.generate = cmd_flag_generate,
+	.data_declared = TRUE
 };
 
 
@@ -71,7 +73,8 @@ const struct sieve_command_def cmd_removeflag = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = ext_imap4flags_command_validate,
-	.generate = cmd_flag_generate
+	.generate = cmd_flag_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -48,7 +48,8 @@ static const struct sieve_command_def cmd_mark = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
-	.validate = cmd_mark_validate
+	.validate = cmd_mark_validate,
+	.data_declared = TRUE
 };
 
 /* Unmark command
@@ -63,7 +64,8 @@ static const struct sieve_command_def cmd_unmark = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
-	.validate = cmd_mark_validate
+	.validate = cmd_mark_validate,
+	.data_declared = TRUE
 };
 
 /*
@@ -41,7 +41,8 @@ const struct sieve_command_def tst_hasflag = {
 	.block_required = FALSE,
 	.registered = tst_hasflag_registered,
 	.validate = tst_hasflag_validate,
-	.generate = tst_hasflag_generate
+	.generate = tst_hasflag_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -36,6 +36,7 @@ const struct sieve_command_def cmd_global = {
 	.block_required = FALSE,
   .validate = cmd_global_validate,
   .generate = cmd_global_generate,
+	.data_declared = TRUE,
 };
 
 /* DEPRICATED:
@@ -55,6 +56,7 @@ const struct sieve_command_def cmd_import = {
 	.block_required = FALSE,
 	.validate = cmd_global_validate,
 	.generate = cmd_global_generate,
+	.data_declared = TRUE,
 };
 
 /* Export command
@@ -71,6 +73,7 @@ const struct sieve_command_def cmd_export = {
 	.block_required = FALSE,
 	.validate = cmd_global_validate,
 	.generate = cmd_global_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -50,7 +50,8 @@ const struct sieve_command_def cmd_include = {
 	.registered = cmd_include_registered,
 	.pre_validate = cmd_include_pre_validate,
 	.validate = cmd_include_validate,
-	.generate = cmd_include_generate
+	.generate = cmd_include_generate,
+	.data_declared = TRUE
 };
 
 /*
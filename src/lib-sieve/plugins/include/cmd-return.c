@@ -28,7 +28,8 @@ const struct sieve_command_def cmd_return = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
-	.generate = cmd_return_generate
+	.generate = cmd_return_generate,
+	.data_declared = TRUE
 };
 
 /*
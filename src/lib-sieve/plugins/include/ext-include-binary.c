@@ -239,24 +239,24 @@ static bool ext_include_binary_pre_save
 	return result;
 }
 
-static bool ext_include_binary_open
-(const struct sieve_extension *ext, struct sieve_binary *sbin, void *context)
+static bool ext_include_binary_read_dependencies
+(const struct sieve_extension *ext, struct sieve_binary *sbin,
+	struct ext_include_binary_context *binctx, bool load,
+	sieve_size_t *offset, bool *outdated_r)
 {
 	struct sieve_instance *svinst = ext->svinst;
 	struct ext_include_context *ext_ctx =
 		(struct ext_include_context *)ext->context;
-	struct ext_include_binary_context *binctx =
-		(struct ext_include_binary_context *) context;
 	struct sieve_binary_block *sblock;
 	unsigned int depcount, i, block_id;
-	sieve_size_t offset;
 
 	sblock = sieve_binary_extension_get_block(sbin, ext);
 	block_id = sieve_binary_block_get_id(sblock);
 
-	offset = 0;
+	*offset = 0;
+	*outdated_r = FALSE;
 
-	if ( !sieve_binary_read_unsigned(sblock, &offset, &depcount) ) {
+	if ( !sieve_binary_read_unsigned(sblock, offset, &depcount) ) {
 		e_error(svinst->event,
 			"include: failed to read include count "
 			"for dependency block %d of binary %s", block_id,
@@ -284,10 +284,10 @@ static bool ext_include_binary_open
 		int ret;
 
 		if (
-			!sieve_binary_read_unsigned(sblock, &offset, &inc_block_id) ||
-			!sieve_binary_read_byte(sblock, &offset, &location) ||
-			!sieve_binary_read_string(sblock, &offset, &script_name) ||
-			!sieve_binary_read_byte(sblock, &offset, &flags) ) {
+			!sieve_binary_read_unsigned(sblock, offset, &inc_block_id) ||
+			!sieve_binary_read_byte(sblock, offset, &location) ||
+			!sieve_binary_read_string(sblock, offset, &script_name) ||
+			!sieve_binary_read_byte(sblock, offset, &flags) ) {
 			/* Binary is corrupt, recompile */
 			e_error(svinst->event,
 				"include: failed to read included script "
@@ -364,7 +364,7 @@ static bool ext_include_binary_open
 
 		/* Can we read script metadata ? */
 		if ( (ret=sieve_script_binary_read_metadata
-			(script, sblock, &offset))	< 0 ) {
+			(script, sblock, offset))	< 0 ) {
 			/* Binary is corrupt, recompile */
 			e_error(svinst->event, "include: "
 				"dependency block %d of binary %s "
@@ -376,14 +376,34 @@ static bool ext_include_binary_open
 		}
 
 		if ( ret == 0 )
-			binctx->outdated = TRUE;
+			*outdated_r = TRUE;
 
-		(void)ext_include_binary_script_include
-			(binctx, location, flags, script, inc_block);
+		if ( load ) {
+			(void)ext_include_binary_script_include
+				(binctx, location, flags, script, inc_block);
+		}
 
 		sieve_script_unref(&script);
 	}
 
+	return TRUE;
+}
+
+static bool ext_include_binary_open
+(const struct sieve_extension *ext, struct sieve_binary *sbin, void *context)
+{
+	struct ext_include_binary_context *binctx =
+		(struct ext_include_binary_context *) context;
+	struct sieve_binary_block *sblock;
+	sieve_size_t offset;
+	bool outdated;
+
+	if ( !ext_include_binary_read_dependencies
+		(ext, sbin, binctx, TRUE, &offset, &outdated) )
+		return FALSE;
+	binctx->outdated = outdated;
+
+	sblock = sieve_binary_extension_get_block(sbin, ext);
 	if ( !ext_include_variables_load
 		(ext, sblock, &offset, &binctx->global_vars) )
 		return FALSE;
@@ -392,14 +412,25 @@ static bool ext_include_binary_open
 }
 
 static bool ext_include_binary_up_to_date
-(const struct sieve_extension *ext ATTR_UNUSED,
-	struct sieve_binary *sbin ATTR_UNUSED, void *context,
+(const struct sieve_extension *ext, struct sieve_binary *sbin, void *context,
 	enum sieve_compile_flags cpflags ATTR_UNUSED)
 {
 	struct ext_include_binary_context *binctx =
 		(struct ext_include_binary_context *) context;
+	sieve_size_t offset;
+	bool outdated;
+
+	if ( binctx->outdated )
+		return FALSE;
 
-	return !binctx->outdated;
+	/* Check the included scripts again; the binary may have been loaded
+	 * long before (e.g. when it is reused from the binary cache) */
+	if ( !ext_include_binary_read_dependencies
+		(ext, sbin, binctx, FALSE, &offset, &outdated) || outdated ) {
+		binctx->outdated = TRUE;
+		return FALSE;
+	}
+	return TRUE;
 }
 
 static void ext_include_binary_free
@@ -342,7 +342,11 @@ ext_include_runtime_init(const struct sieve_extension *this_ext,
 		(struct ext_include_interpreter_context *)context;
 	struct ext_include_context *ectx = ext_include_get_context(this_ext);
 
-	if (ctx->parent == NULL) {
+	if (ctx->parent == NULL && ctx->global != NULL) {
+		/* Interpreter was reset; recycle the global state */
+		array_clear(&ctx->global->included_scripts);
+		sieve_variable_storage_clear(ctx->global->var_storage);
+	} else if (ctx->parent == NULL) {
 		ctx->global = p_new(ctx->pool,
 				    struct ext_include_interpreter_global, 1);
 		p_array_init(&ctx->global->included_scripts, ctx->pool, 10);
@@ -362,9 +366,24 @@ ext_include_runtime_init(const struct sieve_extension *this_ext,
 	return SIEVE_EXEC_OK;
 }
 
+static void
+ext_include_runtime_reset(const struct sieve_extension *this_ext ATTR_UNUSED,
+			  struct sieve_interpreter *interp ATTR_UNUSED,
+			  void *context)
+{
+	struct ext_include_interpreter_context *ctx =
+		(struct ext_include_interpreter_context *)context;
+
+	/* A previous execution may have been interrupted by return or stop
+	   while an include was pending */
+	ctx->include = NULL;
+	ctx->returned = FALSE;
+}
+
 static struct sieve_interpreter_extension include_interpreter_extension = {
 	.ext_def = &include_extension,
-	.run = ext_include_runtime_init
+	.run = ext_include_runtime_init,
+	.reset = ext_include_runtime_reset
 };
 
 /*
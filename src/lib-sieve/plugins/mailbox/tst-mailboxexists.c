@@ -42,6 +42,7 @@ const struct sieve_command_def mailboxexists_test = {
 	.block_required = FALSE,
 	.validate = tst_mailboxexists_validate,
 	.generate = tst_mailboxexists_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -128,6 +129,8 @@ tst_mailboxexists_generate(const struct sieve_codegen_env *cgenv,
 {
 	sieve_operation_emit(cgenv->sblock, tst->ext, &mailboxexists_operation);
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_MAILBOX);
+
  	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
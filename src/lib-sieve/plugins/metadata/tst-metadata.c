@@ -58,6 +58,7 @@ const struct sieve_command_def metadata_test = {
 	.registered = tst_metadata_registered,
 	.validate = tst_metadata_validate,
 	.generate = tst_metadata_generate,
+	.data_declared = TRUE,
 };
 
 /* Servermetadata test
@@ -77,6 +78,7 @@ const struct sieve_command_def servermetadata_test = {
 	.registered = tst_metadata_registered,
 	.validate = tst_metadata_validate,
 	.generate = tst_metadata_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -225,6 +227,8 @@ tst_metadata_generate(const struct sieve_codegen_env *cgenv,
 		i_unreached();
 	}
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_MAILBOX);
+
  	/* Generate arguments */
 	if (!sieve_generate_arguments(cgenv, tst, NULL))
 		return FALSE;
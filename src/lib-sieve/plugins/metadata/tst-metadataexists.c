@@ -53,6 +53,7 @@ const struct sieve_command_def metadataexists_test = {
 	.block_required = FALSE,
 	.validate = tst_metadataexists_validate,
 	.generate = tst_metadataexists_generate,
+	.data_declared = TRUE,
 };
 
 /* Servermetadataexists command
@@ -70,6 +71,7 @@ const struct sieve_command_def servermetadataexists_test = {
 	.block_required = FALSE,
 	.validate = tst_metadataexists_validate,
 	.generate = tst_metadataexists_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -204,6 +206,8 @@ tst_metadataexists_generate(const struct sieve_codegen_env *cgenv,
 		i_unreached();
 	}
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_MAILBOX);
+
  	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
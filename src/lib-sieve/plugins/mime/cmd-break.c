@@ -44,6 +44,7 @@ const struct sieve_command_def cmd_break = {
 	.pre_validate = cmd_break_pre_validate,
 	.validate = cmd_break_validate,
 	.generate = cmd_break_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -45,7 +45,8 @@ const struct sieve_command_def cmd_extracttext = {
 	.block_required = FALSE,
 	.registered = cmd_extracttext_registered,
 	.validate = cmd_extracttext_validate,
-	.generate = cmd_extracttext_generate
+	.generate = cmd_extracttext_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -198,6 +199,9 @@ static bool cmd_extracttext_generate
 
 	sieve_operation_emit(sblock, this_ext, &extracttext_operation);
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_BODY |
+		SIEVE_BINARY_DATA_FLAG_MIME);
+
 	/* Generate arguments */
 	if ( !sieve_generate_arguments(cgenv, cmd, NULL) )
 		return FALSE;
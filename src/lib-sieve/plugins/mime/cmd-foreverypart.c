@@ -45,7 +45,8 @@ const struct sieve_command_def cmd_foreverypart = {
 	.registered = cmd_foreverypart_registered,
 	.pre_validate = cmd_foreverypart_pre_validate,
 	.validate = cmd_foreverypart_validate,
-	.generate = cmd_foreverypart_generate
+	.generate = cmd_foreverypart_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -193,6 +194,8 @@ static bool cmd_foreverypart_generate
 		(struct ext_foreverypart_loop *)cmd->data;
 	sieve_size_t block_begin, loop_jump;
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_MIME);
+
 	/* Emit FOREVERYPART_BEGIN operation */
 	sieve_operation_emit(cgenv->sblock,
 		cmd->ext, &foreverypart_begin_operation);
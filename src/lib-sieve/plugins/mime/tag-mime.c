@@ -222,6 +222,8 @@ static bool tag_mime_generate
 	if ( sieve_ast_argument_type(arg) != SAAT_TAG )
 		return FALSE;
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_MIME);
+
 	sieve_opr_message_override_emit
 		(cgenv->sblock, arg->argument->ext, &mime_header_override);
 
@@ -48,7 +48,8 @@ const struct sieve_command_def cmd_denotify = {
 	.registered = cmd_denotify_registered,
 	.pre_validate = cmd_denotify_pre_validate,
 	.validate = cmd_denotify_validate,
-	.generate = cmd_denotify_generate
+	.generate = cmd_denotify_generate,
+	.data_declared = TRUE
 };
 
 /*
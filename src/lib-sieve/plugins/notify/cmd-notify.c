@@ -64,7 +64,9 @@ const struct sieve_command_def cmd_notify_old = {
 	.registered = cmd_notify_registered,
 	.pre_validate = cmd_notify_pre_validate,
 	.validate = cmd_notify_validate,
-	.generate = cmd_notify_generate
+	.generate = cmd_notify_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE
 };
 
 /*
@@ -1,11 +1,122 @@
 /* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
  */
 
+#include "lib.h"
+
 #include "sieve-common.h"
+#include "sieve-settings.h"
+#include "sieve-extensions.h"
 #include "sieve-match-types.h"
 
 #include "ext-regex-common.h"
 
+/*
+ * Extension configuration
+ */
+
+bool ext_regex_load
+(const struct sieve_extension *ext, void **context)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	struct ext_regex_context *extctx;
+	const struct ext_regex_backend *backend;
+	const char *backend_name;
+	unsigned long long int cache_size;
+
+	if ( *context != NULL ) {
+		ext_regex_unload(ext);
+		*context = NULL;
+	}
+
+	backend = &ext_regex_backend_posix;
+	backend_name = sieve_setting_get(svinst, "sieve_regex_backend");
+	if ( backend_name != NULL && *backend_name != '\0' &&
+		(backend=ext_regex_backend_find(backend_name)) == NULL ) {
+		e_warning(svinst->event, "regex extension: "
+			  "regex backend `%s' is not available "
+			  "(sieve_regex_backend setting); using `%s' instead",
+			  backend_name, ext_regex_backend_posix.name);
+		backend = &ext_regex_backend_posix;
+	}
+
+	if ( !sieve_setting_get_uint_value
+		(svinst, "sieve_regex_cache_size", &cache_size) ) {
+		cache_size = EXT_REGEX_DEFAULT_CACHE_SIZE;
+	}
+
+	extctx = i_new(struct ext_regex_context, 1);
+	extctx->backend = backend;
+	if ( cache_size > 0 ) {
+		extctx->cache = mcht_regex_cache_create
+			((unsigned int)I_MIN(cache_size, UINT_MAX));
+	}
+
+	*context = (void *) extctx;
+	return TRUE;
+}
+
+void ext_regex_unload
+(const struct sieve_extension *ext)
+{
+	struct ext_regex_context *extctx =
+		(struct ext_regex_context *) ext->context;
+
+	if ( extctx == NULL )
+		return;
+
+	mcht_regex_cache_free(&extctx->cache);
+	i_free(extctx);
+}
+
+/*
+ * Regex backend
+ */
+
+static const struct ext_regex_backend *ext_regex_backends[] = {
+	&ext_regex_backend_posix,
+#ifdef HAVE_PCRE2
+	&ext_regex_backend_pcre2,
+#endif
+};
+
+const struct ext_regex_backend *ext_regex_backend_find(const char *name)
+{
+	unsigned int i;
+
+	for ( i = 0; i < N_ELEMENTS(ext_regex_backends); i++ ) {
+		if ( strcasecmp(ext_regex_backends[i]->name, name) == 0 )
+			return ext_regex_backends[i];
+	}
+	return NULL;
+}
+
+struct ext_regex *
+ext_regex_compile(const struct ext_regex_context *extctx,
+	const char *regex_str, enum ext_regex_flags flags,
+	const char **error_r)
+{
+	const struct ext_regex_backend *backend = extctx->backend;
+	struct ext_regex *regex;
+
+	regex = backend->compile(regex_str, flags, error_r);
+	if ( regex == NULL && backend != &ext_regex_backend_posix ) {
+		/* Fall back to POSIX for syntax the backend does not support */
+		regex = ext_regex_backend_posix.compile(regex_str, flags, error_r);
+	}
+	return regex;
+}
+
+void ext_regex_free(struct ext_regex **_regex)
+{
+	struct ext_regex *regex = *_regex;
+
+	*_regex = NULL;
+	if ( regex == NULL )
+		return;
+
+	regex->backend->free(regex);
+}
+
 /*
  * Regex match type operand
  */
@@ -19,4 +130,3 @@ const struct sieve_operand_def regex_match_type_operand = {
 	.class = &sieve_match_type_operand_class,
 	.interface = &ext_match_types
 };
-
@@ -1,12 +1,33 @@
 #ifndef EXT_REGEX_COMMON_H
 #define EXT_REGEX_COMMON_H
 
+#include <sys/types.h>
+#include <regex.h>
+
 /*
  * Extension
  */
 
 extern const struct sieve_extension_def regex_extension;
 
+/*
+ * Extension configuration
+ */
+
+#define EXT_REGEX_DEFAULT_CACHE_SIZE 64
+
+struct ext_regex_context {
+	/* Configured regex engine */
+	const struct ext_regex_backend *backend;
+
+	/* Compiled regular expressions for keys that are not string literals
+	   (e.g. produced by variable substitution) */
+	struct mcht_regex_cache *cache;
+};
+
+bool ext_regex_load(const struct sieve_extension *ext, void **context);
+void ext_regex_unload(const struct sieve_extension *ext);
+
 /*
  * Operand
  */
@@ -19,6 +40,67 @@ extern const struct sieve_operand_def regex_match_type_operand;
 
 extern const struct sieve_match_type_def regex_match_type;
 
+/*
+ * Regex backend
+ */
+
+enum ext_regex_flags {
+	/* Case-insensitive matching (i;ascii-casemap) */
+	EXT_REGEX_FLAG_ICASE = 0x01,
+	/* Match values (sub-expressions) are not needed */
+	EXT_REGEX_FLAG_NOSUB = 0x02,
+};
+
+struct ext_regex {
+	const struct ext_regex_backend *backend;
+};
+
+struct ext_regex_backend {
+	const char *name;
+
+	/* Returns NULL and a description of the problem in error_r when the
+	   regular expression is invalid. */
+	struct ext_regex *(*compile)
+		(const char *regex_str, enum ext_regex_flags flags,
+			const char **error_r);
+	/* Returns 1 for a match and 0 for no match. Returns -1 and an error in
+	   error_r when matching is aborted, e.g. because a resource limit is
+	   exceeded. Unused entries of pmatch[] are set to -1. */
+	int (*exec)
+		(struct ext_regex *regex, const char *val, size_t val_size,
+			size_t nmatch, regmatch_t pmatch[], const char **error_r);
+	void (*free)(struct ext_regex *regex);
+};
+
+extern const struct ext_regex_backend ext_regex_backend_posix;
+#ifdef HAVE_PCRE2
+extern const struct ext_regex_backend ext_regex_backend_pcre2;
 #endif
 
+const struct ext_regex_backend *ext_regex_backend_find(const char *name);
+
+/* Compiles the regular expression using the configured backend. Regular
+   expressions that the backend cannot handle are compiled by the POSIX
+   backend instead. */
+struct ext_regex *
+ext_regex_compile(const struct ext_regex_context *extctx,
+	const char *regex_str, enum ext_regex_flags flags,
+	const char **error_r);
+void ext_regex_free(struct ext_regex **_regex);
+
+static inline int
+ext_regex_exec(struct ext_regex *regex, const char *val, size_t val_size,
+	size_t nmatch, regmatch_t pmatch[], const char **error_r)
+{
+	return regex->backend->exec(regex, val, val_size, nmatch, pmatch,
+		error_r);
+}
 
+/*
+ * Regex cache
+ */
+
+struct mcht_regex_cache *mcht_regex_cache_create(unsigned int max_size);
+void mcht_regex_cache_free(struct mcht_regex_cache **_cache);
+
+#endif
@@ -0,0 +1,135 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+/* PCRE2 regex backend
+ */
+
+#include "lib.h"
+
+#include "sieve-common.h"
+
+#include "ext-regex-common.h"
+
+#ifdef HAVE_PCRE2
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+/* Upper bound on the work done by a single match attempt. This is what
+   keeps pathological expressions from consuming the script's CPU time
+   limit; both the JIT and the interpreter honor it. */
+#define EXT_REGEX_PCRE2_MATCH_LIMIT 1000000
+
+struct ext_regex_pcre2 {
+	struct ext_regex regex;
+
+	pcre2_code *code;
+	pcre2_match_data *match_data;
+	pcre2_match_context *match_context;
+};
+
+static const char *ext_regex_pcre2_error(int errorcode)
+{
+	PCRE2_UCHAR errbuf[256];
+
+	if ( pcre2_get_error_message(errorcode, errbuf, sizeof(errbuf)) < 0 )
+		return t_strdup_printf("PCRE2 error %d", errorcode);
+
+	/* We don't want the error to start with a capital letter */
+	errbuf[0] = i_tolower(errbuf[0]);
+	return t_strdup((const char *)errbuf);
+}
+
+static void ext_regex_pcre2_free(struct ext_regex *regex)
+{
+	struct ext_regex_pcre2 *rx = (struct ext_regex_pcre2 *) regex;
+
+	if ( rx->match_context != NULL )
+		pcre2_match_context_free(rx->match_context);
+	if ( rx->match_data != NULL )
+		pcre2_match_data_free(rx->match_data);
+	if ( rx->code != NULL )
+		pcre2_code_free(rx->code);
+	i_free(rx);
+}
+
+static struct ext_regex *ext_regex_pcre2_compile
+(const char *regex_str, enum ext_regex_flags flags, const char **error_r)
+{
+	struct ext_regex_pcre2 *rx;
+	uint32_t options;
+	PCRE2_SIZE erroffset;
+	int errorcode;
+
+	/* Like POSIX, '$' only matches at the very end of the value */
+	options = PCRE2_DOLLAR_ENDONLY;
+	if ( (flags & EXT_REGEX_FLAG_ICASE) != 0 )
+		options |= PCRE2_CASELESS;
+
+	rx = i_new(struct ext_regex_pcre2, 1);
+	rx->regex.backend = &ext_regex_backend_pcre2;
+
+	rx->code = pcre2_compile((PCRE2_SPTR)regex_str, PCRE2_ZERO_TERMINATED,
+		options, &errorcode, &erroffset, NULL);
+	if ( rx->code == NULL ) {
+		*error_r = t_strdup_printf("%s at offset %llu",
+			ext_regex_pcre2_error(errorcode),
+			(unsigned long long)erroffset);
+		ext_regex_pcre2_free(&rx->regex);
+		return NULL;
+	}
+
+	/* Failure to JIT-compile is not fatal; the interpreter is used then */
+	(void)pcre2_jit_compile(rx->code, PCRE2_JIT_COMPLETE);
+
+	rx->match_data = pcre2_match_data_create_from_pattern(rx->code, NULL);
+	rx->match_context = pcre2_match_context_create(NULL);
+	if ( rx->match_data == NULL || rx->match_context == NULL ) {
+		*error_r = "out of memory";
+		ext_regex_pcre2_free(&rx->regex);
+		return NULL;
+	}
+	pcre2_set_match_limit(rx->match_context, EXT_REGEX_PCRE2_MATCH_LIMIT);
+
+	return &rx->regex;
+}
+
+static int ext_regex_pcre2_exec
+(struct ext_regex *regex, const char *val, size_t val_size,
+	size_t nmatch, regmatch_t pmatch[], const char **error_r)
+{
+	struct ext_regex_pcre2 *rx = (struct ext_regex_pcre2 *) regex;
+	PCRE2_SIZE *ovector;
+	size_t i;
+	int ret;
+
+	ret = pcre2_match(rx->code, (PCRE2_SPTR)val, val_size, 0, 0,
+		rx->match_data, rx->match_context);
+	if ( ret == PCRE2_ERROR_NOMATCH )
+		return 0;
+	if ( ret < 0 ) {
+		*error_r = ext_regex_pcre2_error(ret);
+		return -1;
+	}
+
+	/* Convert sub-expression offsets; ret is the number of pairs set */
+	ovector = pcre2_get_ovector_pointer(rx->match_data);
+	for ( i = 0; i < nmatch; i++ ) {
+		if ( i < (size_t)ret && ovector[2*i] != PCRE2_UNSET ) {
+			pmatch[i].rm_so = (regoff_t)ovector[2*i];
+			pmatch[i].rm_eo = (regoff_t)ovector[2*i+1];
+		} else {
+			pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+		}
+	}
+	return 1;
+}
+
+const struct ext_regex_backend ext_regex_backend_pcre2 = {
+	.name = "pcre2",
+	.compile = ext_regex_pcre2_compile,
+	.exec = ext_regex_pcre2_exec,
+	.free = ext_regex_pcre2_free
+};
+
+#endif
@@ -0,0 +1,99 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+/* POSIX regex backend
+ */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+
+#include "sieve-common.h"
+
+#include "ext-regex-common.h"
+
+#include <sys/types.h>
+#include <regex.h>
+
+struct ext_regex_posix {
+	struct ext_regex regex;
+
+	regex_t regexp;
+	bool nosub:1;
+};
+
+/* Wrapper around the regerror function for easy access */
+static const char *_regexp_error(regex_t *regexp, int errorcode)
+{
+	size_t errsize = regerror(errorcode, regexp, NULL, 0);
+
+	if ( errsize > 0 ) {
+		char *errbuf;
+
+		buffer_t *error_buf =
+			buffer_create_dynamic(pool_datastack_create(), errsize);
+		errbuf = buffer_get_space_unsafe(error_buf, 0, errsize);
+
+		errsize = regerror(errorcode, regexp, errbuf, errsize);
+
+		/* We don't want the error to start with a capital letter */
+		errbuf[0] = i_tolower(errbuf[0]);
+
+		buffer_append_space_unsafe(error_buf, errsize);
+
+		return str_c(error_buf);
+	}
+
+	return "";
+}
+
+static struct ext_regex *ext_regex_posix_compile
+(const char *regex_str, enum ext_regex_flags flags, const char **error_r)
+{
+	struct ext_regex_posix *rx;
+	int cflags = REG_EXTENDED, ret;
+
+	if ( (flags & EXT_REGEX_FLAG_ICASE) != 0 )
+		cflags |= REG_ICASE;
+	if ( (flags & EXT_REGEX_FLAG_NOSUB) != 0 )
+		cflags |= REG_NOSUB;
+
+	rx = i_new(struct ext_regex_posix, 1);
+	rx->regex.backend = &ext_regex_backend_posix;
+	rx->nosub = ( (flags & EXT_REGEX_FLAG_NOSUB) != 0 );
+
+	if ( (ret=regcomp(&rx->regexp, regex_str, cflags)) != 0 ) {
+		*error_r = _regexp_error(&rx->regexp, ret);
+		i_free(rx);
+		return NULL;
+	}
+
+	return &rx->regex;
+}
+
+static int ext_regex_posix_exec
+(struct ext_regex *regex, const char *val, size_t val_size ATTR_UNUSED,
+	size_t nmatch, regmatch_t pmatch[], const char **error_r ATTR_UNUSED)
+{
+	struct ext_regex_posix *rx = (struct ext_regex_posix *) regex;
+
+	if ( rx->nosub )
+		nmatch = 0;
+
+	return ( regexec(&rx->regexp, val, nmatch, pmatch, 0) == 0 ? 1 : 0 );
+}
+
+static void ext_regex_posix_free(struct ext_regex *regex)
+{
+	struct ext_regex_posix *rx = (struct ext_regex_posix *) regex;
+
+	regfree(&rx->regexp);
+	i_free(rx);
+}
+
+const struct ext_regex_backend ext_regex_backend_posix = {
+	.name = "posix",
+	.compile = ext_regex_posix_compile,
+	.exec = ext_regex_posix_exec,
+	.free = ext_regex_posix_free
+};
@@ -12,10 +12,11 @@
  */
 
 /* FIXME: Regular expressions are compiled during compilation and
- * again during interpretation. This is suboptimal and should be
- * changed. This requires dumping the compiled regex to the binary.
- * Most likely, this will only be possible when we implement regular
- * expressions ourselves.
+ * again once the binary is loaded for interpretation. Compiled literal
+ * keys are cached for the lifetime of the loaded binary and other keys in
+ * a bounded cache for the lifetime of the Sieve instance, but dumping the
+ * compiled regex to the binary will only be possible when we implement
+ * regular expressions ourselves.
  *
  */
 
@@ -50,6 +51,8 @@ static bool ext_regex_validator_load
 
 const struct sieve_extension_def regex_extension = {
 	.name = "regex",
+	.load = ext_regex_load,
+	.unload = ext_regex_unload,
 	.validator_load = ext_regex_validator_load,
 	SIEVE_EXT_DEFINE_OPERAND(regex_match_type_operand)
 };
@@ -10,10 +10,13 @@
 #include "array.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "hash.h"
+#include "llist.h"
 
 #include "sieve-common.h"
 #include "sieve-limits.h"
 #include "sieve-ast.h"
+#include "sieve-binary.h"
 #include "sieve-stringlist.h"
 #include "sieve-commands.h"
 #include "sieve-validator.h"
@@ -60,57 +63,33 @@ const struct sieve_match_type_def regex_match_type = {
  * Match type validation
  */
 
-/* Wrapper around the regerror function for easy access */
-static const char *_regexp_error(regex_t *regexp, int errorcode)
-{
-	size_t errsize = regerror(errorcode, regexp, NULL, 0);
-
-	if ( errsize > 0 ) {
-		char *errbuf;
-
-		buffer_t *error_buf =
-			buffer_create_dynamic(pool_datastack_create(), errsize);
-		errbuf = buffer_get_space_unsafe(error_buf, 0, errsize);
-
-		errsize = regerror(errorcode, regexp, errbuf, errsize);
-
-		/* We don't want the error to start with a capital letter */
-		errbuf[0] = i_tolower(errbuf[0]);
-
-		buffer_append_space_unsafe(error_buf, errsize);
-
-		return str_c(error_buf);
-	}
-
-	return "";
-}
-
 static int mcht_regex_validate_regexp
 (struct sieve_validator *valdtr,
-	struct sieve_match_type_context *mtctx ATTR_UNUSED,
-	struct sieve_ast_argument *key, int cflags)
+	struct sieve_match_type_context *mtctx,
+	struct sieve_ast_argument *key, enum ext_regex_flags flags)
 {
-	int ret;
-	regex_t regexp;
+	const struct sieve_extension *this_ext = mtctx->match_type->object.ext;
+	const struct ext_regex_context *extctx =
+		(const struct ext_regex_context *) this_ext->context;
+	struct ext_regex *regex;
 	const char *regex_str = sieve_ast_argument_strc(key);
+	const char *error;
 
-	if ( (ret=regcomp(&regexp, regex_str, cflags)) != 0 ) {
+	if ( (regex=ext_regex_compile(extctx, regex_str, flags, &error)) == NULL ) {
 		sieve_argument_validate_error(valdtr, key,
 			"invalid regular expression '%s' for regex match: %s",
-			str_sanitize(regex_str, 128), _regexp_error(&regexp, ret));
-
-		regfree(&regexp);
+			str_sanitize(regex_str, 128), error);
 		return -1;
 	}
 
-	regfree(&regexp);
+	ext_regex_free(&regex);
 	return 1;
 }
 
 struct _regex_key_context {
 	struct sieve_validator *valdtr;
 	struct sieve_match_type_context *mtctx;
-	int cflags;
+	enum ext_regex_flags flags;
 };
 
 static int mcht_regex_validate_key_argument
@@ -123,7 +102,7 @@ static int mcht_regex_validate_key_argument
 	 */
 	if ( sieve_argument_is_string_literal(key) ) {
 		return mcht_regex_validate_regexp
-			(keyctx->valdtr, keyctx->mtctx, key, keyctx->cflags);
+			(keyctx->valdtr, keyctx->mtctx, key, keyctx->flags);
 	}
 
 	return 1;
@@ -134,15 +113,15 @@ static bool mcht_regex_validate_context
 	struct sieve_match_type_context *mtctx, struct sieve_ast_argument *key_arg)
 {
 	const struct sieve_comparator *cmp = mtctx->comparator;
-	int cflags = REG_EXTENDED | REG_NOSUB;
+	enum ext_regex_flags flags = EXT_REGEX_FLAG_NOSUB;
 	struct _regex_key_context keyctx;
 	struct sieve_ast_argument *kitem;
 
 	if ( cmp != NULL ) {
 		if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) )
-			cflags =  REG_EXTENDED | REG_NOSUB | REG_ICASE;
+			flags =  EXT_REGEX_FLAG_NOSUB | EXT_REGEX_FLAG_ICASE;
 		else if ( sieve_comparator_is(cmp, i_octet_comparator) )
-			cflags =  REG_EXTENDED | REG_NOSUB;
+			flags =  EXT_REGEX_FLAG_NOSUB;
 		else {
 			sieve_argument_validate_error(valdtr, mtctx->argument,
 				"regex match type only supports "
@@ -155,7 +134,7 @@ static bool mcht_regex_validate_context
 
 	keyctx.valdtr = valdtr;
 	keyctx.mtctx = mtctx;
-	keyctx.cflags = cflags;
+	keyctx.flags = flags;
 
 	kitem = key_arg;
 	if ( sieve_ast_stringlist_map(&kitem, (void *) &keyctx,
@@ -166,18 +145,362 @@ static bool mcht_regex_validate_context
 }
 
 /*
- * Match type implementation
+ * Compiled regular expressions
  */
 
 struct mcht_regex_key {
-	regex_t regexp;
+	int refcount;
+
+	struct ext_regex *regex;
 	int status;
+	char *error;
+
+	/* Cache entry; most recently used first */
+	struct mcht_regex_cache *cache;
+	struct mcht_regex_key *prev, *next;
+
+	char *regex_str;
+	enum ext_regex_flags flags;
+};
+
+static int mcht_regex_get_flags
+(const struct sieve_comparator *cmp, bool match_values,
+	enum ext_regex_flags *flags_r)
+{
+	enum ext_regex_flags flags;
+
+	/* Configure case-sensitivity according to comparator */
+	if ( sieve_comparator_is(cmp, i_octet_comparator) )
+		flags = 0;
+	else if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) )
+		flags = EXT_REGEX_FLAG_ICASE;
+	else
+		return -1; /* Not supported */
+
+	/* Indicate whether match values need to be produced */
+	if ( !match_values ) flags |= EXT_REGEX_FLAG_NOSUB;
+
+	*flags_r = flags;
+	return 0;
+}
+
+static const char *mcht_regex_key_compile
+(const struct ext_regex_context *extctx, struct mcht_regex_key *rkey,
+	const char *regex_str, enum ext_regex_flags flags)
+{
+	const char *error;
+
+	/* Compile regular expression */
+	rkey->regex = ext_regex_compile(extctx, regex_str, flags, &error);
+	if ( rkey->regex == NULL ) {
+		rkey->status = -1;
+		return t_strdup_printf(
+			"invalid regular expression '%s' for regex match: %s",
+			str_sanitize(regex_str, 128), error);
+	}
+
+	rkey->status = 1;
+	return NULL;
+}
+
+static void mcht_regex_key_free_regex(struct mcht_regex_key *rkey)
+{
+	ext_regex_free(&rkey->regex);
+	rkey->status = 0;
+}
+
+static void mcht_regex_key_unref(struct mcht_regex_key **_rkey)
+{
+	struct mcht_regex_key *rkey = *_rkey;
+
+	*_rkey = NULL;
+
+	i_assert( rkey->refcount > 0 );
+	if ( --rkey->refcount > 0 )
+		return;
+
+	mcht_regex_key_free_regex(rkey);
+	i_free(rkey->regex_str);
+	i_free(rkey->error);
+	i_free(rkey);
+}
+
+/*
+ * Regex cache
+ */
+
+/* Bounded LRU cache of regular expressions compiled for keys that are not
+ * string literals. It lives as long as the Sieve instance, so that a
+ * long-running process compiles each such regex only once. Entries are
+ * reference counted, because evicted entries may still be in use by a
+ * match context.
+ */
+
+struct mcht_regex_cache {
+	HASH_TABLE(const struct mcht_regex_key *, struct mcht_regex_key *) keys;
+	struct mcht_regex_key *head, *tail;
+
+	unsigned int size, max_size;
+};
+
+static unsigned int mcht_regex_cache_key_hash
+(const struct mcht_regex_key *rkey)
+{
+	return str_hash(rkey->regex_str) ^ (unsigned int)rkey->flags;
+}
+
+static int mcht_regex_cache_key_cmp
+(const struct mcht_regex_key *rkey1, const struct mcht_regex_key *rkey2)
+{
+	if ( rkey1->flags != rkey2->flags )
+		return ( rkey1->flags < rkey2->flags ? -1 : 1 );
+	return strcmp(rkey1->regex_str, rkey2->regex_str);
+}
+
+struct mcht_regex_cache *mcht_regex_cache_create(unsigned int max_size)
+{
+	struct mcht_regex_cache *cache;
+
+	cache = i_new(struct mcht_regex_cache, 1);
+	cache->max_size = max_size;
+	hash_table_create(&cache->keys, default_pool, 0,
+		mcht_regex_cache_key_hash, mcht_regex_cache_key_cmp);
+	return cache;
+}
+
+static void mcht_regex_cache_remove
+(struct mcht_regex_cache *cache, struct mcht_regex_key *rkey)
+{
+	i_assert( rkey->cache == cache );
+
+	hash_table_remove(cache->keys, rkey);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, rkey);
+	cache->size--;
+
+	rkey->cache = NULL;
+	mcht_regex_key_unref(&rkey);
+}
+
+void mcht_regex_cache_free(struct mcht_regex_cache **_cache)
+{
+	struct mcht_regex_cache *cache = *_cache;
+
+	*_cache = NULL;
+	if ( cache == NULL )
+		return;
+
+	while ( cache->head != NULL )
+		mcht_regex_cache_remove(cache, cache->head);
+	hash_table_destroy(&cache->keys);
+	i_free(cache);
+}
+
+static struct mcht_regex_key *mcht_regex_key_get
+(const struct ext_regex_context *extctx, const char *regex_str,
+	enum ext_regex_flags flags)
+{
+	struct mcht_regex_cache *cache = extctx->cache;
+	struct mcht_regex_key lookup_key, *rkey;
+	const char *error;
+
+	if ( cache != NULL ) {
+		i_zero(&lookup_key);
+		lookup_key.regex_str = (char *)regex_str;
+		lookup_key.flags = flags;
+
+		rkey = hash_table_lookup(cache->keys, &lookup_key);
+		if ( rkey != NULL ) {
+			/* Mark as most recently used */
+			DLLIST2_REMOVE(&cache->head, &cache->tail, rkey);
+			DLLIST2_PREPEND(&cache->head, &cache->tail, rkey);
+			rkey->refcount++;
+			return rkey;
+		}
+	}
+
+	rkey = i_new(struct mcht_regex_key, 1);
+	rkey->refcount = 1;
+	rkey->regex_str = i_strdup(regex_str);
+	rkey->flags = flags;
+	error = mcht_regex_key_compile(extctx, rkey, regex_str, flags);
+	if ( error != NULL )
+		rkey->error = i_strdup(error);
+
+	if ( cache == NULL )
+		return rkey;
+
+	/* Evict least recently used entries */
+	while ( cache->size >= cache->max_size && cache->tail != NULL )
+		mcht_regex_cache_remove(cache, cache->tail);
+
+	rkey->cache = cache;
+	rkey->refcount++;
+	hash_table_insert(cache->keys, rkey, rkey);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, rkey);
+	cache->size++;
+	return rkey;
+}
+
+/*
+ * Binary context
+ */
+
+/* Regular expressions for key lists that consist only of string literals
+ * are compiled once and kept for the lifetime of the loaded binary.
+ */
+
+struct mcht_regex_key_list {
+	struct mcht_regex_key *keys;
+	unsigned int count;
 };
 
+struct mcht_regex_key_list_cache {
+	/* Indexed by whether match values are produced */
+	struct mcht_regex_key_list *key_lists[2];
+};
+
+struct mcht_regex_binary_context {
+	ARRAY(struct mcht_regex_key_list *) key_lists;
+};
+
+static void mcht_regex_binary_free
+(const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_binary *sbin ATTR_UNUSED, void *context)
+{
+	struct mcht_regex_binary_context *bctx =
+		(struct mcht_regex_binary_context *) context;
+	struct mcht_regex_key_list *const *key_lists;
+	unsigned int count, i, j;
+
+	key_lists = array_get(&bctx->key_lists, &count);
+	for ( i = 0; i < count; i++ ) {
+		for ( j = 0; j < key_lists[i]->count; j++ )
+			mcht_regex_key_free_regex(&key_lists[i]->keys[j]);
+	}
+}
+
+static const struct sieve_binary_extension regex_binary_ext = {
+	.extension = &regex_extension,
+	.binary_free = mcht_regex_binary_free
+};
+
+static struct mcht_regex_binary_context *mcht_regex_binary_context_get
+(const struct sieve_extension *ext, struct sieve_binary *sbin)
+{
+	struct mcht_regex_binary_context *bctx;
+
+	bctx = (struct mcht_regex_binary_context *)
+		sieve_binary_extension_get_context(sbin, ext);
+	if ( bctx == NULL ) {
+		pool_t pool = sieve_binary_pool(sbin);
+
+		bctx = p_new(pool, struct mcht_regex_binary_context, 1);
+		p_array_init(&bctx->key_lists, pool, 4);
+
+		sieve_binary_extension_set(sbin, ext, &regex_binary_ext, bctx);
+	}
+	return bctx;
+}
+
+static int mcht_regex_key_list_compile
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	pool_t pool, bool match_values, struct mcht_regex_key_list **rkl_r)
+{
+	const struct sieve_runtime_env *renv = mctx->runenv;
+	struct mcht_regex_binary_context *bctx;
+	struct mcht_regex_key_list *rkl;
+	ARRAY(struct mcht_regex_key) keys;
+	string_t *key_item = NULL;
+	const struct sieve_extension *this_ext = mctx->match_type->object.ext;
+	const struct ext_regex_context *extctx =
+		(const struct ext_regex_context *) this_ext->context;
+	enum ext_regex_flags flags = 0;
+	int ret;
+	bool supported;
+
+	supported = ( mcht_regex_get_flags
+		(mctx->comparator, match_values, &flags) == 0 );
+
+	p_array_init(&keys, pool, 16);
+
+	sieve_stringlist_reset(key_list);
+	while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+		struct mcht_regex_key *rkey = array_append_space(&keys);
+
+		rkey->status = -1;
+		if ( supported ) {
+			const char *error = mcht_regex_key_compile
+				(extctx, rkey, str_c(key_item), flags);
+
+			if ( error != NULL )
+				sieve_runtime_error(renv, NULL, "%s", error);
+		}
+	}
+
+	rkl = p_new(pool, struct mcht_regex_key_list, 1);
+	rkl->keys = array_get_modifiable(&keys, &rkl->count);
+
+	/* Registered even when incomplete, so that it is cleaned up */
+	bctx = mcht_regex_binary_context_get
+		(mctx->match_type->object.ext, renv->sbin);
+	array_append(&bctx->key_lists, &rkl, 1);
+
+	if ( ret < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		return -1;
+	}
+
+	*rkl_r = rkl;
+	return 0;
+}
+
+static int mcht_regex_key_list_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	bool match_values, const struct mcht_regex_key_list **rkl_r)
+{
+	struct mcht_regex_key_list_cache *klcache;
+	struct mcht_regex_key_list **rkl;
+	void **cached;
+	pool_t pool;
+	int ret = 0;
+
+	*rkl_r = NULL;
+
+	if ( !sieve_match_key_list_cache_lookup(mctx, key_list, &cached, &pool) )
+		return 0;
+
+	if ( *cached == NULL )
+		*cached = p_new(pool, struct mcht_regex_key_list_cache, 1);
+	klcache = (struct mcht_regex_key_list_cache *) *cached;
+
+	rkl = &klcache->key_lists[match_values ? 0 : 1];
+	if ( *rkl == NULL ) {
+		T_BEGIN {
+			ret = mcht_regex_key_list_compile
+				(mctx, key_list, pool, match_values, rkl);
+		} T_END;
+		if ( ret < 0 )
+			return -1;
+	}
+
+	*rkl_r = *rkl;
+	return 0;
+}
+
+/*
+ * Match type implementation
+ */
+
 struct mcht_regex_context {
-	ARRAY(struct mcht_regex_key) reg_expressions;
+	/* Keys compiled for the binary */
+	const struct mcht_regex_key_list *key_list;
+
+	/* Keys compiled during this match */
+	ARRAY(struct mcht_regex_key *) reg_expressions;
+
 	regmatch_t *pmatch;
 	size_t nmatch;
+	bool key_list_checked:1;
 	bool all_compiled:1;
 };
 
@@ -186,14 +509,21 @@ static void mcht_regex_match_init
 {
 	pool_t pool = mctx->pool;
 	struct mcht_regex_context *ctx;
+	unsigned int needed;
 
 	/* Create context */
 	ctx = p_new(pool, struct mcht_regex_context, 1);
 
-	/* Create storage for match values if match values are requested */
-	if ( sieve_match_values_are_enabled(mctx->runenv) ) {
-		ctx->pmatch = p_new(pool, regmatch_t, MCHT_REGEX_MAX_SUBSTITUTIONS);
-		ctx->nmatch = MCHT_REGEX_MAX_SUBSTITUTIONS;
+	/* Create storage for match values if match values are requested. Only
+	 * the leading substitutions up to the highest one that the script reads
+	 * are extracted by the regex engine.
+	 */
+	needed = sieve_match_values_get_needed(mctx->runenv);
+	if ( needed > MCHT_REGEX_MAX_SUBSTITUTIONS )
+		needed = MCHT_REGEX_MAX_SUBSTITUTIONS;
+	if ( needed > 0 ) {
+		ctx->pmatch = p_new(pool, regmatch_t, needed);
+		ctx->nmatch = needed;
 	} else {
 		ctx->pmatch = NULL;
 		ctx->nmatch = 0;
@@ -204,24 +534,31 @@ static void mcht_regex_match_init
 }
 
 static int mcht_regex_match_key
-(struct sieve_match_context *mctx, const char *val,
-	const regex_t *regexp)
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	struct ext_regex *regex)
 {
 	struct mcht_regex_context *ctx = (struct mcht_regex_context *) mctx->data;
+	const char *error;
 	int ret;
 
 	/* Execute regex */
 
-	ret = regexec(regexp, val, ctx->nmatch, ctx->pmatch, 0);
+	ret = ext_regex_exec
+		(regex, val, val_size, ctx->nmatch, ctx->pmatch, &error);
+	if ( ret < 0 ) {
+		/* Treat as no match; the script should not fail on this */
+		sieve_runtime_warning(mctx->runenv, NULL,
+			"regex match aborted: %s", error);
+		return 0;
+	}
 
 	/* Handle match values if necessary */
 
-	if ( ret == 0 ) {
+	if ( ret > 0 ) {
 		if ( ctx->nmatch > 0 ) {
 			struct sieve_match_values *mvalues;
 			size_t i;
 			int skipped = 0;
-			string_t *subst = t_str_new(32);
 
 			/* Start new list of match values */
 			mvalues = sieve_match_values_start(mctx->runenv);
@@ -230,17 +567,15 @@ static int mcht_regex_match_key
 
 			/* Add match values from regular expression */
 			for ( i = 0; i < ctx->nmatch; i++ ) {
-				str_truncate(subst, 0);
-
 				if ( ctx->pmatch[i].rm_so != -1 ) {
 					if ( skipped > 0 ) {
 						sieve_match_values_skip(mvalues, skipped);
 						skipped = 0;
 					}
 
-					str_append_data(subst, val + ctx->pmatch[i].rm_so,
+					sieve_match_values_add_data(mvalues,
+						val + ctx->pmatch[i].rm_so,
 						ctx->pmatch[i].rm_eo - ctx->pmatch[i].rm_so);
-					sieve_match_values_add(mvalues, subst);
 				} else
 					skipped++;
 			}
@@ -255,17 +590,56 @@ static int mcht_regex_match_key
 	return 0;
 }
 
+static int mcht_regex_match_compiled_key
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	const struct mcht_regex_key *rkey, unsigned int id)
+{
+	const struct sieve_runtime_env *renv = mctx->runenv;
+	int match;
+
+	if ( rkey == NULL || rkey->status <= 0 )
+		return 0;
+
+	match = mcht_regex_match_key(mctx, val, val_size, rkey->regex);
+
+	if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_MATCHING) ) {
+		sieve_runtime_trace(renv, 0,
+			"with compiled regex [id=%d] => %d", id, match);
+	}
+	return match;
+}
+
 static int mcht_regex_match_keys
-(struct sieve_match_context *mctx, const char *val, size_t val_size ATTR_UNUSED,
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
 	struct sieve_stringlist *key_list)
 {
 	const struct sieve_runtime_env *renv = mctx->runenv;
+	const struct sieve_extension *this_ext = mctx->match_type->object.ext;
+	struct ext_regex_context *extctx =
+		(struct ext_regex_context *) this_ext->context;
 	bool trace = sieve_runtime_trace_active(renv, SIEVE_TRLVL_MATCHING);
 	struct mcht_regex_context *ctx = (struct mcht_regex_context *) mctx->data;
 	const struct sieve_comparator *cmp = mctx->comparator;
 	int match;
 
-	if ( !ctx->all_compiled ) {
+	if ( !ctx->key_list_checked ) {
+		/* Literal keys are compiled once for the binary */
+		if ( mcht_regex_key_list_get
+			(mctx, key_list, ctx->nmatch > 0, &ctx->key_list) < 0 )
+			return -1;
+		ctx->key_list_checked = TRUE;
+	}
+
+	if ( ctx->key_list != NULL ) {
+		const struct mcht_regex_key_list *rkl = ctx->key_list;
+		unsigned int i;
+
+		match = 0;
+		for ( i = 0; match == 0 && i < rkl->count; i++ )
+			match = mcht_regex_match_compiled_key
+				(mctx, val, val_size, &rkl->keys[i], i);
+
+	} else if ( !ctx->all_compiled ) {
 		string_t *key_item = NULL;
 		unsigned int i;
 		int ret;
@@ -281,51 +655,37 @@ static int mcht_regex_match_keys
 			(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
 
 			T_BEGIN {
-				struct mcht_regex_key *rkey;
+				struct mcht_regex_key *rkey = NULL;
 
 				if ( i >= array_count(&ctx->reg_expressions) ) {
-					int cflags;
-
-					rkey = array_append_space(&ctx->reg_expressions);
-
-					/* Configure case-sensitivity according to comparator */
-					if ( sieve_comparator_is(cmp, i_octet_comparator) )
-						cflags =  REG_EXTENDED;
-					else if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) )
-						cflags =  REG_EXTENDED | REG_ICASE;
-					else
-						rkey->status = -1; /* Not supported */
-
-					if ( rkey->status >= 0 ) {
-						const char *regex_str = str_c(key_item);
-						int rxret;
+					enum ext_regex_flags flags;
 
-						/* Indicate whether match values need to be produced */
-						if ( ctx->nmatch == 0 ) cflags |= REG_NOSUB;
-
-						/* Compile regular expression */
-						if ( (rxret=regcomp(&rkey->regexp, regex_str, cflags)) != 0 ) {
+					if ( mcht_regex_get_flags
+						(cmp, ctx->nmatch > 0, &flags) == 0 ) {
+						rkey = mcht_regex_key_get
+							(extctx, str_c(key_item), flags);
+						if ( rkey->error != NULL ) {
 							sieve_runtime_error(renv, NULL,
-								"invalid regular expression '%s' for regex match: %s",
-								str_sanitize(regex_str, 128),
-								_regexp_error(&rkey->regexp, rxret));
-							rkey->status = -1;
-						} else {
-							rkey->status = 1;
+								"%s", rkey->error);
 						}
 					}
+					array_append(&ctx->reg_expressions, &rkey, 1);
 				} else {
-					rkey = array_idx_modifiable(&ctx->reg_expressions, 1);
+					struct mcht_regex_key *const *rkeyp =
+						array_idx(&ctx->reg_expressions, i);
+
+					rkey = *rkeyp;
 				}
 
-				if ( rkey->status > 0 ) {
-					match = mcht_regex_match_key(mctx, val, &rkey->regexp);
+				if ( rkey != NULL && rkey->status > 0 ) {
+					match = mcht_regex_match_key
+						(mctx, val, val_size, rkey->regex);
 
 					if ( trace ) {
 						sieve_runtime_trace(renv, 0,
 							"with regex `%s' [id=%d] => %d",
 							str_sanitize(str_c(key_item), 80),
-							array_count(&ctx->reg_expressions)-1, match);
+							i, match);
 					}
 				}
 			} T_END;
@@ -341,27 +701,17 @@ static int mcht_regex_match_keys
 		}
 
 	} else {
-		const struct mcht_regex_key *rkeys;
+		struct mcht_regex_key *const *rkeys;
 		unsigned int i, count;
 
 		/* Regular expressions are compiled */
 
 		rkeys = array_get(&ctx->reg_expressions, &count);
 
-		i = 0;
 		match = 0;
-		while ( match == 0 && i < count ) {
-			if ( rkeys[i].status > 0 ) {
-				match = mcht_regex_match_key(mctx, val, &rkeys[i].regexp);
-
-				if ( trace ) {
-					sieve_runtime_trace(renv, 0,
-						"with compiled regex [id=%d] => %d", i, match);
-				}
-			}
-
-			i++;
-		}
+		for ( i = 0; match == 0 && i < count; i++ )
+			match = mcht_regex_match_compiled_key
+				(mctx, val, val_size, rkeys[i], i);
 	}
 
 	return match;
@@ -371,15 +721,15 @@ void mcht_regex_match_deinit
 (struct sieve_match_context *mctx)
 {
 	struct mcht_regex_context *ctx = (struct mcht_regex_context *) mctx->data;
-	struct mcht_regex_key *rkeys;
+	struct mcht_regex_key **rkeys;
 	unsigned int count, i;
 
-	/* Clean up compiled regular expressions */
+	/* Release compiled regular expressions */
 	if ( array_is_created(&ctx->reg_expressions) ) {
 		rkeys = array_get_modifiable(&ctx->reg_expressions, &count);
 		for ( i = 0; i < count; i++ ) {
-			regfree(&rkeys[i].regexp);
+			if ( rkeys[i] != NULL )
+				mcht_regex_key_unref(&rkeys[i]);
 		}
 	}
 }
-
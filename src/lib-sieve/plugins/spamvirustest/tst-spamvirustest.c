@@ -46,7 +46,8 @@ const struct sieve_command_def spamtest_test = {
 	.block_required = FALSE,
 	.registered = tst_spamvirustest_registered,
 	.validate = tst_spamvirustest_validate,
-	.generate = tst_spamvirustest_generate
+	.generate = tst_spamvirustest_generate,
+	.data_declared = TRUE
 };
 
 /* Virustest test
@@ -64,7 +65,8 @@ const struct sieve_command_def virustest_test = {
 	.block_required = FALSE,
 	.registered = tst_spamvirustest_registered,
 	.validate = tst_spamvirustest_validate,
-	.generate = tst_spamvirustest_generate
+	.generate = tst_spamvirustest_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -191,6 +193,9 @@ static bool tst_spamvirustest_generate
 	else
 		i_unreached();
 
+	/* The tested header fields are configured at runtime */
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_ANY_HEADER);
+
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
@@ -43,6 +43,7 @@ const struct sieve_command_def specialuse_exists_test = {
 	.block_required = FALSE,
 	.validate = tst_specialuse_exists_validate,
 	.generate = tst_specialuse_exists_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -197,6 +198,8 @@ tst_specialuse_exists_generate(const struct sieve_codegen_env *cgenv,
 	sieve_operation_emit(cgenv->sblock,
 		tst->ext, &specialuse_exists_operation);
 
+	sieve_generate_require_data(cgenv, SIEVE_BINARY_DATA_FLAG_MAILBOX);
+
 	/* Generate arguments */
 	arg2 = sieve_ast_argument_next(arg);
 	if (arg2 != NULL) {
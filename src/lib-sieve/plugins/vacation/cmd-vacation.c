@@ -80,6 +80,8 @@ const struct sieve_command_def vacation_command = {
 	.pre_validate = cmd_vacation_pre_validate,
 	.validate = cmd_vacation_validate,
 	.generate = cmd_vacation_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAG_ANY_HEADER,
+	.data_declared = TRUE,
 };
 
 /*
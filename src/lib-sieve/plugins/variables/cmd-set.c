@@ -45,6 +45,7 @@ const struct sieve_command_def cmd_set = {
 	.registered = cmd_set_registered,
 	.validate = cmd_set_validate,
 	.generate = cmd_set_generate,
+	.data_declared = TRUE,
 };
 
 /*
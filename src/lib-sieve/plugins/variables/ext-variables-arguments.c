@@ -141,6 +141,9 @@ static struct sieve_ast_argument *ext_variables_match_value_argument_create
 		return NULL;
   }
 
+	/* Record that the match value is read */
+	ext_variables_ast_reference_match_value(this_ext, ast, index);
+
 	return new_arg;
 }
 
@@ -370,6 +373,10 @@ static bool _sieve_variable_argument_activate
 				/* Match value */
 				result = ext_variables_match_value_argument_activate
 					(this_ext, valdtr, arg, cur_element->num_variable, assignment);
+				if ( result ) {
+					ext_variables_ast_reference_match_value
+						(var_ext, arg->ast, cur_element->num_variable);
+				}
 			}
 
 		} else {
@@ -8,6 +8,7 @@
 
 #include "sieve-common.h"
 #include "sieve-settings.h"
+#include "sieve-limits.h"
 
 #include "sieve-ast.h"
 #include "sieve-binary.h"
@@ -528,6 +529,16 @@ sieve_variable_storage_create(const struct sieve_extension *var_ext,
 	return storage;
 }
 
+void sieve_variable_storage_clear(struct sieve_variable_storage *storage)
+{
+	string_t *value;
+
+	array_foreach_elem(&storage->var_values, value) {
+		if (value != NULL)
+			str_truncate(value, 0);
+	}
+}
+
 static inline bool
 sieve_variable_valid(struct sieve_variable_storage *storage,
 		     unsigned int index)
@@ -662,15 +673,22 @@ bool sieve_variable_assign_cstr(struct sieve_variable_storage *storage,
  * AST Context
  */
 
+struct ext_variables_ast_context {
+	struct sieve_variable_scope *local_scope;
+
+	/* Bit i is set when match value ${i} is read somewhere in the script */
+	uint32_t match_values;
+};
+
 static void
 ext_variables_ast_free(const struct sieve_extension *ext ATTR_UNUSED,
 		       struct sieve_ast *ast ATTR_UNUSED, void *context)
 {
-	struct sieve_variable_scope *local_scope =
-		(struct sieve_variable_scope *)context;
+	struct ext_variables_ast_context *actx =
+		(struct ext_variables_ast_context *)context;
 
 	/* Unreference main variable scope */
-	sieve_variable_scope_unref(&local_scope);
+	sieve_variable_scope_unref(&actx->local_scope);
 }
 
 static const struct sieve_ast_extension variables_ast_extension = {
@@ -682,24 +700,35 @@ static struct sieve_variable_scope *
 ext_variables_create_local_scope(const struct sieve_extension *this_ext,
 				 struct sieve_ast *ast)
 {
-	struct sieve_variable_scope *scope;
+	struct ext_variables_ast_context *actx;
 
-	scope = sieve_variable_scope_create(this_ext->svinst, this_ext, NULL);
+	actx = p_new(sieve_ast_pool(ast), struct ext_variables_ast_context, 1);
+	actx->local_scope =
+		sieve_variable_scope_create(this_ext->svinst, this_ext, NULL);
 
 	sieve_ast_extension_register(ast, this_ext, &variables_ast_extension,
-				     (void *)scope);
-	return scope;
+				     (void *)actx);
+	return actx->local_scope;
 }
 
-static struct sieve_variable_scope *
-ext_variables_ast_get_local_scope(const struct sieve_extension *this_ext,
-				  struct sieve_ast *ast)
+static struct ext_variables_ast_context *
+ext_variables_ast_get_context(const struct sieve_extension *this_ext,
+			      struct sieve_ast *ast)
 {
-	struct sieve_variable_scope *local_scope =
-		(struct sieve_variable_scope *)
-			sieve_ast_extension_get_context(ast, this_ext);
+	return (struct ext_variables_ast_context *)
+		sieve_ast_extension_get_context(ast, this_ext);
+}
 
-	return local_scope;
+void ext_variables_ast_reference_match_value(
+	const struct sieve_extension *this_ext, struct sieve_ast *ast,
+	unsigned int index)
+{
+	struct ext_variables_ast_context *actx =
+		ext_variables_ast_get_context(this_ext, ast);
+
+	/* Values beyond the limit are never captured */
+	if (actx != NULL && index < SIEVE_MAX_MATCH_VALUES)
+		actx->match_values |= (1U << index);
 }
 
 /*
@@ -798,8 +827,9 @@ bool sieve_ext_variables_is_active(const struct sieve_extension *var_ext,
 bool ext_variables_generator_load(const struct sieve_extension *ext,
 				  const struct sieve_codegen_env *cgenv)
 {
-	struct sieve_variable_scope *local_scope =
-		ext_variables_ast_get_local_scope(ext, cgenv->ast);
+	struct ext_variables_ast_context *actx =
+		ext_variables_ast_get_context(ext, cgenv->ast);
+	struct sieve_variable_scope *local_scope = actx->local_scope;
 	unsigned int count = sieve_variable_scope_size(local_scope);
 	sieve_size_t jump;
 
@@ -819,6 +849,9 @@ bool ext_variables_generator_load(const struct sieve_extension *ext,
 	}
 
 	sieve_binary_resolve_offset(cgenv->sblock, jump);
+
+	/* Match values that are read later in the program */
+	sieve_binary_emit_unsigned(cgenv->sblock, actx->match_values);
 	return TRUE;
 }
 
@@ -847,10 +880,27 @@ ext_variables_interpreter_free(const struct sieve_extension *ext ATTR_UNUSED,
 	sieve_variable_scope_binary_unref(&ctx->local_scope_bin);
 }
 
+static void
+ext_variables_interpreter_reset(const struct sieve_extension *ext ATTR_UNUSED,
+				struct sieve_interpreter *interp ATTR_UNUSED,
+				void *context)
+{
+	struct ext_variables_interpreter_context *ctx =
+		(struct ext_variables_interpreter_context *)context;
+	struct sieve_variable_storage *storage;
+
+	sieve_variable_storage_clear(ctx->local_storage);
+	array_foreach_elem(&ctx->ext_storages, storage) {
+		if (storage != NULL)
+			sieve_variable_storage_clear(storage);
+	}
+}
+
 static struct sieve_interpreter_extension
 variables_interpreter_extension = {
 	.ext_def = &variables_extension,
-	.free = ext_variables_interpreter_free
+	.free = ext_variables_interpreter_free,
+	.reset = ext_variables_interpreter_reset
 };
 
 static struct ext_variables_interpreter_context *
@@ -883,18 +933,31 @@ bool ext_variables_interpreter_load(const struct sieve_extension *ext,
 {
 	const struct sieve_execute_env *eenv = renv->exec_env;
 	struct sieve_variable_scope_binary *scpbin;
+	unsigned int match_values;
 
 	scpbin = sieve_variable_scope_binary_read(eenv->svinst, ext, NULL,
 						  renv->sblock, address);
 	if (scpbin == NULL)
 		return FALSE;
 
+	if (!sieve_binary_read_unsigned(renv->sblock, address,
+					&match_values)) {
+		e_error(eenv->svinst->event, "variables: "
+			"failed to read referenced match values");
+		sieve_variable_scope_binary_unref(&scpbin);
+		return FALSE;
+	}
+
 	/* Create our context */
 	(void)ext_variables_interpreter_context_create(ext, renv->interp,
 						       scpbin);
 
-	/* Enable support for match values */
-	(void)sieve_match_values_set_enabled(renv, TRUE);
+	/* Enable support for match values, but only capture those that the
+	   script actually reads */
+	if (match_values != 0) {
+		(void)sieve_match_values_set_enabled(renv, TRUE);
+		sieve_match_values_set_referenced(renv, match_values);
+	}
 
 	return TRUE;
 }
@@ -84,6 +84,14 @@ ext_variables_validator_declare_variable(const struct sieve_extension *this_ext,
 					 struct sieve_validator *validator,
 					 const char *variable);
 
+/*
+ * AST context
+ */
+
+void ext_variables_ast_reference_match_value(
+	const struct sieve_extension *this_ext, struct sieve_ast *ast,
+	unsigned int index);
+
 /*
  * Code generation
  */
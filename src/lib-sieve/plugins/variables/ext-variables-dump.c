@@ -5,6 +5,7 @@
 #include "str.h"
 
 #include "sieve-common.h"
+#include "sieve-limits.h"
 #include "sieve-dump.h"
 #include "sieve-binary.h"
 #include "sieve-code.h"
@@ -76,9 +77,27 @@ bool ext_variables_code_dump
 {
 	struct ext_variables_dump_context *dctx;
 	struct sieve_variable_scope *local_scope;
+	unsigned int match_values, i;
+	string_t *mvstr;
 
 	local_scope = sieve_variable_scope_binary_dump
 		(ext->svinst, ext, NULL, denv, address);
+	if ( local_scope == NULL )
+		return FALSE;
+
+	sieve_code_mark(denv);
+	if ( !sieve_binary_read_unsigned(denv->sblock, address, &match_values) ) {
+		sieve_variable_scope_unref(&local_scope);
+		return FALSE;
+	}
+
+	mvstr = t_str_new(64);
+	for ( i = 0; i < SIEVE_MAX_MATCH_VALUES; i++ ) {
+		if ( (match_values & (1U << i)) != 0 )
+			str_printfa(mvstr, " ${%u}", i);
+	}
+	sieve_code_dumpf(denv, "MATCH VALUES:%s",
+		( str_len(mvstr) > 0 ? str_c(mvstr) : " (none)" ));
 
 	dctx = ext_variables_dump_get_context(ext, denv);
 	dctx->local_scope = local_scope;
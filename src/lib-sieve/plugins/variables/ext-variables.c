@@ -58,6 +58,7 @@ static bool ext_variables_validator_load
 
 const struct sieve_extension_def variables_extension = {
 	.name = "variables",
+	.version = 1,
 	.load = ext_variables_load,
 	.unload = ext_variables_unload,
 	.validator_load = ext_variables_validator_load,
@@ -190,6 +190,9 @@ struct sieve_variable_storage;
 struct sieve_variable_storage *sieve_variable_storage_create
 	(const struct sieve_extension *var_ext, pool_t pool,
 		struct sieve_variable_scope_binary *scpbin);
+/* Makes all variables empty again; the value buffers are kept for reuse */
+void sieve_variable_storage_clear
+	(struct sieve_variable_storage *storage);
 bool sieve_variable_get
 	(struct sieve_variable_storage *storage, unsigned int index,
 		string_t **value);
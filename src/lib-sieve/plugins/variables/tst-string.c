@@ -40,7 +40,8 @@ const struct sieve_command_def tst_string = {
 	.block_required = FALSE,
 	.registered = tst_string_registered,
 	.validate = tst_string_validate,
-	.generate = tst_string_generate
+	.generate = tst_string_generate,
+	.data_declared = TRUE
 };
 
 /*
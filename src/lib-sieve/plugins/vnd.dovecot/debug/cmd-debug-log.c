@@ -36,7 +36,8 @@ const struct sieve_command_def debug_log_command = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = cmd_debug_log_validate,
-	.generate = cmd_debug_log_generate
+	.generate = cmd_debug_log_generate,
+	.data_declared = TRUE
 };
 
 /*
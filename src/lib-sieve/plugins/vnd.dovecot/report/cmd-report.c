@@ -63,7 +63,9 @@ const struct sieve_command_def cmd_report = {
 	.block_required = FALSE,
 	.registered = cmd_report_registered,
 	.validate = cmd_report_validate,
-	.generate = cmd_report_generate
+	.generate = cmd_report_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE
 };
 
 /*
@@ -341,6 +341,11 @@ static bool
 sieve_ast_list_add(struct sieve_ast_list *list, struct sieve_ast_node *node)
 	__LIST_ADD(list, node)
 
+static bool
+sieve_ast_list_insert(struct sieve_ast_list *list,
+		      struct sieve_ast_node *before, struct sieve_ast_node *node)
+	__LIST_INSERT(list, before, node)
+
 static struct sieve_ast_node *
 sieve_ast_list_detach(struct sieve_ast_node *first, unsigned int count)
 	__LIST_DETACH(first, struct sieve_ast_node, count)
@@ -464,6 +469,27 @@ struct sieve_ast_node *sieve_ast_node_detach(struct sieve_ast_node *first)
 	return sieve_ast_list_detach(first, 1);
 }
 
+struct sieve_ast_node *sieve_ast_test_splice(struct sieve_ast_node *test)
+{
+	struct sieve_ast_node *subtest, *next;
+
+	i_assert(test->type == SAT_TEST && test->list != NULL);
+
+	subtest = sieve_ast_test_first(test);
+	while (subtest != NULL) {
+		next = sieve_ast_test_next(subtest);
+
+		(void)sieve_ast_list_detach(subtest, 1);
+		if (!sieve_ast_list_insert(test->list, test, subtest))
+			i_unreached();
+		subtest->parent = test->parent;
+
+		subtest = next;
+	}
+
+	return sieve_ast_node_detach(test);
+}
+
 const char *sieve_ast_type_name(enum sieve_ast_type ast_type)
 {
 	switch (ast_type) {
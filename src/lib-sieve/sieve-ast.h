@@ -217,6 +217,9 @@ sieve_ast_command_create(struct sieve_ast_node *parent, const char *identifier,
 
 struct sieve_ast_node *
 sieve_ast_node_detach(struct sieve_ast_node *first);
+/* Replaces the test in the test list of its parent with its own sub-tests.
+   Returns the node that followed the test. */
+struct sieve_ast_node *sieve_ast_test_splice(struct sieve_ast_node *test);
 
 const char *sieve_ast_type_name(enum sieve_ast_type ast_type);
 
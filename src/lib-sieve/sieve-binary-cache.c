@@ -0,0 +1,208 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+
+#include "sieve-common.h"
+#include "sieve-script.h"
+#include "sieve-binary-private.h"
+#include "sieve-binary-cache.h"
+
+#include <sys/stat.h>
+
+/*
+ * Binary cache
+ */
+
+struct sieve_binary_cache_entry {
+	char *location;
+	struct sieve_binary *sbin;
+	enum sieve_compile_flags cpflags;
+
+	/* Binary file as it was when the entry was last validated */
+	struct stat st;
+	time_t validated;
+
+	unsigned int last_used;
+};
+
+struct sieve_binary_cache {
+	ARRAY(struct sieve_binary_cache_entry) entries;
+	unsigned int use_counter;
+};
+
+static void
+sieve_binary_cache_entry_free(struct sieve_binary_cache_entry *entry)
+{
+	sieve_binary_unref(&entry->sbin);
+	i_free(entry->location);
+}
+
+static void
+sieve_binary_cache_drop(struct sieve_binary_cache *cache, unsigned int idx)
+{
+	struct sieve_binary_cache_entry *entry =
+		array_idx_modifiable(&cache->entries, idx);
+
+	sieve_binary_cache_entry_free(entry);
+	array_delete(&cache->entries, idx, 1);
+}
+
+void sieve_binary_cache_deinit(struct sieve_instance *svinst)
+{
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+	struct sieve_binary_cache_entry *entry;
+
+	svinst->binary_cache = NULL;
+	if (cache == NULL)
+		return;
+
+	array_foreach_modifiable(&cache->entries, entry)
+		sieve_binary_cache_entry_free(entry);
+	array_free(&cache->entries);
+	i_free(cache);
+}
+
+static bool
+sieve_binary_cache_find(struct sieve_binary_cache *cache, const char *location,
+			unsigned int *idx_r)
+{
+	const struct sieve_binary_cache_entry *entries;
+	unsigned int count, i;
+
+	entries = array_get(&cache->entries, &count);
+	for (i = 0; i < count; i++) {
+		if (strcmp(entries[i].location, location) == 0) {
+			*idx_r = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static bool
+sieve_binary_cache_stat_equals(const struct stat *st1, const struct stat *st2)
+{
+	return (st1->st_ino == st2->st_ino && st1->st_dev == st2->st_dev &&
+		st1->st_size == st2->st_size &&
+		st1->st_mtime == st2->st_mtime &&
+		ST_MTIME_NSEC(*st1) == ST_MTIME_NSEC(*st2));
+}
+
+static bool
+sieve_binary_cache_revalidate(struct sieve_binary_cache_entry *entry,
+			      struct sieve_script *script)
+{
+	struct sieve_binary *sbin = entry->sbin;
+	struct stat st;
+
+	/* Was the binary replaced or removed, e.g. by sievec? */
+	if (stat(sieve_binary_path(sbin), &st) < 0) {
+		if (errno != ENOENT) {
+			e_error(sieve_binary_svinst(sbin)->event,
+				"binary cache: stat(%s) failed: %m",
+				sieve_binary_path(sbin));
+		}
+		return FALSE;
+	}
+	if (!sieve_binary_cache_stat_equals(&st, &entry->st))
+		return FALSE;
+
+	/* Check the binary against the script as it is now; this includes
+	   the checks of extensions, e.g. whether included scripts changed. The
+	   cached binary itself is left alone; when it is outdated, the entry
+	   is replaced by the binary the caller loads or compiles next. */
+	return sieve_binary_script_up_to_date(sbin, script, entry->cpflags);
+}
+
+struct sieve_binary *
+sieve_binary_cache_lookup(struct sieve_instance *svinst,
+			  struct sieve_script *script,
+			  enum sieve_compile_flags cpflags)
+{
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+	struct sieve_binary_cache_entry *entry;
+	unsigned int idx;
+
+	if (cache == NULL ||
+	    !sieve_binary_cache_find(cache, sieve_script_location(script),
+				     &idx))
+		return NULL;
+
+	entry = array_idx_modifiable(&cache->entries, idx);
+	if (entry->cpflags != cpflags) {
+		sieve_binary_cache_drop(cache, idx);
+		return NULL;
+	}
+
+	if (ioloop_time < entry->validated ||
+	    (ioloop_time - entry->validated) >=
+		(time_t)svinst->binary_cache_revalidate_secs) {
+		if (!sieve_binary_cache_revalidate(entry, script)) {
+			e_debug(svinst->event,
+				"Cached binary %s is no longer up-to-date",
+				sieve_binary_path(entry->sbin));
+			sieve_binary_cache_drop(cache, idx);
+			return NULL;
+		}
+		entry->validated = ioloop_time;
+	}
+
+	if (entry->sbin->refcount == 1 &&
+	    event_get_parent(entry->sbin->event) != svinst->event) {
+		/* The instance was rebound, e.g. for another delivery */
+		event_unref(&entry->sbin->event);
+		entry->sbin->event = event_create(svinst->event);
+		sieve_binary_update_event(entry->sbin, NULL);
+	}
+
+	entry->last_used = ++cache->use_counter;
+	sieve_binary_ref(entry->sbin);
+	return entry->sbin;
+}
+
+void sieve_binary_cache_add(struct sieve_instance *svinst,
+			    struct sieve_binary *sbin,
+			    enum sieve_compile_flags cpflags)
+{
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+	struct sieve_binary_cache_entry *entry;
+	const char *location = sieve_binary_script_location(sbin);
+	unsigned int idx;
+
+	if (svinst->binary_cache_size == 0 || location == NULL ||
+	    !sieve_binary_loaded(sbin))
+		return;
+
+	if (cache == NULL) {
+		cache = i_new(struct sieve_binary_cache, 1);
+		i_array_init(&cache->entries, svinst->binary_cache_size);
+		svinst->binary_cache = cache;
+	}
+
+	if (sieve_binary_cache_find(cache, location, &idx))
+		sieve_binary_cache_drop(cache, idx);
+	else if (array_count(&cache->entries) >= svinst->binary_cache_size) {
+		const struct sieve_binary_cache_entry *entries;
+		unsigned int count, i;
+
+		/* Evict the least recently used binary */
+		entries = array_get(&cache->entries, &count);
+		for (i = 1, idx = 0; i < count; i++) {
+			if (entries[i].last_used < entries[idx].last_used)
+				idx = i;
+		}
+		sieve_binary_cache_drop(cache, idx);
+	}
+
+	entry = array_append_space(&cache->entries);
+	entry->location = i_strdup(location);
+	entry->sbin = sbin;
+	entry->cpflags = cpflags;
+	entry->st = *sieve_binary_stat(sbin);
+	entry->validated = ioloop_time;
+	entry->last_used = ++cache->use_counter;
+	sieve_binary_ref(sbin);
+}
@@ -0,0 +1,31 @@
+#ifndef SIEVE_BINARY_CACHE_H
+#define SIEVE_BINARY_CACHE_H
+
+#include "sieve-common.h"
+
+/*
+ * Binary cache
+ */
+
+/* Keeps the binaries most recently loaded by sieve_open_script() for reuse by
+   later executions within the same Sieve instance, which may be kept across
+   deliveries (see sieve_set_context()). Binaries are keyed by script
+   location. Unless the configured revalidation interval has not passed yet
+   (by default it is 0), a cached binary is only reused when the binary file
+   is unchanged on disk and sieve_binary_up_to_date() still holds for the
+   (newly opened) script. That also covers binaries that depend on other
+   scripts (e.g. through include), since extensions check those again. */
+
+struct sieve_binary_cache;
+
+void sieve_binary_cache_deinit(struct sieve_instance *svinst);
+
+struct sieve_binary *
+sieve_binary_cache_lookup(struct sieve_instance *svinst,
+			  struct sieve_script *script,
+			  enum sieve_compile_flags cpflags);
+void sieve_binary_cache_add(struct sieve_instance *svinst,
+			    struct sieve_binary *sbin,
+			    enum sieve_compile_flags cpflags);
+
+#endif
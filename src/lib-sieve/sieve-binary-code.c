@@ -14,6 +14,7 @@
 #include "sieve-error.h"
 #include "sieve-extensions.h"
 #include "sieve-code.h"
+#include "sieve-stringlist.h"
 #include "sieve-script.h"
 
 #include "sieve-binary-private.h"
@@ -53,6 +54,23 @@ _sieve_binary_update_data(struct sieve_binary_block *sblock,
 	buffer_write(sblock->data, address, data, size);
 }
 
+static inline sieve_size_t
+_sieve_binary_align(sieve_size_t address, size_t size)
+{
+	return (address + size - 1) & ~((sieve_size_t)size - 1);
+}
+
+static inline sieve_size_t
+_sieve_binary_emit_padding(struct sieve_binary_block *sblock, size_t size)
+{
+	sieve_size_t address = _sieve_binary_block_get_size(sblock);
+	sieve_size_t aligned = _sieve_binary_align(address, size);
+
+	if (aligned > address)
+		buffer_append_zero(sblock->data, aligned - address);
+	return aligned;
+}
+
 sieve_size_t sieve_binary_emit_data(struct sieve_binary_block *sblock,
 				    const void *data, sieve_size_t size)
 {
@@ -89,6 +107,14 @@ sieve_size_t sieve_binary_emit_offset(struct sieve_binary_block *sblock,
 	uint8_t encoded[sizeof(offset)];
 	int i;
 
+	if (sblock->aligned) {
+		/* The returned address is the one before the padding, which is
+		   where readers start. Jump offsets are relative to it. */
+		(void)_sieve_binary_emit_padding(sblock, sizeof(offset));
+		_sieve_binary_emit_data(sblock, &offset, sizeof(offset));
+		return address;
+	}
+
 	for (i = sizeof(offset)-1; i >= 0; i--) {
 		encoded[i] = (uint8_t)offset;
 		offset >>= 8;
@@ -110,6 +136,14 @@ void sieve_binary_resolve_offset(struct sieve_binary_block *sblock,
 	i_assert(cur_address > address);
 	i_assert((cur_address - address) <= (sieve_offset_t)-1);
 	offset = cur_address - address;
+
+	if (sblock->aligned) {
+		_sieve_binary_update_data(
+			sblock, _sieve_binary_align(address, sizeof(offset)),
+			&offset, sizeof(offset));
+		return;
+	}
+
 	for (i = sizeof(offset)-1; i >= 0; i--) {
 		encoded[i] = (uint8_t)offset;
 		offset >>= 8;
@@ -127,6 +161,12 @@ sieve_size_t sieve_binary_emit_integer(struct sieve_binary_block *sblock,
 	uint8_t buffer[sizeof(sieve_number_t) + 1];
 	int bufpos = sizeof(buffer) - 1;
 
+	if (sblock->aligned) {
+		(void)_sieve_binary_emit_padding(sblock, sizeof(integer));
+		_sieve_binary_emit_data(sblock, &integer, sizeof(integer));
+		return address;
+	}
+
 	/* Encode last byte [0xxxxxxx]; msb == 0 marks the last byte */
 	buffer[bufpos] = integer & 0x7F;
 	bufpos--;
@@ -158,26 +198,78 @@ sieve_binary_emit_dynamic_data(struct sieve_binary_block *sblock,
 	return address;
 }
 
-sieve_size_t sieve_binary_emit_cstring(struct sieve_binary_block *sblock,
-				       const char *str)
+/* String table: each entry is an aligned 32-bit length followed by the
+   NUL-terminated string data. Operands refer to the offset of the entry. */
+
+static uint32_t
+sieve_binary_string_table_add(struct sieve_binary *sbin,
+			      const void *data, size_t size)
 {
-	sieve_size_t address =
-		sieve_binary_emit_dynamic_data(sblock, (void *)str,
-					       (sieve_size_t)strlen(str));
+	struct sieve_binary_block *strblock;
+	const char *key = NULL;
+	uint32_t index, length = size;
+	void *value;
+
+	strblock = sieve_binary_block_get(sbin, SIEVE_BINARY_STRINGS_BLOCK);
+	i_assert(strblock != NULL);
+	i_assert(size <= (uint32_t)-1);
+
+	/* Strings containing NUL are not shared */
+	if (memchr(data, '\0', size) == NULL) {
+		if (!hash_table_is_created(sbin->string_index)) {
+			hash_table_create(&sbin->string_index, default_pool, 0,
+					  str_hash, strcmp);
+		}
+		key = t_strndup(data, size);
+		value = hash_table_lookup(sbin->string_index, key);
+		if (value != NULL)
+			return POINTER_CAST_TO(value, uint32_t) - 1;
+	}
+
+	index = _sieve_binary_emit_padding(strblock, sizeof(length));
+	_sieve_binary_emit_data(strblock, &length, sizeof(length));
+	_sieve_binary_emit_data(strblock, data, size);
+	_sieve_binary_emit_byte(strblock, 0);
+
+	if (key != NULL) {
+		hash_table_insert(sbin->string_index,
+				  p_strdup(sbin->pool, key),
+				  POINTER_CAST(index + 1));
+	}
+	return index;
+}
 
-	_sieve_binary_emit_byte(sblock, 0);
+static sieve_size_t
+sieve_binary_emit_string_data(struct sieve_binary_block *sblock,
+			      const void *data, size_t size)
+{
+	sieve_size_t address;
+	uint32_t index;
+
+	if (!sblock->aligned) {
+		address = sieve_binary_emit_dynamic_data(sblock, data, size);
+		_sieve_binary_emit_byte(sblock, 0);
+		return address;
+	}
+
+	address = _sieve_binary_block_get_size(sblock);
+	index = sieve_binary_string_table_add(sblock->sbin, data, size);
+	(void)_sieve_binary_emit_padding(sblock, sizeof(index));
+	_sieve_binary_emit_data(sblock, &index, sizeof(index));
 	return address;
 }
 
+sieve_size_t sieve_binary_emit_cstring(struct sieve_binary_block *sblock,
+				       const char *str)
+{
+	return sieve_binary_emit_string_data(sblock, str, strlen(str));
+}
+
 sieve_size_t sieve_binary_emit_string(struct sieve_binary_block *sblock,
 				      const string_t *str)
 {
-	sieve_size_t address =
-		sieve_binary_emit_dynamic_data(sblock, (void *)str_data(str),
-					       (sieve_size_t)str_len(str));
-
-	_sieve_binary_emit_byte(sblock, 0);
-	return address;
+	return sieve_binary_emit_string_data(sblock, str_data(str),
+					     str_len(str));
 }
 
 /*
@@ -227,6 +319,13 @@ void sieve_binary_emit_extension_object(
 #define ADDR_JUMP(address, offset) \
 	(*address) += offset
 
+/* Aligned operands */
+
+#define ADDR_ALIGN(address, size) \
+	(*address) = _sieve_binary_align(*address, size)
+#define ADDR_VALUE_AT(address, type) \
+	(*(const type *)ADDR_POINTER(address))
+
 /* Literals */
 
 bool sieve_binary_read_byte(struct sieve_binary_block *sblock,
@@ -272,6 +371,18 @@ bool sieve_binary_read_offset(struct sieve_binary_block *sblock,
 	sieve_offset_t offs = 0;
 	ADDR_CODE_READ(sblock);
 
+	if (sblock->aligned) {
+		sieve_size_t field = *address;
+
+		ADDR_ALIGN(&field, sizeof(offs));
+		if (ADDR_BYTES_LEFT(&field) < sizeof(offs))
+			return FALSE;
+		if (offset_r != NULL)
+			*offset_r = ADDR_VALUE_AT(&field, sieve_offset_t);
+		*address = field + sizeof(offs);
+		return TRUE;
+	}
+
 	if (ADDR_BYTES_LEFT(address) >= 4) {
 		int i;
 
@@ -297,6 +408,18 @@ bool sieve_binary_read_integer(struct sieve_binary_block *sblock,
 
 	ADDR_CODE_READ(sblock);
 
+	if (sblock->aligned) {
+		sieve_size_t field = *address;
+
+		ADDR_ALIGN(&field, sizeof(integer));
+		if (ADDR_BYTES_LEFT(&field) < sizeof(integer))
+			return FALSE;
+		if (int_r != NULL)
+			*int_r = ADDR_VALUE_AT(&field, sieve_number_t);
+		*address = field + sizeof(integer);
+		return TRUE;
+	}
+
 	if (ADDR_BYTES_LEFT(address) == 0)
 		return FALSE;
 
@@ -324,14 +447,55 @@ bool sieve_binary_read_integer(struct sieve_binary_block *sblock,
 	return TRUE;
 }
 
-bool sieve_binary_read_string(struct sieve_binary_block *sblock,
-			      sieve_size_t *address, string_t **str_r)
+static bool
+sieve_binary_string_table_get(struct sieve_binary_block *strblock,
+			      sieve_size_t index, struct sieve_string *str_r)
+{
+	uint32_t length;
+
+	ADDR_CODE_READ(strblock);
+
+	if ((index % sizeof(length)) != 0 ||
+	    ADDR_BYTES_LEFT(&index) < sizeof(length))
+		return FALSE;
+	length = ADDR_VALUE_AT(&index, uint32_t);
+	ADDR_JUMP(&index, sizeof(length));
+	if (ADDR_BYTES_LEFT(&index) <= length)
+		return FALSE;
+
+	str_r->data = (const char *)ADDR_POINTER(&index);
+	str_r->size = length;
+
+	ADDR_JUMP(&index, length);
+	return (ADDR_CODE_AT(&index) == 0);
+}
+
+bool sieve_binary_read_string_ref(struct sieve_binary_block *sblock,
+				  sieve_size_t *address,
+				  struct sieve_string *str_r)
 {
 	unsigned int strlen = 0;
 	const char *strdata;
 
 	ADDR_CODE_READ(sblock);
 
+	if (sblock->aligned) {
+		struct sieve_binary_block *strblock;
+		sieve_size_t field = *address, index;
+
+		/* Reference into the string table */
+		ADDR_ALIGN(&field, sizeof(uint32_t));
+		if (ADDR_BYTES_LEFT(&field) < sizeof(uint32_t))
+			return FALSE;
+		index = ADDR_VALUE_AT(&field, uint32_t);
+		*address = field + sizeof(uint32_t);
+
+		strblock = sieve_binary_block_get(sblock->sbin,
+						  SIEVE_BINARY_STRINGS_BLOCK);
+		return (strblock != NULL &&
+			sieve_binary_string_table_get(strblock, index, str_r));
+	}
+
 	if (!sieve_binary_read_unsigned(sblock, address, &strlen))
 		return FALSE;
 
@@ -344,14 +508,27 @@ bool sieve_binary_read_string(struct sieve_binary_block *sblock,
 	if (ADDR_CODE_AT(address) != 0)
 		return FALSE;
 
- 	if (str_r != NULL)
-		*str_r = t_str_new_const(strdata, strlen);
+	str_r->data = strdata;
+	str_r->size = strlen;
 
 	ADDR_JUMP(address, 1);
 
 	return TRUE;
 }
 
+bool sieve_binary_read_string(struct sieve_binary_block *sblock,
+			      sieve_size_t *address, string_t **str_r)
+{
+	struct sieve_string str;
+
+	if (!sieve_binary_read_string_ref(sblock, address, &str))
+		return FALSE;
+
+	if (str_r != NULL)
+		*str_r = t_str_new_const(str.data, str.size);
+	return TRUE;
+}
+
 bool sieve_binary_read_extension(struct sieve_binary_block *sblock,
 				 sieve_size_t *address, unsigned int *offset_r,
 				 const struct sieve_extension **ext_r)
@@ -94,6 +94,40 @@ void sieve_binary_dump_sectionf(const struct sieve_dumptime_env *denv,
  * Dumping the binary
  */
 
+static void
+sieve_binary_dump_data_list(const struct sieve_dumptime_env *denv,
+			    const char *name, const char *const *list)
+{
+	if (*list == NULL)
+		return;
+	sieve_binary_dumpf(denv, "%s = %s\n", name,
+			   t_strarray_join(list, ", "));
+}
+
+static void
+sieve_binary_dump_data_requirements(const struct sieve_dumptime_env *denv)
+{
+	struct sieve_binary_data_requirements reqs;
+
+	sieve_binary_get_data_requirements(denv->sbin, &reqs);
+
+	sieve_binary_dump_sectionf(denv, "Data requirements (block: %d)",
+				   SBIN_SYSBLOCK_DATA_REQUIREMENTS);
+	sieve_binary_dumpf(denv, "flags =%s%s%s%s%s\n",
+		((reqs.flags & SIEVE_BINARY_DATA_FLAG_ANY_HEADER) != 0 ?
+		 " any-header" : ""),
+		((reqs.flags & SIEVE_BINARY_DATA_FLAG_BODY) != 0 ?
+		 " body" : ""),
+		((reqs.flags & SIEVE_BINARY_DATA_FLAG_MIME) != 0 ?
+		 " mime" : ""),
+		((reqs.flags & SIEVE_BINARY_DATA_FLAG_ANY_ENVELOPE) != 0 ?
+		 " any-envelope" : ""),
+		((reqs.flags & SIEVE_BINARY_DATA_FLAG_MAILBOX) != 0 ?
+		 " mailbox" : ""));
+	sieve_binary_dump_data_list(denv, "headers", reqs.headers);
+	sieve_binary_dump_data_list(denv, "envelope", reqs.envelope_parts);
+}
+
 bool sieve_binary_dumper_run(struct sieve_binary_dumper *dumper,
 			     struct ostream *stream, bool verbose)
 {
@@ -123,10 +157,12 @@ bool sieve_binary_dumper_run(struct sieve_binary_dumper *dumper,
 		sieve_binary_dumpf(denv,
 			"resource usage:\n"
 			"  update time = %s\n"
-			"  cpu time = %"PRIu32" ms\n",
+			"  cpu time = %"PRIu32" ms\n"
+			"  work = %"PRIu32" units\n",
 			t_strflocaltime("%Y-%m-%d %H:%M:%S",
 					update_time),
-			header->resource_usage.cpu_time_msecs);
+			header->resource_usage.cpu_time_msecs,
+			header->resource_usage.work_units);
 	}
 
 	/* Dump list of binary blocks */
@@ -162,6 +198,12 @@ bool sieve_binary_dumper_run(struct sieve_binary_dumper *dumper,
 	if (!success)
 		return FALSE;
 
+	/* Dump data requirements */
+
+	T_BEGIN {
+		sieve_binary_dump_data_requirements(denv);
+	} T_END;
+
 	/* Dump list of used extensions */
 
 	count = sieve_binary_extensions_count(sbin);
@@ -9,7 +9,9 @@
 #include "hash.h"
 #include "array.h"
 #include "ostream.h"
+#include "mmap-util.h"
 #include "eacces-error.h"
+#include "hostpid.h"
 #include "safe-mkstemp.h"
 #include "file-lock.h"
 
@@ -20,6 +22,7 @@
 #include "sieve-script.h"
 
 #include "sieve-binary-private.h"
+#include "sieve-binary-store.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -184,6 +187,7 @@ static void sieve_binary_file_update_header(struct sieve_binary *sbin)
 	    sieve_resource_usage_is_high(sbin->svinst, &rusage)) {
 		header->resource_usage.update_time = ioloop_time;
 		header->resource_usage.cpu_time_msecs = rusage.cpu_time_msecs;
+		header->resource_usage.work_units = rusage.work_units;
 	}
 
 	sieve_resource_usage_init(&sbin->rusage);
@@ -401,6 +405,79 @@ sieve_binary_save_to_stream(struct sieve_binary *sbin, struct ostream *stream)
 	return TRUE;
 }
 
+static int
+sieve_binary_do_link(struct sieve_binary *sbin, const char *path,
+		     enum sieve_error *error_r)
+{
+	const char *temp_path;
+
+	if (error_r != NULL)
+		*error_r = SIEVE_ERROR_NONE;
+
+	if (strcmp(sbin->path, path) == 0) {
+		e_debug(sbin->event, "save: "
+			"not saving binary, because it is already linked");
+		return 0;
+	}
+
+	/* Reference the store entry rather than writing a copy of it */
+	temp_path = t_strdup_printf("%s.%s.%s.link", path,
+				    my_hostname, my_pid);
+	if (unlink(temp_path) < 0 && errno != ENOENT) {
+		e_error(sbin->event, "save: "
+			"unlink(%s) failed: %m", temp_path);
+	}
+	if (link(sbin->path, temp_path) < 0) {
+		if (errno == EACCES) {
+			e_error(sbin->event, "save: "
+				"failed to link binary: %s",
+				eacces_error_get_creating("link", temp_path));
+			if (error_r != NULL)
+				*error_r = SIEVE_ERROR_NO_PERMISSION;
+		} else if (errno == EXDEV) {
+			e_debug(sbin->event, "save: "
+				"not linking binary from %s, "
+				"which is on another file system", sbin->path);
+			if (error_r != NULL)
+				*error_r = SIEVE_ERROR_NOT_POSSIBLE;
+		} else {
+			e_error(sbin->event, "save: "
+				"failed to link binary: "
+				"link(%s, %s) failed: %m",
+				sbin->path, temp_path);
+			if (error_r != NULL)
+				*error_r = SIEVE_ERROR_TEMP_FAILURE;
+		}
+		return -1;
+	}
+
+	/* Replace any original binary atomically */
+	if (rename(temp_path, path) < 0) {
+		if (errno == EACCES) {
+			e_error(sbin->event, "save: "
+				"failed to save binary: %s",
+				eacces_error_get_creating("rename", path));
+			if (error_r != NULL)
+				*error_r = SIEVE_ERROR_NO_PERMISSION;
+		} else {
+			e_error(sbin->event, "save: "
+				"failed to save binary: "
+				"rename(%s, %s) failed: %m", temp_path, path);
+			if (error_r != NULL)
+				*error_r = SIEVE_ERROR_TEMP_FAILURE;
+		}
+		if (unlink(temp_path) < 0 && errno != ENOENT) {
+			e_error(sbin->event, "save: "
+				"failed to clean up after error: "
+				"unlink(%s) failed: %m", temp_path);
+		}
+		return -1;
+	}
+
+	sbin->path = p_strdup(sbin->pool, path);
+	return 1;
+}
+
 static int
 sieve_binary_do_save(struct sieve_binary *sbin, const char *path, bool update,
 		     mode_t save_mode, enum sieve_error *error_r)
@@ -411,6 +488,9 @@ sieve_binary_do_save(struct sieve_binary *sbin, const char *path, bool update,
 	struct sieve_binary_extension_reg *const *regs;
 	unsigned int ext_count, i;
 
+	if (sbin->shared)
+		return sieve_binary_do_link(sbin, path, error_r);
+
 	if (error_r != NULL)
 		*error_r = SIEVE_ERROR_NONE;
 
@@ -648,6 +728,37 @@ void sieve_binary_file_close(struct sieve_binary_file **_file)
 	pool_unref(&file->pool);
 }
 
+static void sieve_binary_file_map(struct sieve_binary *sbin)
+{
+	struct sieve_binary_file *file = sbin->file;
+	void *map;
+
+	if (file->st.st_size <= 0 || (uoff_t)file->st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, (size_t)file->st.st_size, PROT_READ, MAP_SHARED,
+		   file->fd, 0);
+	if (map == MAP_FAILED) {
+		/* Not fatal; the blocks are read into memory instead */
+		e_debug(sbin->event, "open: mmap() failed: %m");
+		return;
+	}
+
+	sbin->map = map;
+	sbin->map_size = (size_t)file->st.st_size;
+}
+
+void sieve_binary_file_unmap(struct sieve_binary *sbin)
+{
+	if (sbin->map == NULL)
+		return;
+
+	if (munmap(sbin->map, sbin->map_size) < 0)
+		e_error(sbin->event, "close: munmap() failed: %m");
+	sbin->map = NULL;
+	sbin->map_size = 0;
+}
+
 static int
 sieve_binary_file_read(struct sieve_binary_file *file, off_t *offset,
 		       void *buffer, size_t size)
@@ -731,14 +842,70 @@ sieve_binary_file_load_buffer(struct sieve_binary_file *file,
 	(header *)sieve_binary_file_load_data(sbin->file, offset, \
 					      sizeof(header))
 
+static bool sieve_binary_map_block(struct sieve_binary_block *sblock)
+{
+	struct sieve_binary *sbin = sblock->sbin;
+	unsigned int id = sblock->id;
+	size_t offset = SIEVE_BINARY_ALIGN(sblock->offset);
+	const struct sieve_binary_block_header *header;
+	const void *data;
+
+	if (offset > sbin->map_size ||
+	    (sbin->map_size - offset) < sizeof(*header)) {
+		e_error(sbin->event, "load: binary is corrupt: "
+			"failed to read header of block %d", id);
+		return FALSE;
+	}
+	header = CONST_PTR_OFFSET(sbin->map, offset);
+
+	if (header->id != id) {
+		e_error(sbin->event, "load: binary is corrupt: "
+			"header of block %d has non-matching id %d",
+			id, header->id);
+		return FALSE;
+	}
+
+	offset = SIEVE_BINARY_ALIGN(offset + sizeof(*header));
+	if (offset > sbin->map_size ||
+	    (sbin->map_size - offset) < header->size) {
+		e_error(sbin->event, "load: binary is truncated: "
+			"failed to read block %d of binary (size=%d)",
+			id, header->size);
+		return FALSE;
+	}
+	data = CONST_PTR_OFFSET(sbin->map, offset);
+
+	if (sblock->aligned &&
+	    ((uintptr_t)data % sizeof(sieve_number_t)) != 0) {
+		/* Blocks are only 32-bit aligned in the file; operands
+		   of the aligned encoding are read in place, so these need a
+		   suitably aligned private copy */
+		sblock->data = buffer_create_dynamic(sbin->pool, header->size);
+		buffer_append(sblock->data, data, header->size);
+		return TRUE;
+	}
+
+	/* The pages are only read once the block's code is accessed */
+	sblock->data = p_new(sbin->pool, buffer_t, 1);
+	buffer_create_from_const_data(sblock->data, data, header->size);
+	sblock->mapped = TRUE;
+	return TRUE;
+}
+
 bool sieve_binary_load_block(struct sieve_binary_block *sblock)
 {
 	struct sieve_binary *sbin = sblock->sbin;
 	unsigned int id = sblock->id;
 	off_t offset = sblock->offset;
-	const struct sieve_binary_block_header *header =
-		LOAD_HEADER(sbin, &offset,
-			    const struct sieve_binary_block_header);
+	const struct sieve_binary_block_header *header;
+
+	if (sbin->map != NULL)
+		return sieve_binary_map_block(sblock);
+	if (sbin->file == NULL)
+		return FALSE;
+
+	header = LOAD_HEADER(sbin, &offset,
+			     const struct sieve_binary_block_header);
 
 	if (header == NULL) {
 		e_error(sbin->event, "load: binary is corrupt: "
@@ -863,6 +1030,11 @@ _sieve_binary_open(struct sieve_binary *sbin, enum sieve_error *error_r)
 		return FALSE;
 	offset = sbin->header.hdr_size;
 
+	/* Map the file, so that the blocks can share the page cache with
+	   other processes using the same binary */
+	if (sbin->svinst->binary_mmap)
+		sieve_binary_file_map(sbin);
+
 	/* Load block index */
 
 	for (i = 0; i < sbin->header.blocks && result; i++) {
@@ -932,6 +1104,8 @@ sieve_binary_open(struct sieve_instance *svinst, const char *path,
 		sieve_binary_unref(&sbin);
 		return NULL;
 	}
+	sbin->shared = HAS_ALL_BITS(sbin->header.flags,
+				    SIEVE_BINARY_FLAG_STORED);
 
 	sieve_binary_activate(sbin);
 
@@ -1020,6 +1194,27 @@ int sieve_binary_file_update_resource_usage(struct sieve_binary *sbin,
 		error_r = &error;
 	*error_r = SIEVE_ERROR_NONE;
 
+	if (sbin->shared) {
+		struct sieve_resource_usage rusage;
+
+		/* Never modify the shared store entry; only a script that
+		   needs to record its resource usage gets a private copy */
+		sieve_binary_get_resource_usage(sbin, &rusage);
+		if (!HAS_ALL_BITS(sbin->header.flags,
+				  SIEVE_BINARY_FLAG_RESOURCE_LIMIT) &&
+		    !sieve_resource_usage_is_high(sbin->svinst, &rusage))
+			return 0;
+		if (sbin->script == NULL)
+			return 0;
+		if (sieve_binary_store_detach(sbin) < 0) {
+			*error_r = SIEVE_ERROR_TEMP_FAILURE;
+			return -1;
+		}
+		sieve_binary_file_close(&sbin->file);
+		return sieve_script_binary_save(sbin->script, sbin, TRUE,
+						error_r);
+	}
+
 	sieve_binary_file_close(&sbin->file);
 
 	if (sbin->path == NULL)
@@ -1,6 +1,8 @@
 #ifndef SIEVE_BINARY_PRIVATE_H
 #define SIEVE_BINARY_PRIVATE_H
 
+#include "hash.h"
+
 #include "sieve-common.h"
 #include "sieve-binary.h"
 #include "sieve-extensions.h"
@@ -15,8 +17,20 @@
 
 enum SIEVE_BINARY_FLAGS {
 	SIEVE_BINARY_FLAG_RESOURCE_LIMIT = BIT(0),
+	/* Integers, offsets and string references are stored as aligned
+	   fixed-width native values and strings are kept in a string table
+	   (since version 4.1) */
+	SIEVE_BINARY_FLAG_ALIGNED_OPERANDS = BIT(1),
+	/* The binary is an entry of the shared binary store, which may be
+	   linked as the binary of several scripts; its script metadata belongs
+	   to the script it was first compiled for */
+	SIEVE_BINARY_FLAG_STORED = BIT(2),
 };
 
+/* Block holding the string table of a binary with aligned operands; this is
+   the first block after the system blocks. */
+#define SIEVE_BINARY_STRINGS_BLOCK SBIN_SYSBLOCK_LAST
+
 struct sieve_binary_header {
 	uint32_t magic;
 	uint16_t version_major;
@@ -29,6 +43,7 @@ struct sieve_binary_header {
 	struct {
 		uint64_t update_time;
 		uint32_t cpu_time_msecs;
+		uint32_t work_units;
 	} resource_usage;
 };
 
@@ -43,6 +58,7 @@ struct sieve_binary_file {
 };
 
 void sieve_binary_file_close(struct sieve_binary_file **_file);
+void sieve_binary_file_unmap(struct sieve_binary *sbin);
 
 /*
  * Internal structures
@@ -80,6 +96,16 @@ struct sieve_binary_block {
 	buffer_t *data;
 
 	uoff_t offset;
+
+	/* String lists decoded during execution (owned by sieve-code.c) */
+	struct sieve_code_literal_cache *litcache;
+	/* Execution profile (owned by sieve-profile.c) */
+	struct sieve_profile *profile;
+
+	/* Operands in this block use the aligned encoding */
+	bool aligned:1;
+	/* Data points into the read-only mapping of the binary file */
+	bool mapped:1;
 };
 
 /*
@@ -98,6 +124,12 @@ struct sieve_binary {
 	struct sieve_binary_header header;
 	struct sieve_resource_usage rusage;
 
+	/* Read-only mapping of the whole binary file; blocks refer to it
+	   directly, so it remains valid until the binary is freed, even when
+	   the file itself is closed earlier. */
+	void *map;
+	size_t map_size;
+
 	/* When the binary is loaded into memory or when it is being constructed
 	   by the generator, extensions can be associated to the binary. The
 	   extensions array is a sequential list of all linked extensions. The
@@ -122,7 +154,21 @@ struct sieve_binary {
 	/* Blocks */
 	ARRAY(struct sieve_binary_block *) blocks;
 
+	/* Data requirements; collected by the generator or read from the
+	   binary on demand */
+	enum sieve_binary_data_flags data_flags;
+	ARRAY_TYPE(const_string) data_headers;
+	ARRAY_TYPE(const_string) data_envelope_parts;
+
+	/* String table index for binaries with aligned operands; only used
+	   while generating code. Maps string -> table offset + 1. */
+	HASH_TABLE(const char *, void *) string_index;
+
 	bool rusage_updated:1;
+	bool data_requirements_known:1;
+	/* The binary file is (a link to) an entry of the shared binary store;
+	   it is never modified */
+	bool shared:1;
 };
 
 void sieve_binary_update_event(struct sieve_binary *sbin, const char *new_path)
@@ -0,0 +1,268 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "sha2.h"
+#include "istream.h"
+
+#include "sieve-common.h"
+#include "sieve-extensions.h"
+#include "sieve-script.h"
+
+#include "sieve-binary-private.h"
+#include "sieve-binary-store.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Key
+ */
+
+static bool
+sieve_binary_store_hash_script(struct sieve_script *script,
+			       struct sha256_ctx *ctx)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	enum sieve_error error;
+	int ret;
+
+	if (sieve_script_get_stream(script, &input, &error) < 0)
+		return FALSE;
+
+	i_stream_seek(input, 0);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		sha256_loop(ctx, data, size);
+		i_stream_skip(input, size);
+	}
+	i_assert(ret == -1);
+	if (input->stream_errno != 0) {
+		e_error(script->event, "binary store: "
+			"failed to read script: %s",
+			i_stream_get_error(input));
+		return FALSE;
+	}
+
+	/* Compilation reads the script from the start */
+	i_stream_seek(input, 0);
+	return TRUE;
+}
+
+const char *
+sieve_binary_store_get_path(struct sieve_script *script,
+			    enum sieve_compile_flags cpflags)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	unsigned char digest[SHA256_RESULTLEN];
+	struct sha256_ctx ctx;
+	const char *params;
+
+	if (svinst->binary_store == NULL)
+		return NULL;
+
+	/* Everything besides the source that affects the compiled code */
+	params = t_strdup_printf("%u.%u %s %x %s\n",
+		SIEVE_BINARY_VERSION_MAJOR, SIEVE_BINARY_VERSION_MINOR,
+		(svinst->binary_aligned_operands ? "aligned" : "compact"),
+		(unsigned int)cpflags, sieve_extensions_get_string(svinst));
+
+	sha256_init(&ctx);
+	sha256_loop(&ctx, params, strlen(params));
+	if (!sieve_binary_store_hash_script(script, &ctx))
+		return NULL;
+	sha256_result(&ctx, digest);
+
+	return t_strconcat(svinst->binary_store, "/",
+			   binary_to_hex(digest, sizeof(digest)),
+			   "."SIEVE_BINARY_FILEEXT, NULL);
+}
+
+/*
+ * Trust
+ */
+
+static bool
+sieve_binary_store_is_trusted(struct event *event, const char *path,
+			      const struct stat *st)
+{
+	/* Anyone who can write to the store could make other users execute
+	   arbitrary binaries */
+	if (st->st_uid != 0 && st->st_uid != geteuid()) {
+		e_warning(event, "binary store: "
+			  "ignoring %s: owned by untrusted uid %ld",
+			  path, (long)st->st_uid);
+		return FALSE;
+	}
+	if ((st->st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+		e_warning(event, "binary store: "
+			  "ignoring %s: writable by group or others "
+			  "(mode %04o)", path,
+			  (unsigned int)(st->st_mode & 07777));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static bool
+sieve_binary_store_check_dir(struct sieve_instance *svinst, struct stat *st_r)
+{
+	if (stat(svinst->binary_store, st_r) < 0) {
+		if (errno != ENOENT) {
+			e_error(svinst->event, "binary store: "
+				"stat(%s) failed: %m", svinst->binary_store);
+		}
+		return FALSE;
+	}
+	return sieve_binary_store_is_trusted(svinst->event,
+					     svinst->binary_store, st_r);
+}
+
+/*
+ * Sharing
+ */
+
+static bool sieve_binary_store_can_share(struct sieve_binary *sbin)
+{
+	struct sieve_binary_extension_reg *const *regs;
+	unsigned int ext_count, i;
+
+	/* Extensions that check whether the binary is up-to-date (e.g.
+	   include) make it depend on more than the script source */
+	regs = array_get(&sbin->extensions, &ext_count);
+	for (i = 0; i < ext_count; i++) {
+		const struct sieve_binary_extension *binext = regs[i]->binext;
+
+		if (binext != NULL && binext->binary_up_to_date != NULL)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+struct sieve_binary *
+sieve_binary_store_open(struct sieve_script *script, const char *path)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	struct sieve_binary *sbin;
+	enum sieve_error error;
+	struct stat st;
+
+	if (!sieve_binary_store_check_dir(svinst, &st))
+		return NULL;
+
+	sbin = sieve_binary_open(svinst, path, script, &error);
+	if (sbin == NULL)
+		return NULL;
+
+	if (!sbin->shared ||
+	    !sieve_binary_store_is_trusted(sbin->event, path,
+					   sieve_binary_stat(sbin)) ||
+	    !sieve_binary_store_can_share(sbin)) {
+		sieve_binary_unref(&sbin);
+		return NULL;
+	}
+	return sbin;
+}
+
+bool sieve_binary_store_verify(struct sieve_binary *sbin,
+			       struct sieve_script *script,
+			       enum sieve_compile_flags cpflags)
+{
+	const struct stat *bst = sieve_binary_stat(sbin);
+	const char *path;
+	struct stat st;
+
+	path = sieve_binary_store_get_path(script, cpflags);
+	if (path == NULL ||
+	    !sieve_binary_store_check_dir(sbin->svinst, &st) ||
+	    !sieve_binary_store_is_trusted(sbin->event, sbin->path, bst))
+		return FALSE;
+
+	/* The binary must be a link to the entry for the current source */
+	if (stat(path, &st) < 0) {
+		if (errno != ENOENT) {
+			e_error(sbin->event, "binary store: "
+				"stat(%s) failed: %m", path);
+		}
+		return FALSE;
+	}
+	return (st.st_ino == bst->st_ino && st.st_dev == bst->st_dev);
+}
+
+void sieve_binary_store_add(struct sieve_binary *sbin, const char *path)
+{
+	struct sieve_instance *svinst = sbin->svinst;
+	struct stat st;
+	mode_t file_mode, old_mask;
+	gid_t file_gid;
+	enum sieve_error error;
+	int ret;
+
+	i_assert(sbin->path == NULL);
+
+	if (!sieve_binary_store_can_share(sbin))
+		return;
+
+	/* Use the read permissions of the store directory, so that the binary
+	   is accessible to all users sharing the store */
+	if (!sieve_binary_store_check_dir(svinst, &st))
+		return;
+	file_mode = (st.st_mode & 0644) | 0600;
+	file_gid = (gid_t)-1;
+	if ((st.st_mode & S_ISGID) != 0) {
+		/* Directory's GID is used automatically for new files */
+	} else if ((st.st_mode & 0070) >> 3 == (st.st_mode & 0007)) {
+		/* Group has same permissions as world, so don't bother
+		   changing it */
+	} else if (getegid() != st.st_gid) {
+		file_gid = st.st_gid;
+	}
+
+	sbin->header.flags |= SIEVE_BINARY_FLAG_STORED;
+	old_mask = umask(0777 & ~file_mode);
+	ret = sieve_binary_save(sbin, path, FALSE, file_mode, &error);
+	umask(old_mask);
+	if (ret < 0) {
+		sbin->header.flags &= ENUM_NEGATE(SIEVE_BINARY_FLAG_STORED);
+		return;
+	}
+
+	if (file_gid != (gid_t)-1 &&
+	    chown(path, (uid_t)-1, file_gid) < 0) {
+		e_error(sbin->event, "binary store: "
+			"chown(%s, -1, %ld) failed: %m",
+			path, (long)file_gid);
+	}
+	sbin->shared = TRUE;
+}
+
+int sieve_binary_store_detach(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+	unsigned int count, i;
+
+	i_assert(sbin->shared && sbin->script != NULL);
+
+	/* Fetch all blocks, so that the private copy can be saved after the
+	   file is closed */
+	count = sieve_binary_block_count(sbin);
+	for (i = 0; i < count; i++) {
+		if (sieve_binary_block_index(sbin, i) != NULL &&
+		    sieve_binary_block_get(sbin, i) == NULL)
+			return -1;
+	}
+
+	/* Replace the metadata of the script it was compiled for */
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_SCRIPT_DATA);
+	if (sblock == NULL)
+		return -1;
+	sieve_binary_block_clear(sblock);
+	sieve_script_binary_write_metadata(sbin->script, sblock);
+
+	sbin->header.flags &= ENUM_NEGATE(SIEVE_BINARY_FLAG_STORED);
+	sbin->shared = FALSE;
+	return 0;
+}
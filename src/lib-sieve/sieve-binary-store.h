@@ -0,0 +1,45 @@
+#ifndef SIEVE_BINARY_STORE_H
+#define SIEVE_BINARY_STORE_H
+
+#include "sieve-common.h"
+
+/*
+ * Shared binary store
+ */
+
+/* The shared binary store (sieve_binary_store setting) holds binaries of
+   scripts that don't depend on other scripts, keyed by a hash of the script
+   source, the binary format, the enabled extensions and the compile flags.
+   Scripts of different users with identical source thus share one binary,
+   which only needs to be compiled once. A script using a stored binary gets
+   a hard link to it rather than a copy, so the link count of a store entry
+   tells how many scripts still reference it. Stored binaries are never
+   modified; a script that needs to record its resource usage is detached
+   into a private copy first. The store and its entries are only trusted
+   when they are owned by root or the effective uid and are not writable by
+   group or others. */
+
+/* Returns the path of the stored binary for the script, or NULL if the store
+   is not configured or the script source cannot be read. */
+const char *
+sieve_binary_store_get_path(struct sieve_script *script,
+			    enum sieve_compile_flags cpflags);
+
+/* Opens the stored binary at the provided path for the script. Returns NULL
+   when it doesn't exist (yet) or cannot be used. */
+struct sieve_binary *
+sieve_binary_store_open(struct sieve_script *script, const char *path);
+/* Checks that the shared binary is still the trusted store entry for the
+   current source of the script. */
+bool sieve_binary_store_verify(struct sieve_binary *sbin,
+			       struct sieve_script *script,
+			       enum sieve_compile_flags cpflags);
+/* Adds the newly compiled binary to the store at the provided path, provided
+   that it does not depend on other scripts. */
+void sieve_binary_store_add(struct sieve_binary *sbin, const char *path);
+
+/* Turns the shared binary into a private binary of its script, which can
+   then be saved without modifying the store. */
+int sieve_binary_store_detach(struct sieve_binary *sbin);
+
+#endif
@@ -15,9 +15,11 @@
 #include "sieve-error.h"
 #include "sieve-extensions.h"
 #include "sieve-code.h"
+#include "sieve-profile.h"
 #include "sieve-script.h"
 
 #include "sieve-binary-private.h"
+#include "sieve-binary-store.h"
 
 /*
  * Forward declarations
@@ -107,6 +109,9 @@ struct sieve_binary *sieve_binary_create_new(struct sieve_script *script)
 
 	sieve_binary_update_event(sbin, NULL);
 
+	if (sbin->svinst->binary_aligned_operands)
+		sbin->header.flags |= SIEVE_BINARY_FLAG_ALIGNED_OPERANDS;
+
 	/* Create script metadata block */
 	sblock = sieve_binary_block_create(sbin);
 	sieve_script_binary_write_metadata(script, sblock);
@@ -115,6 +120,12 @@ struct sieve_binary *sieve_binary_create_new(struct sieve_script *script)
 	for (i = 1; i < SBIN_SYSBLOCK_LAST; i++)
 		(void)sieve_binary_block_create(sbin);
 
+	/* Create string table */
+	if ((sbin->header.flags & SIEVE_BINARY_FLAG_ALIGNED_OPERANDS) != 0) {
+		sblock = sieve_binary_block_create(sbin);
+		i_assert(sblock->id == SIEVE_BINARY_STRINGS_BLOCK);
+	}
+
 	return sbin;
 }
 
@@ -140,6 +151,21 @@ static inline void sieve_binary_extensions_free(struct sieve_binary *sbin)
 	}
 }
 
+static inline void sieve_binary_blocks_free(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *const *blocks;
+	unsigned int blk_count, i;
+
+	/* Free literal caches and profiles */
+	blocks = array_get(&sbin->blocks, &blk_count);
+	for (i = 0; i < blk_count; i++) {
+		if (blocks[i] != NULL) {
+			sieve_code_literal_cache_free(&blocks[i]->litcache);
+			sieve_profile_free(&blocks[i]->profile);
+		}
+	}
+}
+
 static void sieve_binary_update_resource_usage(struct sieve_binary *sbin)
 {
 	enum sieve_error error;
@@ -161,9 +187,14 @@ void sieve_binary_unref(struct sieve_binary **_sbin)
 	if (--sbin->refcount != 0)
 		return;
 
-	sieve_binary_file_close(&sbin->file);
+	/* A shared binary may still need to read its blocks from the file */
 	sieve_binary_update_resource_usage(sbin);
+	sieve_binary_file_close(&sbin->file);
 	sieve_binary_extensions_free(sbin);
+	sieve_binary_blocks_free(sbin);
+	sieve_binary_file_unmap(sbin);
+	if (hash_table_is_created(sbin->string_index))
+		hash_table_destroy(&sbin->string_index);
 
 	if (sbin->script != NULL)
 		sieve_script_unref(&sbin->script);
@@ -180,8 +211,12 @@ void sieve_binary_close(struct sieve_binary **_sbin)
 	if (sbin == NULL)
 		return;
 
-	sieve_binary_file_close(&sbin->file);
-	sieve_binary_update_resource_usage(sbin);
+	/* Binaries can be shared (e.g. with the binary cache); keep the file
+	   open for the other users */
+	if (sbin->refcount == 1) {
+		sieve_binary_update_resource_usage(sbin);
+		sieve_binary_file_close(&sbin->file);
+	}
 	sieve_binary_unref(&sbin);
 }
 
@@ -201,6 +236,7 @@ void sieve_binary_get_resource_usage(struct sieve_binary *sbin,
 
 	sieve_resource_usage_init(rusage_r);
 	rusage_r->cpu_time_msecs = header->resource_usage.cpu_time_msecs;
+	rusage_r->work_units = header->resource_usage.work_units;
 	sieve_resource_usage_add(rusage_r, &sbin->rusage);
 }
 
@@ -362,6 +398,13 @@ sieve_binary_block_create_id(struct sieve_binary *sbin, unsigned int id)
 	sblock->sbin = sbin;
 	sblock->id = id;
 
+	/* The blocks read before the encoding is known and the string table
+	   itself always use the compact encoding */
+	sblock->aligned =
+		((sbin->header.flags & SIEVE_BINARY_FLAG_ALIGNED_OPERANDS) != 0 &&
+		 id >= SBIN_SYSBLOCK_MAIN_PROGRAM &&
+		 id != SIEVE_BINARY_STRINGS_BLOCK);
+
 	return sblock;
 }
 
@@ -369,7 +412,7 @@ static bool sieve_binary_block_fetch(struct sieve_binary_block *sblock)
 {
 	struct sieve_binary *sbin = sblock->sbin;
 
-	if (sbin->file != NULL) {
+	if (sbin->file != NULL || sbin->map != NULL) {
 		/* Try to acces the block in the binary on disk (apparently we
 		   were lazy)
 		 */
@@ -399,6 +442,14 @@ sieve_binary_block_get(struct sieve_binary *sbin, unsigned int id)
 
 void sieve_binary_block_clear(struct sieve_binary_block *sblock)
 {
+	sieve_code_literal_cache_free(&sblock->litcache);
+	sieve_profile_free(&sblock->profile);
+	if (sblock->mapped) {
+		/* The mapping is read-only; start a private copy */
+		sblock->data = buffer_create_dynamic(sblock->sbin->pool, 64);
+		sblock->mapped = FALSE;
+		return;
+	}
 	buffer_set_used_size(sblock->data, 0);
 }
 
@@ -421,17 +472,200 @@ unsigned int sieve_binary_block_get_id(const struct sieve_binary_block *sblock)
 	return sblock->id;
 }
 
+struct sieve_code_literal_cache *
+sieve_binary_block_get_literal_cache(const struct sieve_binary_block *sblock)
+{
+	return sblock->litcache;
+}
+
+void sieve_binary_block_set_literal_cache(
+	struct sieve_binary_block *sblock,
+	struct sieve_code_literal_cache *litcache)
+{
+	i_assert(sblock->litcache == NULL || litcache == NULL);
+	sblock->litcache = litcache;
+}
+
+struct sieve_profile *
+sieve_binary_block_get_profile(const struct sieve_binary_block *sblock)
+{
+	return sblock->profile;
+}
+
+void sieve_binary_block_set_profile(struct sieve_binary_block *sblock,
+				    struct sieve_profile *profile)
+{
+	i_assert(sblock->profile == NULL || profile == NULL);
+	sblock->profile = profile;
+}
+
 size_t sieve_binary_block_get_size(const struct sieve_binary_block *sblock)
 {
 	return _sieve_binary_block_get_size(sblock);
 }
 
+/*
+ * Data requirements
+ */
+
+static void
+sieve_binary_data_list_add(struct sieve_binary *sbin,
+			   ARRAY_TYPE(const_string) *list, const char *name)
+{
+	const char *item;
+
+	if (!array_is_created(list))
+		p_array_init(list, sbin->pool, 8);
+
+	array_foreach_elem(list, item) {
+		if (strcasecmp(item, name) == 0)
+			return;
+	}
+	item = p_strdup(sbin->pool, t_str_lcase(name));
+	array_append(list, &item, 1);
+}
+
+void sieve_binary_require_data(struct sieve_binary *sbin,
+			       enum sieve_binary_data_flags flags)
+{
+	sbin->data_flags |= flags;
+}
+
+void sieve_binary_require_header(struct sieve_binary *sbin,
+				 const char *name)
+{
+	sieve_binary_data_list_add(sbin, &sbin->data_headers, name);
+}
+
+void sieve_binary_require_envelope_part(struct sieve_binary *sbin,
+					const char *part)
+{
+	sieve_binary_data_list_add(sbin, &sbin->data_envelope_parts, part);
+}
+
+static void
+sieve_binary_data_list_emit(struct sieve_binary_block *sblock,
+			    ARRAY_TYPE(const_string) *list)
+{
+	const char *item;
+
+	if (!array_is_created(list)) {
+		sieve_binary_emit_unsigned(sblock, 0);
+		return;
+	}
+
+	sieve_binary_emit_unsigned(sblock, array_count(list));
+	array_foreach_elem(list, item)
+		sieve_binary_emit_cstring(sblock, item);
+}
+
+void sieve_binary_emit_data_requirements(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_DATA_REQUIREMENTS);
+	i_assert(sblock != NULL);
+
+	sieve_binary_block_clear(sblock);
+	sieve_binary_emit_unsigned(sblock, sbin->data_flags);
+	sieve_binary_data_list_emit(sblock, &sbin->data_headers);
+	sieve_binary_data_list_emit(sblock, &sbin->data_envelope_parts);
+
+	sbin->data_requirements_known = TRUE;
+}
+
+static bool
+sieve_binary_data_list_read(struct sieve_binary *sbin,
+			    struct sieve_binary_block *sblock,
+			    sieve_size_t *offset, ARRAY_TYPE(const_string) *list)
+{
+	unsigned int count, i;
+	string_t *item;
+
+	if (!sieve_binary_read_unsigned(sblock, offset, &count))
+		return FALSE;
+	for (i = 0; i < count; i++) {
+		if (!sieve_binary_read_string(sblock, offset, &item))
+			return FALSE;
+		sieve_binary_data_list_add(sbin, list, str_c(item));
+	}
+	return TRUE;
+}
+
+static void sieve_binary_read_data_requirements(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+	sieve_size_t offset = 0;
+	unsigned int flags;
+	bool success;
+
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_DATA_REQUIREMENTS);
+	if (sblock == NULL) {
+		sbin->data_flags = SIEVE_BINARY_DATA_FLAGS_ALL;
+		return;
+	}
+
+	T_BEGIN {
+		success = (sieve_binary_read_unsigned(sblock, &offset, &flags) &&
+			   sieve_binary_data_list_read(sbin, sblock, &offset,
+						       &sbin->data_headers) &&
+			   sieve_binary_data_list_read(sbin, sblock, &offset,
+						       &sbin->data_envelope_parts));
+	} T_END;
+
+	if (!success) {
+		e_debug(sbin->event,
+			"Binary has corrupt data requirements block");
+		sbin->data_flags = SIEVE_BINARY_DATA_FLAGS_ALL;
+		return;
+	}
+	sbin->data_flags = flags;
+}
+
+static const char *const *
+sieve_binary_data_list_get(ARRAY_TYPE(const_string) *list)
+{
+	const char **items;
+	unsigned int count = 0;
+
+	if (array_is_created(list))
+		count = array_count(list);
+
+	items = t_new(const char *, count + 1);
+	if (count > 0)
+		memcpy(items, array_idx(list, 0), sizeof(*items) * count);
+	return items;
+}
+
+void sieve_binary_get_data_requirements(
+	struct sieve_binary *sbin,
+	struct sieve_binary_data_requirements *reqs_r)
+{
+	if (!sbin->data_requirements_known) {
+		sieve_binary_read_data_requirements(sbin);
+		sbin->data_requirements_known = TRUE;
+	}
+
+	i_zero(reqs_r);
+	reqs_r->flags = sbin->data_flags;
+	reqs_r->headers = sieve_binary_data_list_get(&sbin->data_headers);
+	reqs_r->envelope_parts =
+		sieve_binary_data_list_get(&sbin->data_envelope_parts);
+}
+
 /*
  * Up-to-date checking
  */
 
 bool sieve_binary_up_to_date(struct sieve_binary *sbin,
 			     enum sieve_compile_flags cpflags)
+{
+	return sieve_binary_script_up_to_date(sbin, sbin->script, cpflags);
+}
+
+bool sieve_binary_script_up_to_date(struct sieve_binary *sbin,
+				    struct sieve_script *script,
+				    enum sieve_compile_flags cpflags)
 {
 	struct sieve_binary_extension_reg *const *regs;
 	struct sieve_binary_block *sblock;
@@ -441,12 +675,28 @@ bool sieve_binary_up_to_date(struct sieve_binary *sbin,
 
 	i_assert(sbin->file != NULL);
 
+	if (((sbin->header.flags & SIEVE_BINARY_FLAG_ALIGNED_OPERANDS) != 0) !=
+	    sbin->svinst->binary_aligned_operands) {
+		e_debug(sbin->event, "up-to-date: "
+			"binary uses a different operand encoding "
+			"than configured");
+		return FALSE;
+	}
+
 	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_SCRIPT_DATA);
-	if (sblock == NULL || sbin->script == NULL)
+	if (sblock == NULL || script == NULL)
 		return FALSE;
 
-	if ((ret = sieve_script_binary_read_metadata(sbin->script, sblock,
-						     &offset)) <= 0) {
+	if (sbin->shared) {
+		/* The metadata belongs to the script the stored binary was
+		   first compiled for */
+		if (!sieve_binary_store_verify(sbin, script, cpflags)) {
+			e_debug(sbin->event, "up-to-date: "
+				"binary is not the store entry for the script");
+			return FALSE;
+		}
+	} else if ((ret = sieve_script_binary_read_metadata(script, sblock,
+							    &offset)) <= 0) {
 		if (ret < 0) {
 			e_debug(sbin->event, "up-to-date: "
 				"failed to read script metadata from binary");
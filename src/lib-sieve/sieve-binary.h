@@ -9,8 +9,8 @@
  * Config
  */
 
-#define SIEVE_BINARY_VERSION_MAJOR     2
-#define SIEVE_BINARY_VERSION_MINOR     0
+#define SIEVE_BINARY_VERSION_MAJOR     4
+#define SIEVE_BINARY_VERSION_MINOR     1
 
 #define SIEVE_BINARY_BASE_HEADER_SIZE  20
 
@@ -84,6 +84,11 @@ sieve_binary_open(struct sieve_instance *svinst, const char *path,
 		  struct sieve_script *script, enum sieve_error *error_r);
 bool sieve_binary_up_to_date(struct sieve_binary *sbin,
 			     enum sieve_compile_flags cpflags);
+/* Same as sieve_binary_up_to_date(), but checks the binary against another
+   (e.g. newly opened) instance of the script it was loaded for. */
+bool sieve_binary_script_up_to_date(struct sieve_binary *sbin,
+				    struct sieve_script *script,
+				    enum sieve_compile_flags cpflags);
 
 int sieve_binary_check_executable(struct sieve_binary *sbin,
 				  enum sieve_error *error_r,
@@ -97,6 +102,7 @@ enum sieve_binary_system_block {
 	SBIN_SYSBLOCK_SCRIPT_DATA,
 	SBIN_SYSBLOCK_EXTENSIONS,
 	SBIN_SYSBLOCK_MAIN_PROGRAM,
+	SBIN_SYSBLOCK_DATA_REQUIREMENTS,
 	SBIN_SYSBLOCK_LAST
 };
 
@@ -116,6 +122,73 @@ sieve_binary_block_get_binary(const struct sieve_binary_block *sblock);
 
 unsigned int sieve_binary_block_get_id(const struct sieve_binary_block *sblock);
 
+/* The cache of decoded literal string lists attached to a program block. It
+   is freed along with the binary and dropped when the block is cleared. */
+struct sieve_code_literal_cache *
+sieve_binary_block_get_literal_cache(const struct sieve_binary_block *sblock);
+void sieve_binary_block_set_literal_cache(
+	struct sieve_binary_block *sblock,
+	struct sieve_code_literal_cache *litcache);
+
+/* The execution profile attached to a program block; likewise freed along
+   with the binary. */
+struct sieve_profile *
+sieve_binary_block_get_profile(const struct sieve_binary_block *sblock);
+void sieve_binary_block_set_profile(struct sieve_binary_block *sblock,
+				    struct sieve_profile *profile);
+
+/*
+ * Data requirements
+ */
+
+/* The message data a script can access while it is evaluated. This is
+   collected by the code generator and stored in the binary, so that callers
+   can prefetch exactly that data before executing the script. */
+
+enum sieve_binary_data_flags {
+	/* Headers are accessed by names not known at compile time */
+	SIEVE_BINARY_DATA_FLAG_ANY_HEADER = BIT(0),
+	/* The message body is accessed */
+	SIEVE_BINARY_DATA_FLAG_BODY = BIT(1),
+	/* The MIME structure of the message is accessed */
+	SIEVE_BINARY_DATA_FLAG_MIME = BIT(2),
+	/* Envelope parts are accessed by names not known at compile time */
+	SIEVE_BINARY_DATA_FLAG_ANY_ENVELOPE = BIT(3),
+	/* Mailboxes or their metadata are accessed */
+	SIEVE_BINARY_DATA_FLAG_MAILBOX = BIT(4),
+};
+#define SIEVE_BINARY_DATA_FLAGS_ALL \
+	(SIEVE_BINARY_DATA_FLAG_ANY_HEADER | SIEVE_BINARY_DATA_FLAG_BODY | \
+	 SIEVE_BINARY_DATA_FLAG_MIME | SIEVE_BINARY_DATA_FLAG_ANY_ENVELOPE | \
+	 SIEVE_BINARY_DATA_FLAG_MAILBOX)
+/* The whole message is accessed, e.g. to send it elsewhere */
+#define SIEVE_BINARY_DATA_FLAGS_MESSAGE \
+	(SIEVE_BINARY_DATA_FLAG_ANY_HEADER | SIEVE_BINARY_DATA_FLAG_BODY)
+
+struct sieve_binary_data_requirements {
+	enum sieve_binary_data_flags flags;
+
+	/* NULL-terminated lists of lower-case names; the lists are allocated
+	   from the data stack */
+	const char *const *headers;
+	const char *const *envelope_parts;
+};
+
+/* Used during code generation */
+void sieve_binary_require_data(struct sieve_binary *sbin,
+			       enum sieve_binary_data_flags flags);
+void sieve_binary_require_header(struct sieve_binary *sbin,
+				 const char *name);
+void sieve_binary_require_envelope_part(struct sieve_binary *sbin,
+					const char *part);
+void sieve_binary_emit_data_requirements(struct sieve_binary *sbin);
+
+/* Returns the data requirements of the compiled script. When these cannot
+   be determined, all flags are set. */
+void sieve_binary_get_data_requirements(
+	struct sieve_binary *sbin,
+	struct sieve_binary_data_requirements *reqs_r);
+
 /*
  * Extension support
  */
@@ -234,6 +307,11 @@ bool sieve_binary_read_integer(struct sieve_binary_block *sblock,
 bool sieve_binary_read_string(struct sieve_binary_block *sblock,
 			      sieve_size_t *address, string_t **str_r)
 			      ATTR_NULL(3);
+/* Same as sieve_binary_read_string(), but refers to the string in the binary
+   without allocating anything. */
+bool sieve_binary_read_string_ref(struct sieve_binary_block *sblock,
+				  sieve_size_t *address,
+				  struct sieve_string *str_r);
 
 static inline bool ATTR_NULL(3)
 sieve_binary_read_unsigned(struct sieve_binary_block *sblock,
@@ -4,6 +4,8 @@
 #include "lib.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "hash.h"
+#include "array.h"
 
 #include "sieve-common.h"
 #include "sieve-limits.h"
@@ -27,6 +29,8 @@
 
 static int sieve_code_stringlist_next_item
 	(struct sieve_stringlist *_strlist, string_t **str_r);
+static int sieve_code_stringlist_next_string
+	(struct sieve_stringlist *_strlist, struct sieve_string *str_r);
 static void sieve_code_stringlist_reset
 	(struct sieve_stringlist *_strlist);
 static int sieve_code_stringlist_get_length
@@ -57,6 +61,7 @@ static struct sieve_stringlist *sieve_code_stringlist_create
 	strlist->strlist.runenv = renv;
 	strlist->strlist.exec_status = SIEVE_EXEC_OK;
 	strlist->strlist.next_item = sieve_code_stringlist_next_item;
+	strlist->strlist.next_string = sieve_code_stringlist_next_string;
 	strlist->strlist.reset = sieve_code_stringlist_reset;
 	strlist->strlist.get_length = sieve_code_stringlist_get_length;
 	strlist->start_address = start_address;
@@ -96,6 +101,48 @@ static int sieve_code_stringlist_next_item
 	return -1;
 }
 
+static int sieve_code_stringlist_next_string
+(struct sieve_stringlist *_strlist, struct sieve_string *str_r)
+{
+	struct sieve_code_stringlist *strlist =
+		(struct sieve_code_stringlist *) _strlist;
+	const struct sieve_runtime_env *renv = _strlist->runenv;
+	struct sieve_operand operand;
+	sieve_size_t address;
+	string_t *str;
+	int ret;
+
+	i_zero(str_r);
+
+	/* Check for end of list */
+	if ( strlist->index >= strlist->length )
+		return 0;
+
+	/* Read next item; literals are referenced directly in the binary */
+	address = strlist->current_offset;
+	if ( (ret=sieve_operand_runtime_read(renv, &address, NULL, &operand)) > 0 ) {
+		if ( sieve_operand_is_string_literal(&operand) ) {
+			if ( !sieve_binary_read_string_ref(renv->sblock, &address, str_r) ) {
+				sieve_runtime_trace_operand_error(renv, &operand,
+					"invalid string operand");
+				ret = SIEVE_EXEC_BIN_CORRUPT;
+			}
+		} else if ( (ret=sieve_opr_string_read_data
+			(renv, &operand, &address, NULL, &str)) == SIEVE_EXEC_OK ) {
+			sieve_string_init_str(str_r, str);
+		}
+	}
+
+	if ( ret == SIEVE_EXEC_OK ) {
+		strlist->index++;
+		strlist->current_offset = address;
+		return 1;
+	}
+
+	_strlist->exec_status = ret;
+	return -1;
+}
+
 static void sieve_code_stringlist_reset
 (struct sieve_stringlist *_strlist)
 {
@@ -115,6 +162,363 @@ static int sieve_code_stringlist_get_length
 	return strlist->length;
 }
 
+/*
+ * Code single stringlist
+ */
+
+/* A literal string operand that is read as a string list. Other than the
+ * generic single stringlist, it remembers where the string is located in the
+ * binary, so that data derived from it can be cached.
+ */
+
+/* Forward declarations */
+
+static int sieve_code_single_stringlist_next_item
+	(struct sieve_stringlist *_strlist, string_t **str_r);
+static void sieve_code_single_stringlist_reset
+	(struct sieve_stringlist *_strlist);
+static int sieve_code_single_stringlist_get_length
+	(struct sieve_stringlist *_strlist);
+
+/* Coded single stringlist object */
+
+struct sieve_code_single_stringlist {
+	struct sieve_stringlist strlist;
+
+	sieve_size_t address;
+	string_t *value;
+
+	bool end:1;
+};
+
+static struct sieve_stringlist *sieve_code_single_stringlist_create
+(const struct sieve_runtime_env *renv, sieve_size_t address, string_t *str)
+{
+	struct sieve_code_single_stringlist *strlist;
+
+	strlist = t_new(struct sieve_code_single_stringlist, 1);
+	strlist->strlist.runenv = renv;
+	strlist->strlist.exec_status = SIEVE_EXEC_OK;
+	strlist->strlist.next_item = sieve_code_single_stringlist_next_item;
+	strlist->strlist.reset = sieve_code_single_stringlist_reset;
+	strlist->strlist.get_length = sieve_code_single_stringlist_get_length;
+	strlist->address = address;
+	strlist->value = str;
+
+	return &strlist->strlist;
+}
+
+/* Stringlist implementation */
+
+static int sieve_code_single_stringlist_next_item
+(struct sieve_stringlist *_strlist, string_t **str_r)
+{
+	struct sieve_code_single_stringlist *strlist =
+		(struct sieve_code_single_stringlist *) _strlist;
+
+	if ( strlist->end ) {
+		*str_r = NULL;
+		return 0;
+	}
+
+	*str_r = strlist->value;
+	strlist->end = TRUE;
+	return 1;
+}
+
+static void sieve_code_single_stringlist_reset
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_code_single_stringlist *strlist =
+		(struct sieve_code_single_stringlist *) _strlist;
+
+	strlist->end = FALSE;
+}
+
+static int sieve_code_single_stringlist_get_length
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_code_single_stringlist *strlist =
+		(struct sieve_code_single_stringlist *) _strlist;
+
+	return ( str_len(strlist->value) > 0 ? 1 : 0 );
+}
+
+/*
+ * Code literal stringlist
+ */
+
+/* A string list consisting only of string literals. Its items are decoded
+ * only once for the loaded binary into strings that refer to the binary, so
+ * iterating the list allocates nothing.
+ */
+
+struct sieve_code_literal_list {
+	string_t *items;
+	unsigned int count;
+
+	bool literal:1;
+};
+
+/* Literal string lists decoded so far, attached to the program block */
+
+struct sieve_code_literal_cache {
+	/* Size of the block when the cache was created */
+	size_t code_size;
+
+	/* Decoded string lists are allocated from this pool */
+	pool_t pool;
+
+	/* Address of the first item -> decoded string list */
+	HASH_TABLE(void *, struct sieve_code_literal_list *) literal_lists;
+};
+
+static struct sieve_code_literal_cache *sieve_code_literal_cache_get
+(struct sieve_binary_block *sblock)
+{
+	struct sieve_code_literal_cache *litcache =
+		sieve_binary_block_get_literal_cache(sblock);
+	size_t code_size = sieve_binary_block_get_size(sblock);
+
+	if ( litcache != NULL ) {
+		if ( litcache->code_size == code_size )
+			return litcache;
+
+		/* Block changed since the lists were decoded */
+		sieve_binary_block_set_literal_cache(sblock, NULL);
+		sieve_code_literal_cache_free(&litcache);
+	}
+
+	litcache = i_new(struct sieve_code_literal_cache, 1);
+	litcache->code_size = code_size;
+	litcache->pool = pool_alloconly_create("sieve literal cache", 1024);
+
+	sieve_binary_block_set_literal_cache(sblock, litcache);
+	return litcache;
+}
+
+void sieve_code_literal_cache_free
+(struct sieve_code_literal_cache **_litcache)
+{
+	struct sieve_code_literal_cache *litcache = *_litcache;
+
+	*_litcache = NULL;
+	if ( litcache == NULL )
+		return;
+
+	if ( hash_table_is_created(litcache->literal_lists) )
+		hash_table_destroy(&litcache->literal_lists);
+	pool_unref(&litcache->pool);
+	i_free(litcache);
+}
+
+static const struct sieve_code_literal_list *sieve_code_literal_cache_lookup
+(struct sieve_binary_block *sblock, sieve_size_t start,
+	unsigned int length, sieve_size_t end)
+{
+	struct sieve_code_literal_cache *litcache;
+	sieve_size_t address = start;
+	struct sieve_code_literal_list *list;
+	string_t *items;
+	unsigned int i;
+
+	litcache = sieve_code_literal_cache_get(sblock);
+
+	if ( !hash_table_is_created(litcache->literal_lists) ) {
+		hash_table_create_direct(&litcache->literal_lists, default_pool, 0);
+	} else {
+		list = hash_table_lookup
+			(litcache->literal_lists, POINTER_CAST(start));
+		if ( list != NULL )
+			return ( list->literal ? list : NULL );
+	}
+
+	list = p_new(litcache->pool, struct sieve_code_literal_list, 1);
+
+	/* Each item occupies at least one byte; anything else is left to the
+	 * generic string list to report as corrupt */
+	if ( end <= litcache->code_size && address <= end &&
+		length <= (end - address) ) {
+		items = p_new(litcache->pool, string_t, length);
+
+		list->literal = TRUE;
+		for ( i = 0; list->literal && i < length; i++ ) {
+			struct sieve_operand operand;
+			struct sieve_string str;
+
+			if ( !sieve_operand_read(sblock, &address, NULL, &operand) ||
+				!sieve_operand_is_string_literal(&operand) ||
+				!sieve_binary_read_string_ref(sblock, &address, &str) ) {
+				list->literal = FALSE;
+				break;
+			}
+
+			/* Strings in the binary are NUL-terminated */
+			buffer_create_from_const_data
+				(&items[i], str.data, str.size + 1);
+			buffer_set_used_size(&items[i], str.size);
+		}
+
+		if ( list->literal && address == end ) {
+			list->items = items;
+			list->count = length;
+		} else {
+			list->literal = FALSE;
+		}
+	}
+
+	hash_table_insert(litcache->literal_lists, POINTER_CAST(start), list);
+	return ( list->literal ? list : NULL );
+}
+
+/* Forward declarations */
+
+static int sieve_code_literal_stringlist_next_item
+	(struct sieve_stringlist *_strlist, string_t **str_r);
+static int sieve_code_literal_stringlist_next_string
+	(struct sieve_stringlist *_strlist, struct sieve_string *str_r);
+static void sieve_code_literal_stringlist_reset
+	(struct sieve_stringlist *_strlist);
+static int sieve_code_literal_stringlist_get_length
+	(struct sieve_stringlist *_strlist);
+
+/* Coded literal stringlist object */
+
+struct sieve_code_literal_stringlist {
+	struct sieve_stringlist strlist;
+
+	sieve_size_t address;
+	const struct sieve_code_literal_list *list;
+	unsigned int index;
+};
+
+static struct sieve_stringlist *sieve_code_literal_stringlist_create
+(const struct sieve_runtime_env *renv, sieve_size_t address,
+	const struct sieve_code_literal_list *list)
+{
+	struct sieve_code_literal_stringlist *strlist;
+
+	strlist = t_new(struct sieve_code_literal_stringlist, 1);
+	strlist->strlist.runenv = renv;
+	strlist->strlist.exec_status = SIEVE_EXEC_OK;
+	strlist->strlist.next_item = sieve_code_literal_stringlist_next_item;
+	strlist->strlist.next_string = sieve_code_literal_stringlist_next_string;
+	strlist->strlist.reset = sieve_code_literal_stringlist_reset;
+	strlist->strlist.get_length = sieve_code_literal_stringlist_get_length;
+	strlist->address = address;
+	strlist->list = list;
+
+	return &strlist->strlist;
+}
+
+/* Stringlist implementation */
+
+static int sieve_code_literal_stringlist_next_item
+(struct sieve_stringlist *_strlist, string_t **str_r)
+{
+	struct sieve_code_literal_stringlist *strlist =
+		(struct sieve_code_literal_stringlist *) _strlist;
+
+	if ( strlist->index >= strlist->list->count ) {
+		*str_r = NULL;
+		return 0;
+	}
+
+	*str_r = &strlist->list->items[strlist->index++];
+	return 1;
+}
+
+static int sieve_code_literal_stringlist_next_string
+(struct sieve_stringlist *_strlist, struct sieve_string *str_r)
+{
+	struct sieve_code_literal_stringlist *strlist =
+		(struct sieve_code_literal_stringlist *) _strlist;
+	string_t *item;
+
+	if ( strlist->index >= strlist->list->count ) {
+		i_zero(str_r);
+		return 0;
+	}
+
+	item = &strlist->list->items[strlist->index++];
+	str_r->data = str_data(item);
+	str_r->size = str_len(item);
+	return 1;
+}
+
+static void sieve_code_literal_stringlist_reset
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_code_literal_stringlist *strlist =
+		(struct sieve_code_literal_stringlist *) _strlist;
+
+	strlist->index = 0;
+}
+
+static int sieve_code_literal_stringlist_get_length
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_code_literal_stringlist *strlist =
+		(struct sieve_code_literal_stringlist *) _strlist;
+
+	return (int)strlist->list->count;
+}
+
+/* Literal key lists */
+
+bool sieve_code_stringlist_get_address
+(struct sieve_stringlist *_strlist, sieve_size_t *address_r)
+{
+	struct sieve_code_stringlist *strlist =
+		(struct sieve_code_stringlist *) _strlist;
+
+	/* Only lists read directly from the binary have a fixed address */
+	if ( _strlist->next_item == sieve_code_single_stringlist_next_item ) {
+		*address_r = ((struct sieve_code_single_stringlist *) _strlist)->address;
+		return TRUE;
+	}
+	if ( _strlist->next_item == sieve_code_literal_stringlist_next_item ) {
+		*address_r = ((struct sieve_code_literal_stringlist *) _strlist)->address;
+		return TRUE;
+	}
+	if ( _strlist->next_item != sieve_code_stringlist_next_item )
+		return FALSE;
+
+	*address_r = strlist->start_address;
+	return TRUE;
+}
+
+bool sieve_code_stringlist_is_literal
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_code_stringlist *strlist =
+		(struct sieve_code_stringlist *) _strlist;
+	struct sieve_binary_block *sblock = _strlist->runenv->sblock;
+	sieve_size_t address;
+	int i;
+
+	/* Only created for string literals */
+	if ( _strlist->next_item == sieve_code_single_stringlist_next_item ||
+		_strlist->next_item == sieve_code_literal_stringlist_next_item )
+		return TRUE;
+	if ( _strlist->next_item != sieve_code_stringlist_next_item )
+		return FALSE;
+
+	/* Check whether all items are plain string literals, i.e. whether they
+	   can never change at runtime (e.g. by variable substitution) */
+	address = strlist->start_address;
+	for ( i = 0; i < strlist->length; i++ ) {
+		struct sieve_operand operand;
+
+		if ( !sieve_operand_read(sblock, &address, NULL, &operand) ||
+			!sieve_operand_is_string_literal(&operand) ||
+			!sieve_binary_read_string(sblock, &address, NULL) )
+			return FALSE;
+	}
+
+	return ( address == strlist->end_address );
+}
+
 static bool sieve_code_stringlist_dump
 (const struct sieve_dumptime_env *denv, sieve_size_t *address,
 	unsigned int length, sieve_size_t end, const char *field_name)
@@ -808,8 +1212,13 @@ int sieve_opr_stringlist_read_data
 			if ( (ret=intf->read(renv, oprnd, address, &stritem)) <= 0 )
 				return ret;
 
-			*strlist_r = sieve_single_stringlist_create
-				(renv, stritem, FALSE);
+			if ( sieve_operand_is_string_literal(oprnd) ) {
+				*strlist_r = sieve_code_single_stringlist_create
+					(renv, oprnd->address, stritem);
+			} else {
+				*strlist_r = sieve_single_stringlist_create
+					(renv, stritem, FALSE);
+			}
 		}
 		return SIEVE_EXEC_OK;
 	}
@@ -899,9 +1308,19 @@ static int opr_stringlist_read
 		return SIEVE_EXEC_BIN_CORRUPT;
 	}
 
-	if ( strlist_r != NULL )
-		*strlist_r = sieve_code_stringlist_create
-			(renv, *address, (unsigned int) length, end);
+	if ( strlist_r != NULL ) {
+		const struct sieve_code_literal_list *literals;
+
+		literals = sieve_code_literal_cache_lookup
+			(renv->sblock, *address, (unsigned int) length, end);
+		if ( literals != NULL ) {
+			*strlist_r = sieve_code_literal_stringlist_create
+				(renv, *address, literals);
+		} else {
+			*strlist_r = sieve_code_stringlist_create
+				(renv, *address, (unsigned int) length, end);
+		}
+	}
 
 	/* Skip over the string list for now */
 	*address = end;
@@ -1041,6 +1460,7 @@ extern const struct sieve_operation_def tst_header_operation;
 extern const struct sieve_operation_def tst_exists_operation;
 extern const struct sieve_operation_def tst_size_over_operation;
 extern const struct sieve_operation_def tst_size_under_operation;
+extern const struct sieve_operation_def tst_header_switch_operation;
 
 const struct sieve_operation_def *sieve_operations[] = {
 	NULL,
@@ -1058,7 +1478,8 @@ const struct sieve_operation_def *sieve_operations[] = {
 	&tst_header_operation,
 	&tst_exists_operation,
 	&tst_size_over_operation,
-	&tst_size_under_operation
+	&tst_size_under_operation,
+	&tst_header_switch_operation
 };
 
 const unsigned int sieve_operation_count =
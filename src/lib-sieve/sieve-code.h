@@ -263,6 +263,14 @@ int sieve_opr_stringlist_read_ex
 	(const struct sieve_runtime_env *renv, sieve_size_t *address,
 		const char *field_name, bool optional, struct sieve_stringlist **strlist_r);
 
+bool sieve_code_stringlist_get_address
+	(struct sieve_stringlist *strlist, sieve_size_t *address_r);
+bool sieve_code_stringlist_is_literal
+	(struct sieve_stringlist *strlist);
+
+void sieve_code_literal_cache_free
+	(struct sieve_code_literal_cache **_litcache);
+
 static inline bool sieve_operand_is_stringlist
 (const struct sieve_operand *operand)
 {
@@ -335,6 +343,7 @@ enum sieve_operation_code {
 	SIEVE_OPERATION_EXISTS,
 	SIEVE_OPERATION_SIZE_OVER,
 	SIEVE_OPERATION_SIZE_UNDER,
+	SIEVE_OPERATION_HEADER_SWITCH,
 
 	SIEVE_OPERATION_CUSTOM
 };
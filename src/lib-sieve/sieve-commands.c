@@ -258,6 +258,18 @@ struct sieve_command *sieve_command_prev
 	return NULL;
 }
 
+struct sieve_command *sieve_command_next
+(struct sieve_command *cmd)
+{
+	struct sieve_ast_node *node = sieve_ast_node_next(cmd->ast_node);
+
+	if ( node != NULL ) {
+		return node->command;
+	}
+
+	return NULL;
+}
+
 struct sieve_command *sieve_command_parent
 (struct sieve_command *cmd)
 {
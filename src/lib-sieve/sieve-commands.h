@@ -5,6 +5,7 @@
 
 #include "sieve-common.h"
 #include "sieve-ast.h"
+#include "sieve-binary.h"
 
 /*
  * Argument definition
@@ -145,6 +146,13 @@ struct sieve_command_def {
 	bool (*control_generate)
 		(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd,
 		struct sieve_jumplist *jumps, bool jump_true);
+
+	/* Message data accessed by this command (sieve-binary.h) in addition
+	   to what its generate() function records using
+	   sieve_generate_require_*(). Unless data_declared is set, the command
+	   is assumed to access any message data. */
+	enum sieve_binary_data_flags data_flags;
+	bool data_declared;
 };
 
 /*
@@ -193,6 +201,8 @@ const char *sieve_command_type_name
 
 struct sieve_command *sieve_command_prev
 	(struct sieve_command *cmd);
+struct sieve_command *sieve_command_next
+	(struct sieve_command *cmd);
 struct sieve_command *sieve_command_parent
 	(struct sieve_command *cmd);
 
@@ -283,4 +293,19 @@ extern const unsigned int sieve_core_tests_count;
 bool sieve_command_verify_headers_argument
 (struct sieve_validator *valdtr, struct sieve_ast_argument *headers);
 
+/*
+ * Header switch
+ */
+
+/* Generates a single operation that selects the first of the given header
+ * tests that matches, where all tests must be compatible according to
+ * sieve_optimize_headers_compatible(). The operation jumps to the address
+ * the offset emitted at case_jumps[i] is resolved to when test i matches,
+ * and to the one emitted at *default_jump_r when none does.
+ */
+bool tst_header_generate_switch
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *const *tests,
+		unsigned int count, sieve_size_t *case_jumps,
+		sieve_size_t *default_jump_r);
+
 #endif
@@ -41,6 +41,7 @@ struct sieve_command_context;
 struct sieve_command_registration;
 
 /* sieve-stringlist.h */
+struct sieve_string;
 struct sieve_stringlist;
 
 /* sieve-code.h */
@@ -85,6 +86,11 @@ struct sieve_operand;
 struct sieve_operand_def;
 struct sieve_operand_class;
 struct sieve_operation;
+struct sieve_code_literal_cache;
+
+/* sieve-profile.h */
+struct sieve_profile;
+struct sieve_binary_cache;
 struct sieve_coded_stringlist;
 
 /* sieve-binary.h */
@@ -197,6 +203,9 @@ struct sieve_instance {
 
 	/* Plugin modules */
 	struct sieve_plugin *plugins;
+
+	/* Recently loaded binaries */
+	struct sieve_binary_cache *binary_cache;
 	enum sieve_env_location env_location;
 	enum sieve_delivery_phase delivery_phase;
 
@@ -205,10 +214,19 @@ struct sieve_instance {
 	unsigned int max_actions;
 	unsigned int max_redirects;
 	unsigned int max_cpu_time_secs;
+	unsigned int max_work_units;
 	unsigned int resource_usage_timeout_secs;
 	const struct smtp_address *user_email, *user_email_implicit;
 	struct sieve_address_source redirect_from;
 	unsigned int redirect_duplicate_period;
+	bool memoize_tests;
+	bool binary_aligned_operands;
+	const char *binary_store;
+	unsigned int no_active_script_cache_secs;
+	unsigned int binary_cache_size;
+	unsigned int binary_cache_revalidate_secs;
+	bool binary_mmap;
+	bool profile;
 };
 
 /*
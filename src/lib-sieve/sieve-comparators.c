@@ -243,6 +243,34 @@ const struct sieve_operand_def comparator_operand = {
 	.interface = &core_comparators
 };
 
+/*
+ * Comparator normalization
+ */
+
+const char *p_sieve_comparator_normalize
+(pool_t pool, const struct sieve_comparator *cmp,
+	const char *val, size_t val_size)
+{
+	char *dest;
+
+	i_assert( sieve_comparator_can_normalize(cmp) );
+
+	/* i;octet */
+	if ( cmp->def->normalize == NULL )
+		return val;
+
+	dest = p_malloc(pool, val_size + 1);
+	cmp->def->normalize(cmp, val, val_size, dest);
+	return dest;
+}
+
+const char *t_sieve_comparator_normalize
+(const struct sieve_comparator *cmp, const char *val, size_t val_size)
+{
+	return p_sieve_comparator_normalize
+		(pool_datastack_create(), cmp, val, val_size);
+}
+
 /*
  * Trivial/Common comparator method implementations
  */
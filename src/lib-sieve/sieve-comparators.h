@@ -53,6 +53,17 @@ struct sieve_comparator_def {
 		const char **key, const char *key_end);
 	bool (*char_skip)(const struct sieve_comparator *cmp,
 		const char **val, const char *val_end);
+
+	/* Normalization */
+
+	/* Writes the canonical form of the value to dest (which may be equal
+	 * to val). Two values are equal under the comparator exactly when their
+	 * canonical forms are equal octet strings. Normalization must not change
+	 * the size of the value. Comparators for which no such form exists leave
+	 * this NULL; i;octet values are canonical already.
+	 */
+	void (*normalize)(const struct sieve_comparator *cmp,
+		const char *val, size_t val_size, char *dest);
 };
 
 /*
@@ -73,6 +84,22 @@ struct sieve_comparator {
 #define sieve_comparator_is(cmp, definition) \
 	( (cmp)->def == &(definition) )
 
+static inline bool sieve_comparator_can_normalize
+(const struct sieve_comparator *cmp)
+{
+	return ( sieve_comparator_is(cmp, i_octet_comparator) ||
+		(cmp->def != NULL && cmp->def->normalize != NULL) );
+}
+
+/* Returns the canonical form of the value, allocated from the pool. When the
+ * comparator leaves values unchanged (i;octet), val itself is returned.
+ */
+const char *t_sieve_comparator_normalize
+	(const struct sieve_comparator *cmp, const char *val, size_t val_size);
+const char *p_sieve_comparator_normalize
+	(pool_t pool, const struct sieve_comparator *cmp,
+		const char *val, size_t val_size);
+
 static inline const struct sieve_comparator *sieve_comparator_copy
 (pool_t pool, const struct sieve_comparator *cmp_orig)
 {
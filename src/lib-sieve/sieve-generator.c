@@ -10,6 +10,7 @@
 #include "sieve-commands.h"
 #include "sieve-code.h"
 #include "sieve-binary.h"
+#include "sieve-optimizer.h"
 
 #include "sieve-generator.h"
 
@@ -182,6 +183,82 @@ sieve_generator_extension_get_context(struct sieve_generator *gentr,
 	return *ctx;
 }
 
+/*
+ * Data requirements
+ */
+
+void sieve_generate_require_data(const struct sieve_codegen_env *cgenv,
+				 enum sieve_binary_data_flags flags)
+{
+	sieve_binary_require_data(cgenv->sbin, flags);
+}
+
+static void
+sieve_generate_require_names(const struct sieve_codegen_env *cgenv,
+			     struct sieve_ast_argument *arg,
+			     enum sieve_binary_data_flags any_flag,
+			     void (*require)(struct sieve_binary *sbin,
+					     const char *name))
+{
+	struct sieve_ast_argument *item;
+
+	if (arg == NULL)
+		return;
+
+	switch (sieve_ast_argument_type(arg)) {
+	case SAAT_STRING:
+		item = arg;
+		break;
+	case SAAT_STRING_LIST:
+		item = sieve_ast_strlist_first(arg);
+		break;
+	default:
+		sieve_binary_require_data(cgenv->sbin, any_flag);
+		return;
+	}
+
+	while (item != NULL) {
+		if (item->argument == NULL ||
+		    !sieve_argument_is_string_literal(item)) {
+			sieve_binary_require_data(cgenv->sbin, any_flag);
+			return;
+		}
+		require(cgenv->sbin, sieve_ast_argument_strc(item));
+
+		if (sieve_ast_argument_type(arg) != SAAT_STRING_LIST)
+			break;
+		item = sieve_ast_strlist_next(item);
+	}
+}
+
+void sieve_generate_require_headers(const struct sieve_codegen_env *cgenv,
+				    struct sieve_ast_argument *arg)
+{
+	sieve_generate_require_names(cgenv, arg,
+				     SIEVE_BINARY_DATA_FLAG_ANY_HEADER,
+				     sieve_binary_require_header);
+}
+
+void sieve_generate_require_envelope_parts(
+	const struct sieve_codegen_env *cgenv, struct sieve_ast_argument *arg)
+{
+	sieve_generate_require_names(cgenv, arg,
+				     SIEVE_BINARY_DATA_FLAG_ANY_ENVELOPE,
+				     sieve_binary_require_envelope_part);
+}
+
+static void
+sieve_generate_require_command_data(const struct sieve_codegen_env *cgenv,
+				    const struct sieve_command_def *cmd_def)
+{
+	if (!cmd_def->data_declared) {
+		sieve_binary_require_data(cgenv->sbin,
+					  SIEVE_BINARY_DATA_FLAGS_ALL);
+		return;
+	}
+	sieve_binary_require_data(cgenv->sbin, cmd_def->data_flags);
+}
+
 /*
  * Code generation API
  */
@@ -345,6 +422,7 @@ bool sieve_generate_test(const struct sieve_codegen_env *cgenv,
 
 	if (tst_def->control_generate != NULL) {
 		sieve_generate_debug_from_ast_node(cgenv, tst_node);
+		sieve_generate_require_command_data(cgenv, tst_def);
 
 		if (tst_def->control_generate(cgenv, test, jlist, jump_true))
 			return TRUE;
@@ -354,6 +432,7 @@ bool sieve_generate_test(const struct sieve_codegen_env *cgenv,
 
 	if (tst_def->generate != NULL) {
 		sieve_generate_debug_from_ast_node(cgenv, tst_node);
+		sieve_generate_require_command_data(cgenv, tst_def);
 
 		if (tst_def->generate(cgenv, test)) {
 
@@ -390,6 +469,7 @@ sieve_generate_command(const struct sieve_codegen_env *cgenv,
 
 	if (cmd_def->generate != NULL) {
 		sieve_generate_debug_from_ast_node(cgenv, cmd_node);
+		sieve_generate_require_command_data(cgenv, cmd_def);
 
 		return cmd_def->generate(cgenv, command);
 	}
@@ -476,10 +556,13 @@ sieve_generator_run(struct sieve_generator *gentr,
 	/* Generate code */
 
 	if (result) {
+		sieve_optimize(gentr->genenv.ast);
+
 		if (!sieve_generate_block(&gentr->genenv,
 					  sieve_ast_root(gentr->genenv.ast))) {
 			result = FALSE;
 		} else if (topmost) {
+			sieve_binary_emit_data_requirements(sbin);
 			sieve_binary_activate(sbin);
 		}
 	}
@@ -2,6 +2,7 @@
 #define SIEVE_GENERATOR_H
 
 #include "sieve-common.h"
+#include "sieve-binary.h"
 
 /*
  * Code generator
@@ -69,6 +70,23 @@ void sieve_jumplist_reset(struct sieve_jumplist *jlist);
 void sieve_jumplist_add(struct sieve_jumplist *jlist, sieve_size_t jump);
 void sieve_jumplist_resolve(struct sieve_jumplist *jlist);
 
+/*
+ * Data requirements
+ */
+
+/* Record which message data the generated code accesses; see
+   sieve_binary_get_data_requirements(). Data accessed by a command or test
+   as a whole is declared in its struct sieve_command_def instead. */
+void sieve_generate_require_data(const struct sieve_codegen_env *cgenv,
+				 enum sieve_binary_data_flags flags);
+/* The argument is a string or string list of header names. Names that are
+   not literal make the script require any header. */
+void sieve_generate_require_headers(const struct sieve_codegen_env *cgenv,
+				    struct sieve_ast_argument *arg);
+/* Same as sieve_generate_require_headers(), but for envelope parts. */
+void sieve_generate_require_envelope_parts(
+	const struct sieve_codegen_env *cgenv, struct sieve_ast_argument *arg);
+
 /*
  * Code generation API
  */
@@ -23,10 +23,12 @@
 #include "sieve-result.h"
 #include "sieve-comparators.h"
 #include "sieve-runtime-trace.h"
+#include "sieve-profile.h"
 
 #include "sieve-interpreter.h"
 
 #include <string.h>
+#include <time.h>
 
 static struct event_category event_category_sieve_runtime = {
 	.parent = &event_category_sieve,
@@ -47,6 +49,13 @@ struct sieve_interpreter_extension_reg {
 	bool started:1;
 };
 
+/*
+ * Scratch pools
+ */
+
+/* The number of cleared scratch pools kept for reuse */
+#define SIEVE_INTERPRETER_SCRATCH_POOLS 4
+
 /*
  * Code loop
  */
@@ -75,6 +84,9 @@ struct sieve_interpreter {
 	/* Execution status */
 	sieve_size_t pc;          /* Program counter */
 
+	/* Cleared pools for short-lived runtime objects */
+	ARRAY(pool_t) scratch_pools;
+
 	/* Loop stack */
 	ARRAY(struct sieve_interpreter_loop) loop_stack;
 	sieve_size_t loop_limit;
@@ -84,6 +96,7 @@ struct sieve_interpreter {
 	struct sieve_runtime_env runenv;
 	struct sieve_runtime_trace trace;
 	struct sieve_resource_usage rusage;
+	unsigned int cpu_limit_checked_units;
 
 	/* Current operation */
 	struct sieve_operation oprtn;
@@ -92,12 +105,44 @@ struct sieve_interpreter {
 	struct sieve_binary_debug_reader *dreader;
 	unsigned int command_line;
 
+	/* Execution profile; NULL when not profiling */
+	struct sieve_profile *profile;
+	uint64_t profile_bytes;
+
 	bool running:1;		    /* Interpreter is running
 				       (may be interrupted) */
 	bool interrupted:1;         /* Interpreter interrupt requested */
 	bool test_result:1;         /* Result of previous test command */
 };
 
+static void sieve_interpreter_init_event(struct sieve_interpreter *interp)
+{
+	struct sieve_binary *sbin = interp->runenv.sbin;
+
+	interp->runenv.event = event_create(interp->runenv.exec_env->event);
+	event_add_category(interp->runenv.event, &event_category_sieve_runtime);
+	event_add_str(interp->runenv.event, "script_name",
+		      sieve_binary_script_name(sbin));
+	event_add_str(interp->runenv.event, "script_location",
+		      sieve_binary_script_location(sbin));
+	event_add_str(interp->runenv.event, "binary_path",
+		      sieve_binary_path(sbin));
+}
+
+static void
+sieve_interpreter_init_trace(struct sieve_interpreter *interp,
+			     const struct sieve_script_env *senv)
+{
+	i_zero(&interp->trace);
+	interp->runenv.trace = NULL;
+	if (senv->trace_log != NULL) {
+		interp->trace.log = senv->trace_log;
+		interp->trace.config = senv->trace_config;
+		interp->trace.indent = 0;
+		interp->runenv.trace = &interp->trace;
+	}
+}
+
 static struct sieve_interpreter *
 _sieve_interpreter_create(struct sieve_binary *sbin,
 			  struct sieve_binary_block *sblock,
@@ -131,23 +176,11 @@ _sieve_interpreter_create(struct sieve_binary *sbin,
 	interp->runenv.sblock = sblock;
 	sieve_binary_ref(sbin);
 
-	interp->runenv.event = event_create(eenv->event);
-	event_add_category(interp->runenv.event, &event_category_sieve_runtime);
-	event_add_str(interp->runenv.event, "script_name",
-		      sieve_binary_script_name(sbin));
-	event_add_str(interp->runenv.event, "script_location",
-		      sieve_binary_script_location(sbin));
-	event_add_str(interp->runenv.event, "binary_path",
-		      sieve_binary_path(sbin));
+	sieve_interpreter_init_event(interp);
 
 	svinst = sieve_binary_svinst(sbin);
 
-	if (senv->trace_log != NULL) {
-		interp->trace.log = senv->trace_log;
-		interp->trace.config = senv->trace_config;
-		interp->trace.indent = 0;
-		interp->runenv.trace = &interp->trace;
-	}
+	sieve_interpreter_init_trace(interp, senv);
 
 	if (script == NULL)
 		interp->runenv.script = sieve_binary_script(sbin);
@@ -308,6 +341,13 @@ void sieve_interpreter_free(struct sieve_interpreter **_interp)
 		for (i = 0; i < count; i++)
 			pool_unref(&loops[i].pool);
 	}
+	if (array_is_created(&interp->scratch_pools)) {
+		pool_t *pools = array_get_modifiable(&interp->scratch_pools,
+						     &count);
+
+		for (i = 0; i < count; i++)
+			pool_unref(&pools[i]);
+	}
 
 	interp->trace.indent = 0;
 	sieve_runtime_trace_end(renv);
@@ -330,6 +370,70 @@ void sieve_interpreter_free(struct sieve_interpreter **_interp)
 	*_interp = NULL;
 }
 
+static void sieve_interpreter_loops_clear(struct sieve_interpreter *interp)
+{
+	struct sieve_interpreter_loop *loop;
+
+	if (!array_is_created(&interp->loop_stack))
+		return;
+
+	array_foreach_modifiable(&interp->loop_stack, loop)
+		sieve_interpreter_scratch_pool_put(interp, &loop->pool);
+	array_clear(&interp->loop_stack);
+	interp->loop_limit = 0;
+}
+
+void sieve_interpreter_recycle(struct sieve_interpreter *interp,
+			       const struct sieve_execute_env *eenv,
+			       struct sieve_error_handler *ehandler)
+{
+	struct sieve_runtime_env *renv = &interp->runenv;
+	struct sieve_interpreter_extension_reg *eregs;
+	unsigned int count, i;
+
+	i_assert(interp->parent == NULL);
+
+	/* A top-level stop interrupts the interpreter, which leaves it marked
+	   as running */
+	interp->running = FALSE;
+
+	sieve_interpreter_loops_clear(interp);
+
+	/* Bind to the new execution */
+	interp->trace.indent = 0;
+	sieve_runtime_trace_end(renv);
+
+	sieve_error_handler_ref(ehandler);
+	sieve_error_handler_unref(&renv->ehandler);
+	renv->ehandler = ehandler;
+
+	renv->exec_env = eenv;
+	event_unref(&renv->event);
+	sieve_interpreter_init_event(interp);
+	sieve_interpreter_init_trace(interp, eenv->scriptenv);
+
+	renv->result = NULL;
+	renv->msgctx = NULL;
+	renv->pc = interp->reset_vector;
+
+	interp->command_line = 0;
+	interp->interrupted = FALSE;
+	interp->test_result = FALSE;
+	sieve_resource_usage_init(&interp->rusage);
+
+	sieve_runtime_trace_begin(renv);
+
+	/* Let extensions drop the state of the previous execution */
+	eregs = array_get_modifiable(&interp->extensions, &count);
+	for (i = 0; i < count; i++) {
+		eregs[i].started = FALSE;
+		if (eregs[i].intext != NULL && eregs[i].intext->reset != NULL) {
+			eregs[i].intext->reset(eregs[i].ext, interp,
+					       eregs[i].context);
+		}
+	}
+}
+
 /*
  * Accessors
  */
@@ -420,6 +524,75 @@ sieve_runtime_get_full_command_location(const struct sieve_runtime_env *renv)
 		renv->script, sieve_runtime_get_command_location(renv));
 }
 
+/*
+ * Resource accounting
+ */
+
+/* Work units of included scripts are charged to the main script, so that
+   the limit applies to the execution as a whole. */
+static inline struct sieve_interpreter *
+sieve_interpreter_get_root(struct sieve_interpreter *interp)
+{
+	while (interp->parent != NULL)
+		interp = interp->parent;
+	return interp;
+}
+
+void sieve_runtime_charge(const struct sieve_runtime_env *renv,
+			  unsigned int units)
+{
+	struct sieve_interpreter *interp =
+		sieve_interpreter_get_root(renv->interp);
+
+	if ((UINT_MAX - interp->rusage.work_units) < units)
+		interp->rusage.work_units = UINT_MAX;
+	else
+		interp->rusage.work_units += units;
+}
+
+void sieve_runtime_charge_bytes(const struct sieve_runtime_env *renv,
+				size_t size)
+{
+	size_t units = 1 + size / SIEVE_WORK_UNIT_BYTES;
+
+	if (renv->interp->profile != NULL)
+		renv->interp->profile_bytes += size;
+
+	sieve_runtime_charge(renv, (units > UINT_MAX ?
+				    UINT_MAX : (unsigned int)units));
+}
+
+static int
+sieve_interpreter_check_resource_limits(struct sieve_interpreter *interp,
+					struct cpu_limit *climit)
+{
+	const struct sieve_runtime_env *renv = &interp->runenv;
+	struct sieve_instance *svinst = renv->exec_env->svinst;
+	struct sieve_interpreter *root = sieve_interpreter_get_root(interp);
+	unsigned int units = root->rusage.work_units;
+
+	if (svinst->max_work_units > 0 && units > svinst->max_work_units) {
+		sieve_runtime_error(renv, NULL,
+				    "execution exceeded work limit");
+		return SIEVE_EXEC_RESOURCE_LIMIT;
+	}
+
+	/* Reading the CPU clock is a system call; only do so every once in
+	   a while */
+	if (climit == NULL ||
+	    (units - interp->cpu_limit_checked_units) <
+		SIEVE_CPU_LIMIT_CHECK_UNITS)
+		return SIEVE_EXEC_OK;
+	interp->cpu_limit_checked_units = units;
+
+	if (cpu_limit_exceeded(climit)) {
+		sieve_runtime_error(renv, NULL,
+				    "execution exceeded CPU time limit");
+		return SIEVE_EXEC_RESOURCE_LIMIT;
+	}
+	return SIEVE_EXEC_OK;
+}
+
 /*
  * Extension support
  */
@@ -490,6 +663,44 @@ int sieve_interpreter_extension_start(struct sieve_interpreter *interp,
 	return SIEVE_EXEC_OK;
 }
 
+/*
+ * Scratch pools
+ */
+
+pool_t sieve_interpreter_scratch_pool_get(struct sieve_interpreter *interp)
+{
+	pool_t pool;
+	unsigned int count;
+
+	if (!array_is_created(&interp->scratch_pools) ||
+	    (count = array_count(&interp->scratch_pools)) == 0)
+		return pool_alloconly_create("sieve_interpreter_scratch", 1024);
+
+	pool = *array_idx(&interp->scratch_pools, count - 1);
+	array_delete(&interp->scratch_pools, count - 1, 1);
+	return pool;
+}
+
+void sieve_interpreter_scratch_pool_put(struct sieve_interpreter *interp,
+					pool_t *_pool)
+{
+	pool_t pool = *_pool;
+
+	*_pool = NULL;
+	if (!array_is_created(&interp->scratch_pools)) {
+		p_array_init(&interp->scratch_pools, interp->pool,
+			     SIEVE_INTERPRETER_SCRATCH_POOLS);
+	}
+	if (array_count(&interp->scratch_pools) >=
+	    SIEVE_INTERPRETER_SCRATCH_POOLS) {
+		pool_unref(&pool);
+		return;
+	}
+
+	p_clear(pool);
+	array_append(&interp->scratch_pools, &pool, 1);
+}
+
 /*
  * Loop handling
  */
@@ -545,7 +756,7 @@ int sieve_interpreter_loop_start(struct sieve_interpreter *interp,
 	loop->ext_def = ext_def;
 	loop->begin = interp->runenv.pc;
 	loop->end = loop_end;
-	loop->pool =  pool_alloconly_create("sieve_interpreter", 128);
+	loop->pool = sieve_interpreter_scratch_pool_get(interp);
 
 	/* Set new loop limit */
 	interp->loop_limit = loop_end;
@@ -630,7 +841,7 @@ int sieve_interpreter_loop_break(struct sieve_interpreter *interp,
 
 	i = count;
 	do {
-		pool_unref(&loops[i-1].pool);
+		sieve_interpreter_scratch_pool_put(interp, &loops[i-1].pool);
 		i--;
 	} while (i > 0 && &loops[i] != loop);
 	i_assert(&loops[i] == loop);
@@ -880,10 +1091,30 @@ bool sieve_interpreter_get_test_result(struct sieve_interpreter *interp)
  * Code execute
  */
 
+static void
+sieve_interpreter_operation_profile(struct sieve_interpreter *interp,
+				    const struct timespec *start)
+{
+	struct timespec end;
+	uint64_t nsecs = 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == 0 &&
+	    (end.tv_sec > start->tv_sec ||
+	     (end.tv_sec == start->tv_sec && end.tv_nsec > start->tv_nsec))) {
+		nsecs = (uint64_t)(end.tv_sec - start->tv_sec) * 1000000000ULL;
+		nsecs += end.tv_nsec;
+		nsecs -= start->tv_nsec;
+	}
+
+	sieve_profile_account(interp->profile, &interp->oprtn,
+			      nsecs, interp->profile_bytes);
+}
+
 static int sieve_interpreter_operation_execute(struct sieve_interpreter *interp)
 {
 	struct sieve_operation *oprtn = &(interp->oprtn);
 	sieve_size_t *address = &(interp->runenv.pc);
+	struct timespec start = { 0, 0 };
 
 	sieve_runtime_trace_toplevel(&interp->runenv);
 
@@ -895,6 +1126,12 @@ static int sieve_interpreter_operation_execute(struct sieve_interpreter *interp)
 		/* Reset cached command location */
 		interp->command_line = 0;
 
+		if (interp->profile != NULL) {
+			interp->profile_bytes = 0;
+			if (clock_gettime(CLOCK_MONOTONIC, &start) < 0)
+				i_zero(&start);
+		}
+
 		/* Execute the operation */
 		if (op->execute != NULL) { /* Noop ? */
 			T_BEGIN {
@@ -908,6 +1145,8 @@ static int sieve_interpreter_operation_execute(struct sieve_interpreter *interp)
 					    sieve_operation_mnemonic(oprtn));
 		}
 
+		if (interp->profile != NULL)
+			sieve_interpreter_operation_profile(interp, &start);
 		return result;
 	}
 
@@ -940,15 +1179,19 @@ int sieve_interpreter_continue(struct sieve_interpreter *interp,
 					CPU_LIMIT_TYPE_USER);
 	}
 
+	interp->cpu_limit_checked_units =
+		sieve_interpreter_get_root(interp)->rusage.work_units;
+
+	interp->profile = NULL;
+	if (svinst->profile)
+		interp->profile = sieve_profile_get(renv->sblock);
+
 	while (ret == SIEVE_EXEC_OK && !interp->interrupted &&
 	       *address < sieve_binary_block_get_size(renv->sblock)) {
-		if (climit != NULL && cpu_limit_exceeded(climit)) {
-			sieve_runtime_error(
-				renv, NULL,
-				"execution exceeded CPU time limit");
-			ret = SIEVE_EXEC_RESOURCE_LIMIT;
+		sieve_runtime_charge(renv, 1);
+		ret = sieve_interpreter_check_resource_limits(interp, climit);
+		if (ret != SIEVE_EXEC_OK)
 			break;
-		}
 		if (interp->loop_limit != 0 && *address > interp->loop_limit) {
 			sieve_runtime_trace_error(
 				renv, "program crossed loop boundary");
@@ -1007,6 +1250,12 @@ int sieve_interpreter_continue(struct sieve_interpreter *interp,
 			sieve_execution_exitcode_to_str(ret),
 			sieve_resource_usage_get_summary(&interp->rusage));
 		interp->running = FALSE;
+
+		if (interp->profile != NULL) T_BEGIN {
+			sieve_profile_flush(interp->profile,
+					    interp->runenv.event,
+					    interp->dreader);
+		} T_END;
 	}
 
 	sieve_result_unref(&interp->runenv.result);
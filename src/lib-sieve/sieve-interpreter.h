@@ -26,6 +26,14 @@ sieve_interpreter_create_for_block(struct sieve_binary_block *sblock,
 				   ATTR_NULL(3);
 void sieve_interpreter_free(struct sieve_interpreter **_interp);
 
+/* Prepares a top-level interpreter that is not running for executing the
+   same program again in a new execution environment, e.g. for the next
+   message. This is much cheaper than creating a new interpreter, since the
+   extensions are not loaded again; these only reset their runtime state. */
+void sieve_interpreter_recycle(struct sieve_interpreter *interp,
+			       const struct sieve_execute_env *eenv,
+			       struct sieve_error_handler *ehandler);
+
 /*
  * Accessors
  */
@@ -45,6 +53,17 @@ sieve_interpreter_svinst(struct sieve_interpreter *interp);
 void sieve_interpreter_set_result(struct sieve_interpreter *interp,
 				  struct sieve_result *result);
 
+/*
+ * Scratch pools
+ */
+
+/* Returns an empty pool for a short-lived runtime object, such as a match
+   context. Pools returned using sieve_interpreter_scratch_pool_put() are
+   cleared and reused, so that no pool is created for each such object. */
+pool_t sieve_interpreter_scratch_pool_get(struct sieve_interpreter *interp);
+void sieve_interpreter_scratch_pool_put(struct sieve_interpreter *interp,
+					pool_t *_pool);
+
 /*
  * Loop handling
  */
@@ -119,6 +138,18 @@ sieve_runtime_get_command_location(const struct sieve_runtime_env *renv);
 const char *
 sieve_runtime_get_full_command_location(const struct sieve_runtime_env *renv);
 
+/*
+ * Resource accounting
+ */
+
+/* Charges work units to the running script. These count towards the
+   sieve_max_work_units limit, which is checked between operations. */
+void sieve_runtime_charge(const struct sieve_runtime_env *renv,
+			  unsigned int units);
+/* Charges the work units for scanning size bytes of data. */
+void sieve_runtime_charge_bytes(const struct sieve_runtime_env *renv,
+				size_t size);
+
 /*
  * Extension support
  */
@@ -131,6 +162,10 @@ struct sieve_interpreter_extension {
 		   void *context, bool deferred);
 	void (*free)(const struct sieve_extension *ext,
 		     struct sieve_interpreter *interp, void *context);
+	/* Called by sieve_interpreter_recycle() to drop all state that belongs
+	   to the previous execution */
+	void (*reset)(const struct sieve_extension *ext,
+		      struct sieve_interpreter *interp, void *context);
 };
 
 void sieve_interpreter_extension_register(
@@ -32,9 +32,19 @@
 
 #define SIEVE_MAX_MATCH_VALUES                          32
 #define SIEVE_HIGH_CPU_TIME_MSECS                       1500
+#define SIEVE_HIGH_WORK_UNITS                           (5 * 1000 * 1000)
+#define SIEVE_WORK_UNIT_BYTES                           64
+#define SIEVE_CPU_LIMIT_CHECK_UNITS                     256
 #define SIEVE_DEFAULT_MAX_CPU_TIME_SECS                 30
 #define SIEVE_DEFAULT_RESOURCE_USAGE_TIMEOUT_SECS       (60 * 60)
 
+/*
+ * Binary cache
+ */
+
+#define SIEVE_DEFAULT_BINARY_CACHE_SIZE                 16
+#define SIEVE_DEFAULT_BINARY_CACHE_REVALIDATE_SECS      0
+
 /*
  * Actions
  */
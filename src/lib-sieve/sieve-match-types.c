@@ -29,8 +29,12 @@
 
 struct sieve_match_values {
 	pool_t pool;
+	struct sieve_interpreter *interp;
 	ARRAY(string_t *) values;
 	unsigned count;
+
+	/* Bit i is set when value i needs to be captured */
+	uint32_t referenced;
 };
 
 /*
@@ -129,7 +133,12 @@ bool mtch_validator_load
 
 struct mtch_interpreter_context {
 	struct sieve_match_values *match_values;
-	bool match_values_enabled;
+
+	/* Match values read by the running script(s) */
+	uint32_t match_values_referenced;
+
+	bool match_values_enabled:1;
+	bool match_values_referenced_known:1;
 };
 
 static void mtch_interpreter_free
@@ -144,10 +153,26 @@ static void mtch_interpreter_free
 	}
 }
 
+static void mtch_interpreter_reset
+(const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_interpreter *interp, void *context)
+{
+	struct mtch_interpreter_context *mctx =
+		(struct mtch_interpreter_context *) context;
+
+	/* Match values do not carry over to the next execution */
+	if ( mctx->match_values != NULL ) {
+		sieve_interpreter_scratch_pool_put
+			(interp, &mctx->match_values->pool);
+		mctx->match_values = NULL;
+	}
+}
+
 struct sieve_interpreter_extension
 mtch_interpreter_extension = {
 	.ext_def = &match_type_extension,
-	.free = mtch_interpreter_free
+	.free = mtch_interpreter_free,
+	.reset = mtch_interpreter_reset
 };
 
 static inline struct mtch_interpreter_context *get_interpreter_context
@@ -203,6 +228,44 @@ bool sieve_match_values_are_enabled
 	return ( ctx == NULL ? FALSE : ctx->match_values_enabled );
 }
 
+void sieve_match_values_set_referenced
+(const struct sieve_runtime_env *renv, uint32_t referenced)
+{
+	struct mtch_interpreter_context *ctx =
+		get_interpreter_context(renv->interp, TRUE);
+
+	ctx->match_values_referenced |= referenced;
+	ctx->match_values_referenced_known = TRUE;
+}
+
+static inline uint32_t mtch_get_referenced
+(const struct mtch_interpreter_context *ctx)
+{
+	/* Without information from the code generator, capture everything */
+	if ( !ctx->match_values_referenced_known )
+		return (uint32_t)-1;
+	return ctx->match_values_referenced;
+}
+
+unsigned int sieve_match_values_get_needed
+(const struct sieve_runtime_env *renv)
+{
+	struct mtch_interpreter_context *ctx =
+		get_interpreter_context(renv->interp, FALSE);
+	uint32_t referenced;
+	unsigned int needed = 0;
+
+	if ( ctx == NULL || !ctx->match_values_enabled )
+		return 0;
+
+	referenced = mtch_get_referenced(ctx);
+	while ( referenced != 0 ) {
+		referenced >>= 1;
+		needed++;
+	}
+	return needed;
+}
+
 struct sieve_match_values *sieve_match_values_start
 (const struct sieve_runtime_env *renv)
 {
@@ -213,11 +276,13 @@ struct sieve_match_values *sieve_match_values_start
 	if ( ctx == NULL || !ctx->match_values_enabled )
 		return NULL;
 
-	pool_t pool = pool_alloconly_create("sieve_match_values", 1024);
+	pool_t pool = sieve_interpreter_scratch_pool_get(renv->interp);
 
 	match_values = p_new(pool, struct sieve_match_values, 1);
 	match_values->pool = pool;
+	match_values->interp = renv->interp;
 	match_values->count = 0;
+	match_values->referenced = mtch_get_referenced(ctx);
 
 	p_array_init(&match_values->values, pool, 4);
 
@@ -241,7 +306,9 @@ static string_t *sieve_match_values_add_entry
 		str_truncate(entry, 0);
 	}
 
-	mvalues->count++;
+	/* Values that are never read are only accounted for */
+	if ( (mvalues->referenced & (1U << mvalues->count++)) == 0 )
+		return NULL;
 
 	return entry;
 }
@@ -249,7 +316,9 @@ static string_t *sieve_match_values_add_entry
 void sieve_match_values_set
 (struct sieve_match_values *mvalues, unsigned int index, string_t *value)
 {
-	if ( mvalues != NULL && index < array_count(&mvalues->values) ) {
+	if ( mvalues != NULL && index < array_count(&mvalues->values) &&
+		index < SIEVE_MAX_MATCH_VALUES &&
+		(mvalues->referenced & (1U << index)) != 0 ) {
 		string_t * const *ep = array_idx(&mvalues->values, index);
     	string_t *entry = *ep;
 
@@ -269,6 +338,15 @@ void sieve_match_values_add
 		str_append_str(entry, value);
 }
 
+void sieve_match_values_add_data
+(struct sieve_match_values *mvalues, const void *data, size_t size)
+{
+	string_t *entry = sieve_match_values_add_entry(mvalues);
+
+	if ( entry != NULL )
+		str_append_data(entry, data, size);
+}
+
 void sieve_match_values_add_char
 (struct sieve_match_values *mvalues, char c)
 {
@@ -299,7 +377,8 @@ void sieve_match_values_commit
 		return;
 
 	if ( ctx->match_values != NULL ) {
-		pool_unref(&ctx->match_values->pool);
+		sieve_interpreter_scratch_pool_put
+			(renv->interp, &ctx->match_values->pool);
 		ctx->match_values = NULL;
 	}
 
@@ -310,10 +389,13 @@ void sieve_match_values_commit
 void sieve_match_values_abort
 (struct sieve_match_values **mvalues)
 {
-	if ( (*mvalues) == NULL ) return;
+	struct sieve_match_values *match_values = *mvalues;
+
+	if ( match_values == NULL ) return;
 
-	pool_unref(&(*mvalues)->pool);
 	*mvalues = NULL;
+	sieve_interpreter_scratch_pool_put
+		(match_values->interp, &match_values->pool);
 }
 
 void sieve_match_values_get
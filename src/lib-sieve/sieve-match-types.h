@@ -64,6 +64,21 @@ struct sieve_match_type_def {
 			const char *key, size_t key_size);
 
 	void (*match_deinit)(struct sieve_match_context *mctx);
+
+	/* Streaming match (optional): the value is passed in consecutive chunks.
+	 * match_stream_init() returns 0 when streaming is not supported for this
+	 * key list, in which case the value is buffered and matched as usual.
+	 * match_stream_more() returns 1 as soon as the outcome is a match.
+	 */
+
+	int (*match_stream_init)
+		(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+			void **context_r);
+	int (*match_stream_more)
+		(struct sieve_match_context *mctx, void *context,
+			const unsigned char *data, size_t size);
+	int (*match_stream_finish)
+		(struct sieve_match_context *mctx, void *context);
 };
 
 /*
@@ -132,6 +147,15 @@ bool sieve_match_values_set_enabled
 	(const struct sieve_runtime_env *renv, bool enable);
 bool sieve_match_values_are_enabled
 	(const struct sieve_runtime_env *renv);
+/* Restricts capturing to the match values that are set in the referenced
+   bitmask (bit i for ${i}). Called for each script that is loaded into the
+   interpreter; when never called, all values are captured. */
+void sieve_match_values_set_referenced
+	(const struct sieve_runtime_env *renv, uint32_t referenced);
+/* Returns the number of leading match values worth capturing: one more than
+   the highest referenced index, or 0 when match values are disabled. */
+unsigned int sieve_match_values_get_needed
+	(const struct sieve_runtime_env *renv);
 
 struct sieve_match_values *sieve_match_values_start
 	(const struct sieve_runtime_env *renv);
@@ -139,6 +163,8 @@ void sieve_match_values_set
 	(struct sieve_match_values *mvalues, unsigned int index, string_t *value);
 void sieve_match_values_add
 	(struct sieve_match_values *mvalues, string_t *value);
+void sieve_match_values_add_data
+	(struct sieve_match_values *mvalues, const void *data, size_t size);
 void sieve_match_values_add_char
 	(struct sieve_match_values *mvalues, char c);
 void sieve_match_values_skip
@@ -5,7 +5,9 @@
 #include "mempool.h"
 #include "hash.h"
 #include "array.h"
+#include "str.h"
 #include "str-sanitize.h"
+#include "istream.h"
 
 #include "sieve-extensions.h"
 #include "sieve-commands.h"
@@ -19,6 +21,7 @@
 #include "sieve-comparators.h"
 #include "sieve-match-types.h"
 #include "sieve-runtime-trace.h"
+#include "sieve-message.h"
 
 #include "sieve-match.h"
 
@@ -40,7 +43,7 @@ struct sieve_match_context *sieve_match_begin
 			return NULL;
 
 	/* Create match context */
-	pool = pool_alloconly_create("sieve_match_context", 1024);
+	pool = sieve_interpreter_scratch_pool_get(renv->interp);
 	mctx = p_new(pool, struct sieve_match_context, 1);
 	mctx->pool = pool;
 	mctx->runenv = renv;
@@ -65,19 +68,65 @@ struct sieve_match_context *sieve_match_begin
 	return mctx;
 }
 
-int sieve_match_value
+int sieve_match_keys_default
 (struct sieve_match_context *mctx, const char *value, size_t value_size,
 	struct sieve_stringlist *key_list)
 {
 	const struct sieve_match_type *mcht = mctx->match_type;
 	const struct sieve_runtime_env *renv = mctx->runenv;
+	struct sieve_string key_item;
 	int match, ret;
 
+	match = 0;
+	while ( match == 0 &&
+		(ret=sieve_stringlist_next_string(key_list, &key_item)) > 0 ) {
+		T_BEGIN {
+			match = mcht->def->match_key
+				(mctx, value, value_size, key_item.data, key_item.size);
+
+			if ( mctx->trace ) {
+				sieve_runtime_trace(renv, 0,
+					"with key `%s' => %d", str_sanitize(key_item.data, 80),
+					match);
+			}
+		} T_END;
+	}
+
+	if ( ret < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		match = -1;
+	}
+
+	return match;
+}
+
+int sieve_match_value
+(struct sieve_match_context *mctx, const char *value, size_t value_size,
+	struct sieve_stringlist *key_list)
+{
+	const struct sieve_match_type *mcht = mctx->match_type;
+	const struct sieve_runtime_env *renv = mctx->runenv;
+	size_t charge_size;
+	int match;
+
 	if ( mctx->trace ) {
 		sieve_runtime_trace(renv, 0,
 			"matching value `%s'", str_sanitize(value, 80));
 	}
 
+	/* Every key comparison scans the value once */
+	if ( mctx->key_list != key_list ) {
+		mctx->key_list = key_list;
+		mctx->key_count = sieve_stringlist_get_length(key_list);
+	}
+	if ( mctx->key_count <= 1 )
+		charge_size = value_size;
+	else if ( value_size > SIZE_MAX / (unsigned int)mctx->key_count )
+		charge_size = SIZE_MAX;
+	else
+		charge_size = value_size * (unsigned int)mctx->key_count;
+	sieve_runtime_charge_bytes(renv, charge_size);
+
 	/* Match to key values */
 
 	sieve_stringlist_reset(key_list);
@@ -91,28 +140,8 @@ int sieve_match_value
 		/* Call match-type's own key match handler */
 		match = mcht->def->match_keys(mctx, value, value_size, key_list);
 	} else {
-		string_t *key_item = NULL;
-
 		/* Default key match loop */
-		match = 0;
-		while ( match == 0 &&
-			(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
-			T_BEGIN {
-				match = mcht->def->match_key
-					(mctx, value, value_size, str_c(key_item), str_len(key_item));
-
-				if ( mctx->trace ) {
-					sieve_runtime_trace(renv, 0,
-						"with key `%s' => %d", str_sanitize(str_c(key_item), 80),
-						match);
-				}
-			} T_END;
-		}
-
-		if ( ret < 0 ) {
-			mctx->exec_status = key_list->exec_status;
-			match = -1;
-		}
+		match = sieve_match_keys_default(mctx, value, value_size, key_list);
 	}
 
 	sieve_runtime_trace_ascend(renv);
@@ -125,11 +154,96 @@ int sieve_match_value
 	return match;
 }
 
+static int sieve_match_stream_read_error
+(struct sieve_match_context *mctx, struct istream *input)
+{
+	sieve_runtime_critical(mctx->runenv, NULL,
+		"failed to read match value",
+		"read(%s) failed: %s", i_stream_get_name(input),
+		i_stream_get_error(input));
+	mctx->exec_status = SIEVE_EXEC_TEMP_FAILURE;
+	mctx->match_status = -1;
+	return -1;
+}
+
+static int sieve_match_value_stream_buffered
+(struct sieve_match_context *mctx, struct istream *input,
+	struct sieve_stringlist *key_list)
+{
+	const unsigned char *data;
+	string_t *value;
+	size_t size;
+	int match, ret;
+
+	value = str_new(default_pool, 8192);
+	while ( (ret=i_stream_read_more(input, &data, &size)) > 0 ) {
+		str_append_data(value, data, size);
+		i_stream_skip(input, size);
+	}
+
+	if ( ret < 0 && input->stream_errno != 0 ) {
+		str_free(&value);
+		return sieve_match_stream_read_error(mctx, input);
+	}
+
+	match = sieve_match_value(mctx, str_c(value), str_len(value), key_list);
+	str_free(&value);
+	return match;
+}
+
+int sieve_match_value_stream
+(struct sieve_match_context *mctx, struct istream *input,
+	struct sieve_stringlist *key_list)
+{
+	const struct sieve_match_type *mcht = mctx->match_type;
+	const unsigned char *data;
+	void *context = NULL;
+	size_t size;
+	int match, ret;
+
+	/* Tracing reports the value and the result for each individual key */
+	if ( mctx->trace || mcht->def->match_stream_init == NULL )
+		return sieve_match_value_stream_buffered(mctx, input, key_list);
+
+	sieve_stringlist_reset(key_list);
+	if ( (ret=mcht->def->match_stream_init(mctx, key_list, &context)) < 0 ) {
+		mctx->match_status = -1;
+		return -1;
+	}
+	if ( ret == 0 ) {
+		sieve_stringlist_reset(key_list);
+		return sieve_match_value_stream_buffered(mctx, input, key_list);
+	}
+
+	/* Feed the value in chunks until the outcome is known */
+	match = 0;
+	while ( match == 0 &&
+		(ret=i_stream_read_more(input, &data, &size)) > 0 ) {
+		sieve_runtime_charge_bytes(mctx->runenv, size);
+		match = mcht->def->match_stream_more(mctx, context, data, size);
+		i_stream_skip(input, size);
+	}
+
+	if ( match == 0 ) {
+		if ( ret < 0 && input->stream_errno != 0 )
+			return sieve_match_stream_read_error(mctx, input);
+		match = mcht->def->match_stream_finish(mctx, context);
+	}
+
+	if ( mctx->match_status < 0 || match < 0 )
+		mctx->match_status = -1;
+	else
+		mctx->match_status =
+			( mctx->match_status > match ? mctx->match_status : match );
+	return match;
+}
+
 int sieve_match_end(struct sieve_match_context **mctx, int *exec_status)
 {
 	const struct sieve_match_type *mcht = (*mctx)->match_type;
 	const struct sieve_runtime_env *renv = (*mctx)->runenv;
 	int match = (*mctx)->match_status;
+	pool_t pool = (*mctx)->pool;
 
 	if ( mcht->def != NULL && mcht->def->match_deinit != NULL )
 		mcht->def->match_deinit(*mctx);
@@ -137,7 +251,9 @@ int sieve_match_end(struct sieve_match_context **mctx, int *exec_status)
 	if ( exec_status != NULL )
 		*exec_status = (*mctx)->exec_status;
 
-	pool_unref(&(*mctx)->pool);
+	/* Recycle the pool for the next match */
+	*mctx = NULL;
+	sieve_interpreter_scratch_pool_put(renv->interp, &pool);
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_MATCHING,
 		"finishing match with result: %s",
@@ -156,7 +272,7 @@ int sieve_match
 	int *exec_status)
 {
 	struct sieve_match_context *mctx;
-	string_t *value_item = NULL;
+	struct sieve_string value_item;
 	int match, ret;
 
 	if ( (mctx=sieve_match_begin(renv, mcht, cmp)) == NULL )
@@ -179,10 +295,10 @@ int sieve_match
 
 		match = 0;
 		while ( match == 0 &&
-			(ret=sieve_stringlist_next_item(value_list, &value_item)) > 0 ) {
+			(ret=sieve_stringlist_next_string(value_list, &value_item)) > 0 ) {
 
 			match = sieve_match_value
-				(mctx, str_c(value_item), str_len(value_item), key_list);
+				(mctx, value_item.data, value_item.size, key_list);
 		}
 
 		if ( ret < 0 ) {
@@ -195,6 +311,177 @@ int sieve_match
 	return match;
 }
 
+/*
+ * Memoization
+ */
+
+bool sieve_match_memo_key_add
+(const struct sieve_runtime_env *renv, buffer_t *key,
+	const struct sieve_match_type *mcht, const struct sieve_comparator *cmp)
+{
+	/* Reusing the result would skip setting the match values */
+	if ( sieve_match_values_get_needed(renv) > 0 &&
+		!sieve_match_type_is(mcht, is_match_type) &&
+		!sieve_match_type_is(mcht, contains_match_type) )
+		return FALSE;
+
+	sieve_message_memo_key_add_object(key, mcht->def);
+	sieve_message_memo_key_add_object(key, cmp->def);
+	return TRUE;
+}
+
+/*
+ * Key list cache
+ */
+
+extern const struct sieve_extension_def match_type_extension;
+
+struct sieve_match_key_list_key {
+	const struct sieve_match_type_def *mcht;
+	const struct sieve_comparator_def *cmp;
+	unsigned int block_id;
+	sieve_size_t address;
+};
+
+struct sieve_match_key_list_entry {
+	struct sieve_match_key_list_key key;
+
+	void *data;
+
+	bool literal:1;
+};
+
+struct sieve_match_binary_context {
+	HASH_TABLE(const struct sieve_match_key_list_key *,
+		struct sieve_match_key_list_entry *) key_lists;
+};
+
+static unsigned int sieve_match_key_list_key_hash
+(const struct sieve_match_key_list_key *key)
+{
+	return (unsigned int)key->address ^ (key->block_id << 24);
+}
+
+static int sieve_match_key_list_key_cmp
+(const struct sieve_match_key_list_key *key1,
+	const struct sieve_match_key_list_key *key2)
+{
+	if ( key1->address != key2->address )
+		return ( key1->address < key2->address ? -1 : 1 );
+	if ( key1->block_id != key2->block_id )
+		return ( key1->block_id < key2->block_id ? -1 : 1 );
+	if ( key1->mcht != key2->mcht )
+		return ( key1->mcht < key2->mcht ? -1 : 1 );
+	if ( key1->cmp != key2->cmp )
+		return ( key1->cmp < key2->cmp ? -1 : 1 );
+	return 0;
+}
+
+static void mtch_binary_free
+(const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_binary *sbin ATTR_UNUSED, void *context)
+{
+	struct sieve_match_binary_context *bctx =
+		(struct sieve_match_binary_context *) context;
+
+	hash_table_destroy(&bctx->key_lists);
+}
+
+static const struct sieve_binary_extension mtch_binary_ext = {
+	.extension = &match_type_extension,
+	.binary_free = mtch_binary_free
+};
+
+static struct sieve_match_binary_context *sieve_match_binary_context_get
+(struct sieve_binary *sbin)
+{
+	const struct sieve_extension *mcht_ext =
+		sieve_get_match_type_extension(sieve_binary_svinst(sbin));
+	struct sieve_match_binary_context *bctx;
+
+	bctx = (struct sieve_match_binary_context *)
+		sieve_binary_extension_get_context(sbin, mcht_ext);
+	if ( bctx == NULL ) {
+		pool_t pool = sieve_binary_pool(sbin);
+
+		bctx = p_new(pool, struct sieve_match_binary_context, 1);
+		hash_table_create(&bctx->key_lists, pool, 0,
+			sieve_match_key_list_key_hash, sieve_match_key_list_key_cmp);
+
+		sieve_binary_extension_set(sbin, mcht_ext, &mtch_binary_ext, bctx);
+	}
+	return bctx;
+}
+
+bool sieve_match_key_list_cache_lookup
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	void ***data_r, pool_t *pool_r)
+{
+	const struct sieve_runtime_env *renv = mctx->runenv;
+	struct sieve_match_binary_context *bctx;
+	struct sieve_match_key_list_key lookup_key;
+	struct sieve_match_key_list_entry *entry;
+
+	*data_r = NULL;
+	*pool_r = NULL;
+
+	i_zero(&lookup_key);
+	if ( !sieve_code_stringlist_get_address(key_list, &lookup_key.address) )
+		return FALSE;
+	lookup_key.mcht = mctx->match_type->def;
+	lookup_key.cmp = mctx->comparator->def;
+	lookup_key.block_id = sieve_binary_block_get_id(renv->sblock);
+
+	bctx = sieve_match_binary_context_get(renv->sbin);
+	entry = hash_table_lookup(bctx->key_lists, &lookup_key);
+	if ( entry == NULL ) {
+		/* First encounter: determine once whether the list is literal */
+		entry = p_new(sieve_binary_pool(renv->sbin),
+			struct sieve_match_key_list_entry, 1);
+		entry->key = lookup_key;
+		entry->literal = sieve_code_stringlist_is_literal(key_list);
+
+		hash_table_insert(bctx->key_lists, &entry->key, entry);
+	}
+
+	if ( !entry->literal )
+		return FALSE;
+
+	*data_r = &entry->data;
+	*pool_r = sieve_binary_pool(renv->sbin);
+	return TRUE;
+}
+
+void sieve_match_operation_cache_lookup
+(const struct sieve_runtime_env *renv, const struct sieve_comparator *cmp,
+	void ***data_r, pool_t *pool_r)
+{
+	struct sieve_match_binary_context *bctx;
+	struct sieve_match_key_list_key lookup_key;
+	struct sieve_match_key_list_entry *entry;
+
+	/* Operation addresses never coincide with key list operands; the match
+	 * type is left NULL to tell these entries apart nonetheless */
+	i_zero(&lookup_key);
+	lookup_key.address = renv->oprtn->address;
+	lookup_key.cmp = cmp->def;
+	lookup_key.block_id = sieve_binary_block_get_id(renv->sblock);
+
+	bctx = sieve_match_binary_context_get(renv->sbin);
+	entry = hash_table_lookup(bctx->key_lists, &lookup_key);
+	if ( entry == NULL ) {
+		entry = p_new(sieve_binary_pool(renv->sbin),
+			struct sieve_match_key_list_entry, 1);
+		entry->key = lookup_key;
+		entry->literal = TRUE;
+
+		hash_table_insert(bctx->key_lists, &entry->key, entry);
+	}
+
+	*data_r = &entry->data;
+	*pool_r = sieve_binary_pool(renv->sbin);
+}
+
 /*
  * Reading match operands
  */
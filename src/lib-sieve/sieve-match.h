@@ -17,6 +17,10 @@ struct sieve_match_context {
 
 	void *data;
 
+	/* Key list last matched against and its length */
+	struct sieve_stringlist *key_list;
+	int key_count;
+
 	int match_status;
 	int exec_status;
 
@@ -37,6 +41,18 @@ int sieve_match_value
 		struct sieve_stringlist *key_list);
 int sieve_match_end(struct sieve_match_context **mctx, int *exec_status);
 
+/* Match a value that is read from a stream, e.g. a large message body. Match
+   types that implement streaming never hold the whole value in memory. */
+int sieve_match_value_stream
+	(struct sieve_match_context *mctx, struct istream *input,
+		struct sieve_stringlist *key_list);
+
+/* Default key match loop (for match types that implement match_keys() only
+   for particular cases) */
+int sieve_match_keys_default
+	(struct sieve_match_context *mctx, const char *value, size_t value_size,
+		struct sieve_stringlist *key_list);
+
 /* Default matching operation */
 int sieve_match
 	(const struct sieve_runtime_env *renv,
@@ -46,6 +62,39 @@ int sieve_match
 		struct sieve_stringlist *key_list,
 		int *exec_status);
 
+/*
+ * Memoization
+ */
+
+/* Adds the match type and comparator to a key created by
+ * sieve_message_memo_key_create(). Returns FALSE when the test result cannot
+ * be memoized, because matching would also set match values.
+ */
+bool sieve_match_memo_key_add
+	(const struct sieve_runtime_env *renv, buffer_t *key,
+		const struct sieve_match_type *mcht, const struct sieve_comparator *cmp);
+
+/*
+ * Key list cache
+ */
+
+/* Match types can associate data with a literal key list, i.e. a list read
+ * directly from the binary that cannot change at runtime. The data is kept
+ * for the lifetime of the binary, so it must be allocated from the returned
+ * pool. Returns FALSE if the key list is not literal; *data_r then remains
+ * NULL.
+ */
+bool sieve_match_key_list_cache_lookup
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+		void ***data_r, pool_t *pool_r);
+
+/* Likewise, operations that match only against literal key lists can
+ * associate data with the operation currently being executed.
+ */
+void sieve_match_operation_cache_lookup
+	(const struct sieve_runtime_env *renv, const struct sieve_comparator *cmp,
+		void ***data_r, pool_t *pool_r);
+
 /*
  * Read matching operands
  */
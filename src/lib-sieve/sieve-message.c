@@ -5,6 +5,7 @@
 #include "ioloop.h"
 #include "mempool.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "istream.h"
@@ -79,6 +80,13 @@ struct sieve_message_part {
 	bool epilogue:1;  /* this is a multipart epilogue */
 };
 
+struct sieve_message_memo_entry {
+	const unsigned char *key;
+	size_t key_size;
+
+	bool result;
+};
+
 struct sieve_message_version {
 	struct mail *mail;
 	struct mailbox *box;
@@ -112,6 +120,11 @@ struct sieve_message_context {
 	ARRAY(struct sieve_message_part_data) return_body_parts;
 	buffer_t *raw_body;
 
+	/* Memoized test results */
+
+	HASH_TABLE(const struct sieve_message_memo_entry *,
+		struct sieve_message_memo_entry *) memo;
+
 	bool edit_snapshot:1;
 	bool substitute_snapshot:1;
 };
@@ -184,6 +197,12 @@ void sieve_message_context_ref(struct sieve_message_context *msgctx)
 	msgctx->refcount++;
 }
 
+static void sieve_message_memo_clear(struct sieve_message_context *msgctx)
+{
+	if ( hash_table_is_created(msgctx->memo) )
+		hash_table_destroy(&msgctx->memo);
+}
+
 static void sieve_message_context_clear(struct sieve_message_context *msgctx)
 {
 	struct sieve_message_version *versions;
@@ -212,6 +231,7 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx)
 
 	sieve_message_context_clear(*msgctx);
 
+	sieve_message_memo_clear(*msgctx);
 	if ( (*msgctx)->context_pool != NULL )
 		pool_unref(&((*msgctx)->context_pool));
 
@@ -223,6 +243,7 @@ static void sieve_message_context_flush(struct sieve_message_context *msgctx)
 {
 	pool_t pool;
 
+	sieve_message_memo_clear(msgctx);
 	if ( msgctx->context_pool != NULL )
 		pool_unref(&(msgctx->context_pool));
 
@@ -416,6 +437,9 @@ struct edit_mail *sieve_message_edit
 
 	msgctx->edit_snapshot = FALSE;
 
+	/* The message is about to change */
+	sieve_message_memo_clear(msgctx);
+
 	return version->edit_mail;
 }
 
@@ -437,6 +461,8 @@ static int sieve_message_header_list_next_item
 		string_t **value_r);
 static int sieve_message_header_list_next_value
 	(struct sieve_stringlist *_strlist, string_t **value_r);
+static int sieve_message_header_list_next_string
+	(struct sieve_stringlist *_strlist, struct sieve_string *value_r);
 static void sieve_message_header_list_reset
 	(struct sieve_stringlist *_strlist);
 
@@ -465,6 +491,7 @@ struct sieve_header_list *sieve_message_header_list_create
 	hdrlist->hdrlist.strlist.runenv = renv;
 	hdrlist->hdrlist.strlist.exec_status = SIEVE_EXEC_OK;
 	hdrlist->hdrlist.strlist.next_item = sieve_message_header_list_next_value;
+	hdrlist->hdrlist.strlist.next_string = sieve_message_header_list_next_string;
 	hdrlist->hdrlist.strlist.reset = sieve_message_header_list_reset;
 	hdrlist->hdrlist.next_item = sieve_message_header_list_next_item;
 	hdrlist->field_names = field_names;
@@ -473,30 +500,42 @@ struct sieve_header_list *sieve_message_header_list_create
 	return &hdrlist->hdrlist;
 }
 
-// NOTE: get rid of this once we have a proper Sieve string type
+static inline size_t _header_right_trim_len(const char *raw)
+{
+	const char *p;
+
+	for ( p = raw + strlen(raw); p > raw; p-- ) {
+		if ( p[-1] != ' ' && p[-1] != '\t' ) break;
+	}
+	return (size_t)(p - raw);
+}
+
 static inline string_t *_header_right_trim(const char *raw)
 {
 	string_t *result;
-	const char *p, *pend;
+	size_t len = _header_right_trim_len(raw);
 
-	pend = raw + strlen(raw);
-	if (raw == pend) {
-		result = t_str_new(1);
-	} else {
-		for ( p = pend-1; p >= raw; p-- ) {
-			if ( *p != ' ' && *p != '\t' ) break;
-		}
-		result = t_str_new(p - raw + 1);
-		str_append_data(result, raw, p - raw + 1);
-	}
+	result = t_str_new(len + 1);
+	str_append_data(result, raw, len);
 	return result;
 }
 
+static inline void
+_header_right_trim_string(const char *raw, struct sieve_string *str_r)
+{
+	size_t len = _header_right_trim_len(raw);
+
+	/* The value is only copied when there is whitespace to trim */
+	if ( raw[len] != '\0' )
+		raw = t_strndup(raw, len);
+	sieve_string_init(str_r, raw, len);
+}
+
 /* String list implementation */
 
-static int sieve_message_header_list_next_item
+static int sieve_message_header_list_next_raw
 (struct sieve_header_list *_hdrlist, const char **name_r,
-	string_t **value_r)
+	const char **value_r)
 {
 	struct sieve_message_header_list *hdrlist =
 		(struct sieve_message_header_list *) _hdrlist;
@@ -558,7 +597,23 @@ static int sieve_message_header_list_next_item
 	/* Return next item */
 	if ( name_r != NULL )
 		*name_r = hdrlist->header_name;
-	*value_r = _header_right_trim(hdrlist->headers[hdrlist->headers_index++]);
+	*value_r = hdrlist->headers[hdrlist->headers_index++];
+	return 1;
+}
+
+static int sieve_message_header_list_next_item
+(struct sieve_header_list *_hdrlist, const char **name_r,
+	string_t **value_r)
+{
+	const char *value;
+	int ret;
+
+	*value_r = NULL;
+	if ( (ret=sieve_message_header_list_next_raw
+		(_hdrlist, name_r, &value)) <= 0 )
+		return ret;
+
+	*value_r = _header_right_trim(value);
 	return 1;
 }
 
@@ -572,6 +627,23 @@ static int sieve_message_header_list_next_value
 		(hdrlist, NULL, value_r);
 }
 
+static int sieve_message_header_list_next_string
+(struct sieve_stringlist *_strlist, struct sieve_string *value_r)
+{
+	struct sieve_header_list *hdrlist =
+		(struct sieve_header_list *) _strlist;
+	const char *value;
+	int ret;
+
+	i_zero(value_r);
+	if ( (ret=sieve_message_header_list_next_raw
+		(hdrlist, NULL, &value)) <= 0 )
+		return ret;
+
+	_header_right_trim_string(value, value_r);
+	return 1;
+}
+
 static void sieve_message_header_list_reset
 (struct sieve_stringlist *strlist)
 {
@@ -735,6 +807,120 @@ int sieve_message_opr_optional_read
 	return -1;
 }
 
+/*
+ * Test result memoization
+ */
+
+static unsigned int sieve_message_memo_entry_hash
+(const struct sieve_message_memo_entry *entry)
+{
+	return mem_hash(entry->key, entry->key_size);
+}
+
+static int sieve_message_memo_entry_cmp
+(const struct sieve_message_memo_entry *entry1,
+	const struct sieve_message_memo_entry *entry2)
+{
+	if ( entry1->key_size != entry2->key_size )
+		return ( entry1->key_size < entry2->key_size ? -1 : 1 );
+	return memcmp(entry1->key, entry2->key, entry1->key_size);
+}
+
+buffer_t *sieve_message_memo_key_create
+(const struct sieve_runtime_env *renv,
+	const ARRAY_TYPE(sieve_message_override) *svmos)
+{
+	const struct sieve_operation_def *op_def = renv->oprtn->def;
+	buffer_t *key;
+
+	if ( !renv->exec_env->svinst->memoize_tests )
+		return NULL;
+
+	/* Overrides make the result depend on more than the message, e.g. on
+	 * the MIME part currently being iterated */
+	if ( svmos != NULL && array_is_created(svmos) && array_count(svmos) > 0 )
+		return NULL;
+
+	key = t_buffer_create(128);
+	buffer_append(key, &op_def, sizeof(op_def));
+	return key;
+}
+
+void sieve_message_memo_key_add_object
+(buffer_t *key, const void *object)
+{
+	buffer_append(key, &object, sizeof(object));
+}
+
+bool sieve_message_memo_key_add_stringlist
+(buffer_t *key, struct sieve_stringlist *strlist)
+{
+	struct sieve_string item;
+	uint32_t size;
+	int ret;
+
+	/* Variable items may differ between otherwise identical tests */
+	if ( !sieve_code_stringlist_is_literal(strlist) )
+		return FALSE;
+
+	sieve_stringlist_reset(strlist);
+	while ( (ret=sieve_stringlist_next_string(strlist, &item)) > 0 ) {
+		size = item.size;
+		buffer_append(key, &size, sizeof(size));
+		buffer_append(key, item.data, size);
+	}
+	sieve_stringlist_reset(strlist);
+
+	/* End of list */
+	size = (uint32_t)-1;
+	buffer_append(key, &size, sizeof(size));
+	return ( ret == 0 );
+}
+
+bool sieve_message_memo_lookup
+(const struct sieve_runtime_env *renv, const buffer_t *key, bool *result_r)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	struct sieve_message_memo_entry lookup_entry, *entry;
+
+	if ( !hash_table_is_created(msgctx->memo) )
+		return FALSE;
+
+	i_zero(&lookup_entry);
+	lookup_entry.key = key->data;
+	lookup_entry.key_size = key->used;
+
+	entry = hash_table_lookup(msgctx->memo, &lookup_entry);
+	if ( entry == NULL )
+		return FALSE;
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_MATCHING,
+		"using result of identical earlier test: %s",
+		( entry->result ? "matched" : "not matched" ));
+
+	*result_r = entry->result;
+	return TRUE;
+}
+
+void sieve_message_memo_store
+(const struct sieve_runtime_env *renv, const buffer_t *key, bool result)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	struct sieve_message_memo_entry *entry;
+
+	if ( !hash_table_is_created(msgctx->memo) ) {
+		hash_table_create(&msgctx->memo, msgctx->context_pool, 0,
+			sieve_message_memo_entry_hash, sieve_message_memo_entry_cmp);
+	}
+
+	entry = p_new(msgctx->context_pool, struct sieve_message_memo_entry, 1);
+	entry->key = p_memdup(msgctx->context_pool, key->data, key->used);
+	entry->key_size = key->used;
+	entry->result = result;
+
+	hash_table_update(msgctx->memo, entry, entry);
+}
+
 /*
  * Message header
  */
@@ -1551,6 +1737,42 @@ int sieve_message_body_get_raw
 	return SIEVE_EXEC_OK;
 }
 
+int sieve_message_body_get_raw_stream
+(const struct sieve_runtime_env *renv, struct istream **input_r)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	struct mail *mail;
+	struct istream *input;
+	struct message_size hdr_size, body_size;
+
+	*input_r = NULL;
+
+	/* Use the body if it was read into memory already */
+	if ( msgctx->raw_body != NULL ) {
+		const buffer_t *buf = msgctx->raw_body;
+
+		if ( buf->used > 1 ) {
+			*input_r = i_stream_create_from_data
+				(buf->data, buf->used - 1);
+		}
+		return SIEVE_EXEC_OK;
+	}
+
+	/* Get stream for message */
+	mail = sieve_message_get_mail(msgctx);
+	if ( mail_get_stream(mail, &hdr_size, &body_size, &input) < 0 ) {
+		return sieve_runtime_mail_error(renv, mail,
+			"failed to open input message");
+	}
+
+	/* Limit stream to the body */
+	if ( body_size.physical_size > 0 ) {
+		*input_r = i_stream_create_range(input,
+			hdr_size.physical_size, body_size.physical_size);
+	}
+	return SIEVE_EXEC_OK;
+}
+
 /*
  * Message part iterator
  */
@@ -182,6 +182,34 @@ int sieve_message_opr_optional_read
 		struct sieve_comparator *cmp, 
 		ARRAY_TYPE(sieve_message_override) *svmos);
 
+/*
+ * Test result memoization
+ */
+
+/* Tests that only depend on the message and on literal operands can remember
+ * their result for the message when the sieve_memoize_tests setting is
+ * enabled. Identical tests in other branches, included scripts and scripts
+ * executed later for the same message then reuse it. The results are
+ * forgotten once the message is modified.
+ */
+
+/* Returns NULL when the result of the current operation cannot be memoized */
+buffer_t *sieve_message_memo_key_create
+	(const struct sieve_runtime_env *renv,
+		const ARRAY_TYPE(sieve_message_override) *svmos);
+void sieve_message_memo_key_add_object
+	(buffer_t *key, const void *object);
+/* Returns FALSE when the list is not literal, in which case the key must not
+ * be used */
+bool sieve_message_memo_key_add_stringlist
+	(buffer_t *key, struct sieve_stringlist *strlist);
+
+bool sieve_message_memo_lookup
+	(const struct sieve_runtime_env *renv, const buffer_t *key,
+		bool *result_r);
+void sieve_message_memo_store
+	(const struct sieve_runtime_env *renv, const buffer_t *key, bool result);
+
 /*
  * Message header
  */
@@ -240,6 +268,10 @@ int sieve_message_body_get_text
 int sieve_message_body_get_raw
 	(const struct sieve_runtime_env *renv,
 		struct sieve_message_part_data **parts_r);
+/* Returns the raw message body as a stream, so that it needs not be read into
+   memory as a whole. *input_r is NULL when the message has no body. */
+int sieve_message_body_get_raw_stream
+	(const struct sieve_runtime_env *renv, struct istream **input_r);
 
 /*
  * Message part iterator
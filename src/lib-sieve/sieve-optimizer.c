@@ -0,0 +1,265 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "str.h"
+
+#include "sieve-common.h"
+#include "sieve-ast.h"
+#include "sieve-commands.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
+
+#include "sieve-optimizer.h"
+
+/*
+ * Literal string arguments
+ */
+
+static struct sieve_ast_argument *
+sieve_optimize_string_first(struct sieve_ast_argument *arg)
+{
+	if (sieve_ast_argument_type(arg) == SAAT_STRING_LIST)
+		return sieve_ast_strlist_first(arg);
+	return arg;
+}
+
+static struct sieve_ast_argument *
+sieve_optimize_string_next(struct sieve_ast_argument *arg,
+			   struct sieve_ast_argument *item)
+{
+	if (sieve_ast_argument_type(arg) == SAAT_STRING_LIST)
+		return sieve_ast_strlist_next(item);
+	return NULL;
+}
+
+static bool sieve_optimize_arg_is_literal(struct sieve_ast_argument *arg)
+{
+	struct sieve_ast_argument *item;
+
+	if (arg == NULL || arg->argument == NULL)
+		return FALSE;
+	if (sieve_ast_argument_type(arg) != SAAT_STRING &&
+	    sieve_ast_argument_type(arg) != SAAT_STRING_LIST)
+		return FALSE;
+
+	item = sieve_optimize_string_first(arg);
+	while (item != NULL) {
+		if (item->argument == NULL ||
+		    !sieve_argument_is_string_literal(item))
+			return FALSE;
+		item = sieve_optimize_string_next(arg, item);
+	}
+	return TRUE;
+}
+
+static bool
+sieve_optimize_args_equal_icase(struct sieve_ast_argument *arg1,
+				struct sieve_ast_argument *arg2)
+{
+	struct sieve_ast_argument *item1, *item2;
+
+	item1 = sieve_optimize_string_first(arg1);
+	item2 = sieve_optimize_string_first(arg2);
+	while (item1 != NULL && item2 != NULL) {
+		if (strcasecmp(sieve_ast_argument_strc(item1),
+			       sieve_ast_argument_strc(item2)) != 0)
+			return FALSE;
+
+		item1 = sieve_optimize_string_next(arg1, item1);
+		item2 = sieve_optimize_string_next(arg2, item2);
+	}
+	return (item1 == NULL && item2 == NULL);
+}
+
+/*
+ * Header test merging
+ */
+
+bool sieve_optimize_header_is_literal(struct sieve_command *tst,
+				      const struct sieve_comparator **cmp_r)
+{
+	const struct sieve_comparator *cmp = NULL;
+	struct sieve_ast_argument *arg;
+
+	if (tst == NULL || !sieve_command_is(tst, tst_header))
+		return FALSE;
+
+	arg = sieve_ast_argument_first(tst->ast_node);
+	while (arg != NULL && arg != tst->first_positional) {
+		if (arg->argument == NULL)
+			return FALSE;
+		if (sieve_argument_is_comparator(arg)) {
+			cmp = sieve_comparator_tag_get(arg);
+		} else if (sieve_argument_is_match_type(arg)) {
+			const struct sieve_match_type_context *mtctx =
+				(const struct sieve_match_type_context *)
+					arg->argument->data;
+
+			if (mtctx == NULL || mtctx->match_type == NULL ||
+			    !sieve_match_type_is(mtctx->match_type,
+						 is_match_type))
+				return FALSE;
+		} else {
+			return FALSE;
+		}
+		arg = sieve_ast_argument_next(arg);
+	}
+
+	arg = tst->first_positional;
+	if (!sieve_optimize_arg_is_literal(arg) ||
+	    !sieve_optimize_arg_is_literal(sieve_ast_argument_next(arg)))
+		return FALSE;
+
+	*cmp_r = (cmp == NULL || cmp->def == NULL ? NULL : cmp);
+	return TRUE;
+}
+
+bool sieve_optimize_headers_compatible(struct sieve_command *tst1,
+				       struct sieve_command *tst2)
+{
+	const struct sieve_comparator *cmp1, *cmp2;
+	const struct sieve_comparator_def *cmp_def1, *cmp_def2;
+
+	if (!sieve_optimize_header_is_literal(tst1, &cmp1) ||
+	    !sieve_optimize_header_is_literal(tst2, &cmp2))
+		return FALSE;
+
+	cmp_def1 = (cmp1 == NULL ? &i_ascii_casemap_comparator : cmp1->def);
+	cmp_def2 = (cmp2 == NULL ? &i_ascii_casemap_comparator : cmp2->def);
+	return (cmp_def1 == cmp_def2 &&
+		sieve_optimize_args_equal_icase(tst1->first_positional,
+						tst2->first_positional));
+}
+
+/* Merges the keys of the second header test into the first one. Within an
+   anyof test list, `header :is "X" "a"' followed by `header :is "X" "b"' is
+   equivalent to `header :is "X" ["a", "b"]', because :is yields no match
+   values. */
+static bool
+sieve_optimize_header_merge(struct sieve_command *tst1,
+			    struct sieve_command *tst2)
+{
+	struct sieve_ast_argument *keys1, *keys2, *keys;
+
+	keys1 = sieve_ast_argument_next(tst1->first_positional);
+	keys2 = sieve_ast_argument_next(tst2->first_positional);
+
+	keys = sieve_ast_stringlist_join(keys1, keys2);
+	if (keys == NULL)
+		return FALSE;
+	if (keys->argument == NULL) {
+		keys->argument = sieve_argument_create(
+			keys->ast, &string_list_argument, NULL, 0);
+	}
+	return TRUE;
+}
+
+static void sieve_optimize_anyof_headers(struct sieve_ast_node *node)
+{
+	struct sieve_ast_node *test, *next;
+
+	test = sieve_ast_test_first(node);
+	while (test != NULL) {
+		next = sieve_ast_test_next(test);
+		if (next == NULL)
+			break;
+
+		if (sieve_optimize_headers_compatible(test->command,
+						      next->command) &&
+		    sieve_optimize_header_merge(test->command, next->command)) {
+			/* Keep merging into this test */
+			(void)sieve_ast_node_detach(next);
+			continue;
+		}
+
+		test = next;
+	}
+}
+
+/*
+ * Test lists
+ */
+
+static bool
+sieve_optimize_test_is_flattened(struct sieve_command *tst,
+				 struct sieve_ast_node *subtest)
+{
+	struct sieve_command *subtst = subtest->command;
+
+	if (subtst == NULL || sieve_ast_test_count(subtest) == 0)
+		return FALSE;
+
+	/* anyof(anyof(a, b), c) == anyof(a, b, c) and likewise for allof */
+	if (sieve_commands_equal(tst, subtst))
+		return TRUE;
+
+	/* anyof/allof with a single test is just that test */
+	return ((sieve_command_is(subtst, tst_anyof) ||
+		 sieve_command_is(subtst, tst_allof)) &&
+		sieve_ast_test_count(subtest) == 1);
+}
+
+static void sieve_optimize_tests(struct sieve_ast_node *node)
+{
+	struct sieve_command *tst = node->command;
+	struct sieve_ast_node *test;
+
+	/* Sub-tests first, so that nested lists are flattened bottom-up */
+	test = sieve_ast_test_first(node);
+	while (test != NULL) {
+		sieve_optimize_tests(test);
+		test = sieve_ast_test_next(test);
+	}
+
+	if (tst == NULL ||
+	    (!sieve_command_is(tst, tst_anyof) &&
+	     !sieve_command_is(tst, tst_allof)))
+		return;
+
+	test = sieve_ast_test_first(node);
+	while (test != NULL) {
+		if (sieve_optimize_test_is_flattened(tst, test))
+			test = sieve_ast_test_splice(test);
+		else
+			test = sieve_ast_test_next(test);
+	}
+
+	if (sieve_command_is(tst, tst_anyof))
+		sieve_optimize_anyof_headers(node);
+}
+
+/*
+ * Blocks
+ */
+
+static void sieve_optimize_block(struct sieve_ast_node *block)
+{
+	struct sieve_command *parent = block->command;
+	struct sieve_ast_node *cmd_node;
+
+	cmd_node = sieve_ast_command_first(block);
+	while (cmd_node != NULL) {
+		struct sieve_command *cmd = cmd_node->command;
+
+		sieve_optimize_tests(cmd_node);
+		sieve_optimize_block(cmd_node);
+
+		cmd_node = sieve_ast_command_next(cmd_node);
+
+		/* Commands that follow an unconditional exit from this block
+		   (stop, break) are never executed */
+		if (cmd != NULL &&
+		    (sieve_command_is(cmd, cmd_stop) ||
+		     (parent != NULL && parent->block_exit_command == cmd)))
+			break;
+	}
+
+	while (cmd_node != NULL)
+		cmd_node = sieve_ast_node_detach(cmd_node);
+}
+
+void sieve_optimize(struct sieve_ast *ast)
+{
+	sieve_optimize_block(sieve_ast_root(ast));
+}
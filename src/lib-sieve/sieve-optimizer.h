@@ -0,0 +1,29 @@
+#ifndef SIEVE_OPTIMIZER_H
+#define SIEVE_OPTIMIZER_H
+
+#include "sieve-common.h"
+
+/*
+ * AST optimizer
+ */
+
+/* Rewrites a validated AST into an equivalent one that produces less code.
+   This is run by the code generator right before code is emitted. Constant
+   tests are already folded by the validator. */
+void sieve_optimize(struct sieve_ast *ast);
+
+/*
+ * Header tests
+ */
+
+/* Returns TRUE when the test is a header test that uses the :is match type,
+   has no other tagged arguments, and has literal header names and keys. The
+   comparator is returned in cmp_r; it is NULL for the default comparator. */
+bool sieve_optimize_header_is_literal(struct sieve_command *tst,
+				      const struct sieve_comparator **cmp_r);
+/* Returns TRUE when both tests are literal header tests as above that use
+   the same comparator on the same header names. */
+bool sieve_optimize_headers_compatible(struct sieve_command *tst1,
+				       struct sieve_command *tst2);
+
+#endif
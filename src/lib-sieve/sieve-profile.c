@@ -0,0 +1,335 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "ostream.h"
+
+#include "sieve-common.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+
+#include "sieve-profile.h"
+
+/*
+ * Profile
+ */
+
+struct sieve_profile_counters {
+	uint64_t count;
+	uint64_t nsecs;
+	uint64_t bytes;
+};
+
+struct sieve_profile_entry {
+	sieve_size_t address;
+	const struct sieve_operation_def *op;
+
+	/* Source line; 0 when not known (yet) */
+	unsigned int line;
+
+	/* Since the previous flush */
+	struct sieve_profile_counters run;
+	/* Accumulated totals */
+	struct sieve_profile_counters total;
+};
+
+struct sieve_profile {
+	/* Size of the block when the profile was created */
+	size_t code_size;
+
+	/* Code address -> entry index + 1, or 0 when never executed */
+	uint32_t *index;
+
+	ARRAY(struct sieve_profile_entry) entries;
+	/* Entries executed since the previous flush */
+	ARRAY(unsigned int) pending;
+};
+
+/* Totals for one source line (or for one address when the line is not known)
+ */
+struct sieve_profile_line {
+	unsigned int line;
+	sieve_size_t address;
+	const struct sieve_operation_def *op;
+	uint64_t op_nsecs;
+
+	struct sieve_profile_counters counters;
+};
+ARRAY_DEFINE_TYPE(sieve_profile_line, struct sieve_profile_line);
+
+void sieve_enable_profiling(struct sieve_instance *svinst)
+{
+	svinst->profile = TRUE;
+}
+
+struct sieve_profile *
+sieve_profile_get(struct sieve_binary_block *sblock)
+{
+	struct sieve_profile *profile = sieve_binary_block_get_profile(sblock);
+	size_t code_size = sieve_binary_block_get_size(sblock);
+
+	if (profile != NULL) {
+		if (profile->code_size == code_size)
+			return profile;
+
+		/* Block changed since it was last executed */
+		sieve_binary_block_set_profile(sblock, NULL);
+		sieve_profile_free(&profile);
+	}
+
+	profile = i_new(struct sieve_profile, 1);
+	profile->code_size = code_size;
+	profile->index = i_new(uint32_t, code_size);
+	i_array_init(&profile->entries, 64);
+	i_array_init(&profile->pending, 64);
+
+	sieve_binary_block_set_profile(sblock, profile);
+	return profile;
+}
+
+void sieve_profile_free(struct sieve_profile **_profile)
+{
+	struct sieve_profile *profile = *_profile;
+
+	*_profile = NULL;
+	if (profile == NULL)
+		return;
+
+	array_free(&profile->pending);
+	array_free(&profile->entries);
+	i_free(profile->index);
+	i_free(profile);
+}
+
+static void
+sieve_profile_counters_add(struct sieve_profile_counters *dest,
+			   const struct sieve_profile_counters *src)
+{
+	dest->count += src->count;
+	dest->nsecs += src->nsecs;
+	dest->bytes += src->bytes;
+}
+
+void sieve_profile_account(struct sieve_profile *profile,
+			   const struct sieve_operation *oprtn,
+			   uint64_t nsecs, uint64_t bytes)
+{
+	struct sieve_profile_entry *entry;
+	unsigned int idx;
+
+	if (oprtn->address >= profile->code_size)
+		return;
+
+	idx = profile->index[oprtn->address];
+	if (idx == 0) {
+		entry = array_append_space(&profile->entries);
+		entry->address = oprtn->address;
+		entry->op = oprtn->def;
+
+		idx = array_count(&profile->entries);
+		profile->index[oprtn->address] = idx;
+	}
+
+	entry = array_idx_modifiable(&profile->entries, idx - 1);
+	if (entry->run.count == 0) {
+		idx--;
+		array_append(&profile->pending, &idx, 1);
+	}
+	entry->run.count++;
+	entry->run.nsecs += nsecs;
+	entry->run.bytes += bytes;
+}
+
+/*
+ * Per-line totals
+ */
+
+static int
+sieve_profile_line_cmp_line(const struct sieve_profile_line *line1,
+			    const struct sieve_profile_line *line2)
+{
+	if (line1->line != line2->line)
+		return (line1->line < line2->line ? -1 : 1);
+	if (line1->line == 0 && line1->address != line2->address)
+		return (line1->address < line2->address ? -1 : 1);
+	return 0;
+}
+
+static int
+sieve_profile_line_cmp_cost(const struct sieve_profile_line *line1,
+			    const struct sieve_profile_line *line2)
+{
+	if (line1->counters.nsecs != line2->counters.nsecs)
+		return (line1->counters.nsecs > line2->counters.nsecs ? -1 : 1);
+	return sieve_profile_line_cmp_line(line1, line2);
+}
+
+static void
+sieve_profile_lines_add(ARRAY_TYPE(sieve_profile_line) *lines,
+			const struct sieve_profile_entry *entry,
+			const struct sieve_profile_counters *counters)
+{
+	struct sieve_profile_line *line;
+
+	line = array_append_space(lines);
+	line->line = entry->line;
+	line->address = entry->address;
+	line->op = entry->op;
+	line->op_nsecs = counters->nsecs;
+	line->counters = *counters;
+}
+
+/* Sorts the records by line and merges those of the same line. The operation
+   recorded for the line is the one that took most time. */
+static void sieve_profile_lines_merge(ARRAY_TYPE(sieve_profile_line) *lines)
+{
+	struct sieve_profile_line *recs;
+	unsigned int count, i, j;
+
+	array_sort(lines, sieve_profile_line_cmp_line);
+
+	recs = array_get_modifiable(lines, &count);
+	for (i = 0, j = 0; i < count; i++) {
+		if (j > 0 && sieve_profile_line_cmp_line(&recs[j-1],
+							 &recs[i]) == 0) {
+			if (recs[i].op_nsecs > recs[j-1].op_nsecs) {
+				recs[j-1].op = recs[i].op;
+				recs[j-1].op_nsecs = recs[i].op_nsecs;
+			}
+			sieve_profile_counters_add(&recs[j-1].counters,
+						   &recs[i].counters);
+		} else {
+			recs[j++] = recs[i];
+		}
+	}
+	array_delete(lines, j, count - j);
+}
+
+/*
+ * Flush
+ */
+
+static int
+sieve_profile_pending_cmp(const unsigned int *idx1, const unsigned int *idx2)
+{
+	if (*idx1 == *idx2)
+		return 0;
+	return (*idx1 < *idx2 ? -1 : 1);
+}
+
+void sieve_profile_flush(struct sieve_profile *profile, struct event *event,
+			 struct sieve_binary_debug_reader *dreader)
+{
+	ARRAY_TYPE(sieve_profile_line) lines;
+	const struct sieve_profile_line *line;
+	const unsigned int *idx;
+
+	if (array_count(&profile->pending) == 0)
+		return;
+
+	/* Entries are created in order of first execution; the debug reader is
+	   most efficient when addresses are ascending */
+	array_sort(&profile->pending, sieve_profile_pending_cmp);
+
+	t_array_init(&lines, array_count(&profile->pending));
+	array_foreach(&profile->pending, idx) {
+		struct sieve_profile_entry *entry =
+			array_idx_modifiable(&profile->entries, *idx);
+
+		if (entry->line == 0 && dreader != NULL) {
+			entry->line = sieve_binary_debug_read_line(
+				dreader, entry->address);
+		}
+
+		sieve_profile_lines_add(&lines, entry, &entry->run);
+		sieve_profile_counters_add(&entry->total, &entry->run);
+		i_zero(&entry->run);
+	}
+	array_clear(&profile->pending);
+
+	sieve_profile_lines_merge(&lines);
+	array_foreach(&lines, line) {
+		struct event_passthrough *e =
+			event_create_passthrough(event)->
+			set_name("sieve_runtime_profile")->
+			add_int("line", line->line)->
+			add_str("operation", line->op->mnemonic)->
+			add_int("operations", line->counters.count)->
+			add_int("usecs", line->counters.nsecs / 1000)->
+			add_int("bytes", line->counters.bytes);
+
+		e_debug(e->event(), "Line %u: "
+			"%"PRIu64" operations, %"PRIu64" us, %"PRIu64" bytes",
+			line->line, line->counters.count,
+			line->counters.nsecs / 1000, line->counters.bytes);
+	}
+}
+
+/*
+ * Report
+ */
+
+static void
+sieve_profile_report_block(struct sieve_profile *profile,
+			   struct ostream *output)
+{
+	ARRAY_TYPE(sieve_profile_line) lines;
+	const struct sieve_profile_entry *entry;
+	const struct sieve_profile_line *line;
+	string_t *out;
+
+	t_array_init(&lines, array_count(&profile->entries));
+	array_foreach(&profile->entries, entry) {
+		struct sieve_profile_counters counters = entry->total;
+
+		/* Include what was not flushed yet, e.g. for a script that
+		   failed */
+		sieve_profile_counters_add(&counters, &entry->run);
+		sieve_profile_lines_add(&lines, entry, &counters);
+	}
+	sieve_profile_lines_merge(&lines);
+	array_sort(&lines, sieve_profile_line_cmp_cost);
+
+	out = t_str_new(128);
+	str_printfa(out, "%8s %12s %12s %12s  %s\n",
+		    "line", "operations", "time (us)", "bytes", "operation");
+	array_foreach(&lines, line) {
+		if (line->line > 0)
+			str_printfa(out, "%8u ", line->line);
+		else {
+			str_printfa(out, "%08llx ",
+				    (unsigned long long)line->address);
+		}
+		str_printfa(out, "%12"PRIu64" %12"PRIu64" %12"PRIu64"  %s\n",
+			    line->counters.count, line->counters.nsecs / 1000,
+			    line->counters.bytes, line->op->mnemonic);
+	}
+	o_stream_nsend(output, str_data(out), str_len(out));
+}
+
+void sieve_profile_report(struct sieve_binary *sbin, struct ostream *output)
+{
+	unsigned int count, i;
+
+	count = sieve_binary_block_count(sbin);
+	for (i = 0; i < count; i++) {
+		struct sieve_binary_block *sblock =
+			sieve_binary_block_get(sbin, i);
+		struct sieve_profile *profile;
+
+		if (sblock == NULL)
+			continue;
+		profile = sieve_binary_block_get_profile(sblock);
+		if (profile == NULL || array_count(&profile->entries) == 0)
+			continue;
+
+		T_BEGIN {
+			o_stream_nsend_str(output, t_strdup_printf(
+				"Profile of `%s' (block: %u):\n",
+				sieve_binary_source(sbin), i));
+			sieve_profile_report_block(profile, output);
+		} T_END;
+	}
+}
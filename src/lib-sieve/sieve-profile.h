@@ -0,0 +1,41 @@
+#ifndef SIEVE_PROFILE_H
+#define SIEVE_PROFILE_H
+
+#include "sieve-common.h"
+
+/*
+ * Execution profile
+ */
+
+/* The profile of a program block accumulates the number of executions, the
+   elapsed time and the number of bytes matched for each operation in the
+   block, keyed by its code address. It is attached to the block and lives as
+   long as the loaded binary. The times include those of any nested script
+   executed by the operation, e.g. by include. */
+
+struct sieve_profile;
+
+/* Enables profiling for all scripts executed by this instance; same as the
+   sieve_profile setting. */
+void sieve_enable_profiling(struct sieve_instance *svinst);
+
+struct sieve_profile *
+sieve_profile_get(struct sieve_binary_block *sblock);
+void sieve_profile_free(struct sieve_profile **_profile);
+
+void sieve_profile_account(struct sieve_profile *profile,
+			   const struct sieve_operation *oprtn,
+			   uint64_t nsecs, uint64_t bytes);
+
+/* Maps the operations executed since the previous flush to source lines,
+   emits a sieve_runtime_profile event for each of those lines and adds the
+   counts to the accumulated totals. */
+void sieve_profile_flush(struct sieve_profile *profile, struct event *event,
+			 struct sieve_binary_debug_reader *dreader)
+			 ATTR_NULL(3);
+
+/* Writes the accumulated totals per source line for all blocks of the binary,
+   most expensive lines first. */
+void sieve_profile_report(struct sieve_binary *sbin, struct ostream *output);
+
+#endif
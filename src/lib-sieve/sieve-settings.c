@@ -226,6 +226,14 @@ void sieve_settings_load(struct sieve_instance *svinst)
 		else
 			svinst->max_cpu_time_secs = (unsigned int)period;
 	}
+	svinst->max_work_units = 0;
+	if (sieve_setting_get_uint_value(svinst, "sieve_max_work_units",
+					 &uint_setting)) {
+		if (uint_setting > UINT_MAX)
+			svinst->max_work_units = UINT_MAX;
+		else
+			svinst->max_work_units = (unsigned int)uint_setting;
+	}
 	svinst->resource_usage_timeout_secs =
 		SIEVE_DEFAULT_RESOURCE_USAGE_TIMEOUT_SECS;
 	if (sieve_setting_get_duration_value(
@@ -253,6 +261,59 @@ void sieve_settings_load(struct sieve_instance *svinst)
 		}
 	}
 
+	svinst->memoize_tests = FALSE;
+	(void)sieve_setting_get_bool_value(svinst, "sieve_memoize_tests",
+					   &svinst->memoize_tests);
+
+	svinst->binary_aligned_operands = FALSE;
+	(void)sieve_setting_get_bool_value(svinst,
+					   "sieve_binary_aligned_operands",
+					   &svinst->binary_aligned_operands);
+
+	svinst->no_active_script_cache_secs = 0;
+	if (sieve_setting_get_duration_value(
+		svinst, "sieve_no_active_script_cache", &period)) {
+		if (period > UINT_MAX)
+			svinst->no_active_script_cache_secs = UINT_MAX;
+		else {
+			svinst->no_active_script_cache_secs =
+				(unsigned int)period;
+		}
+	}
+
+	str_setting = sieve_setting_get(svinst, "sieve_binary_store");
+	svinst->binary_store = NULL;
+	if (str_setting != NULL && *str_setting != '\0')
+		svinst->binary_store = p_strdup(svinst->pool, str_setting);
+
+	svinst->binary_cache_size = SIEVE_DEFAULT_BINARY_CACHE_SIZE;
+	if (sieve_setting_get_uint_value(svinst, "sieve_binary_cache_size",
+					 &uint_setting)) {
+		if (uint_setting > UINT_MAX)
+			svinst->binary_cache_size = UINT_MAX;
+		else
+			svinst->binary_cache_size = (unsigned int)uint_setting;
+	}
+	svinst->binary_cache_revalidate_secs =
+		SIEVE_DEFAULT_BINARY_CACHE_REVALIDATE_SECS;
+	if (sieve_setting_get_duration_value(
+		svinst, "sieve_binary_cache_revalidate", &period)) {
+		if (period > UINT_MAX)
+			svinst->binary_cache_revalidate_secs = UINT_MAX;
+		else {
+			svinst->binary_cache_revalidate_secs =
+				(unsigned int)period;
+		}
+	}
+
+	svinst->binary_mmap = TRUE;
+	(void)sieve_setting_get_bool_value(svinst, "sieve_binary_mmap",
+					   &svinst->binary_mmap);
+
+	svinst->profile = FALSE;
+	(void)sieve_setting_get_bool_value(svinst, "sieve_profile",
+					   &svinst->profile);
+
 	str_setting = sieve_setting_get(svinst, "sieve_user_email");
 	if (str_setting != NULL && *str_setting != '\0') {
 		struct smtp_address *address;
@@ -9,6 +9,8 @@
 #include "mkdir-parents.h"
 #include "ioloop.h"
 #include "mail-storage-private.h"
+#include "mail-namespace.h"
+#include "mail-user.h"
 
 #include "sieve-common.h"
 #include "sieve-settings.h"
@@ -48,6 +50,166 @@ void sieve_storage_sync_deinit
 	/* nothing */
 }
 
+/*
+ * Cached absence of an active script
+ */
+
+/* The time at which a delivery last found that the user has no active script
+   is recorded in a header extension of the user's INBOX index, so that later
+   deliveries need not access the script storage at all. Any change to the
+   personal storage that can make a script active increments the reset
+   generation. The delivery records the generation it read before looking up
+   the script, and the recorded time is only valid while that is still the
+   current generation. A change racing with the delivery thus always
+   invalidates it, no matter in which order both are committed. */
+
+#define SIEVE_STORAGE_SYNC_NO_ACTIVE_EXT_NAME "sieve-no-active"
+
+struct sieve_storage_sync_no_active_header {
+	/* Time at which a delivery found no active script */
+	uint32_t timestamp;
+	/* Reset generation read by that delivery before the lookup */
+	uint32_t generation;
+	/* Incremented by every modification of the personal storage */
+	uint32_t reset_generation;
+};
+
+static uint32_t sieve_storage_sync_no_active_ext(struct mailbox *box)
+{
+	return mail_index_ext_register(
+		box->index, SIEVE_STORAGE_SYNC_NO_ACTIVE_EXT_NAME,
+		sizeof(struct sieve_storage_sync_no_active_header), 0, 0);
+}
+
+static void
+sieve_storage_sync_no_active_get(struct mailbox *inbox, uint32_t ext_id,
+				 struct sieve_storage_sync_no_active_header *hdr_r)
+{
+	const void *data;
+	size_t size;
+
+	i_zero(hdr_r);
+	mail_index_get_header_ext(inbox->view, ext_id, &data, &size);
+	memcpy(hdr_r, data, I_MIN(size, sizeof(*hdr_r)));
+}
+
+static void
+sieve_storage_sync_no_active_reset(struct mailbox_transaction_context *trans)
+{
+	struct mailbox *inbox = mailbox_transaction_get_mailbox(trans);
+	struct sieve_storage_sync_no_active_header hdr;
+	uint32_t ext_id, reset_generation;
+
+	ext_id = sieve_storage_sync_no_active_ext(inbox);
+	sieve_storage_sync_no_active_get(inbox, ext_id, &hdr);
+
+	/* Only the generation is written, so that this cannot be undone by a
+	   concurrent delivery recording its result */
+	reset_generation = hdr.reset_generation + 1;
+	mail_index_update_header_ext(
+		trans->itrans, ext_id,
+		offsetof(struct sieve_storage_sync_no_active_header,
+			 reset_generation),
+		&reset_generation, sizeof(reset_generation));
+}
+
+static struct mailbox *
+sieve_storage_sync_inbox_open(struct mail_user *user, struct event *event)
+{
+	struct mail_namespace *ns;
+	struct mailbox *inbox;
+	enum mail_error error;
+
+	ns = mail_namespace_find_inbox(user->namespaces);
+	if (ns == NULL)
+		return NULL;
+
+	inbox = mailbox_alloc(ns->list, "INBOX", MAILBOX_FLAG_IGNORE_ACLS);
+	if (mailbox_open(inbox) < 0) {
+		e_debug(event, "Failed to open user INBOX "
+			"for cached script status: %s",
+			mailbox_get_last_internal_error(inbox, &error));
+		mailbox_free(&inbox);
+		return NULL;
+	}
+	return inbox;
+}
+
+bool sieve_storage_no_active_script_cached(struct sieve_instance *svinst,
+					   struct mail_user *user,
+					   uint32_t *generation_r)
+{
+	struct sieve_storage_sync_no_active_header hdr;
+	struct mailbox *inbox;
+
+	*generation_r = 0;
+
+	if (svinst->no_active_script_cache_secs == 0)
+		return FALSE;
+
+	inbox = sieve_storage_sync_inbox_open(user, svinst->event);
+	if (inbox == NULL)
+		return FALSE;
+
+	sieve_storage_sync_no_active_get(
+		inbox, sieve_storage_sync_no_active_ext(inbox), &hdr);
+	mailbox_free(&inbox);
+
+	*generation_r = hdr.reset_generation;
+	return (hdr.timestamp != 0 &&
+		hdr.generation == hdr.reset_generation &&
+		(time_t)hdr.timestamp <= ioloop_time &&
+		(ioloop_time - (time_t)hdr.timestamp) <
+			(time_t)svinst->no_active_script_cache_secs);
+}
+
+void sieve_storage_no_active_script_cache(struct sieve_instance *svinst,
+					  struct mail_user *user,
+					  uint32_t generation)
+{
+	struct sieve_storage_sync_no_active_header hdr;
+	struct mailbox_transaction_context *trans;
+	struct mailbox *inbox;
+	enum mail_error error;
+	uint32_t ext_id;
+
+	if (svinst->no_active_script_cache_secs == 0)
+		return;
+
+	inbox = sieve_storage_sync_inbox_open(user, svinst->event);
+	if (inbox == NULL)
+		return;
+	ext_id = sieve_storage_sync_no_active_ext(inbox);
+
+	/* Don't bother when the storage was modified in the mean time; the
+	   recorded generation would not match anyway */
+	sieve_storage_sync_no_active_get(inbox, ext_id, &hdr);
+	if (hdr.reset_generation != generation) {
+		e_debug(svinst->event, "Not caching script status: "
+			"script storage changed during delivery");
+		mailbox_free(&inbox);
+		return;
+	}
+
+	hdr.timestamp = ioloop_time;
+	hdr.generation = generation;
+
+	/* The reset generation is left alone; see above */
+	trans = mailbox_transaction_begin(inbox,
+					  MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  __func__);
+	mail_index_update_header_ext(
+		trans->itrans, ext_id, 0, &hdr,
+		offsetof(struct sieve_storage_sync_no_active_header,
+			 reset_generation));
+	if (mailbox_transaction_commit(&trans) < 0) {
+		e_debug(svinst->event, "Failed to cache script status "
+			"in INBOX: %s",
+			mailbox_get_last_internal_error(inbox, &error));
+	}
+	mailbox_free(&inbox);
+}
+
 /*
  * Sync attributes
  */
@@ -75,6 +237,9 @@ static int sieve_storage_sync_transaction_begin
 	*trans_r = mailbox_transaction_begin(inbox,
 					     MAILBOX_TRANSACTION_FLAG_EXTERNAL,
 					     __func__);
+
+	/* Any modification may make a script active */
+	sieve_storage_sync_no_active_reset(*trans_r);
 	return 1;
 }
 
@@ -184,4 +184,23 @@ int sieve_storage_get_last_change(struct sieve_storage *storage,
 void sieve_storage_set_modified(struct sieve_storage *storage,
 				time_t mtime);
 
+/*
+ * Cached absence of an active script
+ */
+
+/* Returns TRUE when a recent delivery found that the user has no active
+   script (nor a default script) and no script was saved or activated through
+   the storage API since then. Controlled by the
+   sieve_no_active_script_cache setting. The current storage generation is
+   returned in generation_r; it must be read before the script is looked up
+   and passed to sieve_storage_no_active_script_cache(). */
+bool sieve_storage_no_active_script_cached(struct sieve_instance *svinst,
+					   struct mail_user *user,
+					   uint32_t *generation_r);
+/* Records that the user has no active script, unless the storage was
+   modified since the provided generation was obtained. */
+void sieve_storage_no_active_script_cache(struct sieve_instance *svinst,
+					  struct mail_user *user,
+					  uint32_t generation);
+
 #endif
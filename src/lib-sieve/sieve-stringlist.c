@@ -8,10 +8,36 @@
 #include "sieve-common.h"
 #include "sieve-stringlist.h"
 
+/*
+ * Runtime string
+ */
+
+void sieve_string_init_str(struct sieve_string *str, string_t *src)
+{
+	str->data = str_c(src);
+	str->size = str_len(src);
+}
+
 /*
  * Default implementation
  */
 
+int sieve_stringlist_next_string
+(struct sieve_stringlist *strlist, struct sieve_string *str_r)
+{
+	string_t *item = NULL;
+	int ret;
+
+	if ( strlist->next_string != NULL )
+		return strlist->next_string(strlist, str_r);
+
+	if ( (ret=sieve_stringlist_next_item(strlist, &item)) > 0 )
+		sieve_string_init_str(str_r, item);
+	else
+		i_zero(str_r);
+	return ret;
+}
+
 int sieve_stringlist_read_all
 (struct sieve_stringlist *strlist, pool_t pool,
 	const char * const **list_r)
@@ -1,6 +1,31 @@
 #ifndef SIEVE_STRINGLIST_H
 #define SIEVE_STRINGLIST_H
 
+/*
+ * Runtime string
+ */
+
+/* Read-only reference to string data that is owned elsewhere, e.g. by the
+ * binary or the message. Unlike string_t, no buffer object needs to be
+ * allocated and the data needs not be copied to obtain one. The data is
+ * always followed by a NUL, so it can be used as a C string as well.
+ */
+struct sieve_string {
+	const char *data;
+	size_t size;
+};
+
+static inline void sieve_string_init
+(struct sieve_string *str, const char *data, size_t size)
+{
+	i_assert(data[size] == '\0');
+
+	str->data = data;
+	str->size = size;
+}
+
+void sieve_string_init_str(struct sieve_string *str, string_t *src);
+
 /*
  * Stringlist API
  */
@@ -8,6 +33,9 @@
 struct sieve_stringlist {
 	int (*next_item)
 		(struct sieve_stringlist *strlist, string_t **str_r);
+	/* Optional; avoids creating a string_t for each item */
+	int (*next_string)
+		(struct sieve_stringlist *strlist, struct sieve_string *str_r);
 	void (*reset)
 		(struct sieve_stringlist *strlist);
 	int (*get_length)
@@ -50,6 +78,10 @@ static inline void sieve_stringlist_reset
 int sieve_stringlist_get_length
 	(struct sieve_stringlist *strlist);
 
+/* Same as sieve_stringlist_next_item(), but for read-only use of the item */
+int sieve_stringlist_next_string
+	(struct sieve_stringlist *strlist, struct sieve_string *str_r);
+
 int sieve_stringlist_read_all
 	(struct sieve_stringlist *strlist, pool_t pool,
 		const char * const **list_r);
@@ -281,6 +281,11 @@ struct sieve_resource_usage {
 	/* The total amount of system + user CPU time consumed while executing
 	   the Sieve script. */
 	unsigned int cpu_time_msecs;
+	/* The number of work units charged while executing the Sieve script.
+	   Unlike CPU time, this does not depend on the machine or its load:
+	   each operation costs one unit and matching values costs one unit
+	   per SIEVE_WORK_UNIT_BYTES scanned. */
+	unsigned int work_units;
 };
 
 /*
@@ -22,6 +22,8 @@
 #include "sieve-storage-private.h"
 #include "sieve-ast.h"
 #include "sieve-binary.h"
+#include "sieve-binary-cache.h"
+#include "sieve-binary-store.h"
 #include "sieve-actions.h"
 #include "sieve-result.h"
 
@@ -51,6 +53,16 @@ struct event_category event_category_sieve = {
  * Main Sieve library interface
  */
 
+static void
+sieve_init_event(struct sieve_instance *svinst, struct event *event_parent)
+{
+	svinst->event = event_create(event_parent);
+	event_add_category(svinst->event, &event_category_sieve);
+	event_set_forced_debug(svinst->event, svinst->debug);
+	event_set_append_log_prefix(svinst->event, "sieve: ");
+	event_add_str(svinst->event, "user", svinst->username);
+}
+
 struct sieve_instance *
 sieve_init(const struct sieve_environment *env,
 	   const struct sieve_callbacks *callbacks, void *context, bool debug)
@@ -74,11 +86,7 @@ sieve_init(const struct sieve_environment *env,
 	svinst->env_location = env->location;
 	svinst->delivery_phase = env->delivery_phase;
 
-	svinst->event = event_create(env->event_parent);
-	event_add_category(svinst->event, &event_category_sieve);
-	event_set_forced_debug(svinst->event, debug);
-	event_set_append_log_prefix(svinst->event, "sieve: ");
-	event_add_str(svinst->event, "user", env->username);
+	sieve_init_event(svinst, env->event_parent);
 
 	/* Determine domain */
 	if (env->domainname != NULL && *(env->domainname) != '\0')
@@ -136,6 +144,7 @@ void sieve_deinit(struct sieve_instance **_svinst)
 {
 	struct sieve_instance *svinst = *_svinst;
 
+	sieve_binary_cache_deinit(svinst);
 	sieve_plugins_unload(svinst);
 	sieve_storages_deinit(svinst);
 	sieve_extensions_deinit(svinst);
@@ -147,6 +156,16 @@ void sieve_deinit(struct sieve_instance **_svinst)
 	*_svinst = NULL;
 }
 
+void sieve_set_context(struct sieve_instance *svinst, void *context,
+		       struct event *event_parent)
+{
+	svinst->context = context;
+
+	/* Objects created from now on log in the new context */
+	event_unref(&svinst->event);
+	sieve_init_event(svinst, event_parent);
+}
+
 void sieve_set_extensions(struct sieve_instance *svinst, const char *extensions)
 {
 	sieve_extensions_set_string(svinst, extensions, FALSE, FALSE);
@@ -383,7 +402,8 @@ sieve_open_script_real(struct sieve_script *script,
 	struct sieve_resource_usage rusage;
 	struct sieve_binary *sbin;
 	enum sieve_error error;
-	const char *errorstr = NULL;
+	const char *store_path = NULL, *errorstr = NULL;
+	bool outdated = FALSE;
 	int ret;
 
 	if (error_r == NULL)
@@ -391,30 +411,54 @@ sieve_open_script_real(struct sieve_script *script,
 
 	sieve_resource_usage_init(&rusage);
 
-	/* Try to open the matching binary */
-	sbin = sieve_script_binary_load(script, error_r);
+	/* Try a binary loaded earlier by this instance; it is validated by
+	   the cache */
+	sbin = sieve_binary_cache_lookup(svinst, script, flags);
 	if (sbin != NULL) {
-		sieve_binary_get_resource_usage(sbin, &rusage);
+		e_debug(svinst->event,
+			"Script binary %s reused from cache",
+			sieve_binary_path(sbin));
+	} else {
+		/* Try to open the matching binary */
+		sbin = sieve_script_binary_load(script, error_r);
+		if (sbin != NULL) {
+			sieve_binary_get_resource_usage(sbin, &rusage);
+
+			/* Ok, it exists; now let's see if it is up to date */
+			if (!sieve_resource_usage_is_excessive(svinst,
+							       &rusage) &&
+			    !sieve_binary_up_to_date(sbin, flags)) {
+				/* Not up to date */
+				e_debug(svinst->event,
+					"Script binary %s is not up-to-date",
+					sieve_binary_path(sbin));
+				sieve_binary_close(&sbin);
+				outdated = TRUE;
+			}
+		}
+		if (sbin == NULL && svinst->binary_store != NULL &&
+		    (outdated || *error_r == SIEVE_ERROR_NOT_FOUND)) {
+			/* None yet or outdated; try a binary compiled for
+			   another script with the same source */
+			store_path = sieve_binary_store_get_path(script, flags);
+			if (store_path != NULL) {
+				sbin = sieve_binary_store_open(script,
+							       store_path);
+			}
+		}
 
-		/* Ok, it exists; now let's see if it is up to date */
-		if (!sieve_resource_usage_is_excessive(svinst, &rusage) &&
-		    !sieve_binary_up_to_date(sbin, flags)) {
-			/* Not up to date */
+		if (sbin != NULL) {
 			e_debug(svinst->event,
-				"Script binary %s is not up-to-date",
+				"Script binary %s successfully loaded",
 				sieve_binary_path(sbin));
-			sieve_binary_close(&sbin);
+			sieve_binary_cache_add(svinst, sbin, flags);
 		}
 	}
 
 	/* If the binary does not exist or is not up-to-date, we need
 	 * to (re-)compile.
 	 */
-	if (sbin != NULL) {
-		e_debug(svinst->event,
-			"Script binary %s successfully loaded",
-			sieve_binary_path(sbin));
-	} else {
+	if (sbin == NULL) {
 		sbin = sieve_compile_script(script, ehandler, flags, error_r);
 		if (sbin == NULL)
 			return NULL;
@@ -424,6 +468,8 @@ sieve_open_script_real(struct sieve_script *script,
 			sieve_script_name(script),
 			sieve_script_location(script));
 
+		if (store_path != NULL)
+			sieve_binary_store_add(sbin, store_path);
 		sieve_binary_set_resource_usage(sbin, &rusage);
 	}
 
@@ -678,6 +724,88 @@ int sieve_execute(struct sieve_binary *sbin,
 	return ret;
 }
 
+struct sieve_execute_context {
+	pool_t pool;
+	struct sieve_binary *sbin;
+	struct sieve_interpreter *interp;
+};
+
+struct sieve_execute_context *
+sieve_execute_context_create(struct sieve_binary *sbin)
+{
+	struct sieve_execute_context *ectx;
+
+	ectx = i_new(struct sieve_execute_context, 1);
+	ectx->pool = pool_alloconly_create("sieve execution", 4096);
+	ectx->sbin = sbin;
+	sieve_binary_ref(sbin);
+	return ectx;
+}
+
+void sieve_execute_context_free(struct sieve_execute_context **_ectx)
+{
+	struct sieve_execute_context *ectx = *_ectx;
+
+	*_ectx = NULL;
+	if (ectx == NULL)
+		return;
+
+	if (ectx->interp != NULL)
+		sieve_interpreter_free(&ectx->interp);
+	sieve_binary_unref(&ectx->sbin);
+	pool_unref(&ectx->pool);
+	i_free(ectx);
+}
+
+int sieve_execute_context_run(struct sieve_execute_context *ectx,
+			      const struct sieve_message_data *msgdata,
+			      const struct sieve_script_env *senv,
+			      struct sieve_error_handler *exec_ehandler,
+			      struct sieve_error_handler *action_ehandler,
+			      enum sieve_execute_flags flags)
+{
+	struct sieve_binary *sbin = ectx->sbin;
+	struct sieve_instance *svinst = sieve_binary_svinst(sbin);
+	struct sieve_result *result;
+	struct sieve_result_execution *rexec;
+	struct sieve_execute_env eenv;
+	int ret;
+
+	sieve_execute_init(&eenv, svinst, ectx->pool, msgdata, senv, flags);
+
+	/* Create result object */
+	result = sieve_result_create(svinst, ectx->pool, &eenv);
+
+	/* Run the script */
+	if (ectx->interp == NULL) {
+		ectx->interp = sieve_interpreter_create(sbin, NULL, &eenv,
+							exec_ehandler);
+	} else {
+		sieve_interpreter_recycle(ectx->interp, &eenv, exec_ehandler);
+	}
+	if (ectx->interp == NULL)
+		ret = SIEVE_EXEC_BIN_CORRUPT;
+	else
+		ret = sieve_interpreter_run(ectx->interp, result);
+
+	/* The trace log belongs to this message only */
+	if (ectx->interp != NULL && senv->trace_log != NULL)
+		sieve_interpreter_free(&ectx->interp);
+
+	rexec = sieve_result_execution_create(result, ectx->pool);
+	ret = sieve_result_execute(rexec, ret, TRUE, action_ehandler, NULL);
+	sieve_result_execution_destroy(&rexec);
+
+	/* Cleanup */
+	sieve_result_unref(&result);
+	sieve_execute_finish(&eenv, ret);
+	sieve_execute_deinit(&eenv);
+
+	/* Keep the memory of the pool for the next message */
+	p_clear(ectx->pool);
+	return ret;
+}
+
 /*
  * Multiscript support
  */
@@ -1275,12 +1403,17 @@ void sieve_resource_usage_add(struct sieve_resource_usage *dst,
 		dst->cpu_time_msecs = UINT_MAX;
 	else
 		dst->cpu_time_msecs += src->cpu_time_msecs;
+	if ((UINT_MAX - dst->work_units) < src->work_units)
+		dst->work_units = UINT_MAX;
+	else
+		dst->work_units += src->work_units;
 }
 
 bool sieve_resource_usage_is_high(struct sieve_instance *svinst ATTR_UNUSED,
 				  const struct sieve_resource_usage *rusage)
 {
-	return (rusage->cpu_time_msecs > SIEVE_HIGH_CPU_TIME_MSECS);
+	return (rusage->cpu_time_msecs > SIEVE_HIGH_CPU_TIME_MSECS ||
+		rusage->work_units > SIEVE_HIGH_WORK_UNITS);
 }
 
 bool sieve_resource_usage_is_excessive(
@@ -1288,6 +1421,9 @@ bool sieve_resource_usage_is_excessive(
 	const struct sieve_resource_usage *rusage)
 {
 	i_assert(svinst->max_cpu_time_secs <= (UINT_MAX / 1000));
+	if (svinst->max_work_units > 0 &&
+	    rusage->work_units > svinst->max_work_units)
+		return TRUE;
 	if (svinst->max_cpu_time_secs == 0)
 		return FALSE;
 	return (rusage->cpu_time_msecs > (svinst->max_cpu_time_secs * 1000));
@@ -1296,8 +1432,9 @@ bool sieve_resource_usage_is_excessive(
 const char *
 sieve_resource_usage_get_summary(const struct sieve_resource_usage *rusage)
 {
-	if (rusage->cpu_time_msecs == 0)
+	if (rusage->cpu_time_msecs == 0 && rusage->work_units == 0)
 		return "no usage recorded";
 
-	return t_strdup_printf("cpu time = %u ms", rusage->cpu_time_msecs);
+	return t_strdup_printf("cpu time = %u ms, work = %u units",
+			       rusage->cpu_time_msecs, rusage->work_units);
 }
@@ -21,6 +21,12 @@ sieve_init(const struct sieve_environment *env,
 /* Free all memory allocated by the sieve engine. */
 void sieve_deinit(struct sieve_instance **_svinst);
 
+/* Binds the instance to a new callback context and parent event, so that it
+   can be kept for a later use with the same environment and settings, e.g.
+   the next delivery to the same user. The settings are not read again. */
+void sieve_set_context(struct sieve_instance *svinst, void *context,
+		       struct event *event_parent);
+
 /* Get capability string for a particular extension. */
 const char *
 sieve_get_capabilities(struct sieve_instance *svinst, const char *name);
@@ -151,6 +157,23 @@ int sieve_execute(struct sieve_binary *sbin,
 		  struct sieve_error_handler *action_ehandler,
 		  enum sieve_execute_flags flags);
 
+/* Executes one binary for a series of messages. Rather than creating a new
+   interpreter and execution pool for each message, these are reset and
+   reused. */
+struct sieve_execute_context;
+
+struct sieve_execute_context *
+sieve_execute_context_create(struct sieve_binary *sbin);
+void sieve_execute_context_free(struct sieve_execute_context **_ectx);
+
+/* Same as sieve_execute() for the binary of the context. */
+int sieve_execute_context_run(struct sieve_execute_context *ectx,
+			      const struct sieve_message_data *msgdata,
+			      const struct sieve_script_env *senv,
+			      struct sieve_error_handler *exec_ehandler,
+			      struct sieve_error_handler *action_ehandler,
+			      enum sieve_execute_flags flags);
+
 /*
  * Multiscript support
  */
@@ -46,7 +46,8 @@ const struct sieve_command_def tst_address = {
 	.block_required = FALSE,
 	.registered = tst_address_registered,
 	.validate = tst_address_validate,
-	.generate = tst_address_generate
+	.generate = tst_address_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -200,6 +201,8 @@ static bool tst_address_generate
 {
 	sieve_operation_emit(cgenv->sblock, NULL, &tst_address_operation);
 
+	sieve_generate_require_headers(cgenv, tst->first_positional);
+
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
@@ -239,6 +242,8 @@ static int tst_address_operation_execute
 	struct sieve_stringlist *hdr_list, *hdr_value_list, *value_list, *key_list;
 	struct sieve_address_list *addr_list;
 	ARRAY_TYPE(sieve_message_override) svmos;
+	buffer_t *memo_key;
+	bool memo_result;
 	int match, ret;
 
 	/* Read optional operands */
@@ -259,6 +264,21 @@ static int tst_address_operation_execute
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "address test");
 
+	/* Reuse the result of an identical earlier test on this message */
+	memo_key = sieve_message_memo_key_create(renv, &svmos);
+	if ( memo_key != NULL ) {
+		sieve_message_memo_key_add_object(memo_key, addrp.def);
+		if ( !sieve_match_memo_key_add(renv, memo_key, &mcht, &cmp) ||
+			!sieve_message_memo_key_add_stringlist(memo_key, hdr_list) ||
+			!sieve_message_memo_key_add_stringlist(memo_key, key_list) )
+			memo_key = NULL;
+	}
+	if ( memo_key != NULL &&
+		sieve_message_memo_lookup(renv, memo_key, &memo_result) ) {
+		sieve_interpreter_set_test_result(renv->interp, memo_result);
+		return SIEVE_EXEC_OK;
+	}
+
 	/* Get header */
 	sieve_runtime_trace_descend(renv);
 	if ( (ret=sieve_message_get_header_fields
@@ -274,6 +294,9 @@ static int tst_address_operation_execute
 	if ( (match=sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret)) < 0 )
 		return ret;
 
+	if ( memo_key != NULL )
+		sieve_message_memo_store(renv, memo_key, match > 0);
+
 	/* Set test result for subsequent conditional jump */
 	sieve_interpreter_set_test_result(renv->interp, match > 0);
 	return SIEVE_EXEC_OK;
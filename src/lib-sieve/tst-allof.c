@@ -31,7 +31,8 @@ const struct sieve_command_def tst_allof = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate_const = tst_allof_validate_const,
-	.control_generate = tst_allof_generate
+	.control_generate = tst_allof_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -31,7 +31,8 @@ const struct sieve_command_def tst_anyof = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate_const = tst_anyof_validate_const,
-	.control_generate = tst_anyof_generate
+	.control_generate = tst_anyof_generate,
+	.data_declared = TRUE
 };
 
 /*
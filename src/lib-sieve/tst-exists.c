@@ -34,7 +34,8 @@ const struct sieve_command_def tst_exists = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = tst_exists_validate,
-	.generate = tst_exists_generate
+	.generate = tst_exists_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -82,6 +83,8 @@ static bool tst_exists_generate
 {
 	sieve_operation_emit(cgenv->sblock, NULL, &tst_exists_operation);
 
+	sieve_generate_require_headers(cgenv, tst->first_positional);
+
  	/* Generate arguments */
     return sieve_generate_arguments(cgenv, tst, NULL);
 }
@@ -113,6 +116,7 @@ static int tst_exists_operation_execute
 	struct sieve_stringlist *hdr_list;
 	ARRAY_TYPE(sieve_message_override) svmos;
 	string_t *hdr_item;
+	buffer_t *memo_key;
 	bool matched;
 	int ret;
 
@@ -138,6 +142,17 @@ static int tst_exists_operation_execute
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "exists test");
 	sieve_runtime_trace_descend(renv);
 
+	/* Reuse the result of an identical earlier test on this message */
+	memo_key = sieve_message_memo_key_create(renv, &svmos);
+	if ( memo_key != NULL &&
+		!sieve_message_memo_key_add_stringlist(memo_key, hdr_list) )
+		memo_key = NULL;
+	if ( memo_key != NULL &&
+		sieve_message_memo_lookup(renv, memo_key, &matched) ) {
+		sieve_interpreter_set_test_result(renv->interp, matched);
+		return SIEVE_EXEC_OK;
+	}
+
 	/* Iterate through all requested headers to match (must find all specified) */
 	hdr_item = NULL;
 	matched = TRUE;
@@ -170,6 +185,8 @@ static int tst_exists_operation_execute
 
 	/* Set test result for subsequent conditional jump */
 	if ( ret >= 0 ) {
+		if ( memo_key != NULL )
+			sieve_message_memo_store(renv, memo_key, matched);
 		sieve_interpreter_set_test_result(renv->interp, matched);
 		return SIEVE_EXEC_OK;
 	}
@@ -2,11 +2,15 @@
  */
 
 #include "lib.h"
+#include "array.h"
+#include "str.h"
 #include "str-sanitize.h"
 
 #include "sieve-common.h"
 #include "sieve-commands.h"
 #include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-stringlist.h"
 #include "sieve-message.h"
 #include "sieve-comparators.h"
 #include "sieve-match-types.h"
@@ -15,6 +19,9 @@
 #include "sieve-interpreter.h"
 #include "sieve-dump.h"
 #include "sieve-match.h"
+#include "sieve-optimizer.h"
+
+#include <stdlib.h>
 
 /*
  * Header test
@@ -41,7 +48,8 @@ const struct sieve_command_def tst_header = {
 	.block_required = FALSE,
 	.registered = tst_header_registered,
 	.validate = tst_header_validate,
-	.generate = tst_header_generate
+	.generate = tst_header_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -60,6 +68,22 @@ const struct sieve_operation_def tst_header_operation = {
 	.execute = tst_header_operation_execute
 };
 
+/*
+ * Header switch operation
+ */
+
+static bool tst_header_switch_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int tst_header_switch_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def tst_header_switch_operation = {
+	.mnemonic = "HEADER_SWITCH",
+	.code = SIEVE_OPERATION_HEADER_SWITCH,
+	.dump = tst_header_switch_operation_dump,
+	.execute = tst_header_switch_operation_execute
+};
+
 /*
  * Test registration
  */
@@ -123,10 +147,51 @@ static bool tst_header_generate
 {
 	sieve_operation_emit(cgenv->sblock, NULL, &tst_header_operation);
 
+	sieve_generate_require_headers(cgenv, tst->first_positional);
+
  	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
 
+bool tst_header_generate_switch
+(const struct sieve_codegen_env *cgenv, struct sieve_command *const *tests,
+	unsigned int count, sieve_size_t *case_jumps, sieve_size_t *default_jump_r)
+{
+	struct sieve_binary_block *sblock = cgenv->sblock;
+	struct sieve_comparator cmp_default =
+		SIEVE_COMPARATOR_DEFAULT(i_ascii_casemap_comparator);
+	const struct sieve_comparator *cmp;
+	struct sieve_ast_argument *arg;
+	unsigned int i;
+
+	i_assert( count > 0 );
+
+	if ( !sieve_optimize_header_is_literal(tests[0], &cmp) )
+		return FALSE;
+	if ( cmp == NULL )
+		cmp = &cmp_default;
+
+	sieve_operation_emit(sblock, NULL, &tst_header_switch_operation);
+	sieve_opr_comparator_emit(sblock, cmp);
+
+	/* Header names are the same for all tests */
+	arg = tests[0]->first_positional;
+	sieve_generate_require_headers(cgenv, arg);
+	if ( !sieve_generate_argument(cgenv, arg, tests[0]) )
+		return FALSE;
+
+	/* Key list and jump offset for each case */
+	sieve_binary_emit_unsigned(sblock, count);
+	for ( i = 0; i < count; i++ ) {
+		arg = sieve_ast_argument_next(tests[i]->first_positional);
+		if ( !sieve_generate_argument(cgenv, arg, tests[i]) )
+			return FALSE;
+		case_jumps[i] = sieve_binary_emit_offset(sblock, 0);
+	}
+	*default_jump_r = sieve_binary_emit_offset(sblock, 0);
+	return TRUE;
+}
+
 /*
  * Code dump
  */
@@ -146,6 +211,48 @@ static bool tst_header_operation_dump
 		sieve_opr_stringlist_dump(denv, address, "key list");
 }
 
+static bool tst_header_switch_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address)
+{
+	unsigned int count, i;
+	sieve_size_t pc;
+	sieve_offset_t offset;
+
+	sieve_code_dumpf(denv, "HEADER_SWITCH");
+	sieve_code_descend(denv);
+
+	if ( !sieve_opr_comparator_dump(denv, address) ||
+		!sieve_opr_stringlist_dump(denv, address, "header names") )
+		return FALSE;
+
+	sieve_code_mark(denv);
+	if ( !sieve_binary_read_unsigned(denv->sblock, address, &count) )
+		return FALSE;
+	sieve_code_dumpf(denv, "cases: %u", count);
+
+	sieve_code_descend(denv);
+	for ( i = 0; i < count; i++ ) {
+		if ( !sieve_opr_stringlist_dump(denv, address, "key list") )
+			return FALSE;
+
+		sieve_code_mark(denv);
+		pc = *address;
+		if ( !sieve_binary_read_offset(denv->sblock, address, &offset) )
+			return FALSE;
+		sieve_code_dumpf(denv, "jump: %d [%08x]",
+			offset, (unsigned int)(pc + offset));
+	}
+	sieve_code_ascend(denv);
+
+	sieve_code_mark(denv);
+	pc = *address;
+	if ( !sieve_binary_read_offset(denv->sblock, address, &offset) )
+		return FALSE;
+	sieve_code_dumpf(denv, "default: %d [%08x]",
+		offset, (unsigned int)(pc + offset));
+	return TRUE;
+}
+
 /*
  * Code execution
  */
@@ -159,6 +266,8 @@ static int tst_header_operation_execute
 		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
 	struct sieve_stringlist *hdr_list, *key_list, *value_list;
 	ARRAY_TYPE(sieve_message_override) svmos;
+	buffer_t *memo_key;
+	bool memo_result;
 	int match, ret;
 
 	/*
@@ -187,6 +296,19 @@ static int tst_header_operation_execute
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "header test");
 
+	/* Reuse the result of an identical earlier test on this message */
+	memo_key = sieve_message_memo_key_create(renv, &svmos);
+	if ( memo_key != NULL &&
+		(!sieve_match_memo_key_add(renv, memo_key, &mcht, &cmp) ||
+			!sieve_message_memo_key_add_stringlist(memo_key, hdr_list) ||
+			!sieve_message_memo_key_add_stringlist(memo_key, key_list)) )
+		memo_key = NULL;
+	if ( memo_key != NULL &&
+		sieve_message_memo_lookup(renv, memo_key, &memo_result) ) {
+		sieve_interpreter_set_test_result(renv->interp, memo_result);
+		return SIEVE_EXEC_OK;
+	}
+
 	/* Get header */
 	sieve_runtime_trace_descend(renv);
 	if ( (ret=sieve_message_get_header_fields
@@ -198,7 +320,299 @@ static int tst_header_operation_execute
 	if ( (match=sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret)) < 0 )
 		return ret;
 
+	if ( memo_key != NULL )
+		sieve_message_memo_store(renv, memo_key, match > 0);
+
 	/* Set test result for subsequent conditional jump */
 	sieve_interpreter_set_test_result(renv->interp, match > 0);
 	return SIEVE_EXEC_OK;
 }
+
+/* Header switch */
+
+/* When the comparator can normalize values, the literal keys of all cases are
+ * put in a single sorted table once for the loaded binary. Each header value
+ * is then looked up using a binary search rather than being matched against
+ * the key list of every case in turn.
+ */
+
+struct tst_header_switch_case {
+	struct sieve_stringlist *key_list;
+	sieve_size_t target;
+};
+
+struct tst_header_switch_key {
+	const char *data;
+	size_t size;
+
+	unsigned int case_idx;
+};
+
+struct tst_header_switch_table {
+	const struct tst_header_switch_key *keys;
+	unsigned int keys_count;
+
+	/* Jump target for each case, followed by the default */
+	const sieve_size_t *targets;
+	unsigned int cases_count;
+};
+
+static int tst_header_switch_key_cmp(const void *p1, const void *p2)
+{
+	const struct tst_header_switch_key *key1 = p1, *key2 = p2;
+
+	if ( key1->size != key2->size )
+		return ( key1->size < key2->size ? -1 : 1 );
+	return memcmp(key1->data, key2->data, key1->size);
+}
+
+static int tst_header_switch_key_sort_cmp(const void *p1, const void *p2)
+{
+	const struct tst_header_switch_key *key1 = p1, *key2 = p2;
+	int ret;
+
+	if ( (ret=tst_header_switch_key_cmp(key1, key2)) != 0 )
+		return ret;
+
+	/* Earlier cases take precedence for duplicate keys */
+	if ( key1->case_idx != key2->case_idx )
+		return ( key1->case_idx < key2->case_idx ? -1 : 1 );
+	return 0;
+}
+
+static int tst_header_switch_read_cases
+(const struct sieve_runtime_env *renv, sieve_size_t *address,
+	struct tst_header_switch_case **cases_r, unsigned int *count_r)
+{
+	struct tst_header_switch_case *cases;
+	unsigned int count, i;
+	sieve_size_t pc;
+	sieve_offset_t offset;
+	int ret;
+
+	if ( !sieve_binary_read_unsigned(renv->sblock, address, &count) ||
+		count == 0 || count > sieve_binary_block_get_size(renv->sblock) ) {
+		sieve_runtime_trace_error(renv, "invalid case count");
+		return SIEVE_EXEC_BIN_CORRUPT;
+	}
+
+	/* The final entry is the default */
+	cases = t_new(struct tst_header_switch_case, count + 1);
+	for ( i = 0; i <= count; i++ ) {
+		if ( i < count && (ret=sieve_opr_stringlist_read
+			(renv, address, "key-list", &cases[i].key_list)) <= 0 )
+			return ret;
+
+		pc = *address;
+		if ( !sieve_binary_read_offset(renv->sblock, address, &offset) ) {
+			sieve_runtime_trace_error(renv, "invalid jump offset");
+			return SIEVE_EXEC_BIN_CORRUPT;
+		}
+		cases[i].target = pc + offset;
+	}
+
+	*cases_r = cases;
+	*count_r = count;
+	return SIEVE_EXEC_OK;
+}
+
+static int tst_header_switch_table_create
+(const struct sieve_comparator *cmp,
+	const struct tst_header_switch_case *cases, unsigned int count,
+	pool_t pool, struct tst_header_switch_table **table_r)
+{
+	struct tst_header_switch_table *table;
+	ARRAY(struct tst_header_switch_key) keys;
+	struct tst_header_switch_key *key, *keys_sorted;
+	sieve_size_t *targets;
+	string_t *key_item = NULL;
+	unsigned int keys_count, i, j;
+	int ret = 0;
+
+	*table_r = NULL;
+
+	t_array_init(&keys, count * 2);
+	for ( i = 0; i < count; i++ ) {
+		struct sieve_stringlist *key_list = cases[i].key_list;
+
+		/* Generated only for literal keys, but be careful anyway */
+		if ( !sieve_code_stringlist_is_literal(key_list) )
+			return SIEVE_EXEC_OK;
+
+		sieve_stringlist_reset(key_list);
+		while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+			key = array_append_space(&keys);
+			key->size = str_len(key_item);
+			key->data = p_sieve_comparator_normalize
+				(pool, cmp, str_c(key_item), key->size);
+			if ( key->data == str_c(key_item) )
+				key->data = p_strndup(pool, key->data, key->size);
+			key->case_idx = i;
+		}
+		if ( ret < 0 )
+			return key_list->exec_status;
+	}
+
+	/* Sort and keep only the first case for each key */
+	keys_sorted = array_get_modifiable(&keys, &keys_count);
+	qsort(keys_sorted, keys_count, sizeof(*keys_sorted),
+		tst_header_switch_key_sort_cmp);
+
+	table = p_new(pool, struct tst_header_switch_table, 1);
+	key = p_new(pool, struct tst_header_switch_key, keys_count + 1);
+	for ( i = 0, j = 0; i < keys_count; i++ ) {
+		if ( j > 0 && tst_header_switch_key_cmp
+			(&key[j-1], &keys_sorted[i]) == 0 )
+			continue;
+		key[j++] = keys_sorted[i];
+	}
+	table->keys = key;
+	table->keys_count = j;
+
+	targets = p_new(pool, sieve_size_t, count + 1);
+	for ( i = 0; i <= count; i++ )
+		targets[i] = cases[i].target;
+	table->targets = targets;
+	table->cases_count = count;
+
+	*table_r = table;
+	return SIEVE_EXEC_OK;
+}
+
+static int tst_header_switch_lookup
+(const struct tst_header_switch_table *table,
+	const struct sieve_comparator *cmp, struct sieve_stringlist *value_list,
+	sieve_size_t *target_r)
+{
+	unsigned int case_idx = table->cases_count;
+	string_t *value_item = NULL;
+	int ret = 0;
+
+	while ( case_idx > 0 &&
+		(ret=sieve_stringlist_next_item(value_list, &value_item)) > 0 ) {
+		const struct tst_header_switch_key *found;
+		struct tst_header_switch_key lookup_key;
+
+		sieve_runtime_charge_bytes(value_list->runenv,
+			str_len(value_item));
+
+		T_BEGIN {
+			lookup_key.size = str_len(value_item);
+			lookup_key.data = t_sieve_comparator_normalize
+				(cmp, str_c(value_item), lookup_key.size);
+
+			found = bsearch(&lookup_key, table->keys, table->keys_count,
+				sizeof(*table->keys), tst_header_switch_key_cmp);
+		} T_END;
+
+		if ( found != NULL && found->case_idx < case_idx )
+			case_idx = found->case_idx;
+	}
+
+	if ( case_idx > 0 && ret < 0 )
+		return value_list->exec_status;
+
+	*target_r = table->targets[case_idx];
+	return SIEVE_EXEC_OK;
+}
+
+static int tst_header_switch_match
+(const struct sieve_runtime_env *renv, const struct sieve_comparator *cmp,
+	const struct tst_header_switch_case *cases, unsigned int count,
+	struct sieve_stringlist *value_list, sieve_size_t *target_r)
+{
+	struct sieve_match_type mcht =
+		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
+	unsigned int i;
+	int match, ret;
+
+	for ( i = 0; i < count; i++ ) {
+		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+			"header test (case %u)", i + 1);
+
+		sieve_stringlist_reset(cases[i].key_list);
+		if ( (match=sieve_match
+			(renv, &mcht, cmp, value_list, cases[i].key_list, &ret)) < 0 )
+			return ret;
+		if ( match > 0 )
+			break;
+	}
+
+	*target_r = cases[i].target;
+	return SIEVE_EXEC_OK;
+}
+
+static int tst_header_switch_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address)
+{
+	struct sieve_comparator cmp =
+		SIEVE_COMPARATOR_DEFAULT(i_ascii_casemap_comparator);
+	struct sieve_stringlist *hdr_list, *value_list;
+	ARRAY_TYPE(sieve_message_override) svmos;
+	struct tst_header_switch_case *cases = NULL;
+	struct tst_header_switch_table *table = NULL;
+	unsigned int count = 0;
+	sieve_size_t target;
+	void **cached = NULL;
+	pool_t pool;
+	int ret;
+
+	/*
+	 * Read operands
+	 */
+
+	if ( (ret=sieve_opr_comparator_read(renv, address, &cmp)) <= 0 )
+		return ret;
+
+	/* Read header-list */
+	if ( (ret=sieve_opr_stringlist_read(renv, address, "header-list", &hdr_list))
+		<= 0 )
+		return ret;
+
+	/* Tracing reports the match result for each case */
+	if ( !sieve_runtime_trace_active(renv, SIEVE_TRLVL_MATCHING) &&
+		sieve_comparator_can_normalize(&cmp) ) {
+		sieve_match_operation_cache_lookup(renv, &cmp, &cached, &pool);
+		table = (struct tst_header_switch_table *) *cached;
+	}
+
+	/* The table holds all jump targets, so the cases need not be read */
+	if ( table == NULL ) {
+		if ( (ret=tst_header_switch_read_cases
+			(renv, address, &cases, &count)) <= 0 )
+			return ret;
+
+		if ( cached != NULL ) {
+			if ( (ret=tst_header_switch_table_create
+				(&cmp, cases, count, pool, &table)) <= 0 )
+				return ret;
+			*cached = table;
+		}
+	}
+
+	/*
+	 * Perform test
+	 */
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "header switch");
+
+	/* Get header */
+	i_zero(&svmos);
+	sieve_runtime_trace_descend(renv);
+	if ( (ret=sieve_message_get_header_fields
+		(renv, hdr_list, &svmos, TRUE, &value_list)) <= 0 )
+		return ret;
+	sieve_runtime_trace_ascend(renv);
+
+	/* Select case */
+	if ( table != NULL ) {
+		ret = tst_header_switch_lookup(table, &cmp, value_list, &target);
+	} else {
+		ret = tst_header_switch_match
+			(renv, &cmp, cases, count, value_list, &target);
+	}
+	if ( ret <= 0 )
+		return ret;
+
+	return sieve_interpreter_program_jump_to(renv->interp, target, FALSE);
+}
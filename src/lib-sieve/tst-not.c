@@ -28,7 +28,8 @@ const struct sieve_command_def tst_not = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate_const = tst_not_validate_const,
-	.control_generate = tst_not_generate
+	.control_generate = tst_not_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -43,7 +43,8 @@ const struct sieve_command_def tst_size = {
 	.registered = tst_size_registered,
 	.pre_validate = tst_size_pre_validate,
 	.validate = tst_size_validate,
-	.generate = tst_size_generate
+	.generate = tst_size_generate,
+	.data_declared = TRUE
 };
 
 /*
@@ -29,7 +29,8 @@ const struct sieve_command_def tst_false = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate_const = tst_false_validate_const,
-	.control_generate = tst_false_generate
+	.control_generate = tst_false_generate,
+	.data_declared = TRUE
 };
 
 static bool tst_true_validate_const
@@ -47,7 +48,8 @@ const struct sieve_command_def tst_true = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate_const = tst_true_validate_const,
-	.control_generate = tst_true_generate
+	.control_generate = tst_true_generate,
+	.data_declared = TRUE
 };
 
 /*
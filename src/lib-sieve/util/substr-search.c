@@ -0,0 +1,307 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "str.h"
+
+#include "substr-search.h"
+
+/*
+ * Substring search
+ */
+
+/* Below these sizes, building the Horspool shift table costs more than it
+   saves. */
+#define SUBSTR_SEARCH_HORSPOOL_MIN_KEY_SIZE 4
+#define SUBSTR_SEARCH_HORSPOOL_MIN_DATA_SIZE 256
+
+static inline bool
+substr_search_equals(const unsigned char *data, const unsigned char *key,
+		     size_t size, bool icase)
+{
+	if (icase)
+		return (i_memcasecmp(data, key, size) == 0);
+	return (memcmp(data, key, size) == 0);
+}
+
+static const unsigned char *
+substr_search_memchr(const unsigned char *data, size_t data_size,
+		     const unsigned char *key, size_t key_size, bool icase)
+{
+	const unsigned char *p = data;
+	const unsigned char *pend = data + (data_size - key_size) + 1;
+	const unsigned char *lp, *up;
+	unsigned char lc, uc;
+
+	lc = (unsigned char)i_tolower(key[0]);
+	uc = (unsigned char)i_toupper(key[0]);
+	if (!icase || lc == uc) {
+		/* Single anchor byte */
+		while (p < pend &&
+		       (p = memchr(p, key[0], pend - p)) != NULL) {
+			if (substr_search_equals(p + 1, key + 1,
+						 key_size - 1, icase))
+				return p;
+			p++;
+		}
+		return NULL;
+	}
+
+	/* Two anchor bytes: track the next occurrence of each case variant
+	   separately, so that neither is scanned more than once. A pointer
+	   equal to pend means that there is no further occurrence. */
+	lp = up = NULL;
+	for (;;) {
+		if (lp == NULL || lp < p) {
+			lp = memchr(p, lc, pend - p);
+			if (lp == NULL)
+				lp = pend;
+		}
+		if (up == NULL || up < p) {
+			up = memchr(p, uc, pend - p);
+			if (up == NULL)
+				up = pend;
+		}
+		p = (up < lp ? up : lp);
+		if (p >= pend)
+			return NULL;
+
+		if (substr_search_equals(p + 1, key + 1, key_size - 1, TRUE))
+			return p;
+		p++;
+	}
+}
+
+static const unsigned char *
+substr_search_horspool(const unsigned char *data, size_t data_size,
+		       const unsigned char *key, size_t key_size, bool icase)
+{
+	size_t shift[256];
+	size_t i, pos, last = key_size - 1;
+	unsigned char lc, uc;
+
+	for (i = 0; i < N_ELEMENTS(shift); i++)
+		shift[i] = key_size;
+	for (i = 0; i < last; i++) {
+		if (icase) {
+			shift[(unsigned char)i_tolower(key[i])] = last - i;
+			shift[(unsigned char)i_toupper(key[i])] = last - i;
+		} else {
+			shift[key[i]] = last - i;
+		}
+	}
+
+	lc = (unsigned char)i_tolower(key[last]);
+	uc = (unsigned char)i_toupper(key[last]);
+	if (!icase)
+		lc = uc = key[last];
+
+	pos = 0;
+	while (pos <= data_size - key_size) {
+		unsigned char c = data[pos + last];
+
+		if ((c == lc || c == uc) &&
+		    substr_search_equals(data + pos, key, last, icase))
+			return data + pos;
+		pos += shift[c];
+	}
+	return NULL;
+}
+
+bool substr_search_find(const void *data, size_t data_size,
+			const void *key, size_t key_size, bool icase,
+			size_t *offset_r)
+{
+	const unsigned char *match;
+
+	if (key_size == 0) {
+		if (offset_r != NULL)
+			*offset_r = 0;
+		return TRUE;
+	}
+	if (key_size > data_size)
+		return FALSE;
+
+	if (key_size < SUBSTR_SEARCH_HORSPOOL_MIN_KEY_SIZE ||
+	    data_size < SUBSTR_SEARCH_HORSPOOL_MIN_DATA_SIZE) {
+		match = substr_search_memchr(data, data_size,
+					     key, key_size, icase);
+	} else {
+		match = substr_search_horspool(data, data_size,
+					       key, key_size, icase);
+	}
+
+	if (match == NULL)
+		return FALSE;
+	if (offset_r != NULL)
+		*offset_r = match - (const unsigned char *)data;
+	return TRUE;
+}
+
+/*
+ * Multi-key substring search
+ */
+
+/* Marks states that do not recognize any key */
+#define SUBSTR_SEARCH_MULTI_NO_KEY ((unsigned int)-1)
+
+struct substr_search_multi {
+	pool_t pool;
+
+	/* Byte -> alphabet class; class 0 is for bytes not in any key */
+	uint16_t classes[256];
+	unsigned int classes_count;
+
+	/* DFA: states_count * classes_count transitions; state 0 is root */
+	uint32_t *delta;
+	unsigned int states_count;
+
+	/* State -> index of recognized key or SUBSTR_SEARCH_MULTI_NO_KEY */
+	unsigned int *keys;
+};
+
+struct substr_search_multi *
+substr_search_multi_create(pool_t pool, const string_t *const *keys,
+			   unsigned int keys_count, bool icase)
+{
+	struct substr_search_multi *ssm;
+	uint16_t classes[256];
+	unsigned int *fail, *queue;
+	unsigned int i, c, nclasses, qhead, qtail;
+	size_t max_states;
+	uint32_t *delta;
+
+	/* Determine alphabet */
+	memset(classes, 0, sizeof(classes));
+	max_states = 1;
+	nclasses = 1;
+	for (i = 0; i < keys_count; i++) {
+		const unsigned char *kdata = str_data(keys[i]);
+		size_t ksize = str_len(keys[i]), j;
+
+		for (j = 0; j < ksize; j++) {
+			unsigned char b = (icase ?
+				(unsigned char)i_tolower(kdata[j]) : kdata[j]);
+
+			if (classes[b] == 0)
+				classes[b] = nclasses++;
+		}
+		max_states += ksize;
+		if (max_states > SUBSTR_SEARCH_MULTI_MAX_TRANSITIONS)
+			return NULL;
+	}
+	if (max_states * nclasses > SUBSTR_SEARCH_MULTI_MAX_TRANSITIONS)
+		return NULL;
+
+	ssm = p_new(pool, struct substr_search_multi, 1);
+	ssm->pool = pool;
+	memcpy(ssm->classes, classes, sizeof(ssm->classes));
+	if (icase) {
+		for (c = 0; c < N_ELEMENTS(ssm->classes); c++)
+			ssm->classes[c] = ssm->classes[(unsigned char)i_tolower(c)];
+	}
+	ssm->classes_count = nclasses;
+
+	/* Build trie; unset transitions are 0, which is never a child */
+	delta = p_new(pool, uint32_t, (size_t)max_states * nclasses);
+	ssm->keys = p_new(pool, unsigned int, max_states);
+	ssm->keys[0] = SUBSTR_SEARCH_MULTI_NO_KEY;
+	ssm->states_count = 1;
+	for (i = 0; i < keys_count; i++) {
+		const unsigned char *kdata = str_data(keys[i]);
+		size_t ksize = str_len(keys[i]), j;
+		unsigned int state = 0;
+
+		for (j = 0; j < ksize; j++) {
+			uint32_t *next =
+				&delta[state * nclasses + ssm->classes[kdata[j]]];
+
+			if (*next == 0) {
+				*next = ssm->states_count++;
+				ssm->keys[*next] = SUBSTR_SEARCH_MULTI_NO_KEY;
+			}
+			state = *next;
+		}
+		if (ssm->keys[state] == SUBSTR_SEARCH_MULTI_NO_KEY)
+			ssm->keys[state] = i;
+	}
+
+	/* Compute failure links breadth-first and complete the DFA */
+	fail = t_new(unsigned int, ssm->states_count);
+	queue = t_new(unsigned int, ssm->states_count);
+	qhead = qtail = 0;
+	queue[qtail++] = 0;
+	while (qhead < qtail) {
+		unsigned int state = queue[qhead++];
+		uint32_t *row = &delta[state * nclasses];
+		const uint32_t *frow = &delta[fail[state] * nclasses];
+
+		if (ssm->keys[state] == SUBSTR_SEARCH_MULTI_NO_KEY)
+			ssm->keys[state] = ssm->keys[fail[state]];
+
+		for (c = 0; c < nclasses; c++) {
+			if (row[c] == 0) {
+				row[c] = (state == 0 ? 0 : frow[c]);
+				continue;
+			}
+			fail[row[c]] = (state == 0 ? 0 : frow[c]);
+			queue[qtail++] = row[c];
+		}
+	}
+
+	ssm->delta = delta;
+	return ssm;
+}
+
+void substr_search_multi_free(struct substr_search_multi **_ssm)
+{
+	struct substr_search_multi *ssm = *_ssm;
+
+	*_ssm = NULL;
+	if (ssm == NULL)
+		return;
+
+	p_free(ssm->pool, ssm->delta);
+	p_free(ssm->pool, ssm->keys);
+	p_free(ssm->pool, ssm);
+}
+
+bool substr_search_multi_find(const struct substr_search_multi *ssm,
+			      const void *data, size_t data_size,
+			      unsigned int *key_idx_r)
+{
+	unsigned int state = 0;
+
+	return substr_search_multi_find_more(ssm, &state, data, data_size,
+					     key_idx_r);
+}
+
+bool substr_search_multi_find_more(const struct substr_search_multi *ssm,
+				   unsigned int *state_p,
+				   const void *data, size_t data_size,
+				   unsigned int *key_idx_r)
+{
+	const unsigned char *p = data, *pend = p + data_size;
+	const uint32_t *delta = ssm->delta;
+	unsigned int nclasses = ssm->classes_count;
+	uint32_t state = *state_p;
+
+	/* Empty key matches immediately */
+	if (ssm->keys[0] != SUBSTR_SEARCH_MULTI_NO_KEY) {
+		if (key_idx_r != NULL)
+			*key_idx_r = ssm->keys[0];
+		return TRUE;
+	}
+
+	for (; p < pend; p++) {
+		state = delta[state * nclasses + ssm->classes[*p]];
+		if (ssm->keys[state] != SUBSTR_SEARCH_MULTI_NO_KEY) {
+			*state_p = state;
+			if (key_idx_r != NULL)
+				*key_idx_r = ssm->keys[state];
+			return TRUE;
+		}
+	}
+	*state_p = state;
+	return FALSE;
+}
@@ -0,0 +1,58 @@
+#ifndef SUBSTR_SEARCH_H
+#define SUBSTR_SEARCH_H
+
+#include "lib.h"
+
+/*
+ * Substring search
+ */
+
+/* Finds the first occurrence of key in data. Candidate positions are located
+   using memchr() on the first key byte for short keys or short data; longer
+   keys are searched using Boyer-Moore-Horspool, which skips up to key_size
+   bytes at a time. When icase is TRUE, US-ASCII letters are compared
+   case-insensitively (i;ascii-casemap semantics). An empty key matches at
+   offset 0. When found, the offset of the match is returned in offset_r
+   (which may be NULL). */
+bool substr_search_find(const void *data, size_t data_size,
+			const void *key, size_t key_size, bool icase,
+			size_t *offset_r);
+
+/*
+ * Multi-key substring search
+ */
+
+/* Aho-Corasick automaton that finds whether any of a set of keys occurs in
+   the data in a single pass. The automaton is stored as a DFA over the
+   (compressed) alphabet of bytes that actually occur in the keys, so that
+   scanning costs one table lookup per byte irrespective of the number of
+   keys. */
+
+/* The maximum size of the DFA in transitions (of 4 bytes each) */
+#define SUBSTR_SEARCH_MULTI_MAX_TRANSITIONS (1024 * 1024)
+
+struct substr_search_multi;
+
+/* Returns NULL when the automaton for the keys would exceed
+   SUBSTR_SEARCH_MULTI_MAX_TRANSITIONS; the keys then need to be searched one
+   by one using substr_search_find(). */
+struct substr_search_multi *
+substr_search_multi_create(pool_t pool, const string_t *const *keys,
+			   unsigned int keys_count, bool icase);
+void substr_search_multi_free(struct substr_search_multi **_ssm);
+
+/* Returns TRUE if any key occurs in data. When key_idx_r is not NULL, the
+   index of the key that ends first in data is returned. */
+bool substr_search_multi_find(const struct substr_search_multi *ssm,
+			      const void *data, size_t data_size,
+			      unsigned int *key_idx_r);
+/* Same as substr_search_multi_find(), but for data that arrives in
+   consecutive chunks. The automaton state is carried in *state_p, which must
+   be 0 before the first chunk, so that keys spanning a chunk boundary are
+   found as well. */
+bool substr_search_multi_find_more(const struct substr_search_multi *ssm,
+				   unsigned int *state_p,
+				   const void *data, size_t data_size,
+				   unsigned int *key_idx_r);
+
+#endif
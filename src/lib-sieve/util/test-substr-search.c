@@ -0,0 +1,229 @@
+/* Copyright (c) 2018 Pigeonhole authors, see the included COPYING file */
+
+#include "lib.h"
+#include "test-common.h"
+#include "str.h"
+
+#include "substr-search.h"
+
+struct test_substr_search {
+	const char *data;
+	const char *key;
+	bool icase;
+	int offset; /* -1 = not found */
+};
+
+static const struct test_substr_search substr_search_tests[] = {
+	{ "", "", FALSE, 0 },
+	{ "", "a", FALSE, -1 },
+	{ "frop", "", FALSE, 0 },
+	{ "frop", "frop", FALSE, 0 },
+	{ "frop", "frops", FALSE, -1 },
+	{ "frop", "rop", FALSE, 1 },
+	{ "frop", "ROP", FALSE, -1 },
+	{ "frop", "ROP", TRUE, 1 },
+	{ "FrOp", "fRoP", TRUE, 0 },
+	{ "aaaaaaab", "aab", FALSE, 5 },
+	{ "xxXxxXxY", "xy", TRUE, 6 },
+	{ "Xaxb", "XB", TRUE, 2 },
+	{ "1234", "4", FALSE, 3 },
+	{ "12[34", "[3", TRUE, 2 },
+};
+
+static const unsigned int substr_search_tests_count =
+	N_ELEMENTS(substr_search_tests);
+
+static void test_substr_search_short(void)
+{
+	unsigned int i;
+
+	test_begin("substr search - short");
+
+	for (i = 0; i < substr_search_tests_count; i++) {
+		const struct test_substr_search *test = &substr_search_tests[i];
+		size_t offset;
+		bool found;
+
+		found = substr_search_find(test->data, strlen(test->data),
+					   test->key, strlen(test->key),
+					   test->icase, &offset);
+		test_assert_idx(found == (test->offset >= 0), i);
+		test_assert_idx(!found || offset == (size_t)test->offset, i);
+	}
+
+	test_end();
+}
+
+static void test_substr_search_long(void)
+{
+	static const char *keys[] = {
+		"needle", "NeEdLe", "eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeef",
+		"haystack", "hay", "kh",
+	};
+	char data[4096];
+	unsigned int i, j;
+
+	test_begin("substr search - long");
+
+	/* "haystackhaystack...eeee...eeef...needle" */
+	for (i = 0; i < 2048; i++)
+		data[i] = "haystack"[i % 8];
+	for (; i < 4000; i++)
+		data[i] = 'e';
+	data[i++] = 'f';
+	memcpy(data + i, "needle", 6);
+	i += 6;
+	for (; i < sizeof(data); i++)
+		data[i] = 'h';
+
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		size_t key_size = strlen(keys[i]);
+
+		for (j = 0; j < 2; j++) {
+			bool icase = (j == 1), found, expected = FALSE;
+			size_t offset, pos, expected_offset = 0;
+
+			/* Compare against trivial search */
+			for (pos = 0; pos + key_size <= sizeof(data); pos++) {
+				if ((icase ?
+				     i_memcasecmp(data + pos, keys[i], key_size) :
+				     memcmp(data + pos, keys[i], key_size)) == 0) {
+					expected = TRUE;
+					expected_offset = pos;
+					break;
+				}
+			}
+
+			found = substr_search_find(data, sizeof(data),
+						   keys[i], key_size, icase,
+						   &offset);
+			test_assert_idx(found == expected, i*2 + j);
+			test_assert_idx(!found || offset == expected_offset,
+					i*2 + j);
+		}
+	}
+
+	test_end();
+}
+
+static void test_substr_search_multi(void)
+{
+	static const char *keys[] = {
+		"he", "she", "his", "hers", "FROP",
+	};
+	static const struct {
+		const char *data;
+		bool icase;
+		int key_idx; /* -1 = not found */
+	} tests[] = {
+		{ "", FALSE, -1 },
+		{ "ushers", FALSE, 1 },
+		{ "usHers", FALSE, -1 },
+		{ "usHers", TRUE, 1 },
+		{ "this", FALSE, 2 },
+		{ "frobnitzn frop", FALSE, -1 },
+		{ "frobnitzn frop", TRUE, 4 },
+		{ "xxhxxexx", TRUE, -1 },
+	};
+	struct substr_search_multi *ssm;
+	string_t *key_strs[N_ELEMENTS(keys)];
+	unsigned int i, key_idx;
+
+	test_begin("substr search - multi");
+
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		key_strs[i] = t_str_new_const(keys[i], strlen(keys[i]));
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		bool found;
+
+		ssm = substr_search_multi_create(
+			default_pool, (const string_t *const *)key_strs,
+			N_ELEMENTS(key_strs), tests[i].icase);
+		found = substr_search_multi_find(ssm, tests[i].data,
+						 strlen(tests[i].data),
+						 &key_idx);
+		test_assert_idx(found == (tests[i].key_idx >= 0), i);
+		test_assert_idx(!found || key_idx == (unsigned)tests[i].key_idx,
+				i);
+		substr_search_multi_free(&ssm);
+	}
+
+	/* Keys spanning chunk boundaries are found as well */
+	ssm = substr_search_multi_create(default_pool,
+					 (const string_t *const *)key_strs,
+					 N_ELEMENTS(key_strs), TRUE);
+	for (i = 1; i < 9; i++) {
+		static const char data[] = "frobnitz frop";
+		unsigned int state = 0;
+		size_t pos;
+		bool found = FALSE;
+
+		for (pos = 0; !found && pos < sizeof(data) - 1; pos += i) {
+			size_t size = I_MIN(i, sizeof(data) - 1 - pos);
+
+			found = substr_search_multi_find_more(ssm, &state,
+							      data + pos, size,
+							      &key_idx);
+		}
+		test_assert_idx(found && key_idx == 4, i);
+	}
+	substr_search_multi_free(&ssm);
+
+	/* An empty key matches anything */
+	key_strs[0] = t_str_new_const("", 0);
+	ssm = substr_search_multi_create(default_pool,
+					 (const string_t *const *)key_strs,
+					 N_ELEMENTS(key_strs), FALSE);
+	test_assert(substr_search_multi_find(ssm, "", 0, &key_idx));
+	test_assert(key_idx == 0);
+	substr_search_multi_free(&ssm);
+
+	test_end();
+}
+
+static void test_substr_search_multi_limit(void)
+{
+	string_t *key_strs[2];
+	struct substr_search_multi *ssm;
+	unsigned int i, states;
+
+	test_begin("substr search - multi size limit");
+
+	/* Uses all 256 byte values, so the DFA has 257 classes */
+	states = SUBSTR_SEARCH_MULTI_MAX_TRANSITIONS / 257;
+	key_strs[0] = t_str_new(states);
+	for (i = 0; i < states - 2; i++)
+		str_append_c(key_strs[0], (unsigned char)i);
+	key_strs[1] = t_str_new_const("frop", 4);
+
+	/* Just within the limit */
+	ssm = substr_search_multi_create(default_pool,
+					 (const string_t *const *)key_strs,
+					 1, FALSE);
+	test_assert(ssm != NULL);
+	substr_search_multi_free(&ssm);
+
+	/* Exceeding it; the caller falls back to searching each key */
+	ssm = substr_search_multi_create(default_pool,
+					 (const string_t *const *)key_strs,
+					 N_ELEMENTS(key_strs), FALSE);
+	test_assert(ssm == NULL);
+	test_assert(substr_search_find("frobnitz frop", 13,
+				       str_data(key_strs[1]),
+				       str_len(key_strs[1]), FALSE, NULL));
+
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_substr_search_short,
+		test_substr_search_long,
+		test_substr_search_multi,
+		test_substr_search_multi_limit,
+		NULL
+	};
+	return test_run(test_functions);
+}
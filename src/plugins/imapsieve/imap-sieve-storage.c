@@ -678,9 +678,9 @@ imap_sieve_mailbox_transaction_run(
 	struct mailbox *dest_box,
 	struct mail_transaction_commit_changes *changes)
 {
-	static const char *wanted_headers[] = {
-		"From", "To", "Message-ID", "Subject", "Return-Path",
-		NULL
+	/* Used for logging and the Sieve message data */
+	static const char *base_headers[] = {
+		"From", "To", "Message-ID", "Subject", "Return-Path"
 	};
 	struct mailbox *src_box = ismt->src_box;
 	struct mail_user *user = dest_box->storage->user;
@@ -798,7 +798,18 @@ imap_sieve_mailbox_transaction_run(
 
 	/* Create transaction for event messages */
 	st = mailbox_transaction_begin(sbox, 0, __func__);
-	headers_ctx = mailbox_header_lookup_init(sbox, wanted_headers);
+	T_BEGIN {
+		ARRAY_TYPE(const_string) wanted_headers;
+
+		t_array_init(&wanted_headers, 16);
+		array_append(&wanted_headers, base_headers,
+			     N_ELEMENTS(base_headers));
+		imap_sieve_run_get_wanted_headers(isrun, &wanted_headers);
+		array_append_zero(&wanted_headers);
+
+		headers_ctx = mailbox_header_lookup_init(
+			sbox, array_idx(&wanted_headers, 0));
+	} T_END;
 	mail = mail_alloc(st, 0, headers_ctx);
 	mailbox_header_lookup_unref(&headers_ctx);
 
@@ -15,6 +15,7 @@
 
 #include "sieve.h"
 #include "sieve-script.h"
+#include "sieve-binary.h"
 #include "sieve-storage.h"
 
 #include "ext-imapsieve-common.h"
@@ -696,6 +697,68 @@ imap_sieve_handle_exec_status(struct imap_sieve_run *isrun,
 	return ret;
 }
 
+static enum sieve_compile_flags
+imap_sieve_run_compile_flags(struct imap_sieve_run *isrun,
+			     struct sieve_script *script)
+{
+	if (script == isrun->user_script)
+		return SIEVE_COMPILE_FLAG_NOGLOBAL;
+	return SIEVE_COMPILE_FLAG_NO_ENVELOPE;
+}
+
+static void
+imap_sieve_add_wanted_header(ARRAY_TYPE(const_string) *headers,
+			     const char *name)
+{
+	const char *header;
+
+	array_foreach_elem(headers, header) {
+		if (strcasecmp(header, name) == 0)
+			return;
+	}
+	array_append(headers, &name, 1);
+}
+
+void imap_sieve_run_get_wanted_headers(struct imap_sieve_run *isrun,
+				       ARRAY_TYPE(const_string) *headers)
+{
+	struct imap_sieve_run_script *scripts = isrun->scripts;
+	struct sieve_binary_data_requirements reqs;
+	ARRAY_TYPE(const_string) script_headers;
+	const char *const *name, *header;
+	unsigned int i;
+
+	t_array_init(&script_headers, 16);
+	for (i = 0; i < isrun->scripts_count; i++) {
+		struct sieve_script *script = scripts[i].script;
+		enum sieve_error error;
+
+		/* Open binaries now rather than when the first message is
+		   executed; imap_sieve_run_scripts() uses them as they are */
+		if (scripts[i].binary == NULL) {
+			if (scripts[i].compile_error != SIEVE_ERROR_NONE)
+				return;
+			scripts[i].binary = imap_sieve_run_open_script(
+				isrun, script,
+				imap_sieve_run_compile_flags(isrun, script),
+				FALSE, &error);
+			if (scripts[i].binary == NULL) {
+				scripts[i].compile_error = error;
+				return;
+			}
+		}
+
+		sieve_binary_get_data_requirements(scripts[i].binary, &reqs);
+		if ((reqs.flags & SIEVE_BINARY_DATA_FLAG_ANY_HEADER) != 0)
+			return;
+		for (name = reqs.headers; *name != NULL; name++)
+			imap_sieve_add_wanted_header(&script_headers, *name);
+	}
+
+	array_foreach_elem(&script_headers, header)
+		imap_sieve_add_wanted_header(headers, header);
+}
+
 static int
 imap_sieve_run_scripts(struct imap_sieve_run *isrun,
 		       const struct sieve_message_data *msgdata,
@@ -728,7 +791,7 @@ imap_sieve_run_scripts(struct imap_sieve_run *isrun,
 		struct sieve_binary *sbin = scripts[i].binary;
 		int mstatus;
 
-		cpflags = 0;
+		cpflags = imap_sieve_run_compile_flags(isrun, script);
 		exflags = SIEVE_EXECUTE_FLAG_NO_ENVELOPE |
 			  SIEVE_EXECUTE_FLAG_SKIP_RESPONSES;
 
@@ -742,11 +805,9 @@ imap_sieve_run_scripts(struct imap_sieve_run *isrun,
 
 		sieve_resource_usage_init(rusage);
 		if (user_script) {
-			cpflags |= SIEVE_COMPILE_FLAG_NOGLOBAL;
 			exflags |= SIEVE_EXECUTE_FLAG_NOGLOBAL;
 			ehandler = isrun->user_ehandler;
 		} else {
-			cpflags |= SIEVE_COMPILE_FLAG_NO_ENVELOPE;
 			ehandler = isieve->master_ehandler;
 		}
 
@@ -51,6 +51,12 @@ int imap_sieve_run_init(struct imap_sieve *isieve, struct mailbox *dest_mailbox,
 			struct imap_sieve_run **isrun_r)
 			ATTR_NULL(4, 5, 6);
 
+/* Adds the header fields that the scripts of this run evaluate to the
+   headers array, so that these can be prefetched. Nothing is added when the
+   scripts can access arbitrary header fields. */
+void imap_sieve_run_get_wanted_headers(struct imap_sieve_run *isrun,
+				       ARRAY_TYPE(const_string) *headers);
+
 int imap_sieve_run_mail(struct imap_sieve_run *isrun, struct mail *mail,
 			const char *changed_flags, bool *fatal_r);
 
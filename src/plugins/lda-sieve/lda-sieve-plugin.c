@@ -20,6 +20,7 @@
 
 #include "sieve.h"
 #include "sieve-script.h"
+#include "sieve-binary.h"
 #include "sieve-storage.h"
 
 #include "lda-sieve-plugin.h"
@@ -41,6 +42,11 @@
 
 static deliver_mail_func_t *next_deliver_mail;
 
+/* Sieve instance of the last delivery, kept with the key of its environment
+   and settings */
+static struct sieve_instance *lda_sieve_svinst = NULL;
+static char *lda_sieve_svinst_key = NULL;
+
 /*
  * Settings handling
  */
@@ -513,6 +519,31 @@ lda_sieve_handle_exec_status(struct lda_sieve_run_context *srctx,
 	return ret;
 }
 
+static void
+lda_sieve_prefetch(struct lda_sieve_run_context *srctx,
+		   struct sieve_binary *sbin)
+{
+	struct mail *mail = srctx->msgdata->mail;
+	struct sieve_binary_data_requirements reqs;
+	struct mailbox_header_lookup_ctx *headers_ctx = NULL;
+	enum mail_fetch_field fields = 0;
+
+	/* Tell the mail which data the script is going to read */
+	sieve_binary_get_data_requirements(sbin, &reqs);
+	if ((reqs.flags & (SIEVE_BINARY_DATA_FLAG_BODY |
+			   SIEVE_BINARY_DATA_FLAG_MIME)) != 0)
+		fields |= MAIL_FETCH_STREAM_BODY;
+	if ((reqs.flags & SIEVE_BINARY_DATA_FLAG_ANY_HEADER) == 0 &&
+	    reqs.headers[0] != NULL)
+		headers_ctx = mailbox_header_lookup_init(mail->box,
+							 reqs.headers);
+
+	if (fields != 0 || headers_ctx != NULL)
+		mail_add_temp_wanted_fields(mail, fields, headers_ctx);
+	if (headers_ctx != NULL)
+		mailbox_header_lookup_unref(&headers_ctx);
+}
+
 static int
 lda_sieve_execute_script(struct lda_sieve_run_context *srctx,
 			 struct sieve_multiscript *mscript,
@@ -560,6 +591,8 @@ lda_sieve_execute_script(struct lda_sieve_run_context *srctx,
 	if (sbin == NULL)
 		return 0;
 
+	lda_sieve_prefetch(srctx, sbin);
+
 	/* Execute */
 
 	e_debug(sieve_get_event(svinst),
@@ -715,42 +748,58 @@ static int lda_sieve_find_scripts(struct lda_sieve_run_context *srctx)
 	ARRAY_TYPE(sieve_script) script_sequence;
 	struct sieve_script *const *scripts;
 	unsigned int after_index, count, i;
+	uint32_t storage_generation;
 	int ret = 1;
 
 	/* Find the personal script to execute */
 
-	ret = lda_sieve_get_personal_storage(svinst, mdctx->rcpt_user,
-					     &main_storage, &error);
-	if (ret == 0 && error == SIEVE_ERROR_NOT_POSSIBLE)
-		return 0;
-	if (ret > 0) {
-		srctx->main_script =
-			sieve_storage_active_script_open(main_storage, &error);
-
-		if (srctx->main_script == NULL) {
-			switch (error) {
-			case SIEVE_ERROR_NOT_FOUND:
-				e_debug(sieve_get_event(svinst),
-					"User has no active script in storage `%s'",
-					sieve_storage_location(main_storage));
-				break;
-			case SIEVE_ERROR_TEMP_FAILURE:
-				e_error(sieve_get_event(svinst),
-					"Failed to access active Sieve script in user storage `%s' "
-					"(temporary failure)",
-					sieve_storage_location(main_storage));
-				ret = -1;
-				break;
-			default:
-				e_error(sieve_get_event(svinst),
-					"Failed to access active Sieve script in user storage `%s'",
-					sieve_storage_location(main_storage));
-				break;
+	if (sieve_storage_no_active_script_cached(svinst, mdctx->rcpt_user,
+						  &storage_generation)) {
+		e_debug(sieve_get_event(svinst),
+			"User has no active script (cached)");
+		ret = 0;
+	} else {
+		ret = lda_sieve_get_personal_storage(svinst, mdctx->rcpt_user,
+						     &main_storage, &error);
+		if (ret == 0 && error == SIEVE_ERROR_NOT_POSSIBLE)
+			return 0;
+		if (ret > 0) {
+			srctx->main_script = sieve_storage_active_script_open(
+				main_storage, &error);
+
+			if (srctx->main_script == NULL) {
+				switch (error) {
+				case SIEVE_ERROR_NOT_FOUND:
+					e_debug(sieve_get_event(svinst),
+						"User has no active script in storage `%s'",
+						sieve_storage_location(main_storage));
+					break;
+				case SIEVE_ERROR_TEMP_FAILURE:
+					e_error(sieve_get_event(svinst),
+						"Failed to access active Sieve script in user storage `%s' "
+						"(temporary failure)",
+						sieve_storage_location(main_storage));
+					ret = -1;
+					break;
+				default:
+					e_error(sieve_get_event(svinst),
+						"Failed to access active Sieve script in user storage `%s'",
+						sieve_storage_location(main_storage));
+					break;
+				}
+			} else if (!sieve_script_is_default(srctx->main_script)) {
+				srctx->user_script = srctx->main_script;
 			}
-		} else if (!sieve_script_is_default(srctx->main_script)) {
-			srctx->user_script = srctx->main_script;
+			sieve_storage_unref(&main_storage);
+		}
+
+		/* Remember that there is no script, so that the next
+		   deliveries need not access the storage */
+		if (ret >= 0 && srctx->main_script == NULL &&
+		    error == SIEVE_ERROR_NOT_FOUND) {
+			sieve_storage_no_active_script_cache(
+				svinst, mdctx->rcpt_user, storage_generation);
 		}
-		sieve_storage_unref(&main_storage);
 	}
 
 	if (ret >= 0 && srctx->main_script == NULL) {
@@ -1044,6 +1093,97 @@ lda_sieve_execute(struct lda_sieve_run_context *srctx,
 	return ret;
 }
 
+/*
+ * Sieve instance
+ */
+
+static const char *
+lda_sieve_instance_key(struct mail_deliver_context *mdctx,
+		       const struct sieve_environment *svenv, bool debug)
+{
+	const struct mail_user_settings *user_set = mdctx->rcpt_user->set;
+	const char *const fields[] = {
+		svenv->username, svenv->home_dir, svenv->hostname,
+		svenv->base_dir, svenv->temp_dir,
+		mdctx->set->recipient_delimiter,
+	};
+	const char *const *envs;
+	string_t *key;
+	unsigned int count, i;
+
+	key = t_str_new(1024);
+	str_append_c(key, debug ? '1' : '0');
+	for (i = 0; i < N_ELEMENTS(fields); i++) {
+		str_append_c(key, '\n');
+		if (fields[i] != NULL)
+			str_append(key, fields[i]);
+	}
+	if (array_is_created(&user_set->plugin_envs)) {
+		envs = array_get(&user_set->plugin_envs, &count);
+		for (i = 0; i < count; i++) {
+			str_append_c(key, '\n');
+			str_append(key, envs[i]);
+		}
+	}
+	return str_c(key);
+}
+
+static struct sieve_instance *
+lda_sieve_instance_get(struct mail_deliver_context *mdctx,
+		       const struct sieve_environment *svenv,
+		       const char *key, bool debug)
+{
+	struct sieve_instance *svinst;
+
+	/* Reuse the instance of the last delivery when nothing changed, so
+	   that the binaries it cached are reused as well */
+	if (lda_sieve_svinst != NULL &&
+	    strcmp(lda_sieve_svinst_key, key) == 0) {
+		svinst = lda_sieve_svinst;
+		lda_sieve_svinst = NULL;
+
+		sieve_set_context(svinst, mdctx, svenv->event_parent);
+		e_debug(sieve_get_event(svinst),
+			"Reusing Sieve instance of previous delivery");
+		return svinst;
+	}
+
+	if (lda_sieve_svinst != NULL)
+		sieve_deinit(&lda_sieve_svinst);
+	i_free(lda_sieve_svinst_key);
+
+	return sieve_init(svenv, &lda_sieve_callbacks, mdctx, debug);
+}
+
+static void
+lda_sieve_instance_put(struct sieve_instance **_svinst, const char *key)
+{
+	struct sieve_instance *svinst = *_svinst;
+
+	*_svinst = NULL;
+	if (svinst == NULL)
+		return;
+
+	/* The delivery context is gone after this */
+	sieve_set_context(svinst, NULL, NULL);
+
+	i_assert(lda_sieve_svinst == NULL);
+	lda_sieve_svinst = svinst;
+	i_free(lda_sieve_svinst_key);
+	lda_sieve_svinst_key = i_strdup(key);
+}
+
+static void lda_sieve_instance_deinit(void)
+{
+	if (lda_sieve_svinst != NULL)
+		sieve_deinit(&lda_sieve_svinst);
+	i_free(lda_sieve_svinst_key);
+}
+
+/*
+ * Mail delivery
+ */
+
 static int
 lda_sieve_deliver_mail(struct mail_deliver_context *mdctx,
 		       struct mail_storage **storage_r)
@@ -1053,6 +1193,7 @@ lda_sieve_deliver_mail(struct mail_deliver_context *mdctx,
 		mail_user_set_get_storage_set(mdctx->rcpt_user);
 	bool debug = mdctx->rcpt_user->mail_debug;
 	struct sieve_environment svenv;
+	const char *svinst_key;
 	int ret = 0;
 
 	/* Initialize run context */
@@ -1074,7 +1215,8 @@ lda_sieve_deliver_mail(struct mail_deliver_context *mdctx,
 	svenv.location = SIEVE_ENV_LOCATION_MDA;
 	svenv.delivery_phase = SIEVE_DELIVERY_PHASE_DURING;
 
-	srctx.svinst = sieve_init(&svenv, &lda_sieve_callbacks, mdctx, debug);
+	svinst_key = lda_sieve_instance_key(mdctx, &svenv, debug);
+	srctx.svinst = lda_sieve_instance_get(mdctx, &svenv, svinst_key, debug);
 
 	/* Initialize master error handler */
 
@@ -1103,7 +1245,7 @@ lda_sieve_deliver_mail(struct mail_deliver_context *mdctx,
 	if (srctx.user_ehandler != NULL)
 		sieve_error_handler_unref(&srctx.user_ehandler);
 	sieve_error_handler_unref(&srctx.master_ehandler);
-	sieve_deinit(&srctx.svinst);
+	lda_sieve_instance_put(&srctx.svinst, svinst_key);
 
 	return ret;
 }
@@ -1125,4 +1267,6 @@ void sieve_plugin_deinit(void)
 {
 	/* Remove hook */
 	mail_deliver_hook_set(next_deliver_mail);
+
+	lda_sieve_instance_deinit();
 }
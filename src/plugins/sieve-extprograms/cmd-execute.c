@@ -54,6 +54,7 @@ const struct sieve_command_def sieve_cmd_execute = {
 	.registered = cmd_execute_registered,
 	.validate = sieve_extprogram_command_validate,
 	.generate = cmd_execute_generate,
+	.data_declared = TRUE,
 };
 
 /*
@@ -223,6 +224,9 @@ cmd_execute_generate_input_tag(const struct sieve_codegen_env *cgenv,
 			       struct sieve_command *cmd)
 {
 	if (arg->parameters == NULL) {
+		/* :pipe passes the message to the program */
+		sieve_generate_require_data(cgenv,
+					    SIEVE_BINARY_DATA_FLAGS_MESSAGE);
 		sieve_opr_omitted_emit(cgenv->sblock);
 		return TRUE;
 	}
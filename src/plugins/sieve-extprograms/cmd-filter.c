@@ -48,7 +48,9 @@ const struct sieve_command_def sieve_cmd_filter = {
 	.block_allowed = FALSE,
 	.block_required = FALSE,
 	.validate = sieve_extprogram_command_validate,
-	.generate = cmd_filter_generate
+	.generate = cmd_filter_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE
 };
 
 /* 
@@ -46,6 +46,8 @@ const struct sieve_command_def sieve_cmd_pipe = {
 	.registered = cmd_pipe_registered,
 	.validate = sieve_extprogram_command_validate,
 	.generate = cmd_pipe_generate,
+	.data_flags = SIEVE_BINARY_DATA_FLAGS_MESSAGE,
+	.data_declared = TRUE,
 };
 
 /*
@@ -61,6 +61,7 @@ struct sieve_filter_data {
 
 struct sieve_filter_context {
 	const struct sieve_filter_data *data;
+	struct sieve_execute_context *ectx;
 
 	struct mailbox_transaction_context *move_trans;
 
@@ -137,8 +138,10 @@ static int filter_message(struct sieve_filter_context *sfctx, struct mail *mail)
 			   "filtering: [%s; %"PRIuUOFF_T" bytes] `%s'",
 			   date, size, str_sanitize(subject, 40));
 
-		ret = sieve_execute(sbin, &msgdata, senv, ehandler, ehandler,
-				    exflags);
+		if (sfctx->ectx == NULL)
+			sfctx->ectx = sieve_execute_context_create(sbin);
+		ret = sieve_execute_context_run(sfctx->ectx, &msgdata, senv,
+						ehandler, ehandler, exflags);
 	} else {
 		o_stream_nsend_str(
 			sfctx->teststream,
@@ -353,6 +356,7 @@ filter_mailbox(const struct sieve_filter_data *sfdata, struct mailbox *src_box)
 
 	if (sfctx.teststream != NULL)
 		o_stream_destroy(&sfctx.teststream);
+	sieve_execute_context_free(&sfctx.ectx);
 
 	if (ret < 0) return ret;
 
@@ -17,6 +17,7 @@
 #include "sieve.h"
 #include "sieve-binary.h"
 #include "sieve-extensions.h"
+#include "sieve-profile.h"
 
 #include "sieve-tool.h"
 
@@ -43,7 +44,7 @@ static void print_help(void)
 "Usage: sieve-test [-a <orig-recipient-address] [-c <config-file>]\n"
 "                  [-C] [-D] [-d <dump-filename>] [-e]\n"
 "                  [-f <envelope-sender>] [-l <mail-location>]\n"
-"                  [-m <default-mailbox>] [-P <plugin>]\n"
+"                  [-m <default-mailbox>] [-p] [-P <plugin>]\n"
 "                  [-r <recipient-address>] [-s <script-file>]\n"
 "                  [-t <trace-file>] [-T <trace-option>] [-x <extensions>]\n"
 "                  <script-file> <mail-file>\n"
@@ -183,12 +184,12 @@ int main(int argc, char **argv)
 	struct sieve_error_handler *ehandler;
 	struct ostream *teststream = NULL;
 	struct sieve_trace_log *trace_log = NULL;
-	bool force_compile = FALSE, execute = FALSE;
+	bool force_compile = FALSE, execute = FALSE, profile = FALSE;
 	int exit_status = EXIT_SUCCESS;
 	int ret, c;
 
 	sieve_tool = sieve_tool_init("sieve-test", &argc, &argv,
-				     "r:a:f:m:d:l:s:eCt:T:DP:x:u:", FALSE);
+				     "r:a:f:m:d:l:s:epCt:T:DP:x:u:", FALSE);
 
 	ehandler = NULL;
 	t_array_init(&scriptfiles, 16);
@@ -260,6 +261,10 @@ int main(int argc, char **argv)
 		case 'C':
 			force_compile = TRUE;
 			break;
+			/* profiling */
+		case 'p':
+			profile = TRUE;
+			break;
 		default:
 			/* unrecognized option */
 			print_help();
@@ -293,6 +298,9 @@ int main(int argc, char **argv)
 	/* Enable debug extension */
 	sieve_enable_debug_extension(svinst);
 
+	if (profile)
+		sieve_enable_profiling(svinst);
+
 	/* Create error handler */
 	ehandler = sieve_stderr_ehandler_create(svinst, 0);
 	sieve_error_handler_accept_infolog(ehandler, TRUE);
@@ -496,6 +504,16 @@ int main(int argc, char **argv)
 
 		if (teststream != NULL)
 			o_stream_destroy(&teststream);
+
+		/* Print profile of the main script */
+		if (profile && sbin != NULL) {
+			struct ostream *profstream;
+
+			profstream = o_stream_create_fd(1, 0);
+			o_stream_set_no_error_handling(profstream, TRUE);
+			sieve_profile_report(sbin, profstream);
+			o_stream_destroy(&profstream);
+		}
 		if (trace_log != NULL)
 			sieve_trace_log_free(&trace_log);
 
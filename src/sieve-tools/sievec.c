@@ -3,6 +3,9 @@
 
 #include "lib.h"
 #include "array.h"
+#include "istream.h"
+#include "time-util.h"
+#include "write-full.h"
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "mail-storage-service.h"
@@ -11,6 +14,7 @@
 #include "sieve.h"
 #include "sieve-extensions.h"
 #include "sieve-script.h"
+#include "sieve-error.h"
 #include "sieve-tool.h"
 
 #include <stdio.h>
@@ -21,6 +25,7 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <sysexits.h>
+#include <sys/wait.h>
 
 /*
  * Print help
@@ -31,9 +36,234 @@ static void print_help(void)
 	printf(
 "Usage: sievec  [-c <config-file>] [-d] [-D] [-P <plugin>] [-x <extensions>] \n"
 "              <script-file> [<out-file>]\n"
+"       sievec  [-c <config-file>] [-D] [-P <plugin>] [-x <extensions>] \n"
+"              [-j <workers>] -l <list-file>\n"
 	);
 }
 
+/*
+ * Bulk compilation
+ */
+
+struct sievec_bulk_stats {
+	unsigned int compiled;
+	unsigned int current;
+	unsigned int failed;
+};
+
+static void sievec_bulk_add_dir
+(ARRAY_TYPE(const_string) *locations, const char *path)
+{
+	DIR *dirp;
+	struct dirent *dp;
+
+	if ( (dirp = opendir(path)) == NULL ) {
+		i_error("opendir(%s) failed: %m", path);
+		return;
+	}
+
+	for (;;) {
+		const char *file;
+
+		errno = 0;
+		if ( (dp = readdir(dirp)) == NULL ) {
+			if ( errno != 0 )
+				i_error("readdir(%s) failed: %m", path);
+			break;
+		}
+
+		if ( !sieve_script_file_has_extension(dp->d_name) )
+			continue;
+
+		if ( path[strlen(path)-1] == '/' )
+			file = t_strconcat(path, dp->d_name, NULL);
+		else
+			file = t_strconcat(path, "/", dp->d_name, NULL);
+		array_append(locations, &file, 1);
+	}
+
+	if ( closedir(dirp) < 0 )
+		i_error("closedir(%s) failed: %m", path);
+}
+
+/* Reads the list of script locations, one per line. Directories are expanded
+   into the scripts they contain. */
+static void sievec_bulk_read_list
+(ARRAY_TYPE(const_string) *locations, const char *listfile)
+{
+	struct istream *input;
+	const char *line;
+	struct stat st;
+	int fd;
+
+	if ( strcmp(listfile, "-") == 0 )
+		fd = STDIN_FILENO;
+	else if ( (fd = open(listfile, O_RDONLY)) < 0 )
+		i_fatal("open(%s) failed: %m", listfile);
+
+	input = i_stream_create_fd(fd, (size_t)-1);
+	while ( (line = i_stream_read_next_line(input)) != NULL ) {
+		line = t_str_trim(line, " \t\r");
+		if ( *line == '\0' || *line == '#' )
+			continue;
+
+		if ( stat(line, &st) == 0 && S_ISDIR(st.st_mode) )
+			sievec_bulk_add_dir(locations, line);
+		else {
+			line = t_strdup(line);
+			array_append(locations, &line, 1);
+		}
+	}
+	if ( input->stream_errno != 0 ) {
+		i_fatal("read(%s) failed: %s", listfile,
+			i_stream_get_error(input));
+	}
+	i_stream_destroy(&input);
+
+	if ( fd != STDIN_FILENO && close(fd) < 0 )
+		i_error("close(%s) failed: %m", listfile);
+}
+
+static void sievec_bulk_compile
+(struct sieve_instance *svinst, const char *location,
+	struct sievec_bulk_stats *stats)
+{
+	struct sieve_error_handler *ehandler;
+	struct sieve_binary *sbin;
+	enum sieve_error error;
+
+	ehandler = sieve_stderr_ehandler_create(svinst, 0);
+	sieve_error_handler_accept_infolog(ehandler, TRUE);
+
+	/* Opening the script compiles it only when its binary is missing or
+	   not up-to-date */
+	sbin = sieve_open(svinst, location, NULL, ehandler, 0, &error);
+	if ( sbin == NULL ) {
+		i_error("failed to compile sieve script `%s'", location);
+		stats->failed++;
+	} else if ( sieve_is_loaded(sbin) ) {
+		stats->current++;
+	} else if ( sieve_save(sbin, TRUE, &error) < 0 ) {
+		i_error("failed to save binary for sieve script `%s'",
+			location);
+		stats->failed++;
+	} else {
+		stats->compiled++;
+	}
+
+	if ( sbin != NULL )
+		sieve_close(&sbin);
+	sieve_error_handler_unref(&ehandler);
+}
+
+static void sievec_bulk_worker
+(struct sieve_instance *svinst, const char *const *locations,
+	unsigned int count, unsigned int first, unsigned int step,
+	struct sievec_bulk_stats *stats)
+{
+	unsigned int i;
+
+	for ( i = first; i < count; i += step ) T_BEGIN {
+		sievec_bulk_compile(svinst, locations[i], stats);
+	} T_END;
+}
+
+static void sievec_bulk_collect
+(int fd, pid_t pid, struct sievec_bulk_stats *stats)
+{
+	struct sievec_bulk_stats wstats;
+	ssize_t ret;
+	int status;
+
+	ret = read(fd, &wstats, sizeof(wstats));
+	if ( ret < 0 )
+		i_error("read() from worker failed: %m");
+	if ( close(fd) < 0 )
+		i_error("close() failed: %m");
+
+	if ( waitpid(pid, &status, 0) < 0 )
+		i_error("waitpid() failed: %m");
+	else if ( ret == (ssize_t)sizeof(wstats) &&
+		WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ) {
+		stats->compiled += wstats.compiled;
+		stats->current += wstats.current;
+		stats->failed += wstats.failed;
+		return;
+	}
+
+	i_error("worker process %s terminated abnormally", dec2str(pid));
+	stats->failed++;
+}
+
+static int sievec_bulk
+(struct sieve_instance *svinst, const char *listfile, unsigned int workers)
+{
+	ARRAY_TYPE(const_string) locations;
+	struct sievec_bulk_stats stats;
+	const char *const *locs;
+	unsigned int count, i;
+	struct timeval start, end;
+	long long msecs;
+	pid_t *pids;
+	int *fds;
+
+	t_array_init(&locations, 256);
+	sievec_bulk_read_list(&locations, listfile);
+	locs = array_get(&locations, &count);
+
+	if ( workers > count )
+		workers = (count > 0 ? count : 1);
+
+	i_zero(&stats);
+	i_gettimeofday(&start);
+
+	if ( workers <= 1 ) {
+		sievec_bulk_worker(svinst, locs, count, 0, 1, &stats);
+	} else {
+		pids = t_new(pid_t, workers);
+		fds = t_new(int, workers);
+
+		for ( i = 0; i < workers; i++ ) {
+			int pfd[2];
+
+			if ( pipe(pfd) < 0 )
+				i_fatal("pipe() failed: %m");
+
+			if ( (pids[i] = fork()) < 0 )
+				i_fatal("fork() failed: %m");
+			if ( pids[i] == 0 ) {
+				/* Worker */
+				if ( close(pfd[0]) < 0 )
+					i_error("close() failed: %m");
+				sievec_bulk_worker
+					(svinst, locs, count, i, workers, &stats);
+				if ( write_full(pfd[1], &stats, sizeof(stats)) < 0 )
+					i_fatal("write() to parent failed: %m");
+				sieve_tool_deinit(&sieve_tool);
+				exit(EXIT_SUCCESS);
+			}
+
+			if ( close(pfd[1]) < 0 )
+				i_error("close() failed: %m");
+			fds[i] = pfd[0];
+		}
+
+		for ( i = 0; i < workers; i++ )
+			sievec_bulk_collect(fds[i], pids[i], &stats);
+	}
+
+	i_gettimeofday(&end);
+	msecs = timeval_diff_msecs(&end, &start);
+
+	printf("%u scripts in %lld.%03lld s (%u workers, %.1f scripts/s): "
+		"%u compiled, %u up-to-date, %u failed\n",
+		count, msecs / 1000, msecs % 1000, workers,
+		(msecs > 0 ? (double)count * 1000 / msecs : (double)count),
+		stats.compiled, stats.current, stats.failed);
+
+	return ( stats.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
 /*
  * Tool implementation
  */
@@ -44,11 +274,12 @@ int main(int argc, char **argv)
 	struct stat st;
 	struct sieve_binary *sbin;
 	bool dump = FALSE;
-	const char *scriptfile, *outfile;
+	const char *scriptfile, *outfile, *listfile = NULL;
+	unsigned int workers = 1;
 	int exit_status = EXIT_SUCCESS;
 	int c;
 
-	sieve_tool = sieve_tool_init("sievec", &argc, &argv, "DdP:x:u:", FALSE);
+	sieve_tool = sieve_tool_init("sievec", &argc, &argv, "DdP:x:u:j:l:", FALSE);
 
 	outfile = NULL;
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
@@ -57,6 +288,18 @@ int main(int argc, char **argv)
 			/* dump file */
 			dump = TRUE;
 			break;
+		case 'j':
+			/* number of bulk workers */
+			if ( str_to_uint(optarg, &workers) < 0 || workers == 0 ) {
+				print_help();
+				i_fatal_status(EX_USAGE,
+					"Invalid number of workers: %s", optarg);
+			}
+			break;
+		case 'l':
+			/* bulk compile list */
+			listfile = optarg;
+			break;
 		default:
 			print_help();
 			i_fatal_status(EX_USAGE, "Unknown argument: %c", c);
@@ -64,6 +307,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if ( listfile != NULL ) {
+		if ( dump || optind < argc ) {
+			print_help();
+			i_fatal_status(EX_USAGE,
+				"the -d option and script arguments are not allowed with -l");
+		}
+
+		svinst = sieve_tool_init_finish(sieve_tool, FALSE, TRUE);
+		sieve_enable_debug_extension(svinst);
+
+		exit_status = sievec_bulk(svinst, listfile, workers);
+
+		sieve_tool_deinit(&sieve_tool);
+		return exit_status;
+	}
+
 	if ( optind < argc ) {
 		scriptfile = argv[optind++];
 	} else {
@@ -89,6 +89,7 @@ extern const struct sieve_command_def tst_test_multiscript;
 extern const struct sieve_command_def tst_test_error;
 extern const struct sieve_command_def tst_test_result_action;
 extern const struct sieve_command_def tst_test_result_execute;
+extern const struct sieve_command_def tst_test_script_data;
 
 /*
  * Operations
@@ -117,7 +118,8 @@ enum testsuite_operation_code {
 	TESTSUITE_OPERATION_TEST_MAILBOX_DELETE,
 	TESTSUITE_OPERATION_TEST_BINARY_LOAD,
 	TESTSUITE_OPERATION_TEST_BINARY_SAVE,
-	TESTSUITE_OPERATION_TEST_IMAP_METADATA_SET
+	TESTSUITE_OPERATION_TEST_IMAP_METADATA_SET,
+	TESTSUITE_OPERATION_TEST_SCRIPT_DATA
 };
 
 extern const struct sieve_operation_def test_operation;
@@ -143,6 +145,7 @@ extern const struct sieve_operation_def test_mailbox_delete_operation;
 extern const struct sieve_operation_def test_binary_load_operation;
 extern const struct sieve_operation_def test_binary_save_operation;
 extern const struct sieve_operation_def test_imap_metadata_set_operation;
+extern const struct sieve_operation_def test_script_data_operation;
 
 /*
  * Operands
@@ -0,0 +1,280 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "sieve-common.h"
+#include "sieve-commands.h"
+#include "sieve-stringlist.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
+#include "sieve-validator.h"
+#include "sieve-generator.h"
+#include "sieve-interpreter.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-dump.h"
+#include "sieve-match.h"
+
+#include "testsuite-common.h"
+#include "testsuite-script.h"
+
+/*
+ * Test_script_data command
+ *
+ * Syntax:
+ *   test_script_data [MATCH-TYPE] [COMPARATOR] <key-list: string-list>
+ *
+ * Matches the key list against the data requirements of the compiled
+ * script. These are listed as "any-header", "body", "mime", "any-envelope",
+ * "mailbox", "header:<name>" and "envelope:<part>".
+ */
+
+static bool tst_test_script_data_registered
+	(struct sieve_validator *valdtr, const struct sieve_extension *ext,
+		struct sieve_command_registration *cmd_reg);
+static bool tst_test_script_data_validate
+	(struct sieve_validator *valdtr, struct sieve_command *cmd);
+static bool tst_test_script_data_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *ctx);
+
+const struct sieve_command_def tst_test_script_data = {
+	.identifier = "test_script_data",
+	.type = SCT_TEST,
+	.positional_args = 1,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.registered = tst_test_script_data_registered,
+	.validate = tst_test_script_data_validate,
+	.generate = tst_test_script_data_generate
+};
+
+/*
+ * Operation
+ */
+
+static bool tst_test_script_data_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int tst_test_script_data_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def test_script_data_operation = {
+	.mnemonic = "TEST_SCRIPT_DATA",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_SCRIPT_DATA,
+	.dump = tst_test_script_data_operation_dump,
+	.execute = tst_test_script_data_operation_execute
+};
+
+/*
+ * Command registration
+ */
+
+static bool tst_test_script_data_registered
+(struct sieve_validator *valdtr, const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_command_registration *cmd_reg)
+{
+	/* The order of these is not significant */
+	sieve_comparators_link_tag(valdtr, cmd_reg, SIEVE_MATCH_OPT_COMPARATOR);
+	sieve_match_types_link_tags(valdtr, cmd_reg, SIEVE_MATCH_OPT_MATCH_TYPE);
+
+	return TRUE;
+}
+
+/*
+ * Validation
+ */
+
+static bool tst_test_script_data_validate
+(struct sieve_validator *valdtr ATTR_UNUSED, struct sieve_command *tst)
+{
+	struct sieve_ast_argument *arg = tst->first_positional;
+	struct sieve_comparator cmp_default =
+		SIEVE_COMPARATOR_DEFAULT(i_octet_comparator);
+	struct sieve_match_type mcht_default =
+		SIEVE_COMPARATOR_DEFAULT(is_match_type);
+
+	if ( !sieve_validate_positional_argument
+		(valdtr, tst, arg, "key list", 1, SAAT_STRING_LIST) ) {
+		return FALSE;
+	}
+
+	if ( !sieve_validator_argument_activate(valdtr, tst, arg, FALSE) )
+		return FALSE;
+
+	/* Validate the key argument to a specified match type */
+	return sieve_match_type_validate
+		(valdtr, tst, arg, &mcht_default, &cmp_default);
+}
+
+/*
+ * Code generation
+ */
+
+static bool tst_test_script_data_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *tst)
+{
+	sieve_operation_emit
+		(cgenv->sblock, tst->ext, &test_script_data_operation);
+
+	/* Generate arguments */
+	return sieve_generate_arguments(cgenv, tst, NULL);
+}
+
+/*
+ * Code dump
+ */
+
+static bool tst_test_script_data_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address)
+{
+	sieve_code_dumpf(denv, "TEST_SCRIPT_DATA:");
+	sieve_code_descend(denv);
+
+	/* Handle any optional arguments */
+	if ( sieve_match_opr_optional_dump(denv, address, NULL) != 0 )
+		return FALSE;
+
+	return sieve_opr_stringlist_dump(denv, address, "key list");
+}
+
+/*
+ * Data requirements stringlist
+ */
+
+struct testsuite_data_stringlist {
+	struct sieve_stringlist strlist;
+
+	const char *const *items;
+	unsigned int pos;
+};
+
+static int testsuite_data_stringlist_next_item
+(struct sieve_stringlist *_strlist, string_t **str_r)
+{
+	struct testsuite_data_stringlist *strlist =
+		(struct testsuite_data_stringlist *)_strlist;
+	const char *item = strlist->items[strlist->pos];
+
+	if ( item == NULL ) {
+		*str_r = NULL;
+		return 0;
+	}
+
+	strlist->pos++;
+	*str_r = t_str_new_const(item, strlen(item));
+	return 1;
+}
+
+static void testsuite_data_stringlist_reset
+(struct sieve_stringlist *_strlist)
+{
+	struct testsuite_data_stringlist *strlist =
+		(struct testsuite_data_stringlist *)_strlist;
+
+	strlist->pos = 0;
+}
+
+static struct sieve_stringlist *testsuite_data_stringlist_create
+(const struct sieve_runtime_env *renv, struct sieve_binary *sbin)
+{
+	struct testsuite_data_stringlist *strlist;
+	struct sieve_binary_data_requirements reqs;
+	ARRAY_TYPE(const_string) items;
+	const char *const *name;
+	const char *item;
+
+	sieve_binary_get_data_requirements(sbin, &reqs);
+
+	t_array_init(&items, 16);
+	if ( (reqs.flags & SIEVE_BINARY_DATA_FLAG_ANY_HEADER) != 0 ) {
+		item = "any-header";
+		array_append(&items, &item, 1);
+	}
+	if ( (reqs.flags & SIEVE_BINARY_DATA_FLAG_BODY) != 0 ) {
+		item = "body";
+		array_append(&items, &item, 1);
+	}
+	if ( (reqs.flags & SIEVE_BINARY_DATA_FLAG_MIME) != 0 ) {
+		item = "mime";
+		array_append(&items, &item, 1);
+	}
+	if ( (reqs.flags & SIEVE_BINARY_DATA_FLAG_ANY_ENVELOPE) != 0 ) {
+		item = "any-envelope";
+		array_append(&items, &item, 1);
+	}
+	if ( (reqs.flags & SIEVE_BINARY_DATA_FLAG_MAILBOX) != 0 ) {
+		item = "mailbox";
+		array_append(&items, &item, 1);
+	}
+	for ( name = reqs.headers; *name != NULL; name++ ) {
+		item = t_strconcat("header:", *name, NULL);
+		array_append(&items, &item, 1);
+	}
+	for ( name = reqs.envelope_parts; *name != NULL; name++ ) {
+		item = t_strconcat("envelope:", *name, NULL);
+		array_append(&items, &item, 1);
+	}
+	array_append_zero(&items);
+
+	strlist = t_new(struct testsuite_data_stringlist, 1);
+	strlist->strlist.runenv = renv;
+	strlist->strlist.exec_status = SIEVE_EXEC_OK;
+	strlist->strlist.next_item = testsuite_data_stringlist_next_item;
+	strlist->strlist.reset = testsuite_data_stringlist_reset;
+	strlist->items = array_idx(&items, 0);
+
+	return &strlist->strlist;
+}
+
+/*
+ * Intepretation
+ */
+
+static int tst_test_script_data_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address)
+{
+	struct sieve_comparator cmp = SIEVE_COMPARATOR_DEFAULT(i_octet_comparator);
+	struct sieve_match_type mcht = SIEVE_COMPARATOR_DEFAULT(is_match_type);
+	struct sieve_stringlist *value_list, *key_list;
+	struct sieve_binary *sbin;
+	int match, ret;
+
+	/*
+	 * Read operands
+	 */
+
+	/* Handle match-type and comparator operands */
+	if ( sieve_match_opr_optional_read
+		(renv, address, NULL, &ret, &cmp, &mcht) < 0 )
+		return ret;
+
+	/* Read key-list */
+	if ( (ret=sieve_opr_stringlist_read(renv, address, "key_list", &key_list))
+		<= 0 )
+		return ret;
+
+	/*
+	 * Perform operation
+	 */
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+		"testsuite: test_script_data test");
+
+	sbin = testsuite_script_get_binary(renv);
+	if ( sbin == NULL ) {
+		sieve_runtime_error(renv, NULL, "testsuite: "
+			"trying to inspect script data, but no script compiled yet");
+		return SIEVE_EXEC_FAILURE;
+	}
+
+	/* Create value stringlist */
+	value_list = testsuite_data_stringlist_create(renv, sbin);
+
+	/* Perform match */
+	if ( (match=sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret)) < 0 )
+		return ret;
+
+	/* Set test result for subsequent conditional jump */
+	sieve_interpreter_set_test_result(renv->interp, match > 0);
+	return SIEVE_EXEC_OK;
+}